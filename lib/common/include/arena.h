@@ -0,0 +1,69 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "./allocator.h"
+
+/**
+ * Bump arena.
+ *
+ * A single block is reserved at creation; allocations only move a cursor,
+ * and everything is released at once with arena_reset or arena_destroy.
+ */
+typedef struct arena_t {
+  allocator_t allocator;
+  byte* base;
+  size_t size, capacity;
+} arena_t;
+
+/**
+ * \brief Reserve capacity bytes from the allocator.
+ */
+bool arena_create(arena_t* arena, allocator_t* allocator, size_t capacity);
+void arena_destroy(arena_t* arena);
+
+/**
+ * \brief Carve len bytes aligned on align (power of two), NULL if the arena is exhausted.
+ */
+void* arena_alloc(arena_t* arena, size_t len, size_t align);
+void arena_reset(arena_t* arena);
+
+//////////
+// IMPL //
+//////////
+
+bool arena_create(arena_t* arena, allocator_t* allocator, size_t capacity)
+{
+  arena->allocator = allocator_copy(allocator);
+  arena->base = capacity > 0 ? (byte*) pmalloc(allocator, capacity) : NULL;
+  arena->size = 0;
+  arena->capacity = arena->base != NULL ? capacity : 0;
+
+  return arena->base != NULL || capacity == 0;
+}
+
+void arena_destroy(arena_t* arena)
+{
+  if(arena->base != NULL)
+    pfree(&arena->allocator, arena->base);
+
+  arena->base = NULL;
+  arena->size = arena->capacity = 0;
+}
+
+void* arena_alloc(arena_t* arena, size_t len, size_t align)
+{
+  size_t start = (arena->size + align - 1) & ~(align - 1);
+
+  if(start + len > arena->capacity)
+    return NULL;
+
+  arena->size = start + len;
+  return arena->base + start;
+}
+
+void arena_reset(arena_t* arena)
+{
+  arena->size = 0;
+}
+
+#endif
@@ -2,189 +2,245 @@
 #define __TRANSACTION_H__
 
 #include "./allocator.h"
+#include "./arena.h"
 
+#include <string.h>
+
+/**
+ * Transaction log.
+ *
+ * Every deferred write is a fixed-size slot { dest, width, value } appended to a flat array.
+ * Values up to an octa are stored inline; wider values (e.g. pipeline stages) are copied
+ * into a side blob area and the slot keeps their offset.
+ * An invalidated slot has its destination cleared.
+ *
+ * The storage is reserved once, either from the log allocator or carved from an arena;
+ * it is only grown (from the log allocator) if a cycle overflows it.
+ */
 typedef struct transaction_log_t {
-    void (*commit)(struct transaction_log_t* self);
-    bool invalid;
-    uintptr_t next;
+    void* dest;
+    size_t width;
+    union {
+        byte b;
+        word w;
+        tetra t;
+        octa o;
+        size_t offset; // In the blob area, if width is not 1, 2, 4 or 8.
+    } value;
 } transaction_log_t;
 
 typedef struct {
     allocator_t log_allocator;
-    void* base;
+
+    transaction_log_t* logs;
     size_t size, capacity;
-    uintptr_t tail;
+
+    byte* blob;
+    size_t blob_size, blob_capacity;
+
+    // The buffers belong to the log allocator (and not to an arena)
+    bool owns_logs, owns_blob;
 } transaction_t;
 
-typedef struct {
-    transaction_t* transaction;
-    transaction_log_t* curr;
-    bool started;
-} transaction_log_iterator_t;
+/**
+ * \brief Create a transaction able to hold capacity writes per commit, reserved from the allocator.
+ */
+void transaction_create(transaction_t* transaction, allocator_t* log_allocator, size_t capacity);
 
-void transaction_log_iter(transaction_t* transaction, transaction_log_iterator_t* it)
-{
-    it->curr = 0;
-    it->started = 0;
-    it->transaction = transaction;
-}
+/**
+ * \brief Create a transaction whose slots and blob area are carved from the arena.
+ *
+ * The log allocator is only used if a commit overflows the reserved storage.
+ */
+void transaction_create_from_arena(transaction_t* transaction, arena_t* arena, allocator_t* log_allocator, size_t capacity, size_t blob_capacity);
+void transaction_destroy(transaction_t* transaction);
 
-bool transaction_log_it_next(transaction_log_iterator_t* it) {
-    if(it->started == false)
-    {   
-        it->curr = (transaction_log_t*)(it->transaction->size > 0 ? it->transaction->base : 0);
-        it->started = true;
-        
-        if(it->transaction->size == 0)
-            return false;
-        
-        return true;
-    }
+/**
+ * \brief Log a write of width bytes from value into dest.
+ */
+static inline bool tst_log_write(transaction_t* transaction, void* dest, const void* value, size_t width);
 
-    if(it->curr->next == 0)
-        return false;
-    else
-        it->curr = (transaction_log_t*)((uintptr_t)(it->transaction->base) + it->curr->next);
-    
-    return true;
+/**
+ * \brief Drop all logged writes targetting [base, base + length).
+ */
+void tst_log_invalid(transaction_t* transaction, void* base, size_t length);
+void tst_commit(transaction_t* transaction);
+
+//////////
+// IMPL //
+//////////
+
+static inline bool __tst_is_inline_width(size_t width)
+{
+    return width == sizeof(byte) || width == sizeof(word) || width == sizeof(tetra) || width == sizeof(octa);
 }
 
-bool transaction_log_it_get(transaction_log_iterator_t* it, transaction_log_t** out)
+static size_t __tst_default_blob_capacity(size_t capacity)
 {
-    if(it->curr != 0) 
-    {
-        *out = it->curr;
-        return true;
-    }
-    
-    return false;
+    return capacity * sizeof(octa);
 }
 
 void transaction_create(transaction_t* transaction, allocator_t* log_allocator, size_t capacity)
 {
+    size_t blob_capacity = __tst_default_blob_capacity(capacity);
+
     transaction->log_allocator = allocator_copy(log_allocator);
-    transaction->base = pmalloc(log_allocator, capacity);
-    transaction->capacity = capacity;
-    transaction->size = 0;
-    transaction->tail = 0;
+    transaction->logs = (transaction_log_t*) pmalloc(log_allocator, capacity * sizeof(transaction_log_t));
+    transaction->blob = (byte*) pmalloc(log_allocator, blob_capacity);
+    transaction->capacity = transaction->logs != NULL ? capacity : 0;
+    transaction->blob_capacity = transaction->blob != NULL ? blob_capacity : 0;
+    transaction->size = transaction->blob_size = 0;
+    transaction->owns_logs = transaction->owns_blob = true;
+}
+
+void transaction_create_from_arena(transaction_t* transaction, arena_t* arena, allocator_t* log_allocator, size_t capacity, size_t blob_capacity)
+{
+    transaction->log_allocator = allocator_copy(log_allocator);
+    transaction->logs = (transaction_log_t*) arena_alloc(arena, capacity * sizeof(transaction_log_t), sizeof(octa));
+    transaction->blob = (byte*) arena_alloc(arena, blob_capacity, sizeof(octa));
+    transaction->capacity = transaction->logs != NULL ? capacity : 0;
+    transaction->blob_capacity = transaction->blob != NULL ? blob_capacity : 0;
+    transaction->size = transaction->blob_size = 0;
+    transaction->owns_logs = transaction->owns_blob = false;
 }
 
 void transaction_destroy(transaction_t* transaction)
 {
-    if(transaction->base == 0) return;
-    
-    pfree(&transaction->log_allocator, transaction->base);
-    transaction->base = 0;
+    if(transaction->owns_logs && transaction->logs != NULL)
+        pfree(&transaction->log_allocator, transaction->logs);
+
+    if(transaction->owns_blob && transaction->blob != NULL)
+        pfree(&transaction->log_allocator, transaction->blob);
+
+    transaction->logs = 0;
+    transaction->blob = 0;
     transaction->size = transaction->capacity = 0;
-    transaction->tail = 0;
+    transaction->blob_size = transaction->blob_capacity = 0;
 }
 
-void tst_log_invalid(transaction_t* transaction, void* base, size_t length)
+// Cold path: move a buffer to a larger block from the log allocator.
+static void* __tst_grow(transaction_t* transaction, void* buffer, bool* owned, size_t used, size_t capacity)
 {
-    uintptr_t x0 = (uintptr_t) base;
-    uintptr_t x1 = (uintptr_t) (x0 + length);
+    void* grown = pmalloc(&transaction->log_allocator, capacity);
 
-    transaction_log_iterator_t it;
-    transaction_log_iter(transaction, &it);
+    if(grown == NULL)
+        return NULL;
 
-    transaction_log_t* log;
+    if(used > 0)
+        memcpy(grown, buffer, used);
 
-    while(transaction_log_it_next(&it)) 
-    {
-        transaction_log_it_get(&it, &log);
-        uintptr_t dest = (uintptr_t)(*(void**)(log + 1));
-        if(dest >= x0 && dest < x1) log->invalid = true;
-    }
+    if(*owned && buffer != NULL)
+        pfree(&transaction->log_allocator, buffer);
+
+    *owned = true;
+    return grown;
 }
 
-static void tst_add_log(transaction_t* transaction, transaction_log_t* log, size_t length)
+static bool __tst_reserve_log(transaction_t* transaction)
 {
-    uintptr_t rel = (uintptr_t)(log) - (uintptr_t)(transaction->base);
+    size_t capacity = transaction->capacity > 0 ? transaction->capacity << 1 : 1;
+    transaction_log_t* logs = (transaction_log_t*) __tst_grow(
+        transaction, transaction->logs, &transaction->owns_logs,
+        transaction->size * sizeof(transaction_log_t),
+        capacity * sizeof(transaction_log_t)
+    );
 
-    if(transaction->size == 0) transaction->tail = rel;
-    else {
-        transaction_log_t* tail = (transaction_log_t*)(transaction->base + transaction->tail);
-        tail->next = rel;
-        transaction->tail = rel;
-    }
+    if(logs == NULL)
+        return false;
 
-    transaction->size += length;
+    transaction->logs = logs;
+    transaction->capacity = capacity;
+    return true;
 }
 
-static bool __check_capacity(transaction_t* transaction, size_t payload_size)
+static bool __tst_reserve_blob(transaction_t* transaction, size_t length)
 {
-    size_t length = sizeof(transaction_log_t) + payload_size;
-    
-    if(transaction->size + length > transaction->capacity) 
-    {
-        size_t capacity = transaction->capacity;
-        
-        while(capacity < transaction->size + length) 
-        {
-            if(capacity == 0) capacity = 1;
-            else capacity <<= 1;
-        }
-        
-        transaction_log_t* base = (transaction_log_t*) prealloc(&transaction->log_allocator, transaction->base, capacity);
-        
-        if(!base) return false;
-        
-        transaction->base = base;
-        transaction->capacity = capacity;
-    }
+    size_t capacity = transaction->blob_capacity > 0 ? transaction->blob_capacity : 1;
+
+    while(capacity < transaction->blob_size + length)
+        capacity <<= 1;
+
+    byte* blob = (byte*) __tst_grow(transaction, transaction->blob, &transaction->owns_blob, transaction->blob_size, capacity);
+
+    if(blob == NULL)
+        return false;
 
+    transaction->blob = blob;
+    transaction->blob_capacity = capacity;
     return true;
 }
 
-transaction_log_t* tst_new_log(transaction_t* transaction, size_t payload_size)
+static inline bool tst_log_write(transaction_t* transaction, void* dest, const void* value, size_t width)
 {
-    if(transaction->base == 0)
-        return 0;
+    if(transaction->size == transaction->capacity && !__tst_reserve_log(transaction))
+        return false;
 
-    size_t length = sizeof(transaction_log_t) + payload_size;
-    
-    if(!__check_capacity(transaction, payload_size))
-        return NULL;
+    transaction_log_t* log = &transaction->logs[transaction->size];
 
-    transaction_log_t* log = (transaction_log_t*) ((char*)(transaction->base) + transaction->size);
-    log->invalid = false;
-    log->next = 0;
-    tst_add_log(transaction, log, length);
-    return log;   
+    if(__tst_is_inline_width(width))
+    {
+        memcpy(&log->value, value, width);
+    }
+    else
+    {
+        // Keep the blob octa-aligned
+        size_t length = (width + sizeof(octa) - 1) & ~(sizeof(octa) - 1);
+
+        if(transaction->blob_size + length > transaction->blob_capacity && !__tst_reserve_blob(transaction, length))
+            return false;
+
+        memcpy(transaction->blob + transaction->blob_size, value, width);
+        log->value.offset = transaction->blob_size;
+        transaction->blob_size += length;
+    }
+
+    log->dest = dest;
+    log->width = width;
+    transaction->size++;
+
+    return true;
 }
 
-void tst_commit_log(transaction_log_t* log)
+void tst_log_invalid(transaction_t* transaction, void* base, size_t length)
 {
-    if(!log->invalid) log->commit(log);
+    uintptr_t x0 = (uintptr_t) base;
+    uintptr_t x1 = (uintptr_t) (x0 + length);
+
+    transaction_log_t* log = transaction->logs;
+    transaction_log_t* limit = log + transaction->size;
+
+    for(; log != limit; log++)
+    {
+        uintptr_t dest = (uintptr_t) log->dest;
+        if(dest >= x0 && dest < x1) log->dest = 0;
+    }
 }
 
-void tst_commit(transaction_t* transaction) 
+void tst_commit(transaction_t* transaction)
 {
-    transaction_log_iterator_t it;
-    transaction_log_iter(transaction, &it);
-
-    transaction_log_t* log;
+    transaction_log_t* log = transaction->logs;
+    transaction_log_t* limit = log + transaction->size;
 
-    while(transaction_log_it_next(&it)) 
+    for(; log != limit; log++)
     {
-        transaction_log_it_get(&it, &log);
-        tst_commit_log(log);
+        if(log->dest == 0)
+            continue;
+
+        switch(log->width)
+        {
+            case sizeof(byte):  memcpy(log->dest, &log->value, sizeof(byte)); break;
+            case sizeof(word):  memcpy(log->dest, &log->value, sizeof(word)); break;
+            case sizeof(tetra): memcpy(log->dest, &log->value, sizeof(tetra)); break;
+            case sizeof(octa):  memcpy(log->dest, &log->value, sizeof(octa)); break;
+            default:            memcpy(log->dest, transaction->blob + log->value.offset, log->width); break;
+        }
     }
 
-    transaction->tail = 0;
     transaction->size = 0;
+    transaction->blob_size = 0;
 }
 
-#define decl_tst_update_type(type, typename) static void tst_update_ ## typename ## _commit(transaction_log_t* log) \
-{\
-    uintptr_t base = (uintptr_t)(log + 1); \
-    type** dest = (type**)(base); \
-    type* value = (type*)(base + sizeof(type*)); \
-\
-    **dest = *value; \
-}\
-\
-bool tst_update_##typename(transaction_t* transaction, type* dest, type value)\
+#define decl_tst_update_type(type, typename) bool tst_update_##typename(transaction_t* transaction, type* dest, type value)\
 {\
     if(transaction == 0)\
     {\
@@ -193,21 +249,7 @@ bool tst_update_##typename(transaction_t* transaction, type* dest, type value)\
     }\
     if(memcmp(dest, &value, sizeof(type)) == 0) return true;\
 \
-    transaction_log_t* log = (transaction_log_t*) tst_new_log(transaction, sizeof(type*) + sizeof(type));\
-\
-    if(log == NULL)\
-        return false;\
-\
-    uintptr_t base = (uintptr_t)(log + 1);\
-    type** __dest = (type**) base;\
-    type* __value = (type*)(base + sizeof(type*));\
-\
-    *__dest = dest;\
-    *__value = value;\
-\
-    log->commit = tst_update_##typename##_commit;\
-\
-    return true;\
+    return tst_log_write(transaction, dest, &value, sizeof(type));\
 }
 
 decl_tst_update_type(byte, byte)
@@ -220,4 +262,4 @@ decl_tst_update_type(bool, bool)
 decl_tst_update_type(char, char)
 decl_tst_update_type(unsigned char, uchar)
 
-#endif
\ No newline at end of file
+#endif
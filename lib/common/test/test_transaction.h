@@ -38,4 +38,41 @@ define_test(transaction, test_print("Transaction"))
     test_teardown;
     transaction_destroy(&transaction);
     test_end;
-}
\ No newline at end of file
+}
+
+define_test(transaction_arena, test_print("Transaction from an arena"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+    arena_t arena;
+    transaction_t transaction;
+    struct { octa a, b; byte c; } wide = {0, 0, 0}, value = {1, 2, 3};
+    octa octas[4] = {0, 0, 0, 0};
+
+    arena_create(&arena, &allocator, 2 * sizeof(transaction_log_t) + 8);
+    transaction_create_from_arena(&transaction, &arena, &allocator, 2, 8);
+
+    for(unsigned int i = 0; i < 4; i++)
+        tst_log_write(&transaction, &octas[i], &(octa){i + 1}, sizeof(octa));
+
+    tst_log_write(&transaction, &wide, &value, sizeof(wide));
+
+    test_check(
+        test_print("Check that the writes overflowing the arena are still deferred."),
+        octas[3] == 0 && wide.c == 0 && transaction.size == 5,
+        test_failure("Expecting 5 pending writes")
+    );
+
+    tst_commit(&transaction);
+
+    test_check(
+        test_print("Check that every write has been committed."),
+        octas[0] == 1 && octas[3] == 4 && wide.a == 1 && wide.b == 2 && wide.c == 3,
+        test_failure("Expecting 1, 4 and {1, 2, 3}")
+    );
+
+    test_success;
+    test_teardown;
+    transaction_destroy(&transaction);
+    arena_destroy(&arena);
+    test_end;
+}
@@ -0,0 +1,406 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "../lib/common/include/allocator.h"
+#include "../lib/common/include/types.h"
+
+#include "./memory/core.h"
+#include "./system.h"
+#include "./riscv.h"
+#include "./mmix/core.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/**
+ * Batch runner, for many short and independent programs.
+ *
+ * Each job describes a system (RISC-V or MMIX), a program image loaded in its guest memory,
+ * and a cycle budget. Jobs are spread over a pool of threads, each owning a deque of jobs:
+ * a worker pops its own jobs from the front, and steals from the back of the others once empty.
+ *
+ * A worker keeps one system per kind and its guest memory between jobs: the next job
+ * re-initialises the component in place (see sys_reset), reusing the system allocation,
+ * its transaction storage, the memory mappings and the L1 storage of the RISC-V processor.
+ *
+ * The result of a job is the final state of the system, and digests of its registers and memory.
+ * A job which used up its cycle budget without halting is left SYS_RUNNING.
+ */
+#define BATCH_MAX_WORKERS 64
+
+typedef enum {
+  BATCH_RISCV,
+  BATCH_MMIX
+} batch_kind_t;
+
+typedef struct {
+  batch_kind_t kind;
+
+  union {
+    riscv_processor_cfg_t riscv;
+    mmix_cfg_t mmix;
+  } cfg;
+
+  // Program image, copied at load_address
+  const void* image;
+  size_t image_len;
+  octa load_address;
+
+  // Guest memory, mapped from the page of load_address
+  size_t memory_size;
+
+  unsigned int cycles; // Budget
+} batch_job_t;
+
+typedef struct {
+  int state; // SYS_RUNNING when the budget ran out
+  unsigned int cycles; // Executed
+  octa regs_digest;
+  octa memory_digest;
+} batch_result_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  size_t lo, hi; // Deque of job indices
+
+  // Reused between jobs
+  system_t* systems[2];
+  unsigned int mmix_lsize;
+  octa mapped_base[2];
+  size_t mapped_len[2];
+  byte* memory;
+  size_t memory_capacity;
+
+  struct batch_t* batch;
+  unsigned int index;
+} batch_worker_t;
+
+typedef struct batch_t {
+  allocator_t allocator;
+  const batch_job_t* jobs;
+  batch_result_t* results;
+  unsigned int count;
+  batch_worker_t workers[BATCH_MAX_WORKERS];
+} batch_t;
+
+/**
+ * \brief Run count jobs over a pool of workers, results[i] receives the outcome of jobs[i].
+ *
+ * The jobs of a worker whose thread could not be started are run by the calling thread.
+ *
+ * \return false if a job panicked, or could not be set up (its result state is then SYS_PANICKED).
+ */
+bool batch_run(allocator_t* allocator, const batch_job_t* jobs, batch_result_t* results, size_t count, unsigned int workers);
+
+/**
+ * \brief Hash a memory block (FNV-1a), chained from the digest h.
+ */
+static inline octa batch_digest(octa h, const void* data, size_t len);
+
+static bool __batch_pop(batch_worker_t* worker, size_t* job);
+static bool __batch_steal(batch_t* batch, batch_worker_t* thief, size_t* job);
+static system_t* __batch_setup(batch_worker_t* worker, const batch_job_t* job);
+static bool __batch_exec(batch_worker_t* worker, const batch_job_t* job, batch_result_t* result);
+static void* __batch_thread(void* arg);
+
+//////////
+// IMPL //
+//////////
+
+static inline octa batch_digest(octa h, const void* data, size_t len)
+{
+  const byte* it = (const byte*) data;
+
+  for(size_t i = 0; i < len; i++)
+    h = (h ^ it[i]) * 0x100000001b3ULL;
+
+  return h;
+}
+
+static bool __batch_pop(batch_worker_t* worker, size_t* job)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&worker->lock);
+
+  if(worker->lo < worker->hi)
+  {
+    *job = worker->lo++;
+    found = true;
+  }
+
+  pthread_mutex_unlock(&worker->lock);
+
+  return found;
+}
+
+static bool __batch_steal(batch_t* batch, batch_worker_t* thief, size_t* job)
+{
+  unsigned int count = batch->count;
+
+  for(unsigned int i = 1; i < count; i++)
+  {
+    batch_worker_t* victim = &batch->workers[(thief->index + i) % count];
+    bool found = false;
+
+    pthread_mutex_lock(&victim->lock);
+
+    if(victim->lo < victim->hi)
+    {
+      *job = --victim->hi;
+      found = true;
+    }
+
+    pthread_mutex_unlock(&victim->lock);
+
+    if(found)
+      return true;
+  }
+
+  return false;
+}
+
+// Get the system of the job kind, created once per worker then re-initialised in place.
+static system_t* __batch_setup(batch_worker_t* worker, const batch_job_t* job)
+{
+  allocator_t* allocator = &worker->batch->allocator;
+  system_t* sys = worker->systems[job->kind];
+
+  if(job->kind == BATCH_MMIX)
+  {
+    mmix_cfg_t cfg = job->cfg.mmix;
+
+    if(cfg.lsize < 256) cfg.lsize = 256;
+
+    // The local registers follow the processor, a larger ring needs a larger system.
+    if(sys != NULL && cfg.lsize > worker->mmix_lsize)
+    {
+      sys_delete(sys, allocator);
+      sys = worker->systems[BATCH_MMIX] = NULL;
+    }
+
+    if(sys == NULL)
+    {
+      sys = worker->systems[BATCH_MMIX] = mmix_create(allocator, &cfg);
+      worker->mmix_lsize = cfg.lsize;
+      worker->mapped_len[BATCH_MMIX] = 0;
+    }
+    else
+    {
+      sys_reset(sys);
+      cfg.lmask = cfg.lsize - 1;
+      __mmix_init(sys, &cfg);
+    }
+
+    // The processor halts after any instruction leaving rI at 0. Above the cost of an instruction,
+    // rI only counts up (see __mmix_sclock_incr): the job runs until its budget.
+    __get_mmix_proc(sys)->g[rI] = uint_to_octa(UINT_MAX);
+  }
+  else
+  {
+    riscv_processor_cfg_t cfg = job->cfg.riscv;
+
+    if(sys == NULL)
+    {
+      sys = worker->systems[BATCH_RISCV] = riscv_new(allocator, &cfg);
+      worker->mapped_len[BATCH_RISCV] = 0;
+    }
+    else
+    {
+      sys_reset(sys);
+
+      if(!__riscv_init(sys, &cfg))
+        return NULL;
+    }
+  }
+
+  return sys;
+}
+
+static bool __batch_exec(batch_worker_t* worker, const batch_job_t* job, batch_result_t* result)
+{
+  allocator_t* allocator = &worker->batch->allocator;
+  octa base = job->load_address & ~(octa)(PAGE_SIZE - 1);
+  size_t len = mem_align(PAGE_OFFSET(job->load_address) + (job->memory_size > job->image_len ? job->memory_size : job->image_len));
+
+  result->state = SYS_PANICKED;
+  result->cycles = 0;
+  result->regs_digest = result->memory_digest = 0;
+
+  system_t* sys = __batch_setup(worker, job);
+
+  if(sys == NULL)
+    return false;
+
+  if(len > worker->memory_capacity)
+  {
+    byte* memory = (byte*) pmalloc(allocator, len);
+
+    if(memory == NULL)
+      return false;
+
+    if(worker->memory != NULL)
+      pfree(allocator, worker->memory);
+
+    worker->memory = memory;
+    worker->memory_capacity = len;
+
+    // Drop the mappings of the previous block
+    for(unsigned int k = 0; k < 2; k++)
+    {
+      if(worker->systems[k] != NULL && worker->mapped_len[k] > 0)
+        mem_unmap(&worker->systems[k]->mem, (void*)(uintptr_t) worker->mapped_base[k], worker->mapped_len[k]);
+
+      worker->mapped_len[k] = 0;
+    }
+  }
+
+  memset(worker->memory, 0, len);
+  memcpy(worker->memory + PAGE_OFFSET(job->load_address), job->image, job->image_len);
+
+  if(worker->mapped_base[job->kind] != base || worker->mapped_len[job->kind] != len)
+  {
+    if(worker->mapped_len[job->kind] > 0)
+      mem_unmap(&sys->mem, (void*)(uintptr_t) worker->mapped_base[job->kind], worker->mapped_len[job->kind]);
+
+    mem_map_window(&sys->mem, (void*)(uintptr_t) base, worker->memory, len);
+    worker->mapped_base[job->kind] = base;
+    worker->mapped_len[job->kind] = len;
+  }
+
+  sys->state = SYS_RUNNING;
+  sys->steps = job->cycles;
+
+  while(sys->state == SYS_RUNNING && sys->steps > 0)
+  {
+    sys_skip_idle(sys);
+
+    if(sys->steps > 0)
+      sys_step(sys);
+  }
+
+  octa h = 0xcbf29ce484222325ULL;
+
+  if(job->kind == BATCH_MMIX)
+  {
+    mmix_processor_t* proc = __get_mmix_proc(sys);
+    octa g[256];
+
+    // rN holds the creation time
+    memcpy(g, proc->g, sizeof(g));
+    g[rN] = 0;
+
+    h = batch_digest(h, g, sizeof(g));
+    h = batch_digest(h, proc->l, sizeof(octa) * proc->lsize);
+    h = batch_digest(h, &proc->instr_ptr, sizeof(proc->instr_ptr));
+  }
+  else
+  {
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+
+    // The stores of the pipeline stay in the dirty lines of the L1
+    data_cache_flush(&proc->l1, sys, (data_cache_writeback_t) __riscv_writeback_line);
+
+    h = batch_digest(h, proc->regs, sizeof(proc->regs));
+    h = batch_digest(h, &proc->pc, sizeof(proc->pc));
+  }
+
+  result->state = sys->state;
+  result->cycles = job->cycles - (unsigned int) sys->steps;
+  result->regs_digest = h;
+  result->memory_digest = batch_digest(0xcbf29ce484222325ULL, worker->memory, len);
+
+  return true;
+}
+
+static void* __batch_thread(void* arg)
+{
+  batch_worker_t* worker = (batch_worker_t*) arg;
+  batch_t* batch = worker->batch;
+  size_t job;
+
+  while(__batch_pop(worker, &job) || __batch_steal(batch, worker, &job))
+    __batch_exec(worker, &batch->jobs[job], &batch->results[job]);
+
+  return NULL;
+}
+
+bool batch_run(allocator_t* allocator, const batch_job_t* jobs, batch_result_t* results, size_t count, unsigned int workers)
+{
+  batch_t* batch = (batch_t*) pmalloc(allocator, sizeof(batch_t));
+  pthread_t threads[BATCH_MAX_WORKERS];
+  bool started[BATCH_MAX_WORKERS];
+
+  if(batch == NULL)
+    return false;
+
+  if(workers == 0) workers = 1;
+  if(workers > BATCH_MAX_WORKERS) workers = BATCH_MAX_WORKERS;
+  if(workers > count && count > 0) workers = (unsigned int) count;
+
+  batch->allocator = allocator_copy(allocator);
+  batch->jobs = jobs;
+  batch->results = results;
+  batch->count = workers;
+
+  // Contiguous shares, the stealing balances them.
+  for(unsigned int i = 0; i < workers; i++)
+  {
+    batch_worker_t* worker = &batch->workers[i];
+
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->lo = count * i / workers;
+    worker->hi = count * (i + 1) / workers;
+    worker->systems[BATCH_RISCV] = worker->systems[BATCH_MMIX] = NULL;
+    worker->mmix_lsize = 0;
+    worker->mapped_base[BATCH_RISCV] = worker->mapped_base[BATCH_MMIX] = 0;
+    worker->mapped_len[BATCH_RISCV] = worker->mapped_len[BATCH_MMIX] = 0;
+    worker->memory = NULL;
+    worker->memory_capacity = 0;
+    worker->batch = batch;
+    worker->index = i;
+  }
+
+  for(unsigned int i = 0; i < workers; i++)
+    started[i] = pthread_create(&threads[i], NULL, __batch_thread, &batch->workers[i]) == 0;
+
+  // Take over the deques of the workers which did not start.
+  for(unsigned int i = 0; i < workers; i++)
+  {
+    if(!started[i])
+      __batch_thread(&batch->workers[i]);
+  }
+
+  for(unsigned int i = 0; i < workers; i++)
+  {
+    if(started[i])
+      pthread_join(threads[i], NULL);
+  }
+
+  for(unsigned int i = 0; i < workers; i++)
+  {
+    batch_worker_t* worker = &batch->workers[i];
+
+    for(unsigned int k = 0; k < 2; k++)
+    {
+      if(worker->systems[k] != NULL)
+        sys_delete(worker->systems[k], allocator);
+    }
+
+    if(worker->memory != NULL)
+      pfree(allocator, worker->memory);
+
+    pthread_mutex_destroy(&worker->lock);
+  }
+
+  pfree(allocator, batch);
+
+  bool ok = true;
+
+  for(size_t i = 0; i < count; i++)
+    ok = ok && results[i].state != SYS_PANICKED;
+
+  return ok;
+}
+
+#endif
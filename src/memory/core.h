@@ -2,6 +2,13 @@
 #define __MEM_H__
 
 #include <math.h>
+#include <string.h>
+#include <sys/types.h>
+
+#if defined(__linux__)
+#define MEM_MMAP_SUPPORTED
+#include <sys/mman.h>
+#endif
 
 #include "../../lib/common/include/allocator.h"
 #include "../../lib/common/include/macro.h"
@@ -20,10 +27,62 @@
 /**
 * Paging works \w 64-bits address
 
-* 20 bits for directory id (1MiB)
-* 20 bits for table id (1MiB)
+* 52 bits of page id, split into 4 radix levels of 13 bits (DIR, MIDDLE DIR, UPPER TABLE, TABLE)
 * 12 bits for offset (page_size = 4KiB)
+*
+* The radix table keeps record of the mapped pages, translations walk it behind a direct-mapped
+* TLB keyed by PAGE_ID. A page table spans MEM_LARGE_SIZE (32 MiB): a mapping covering a whole
+* aligned span is a single large page entry in place of the table, so mapping GiBs of guest
+* memory costs a few entries. A large page is split into a page table once one of its pages
+* is remapped, unmapped or copied.
+*
+* Managed blocks are reference counted: by the memory which allocated them, and by each page
+* mapped over them. mem_clone shares the pages of a memory with another one, both sides
+* being copy-on-write: the first write to a shared page, through mem_tl_write, copies it
+* into a page of its own. The unmanaged memory (mem_map) is shared as well, but is still
+* owned by the caller.
+*
+* A memory has at most one linear window, for flat guest RAM: one contiguous range of
+* virtual memory backed by one contiguous host block (mem_map_window, mem_alloc_window).
+* A translation in the window is a bounds check and an add, the TLB and the radix are only
+* walked outside of it (MMIO, sparse mappings...). The pages of the window are mapped in the
+* radix as well, for mem_walk and mem_clone: the window is dropped once a page of its range
+* is remapped, unmapped or shared copy-on-write, the translations falling back to the radix.
+*
+* Devices (UART, timer, block device...) are bound to regions of the virtual memory, out of the
+* mapped pages, with read and write callbacks. The regions are kept sorted by base: a device
+* access is dispatched by a binary search, which is only done once the translation faulted,
+* so the accesses to the RAM never pay for it.
+*/
+#define MEM_RADIX_BITS 13
+#define MEM_RADIX_LEVELS 4
+#define MEM_RADIX_SIZE (1 << MEM_RADIX_BITS)
+#define MEM_RADIX_INDEX(pid, level) (((uintptr_t)(pid) >> ((MEM_RADIX_LEVELS - 1 - (level)) * MEM_RADIX_BITS)) & (MEM_RADIX_SIZE - 1))
+
+#define MEM_LARGE_PAGES MEM_RADIX_SIZE
+#define MEM_LARGE_SIZE ((size_t) MEM_LARGE_PAGES * PAGE_SIZE)
+#define MEM_LARGE_TAG 1 // Tags a large page in a page table slot
+
+// Managed blocks from this size are mmap-ed where supported, the kernel zeroes them lazily.
+#define MEM_MMAP_THRESHOLD (2 * 1024 * 1024)
+
+#define MEM_TLB_SIZE 64
+#define MEM_TLB_INVALID UINTPTR_MAX
+
+/**
+* \brief Radix table node, its leaves are page tables (page_t[MEM_RADIX_SIZE]) or large pages.
 */
+typedef struct mem_radix_node_t
+{
+  void* slots[MEM_RADIX_SIZE];
+} mem_radix_node_t;
+
+typedef struct
+{
+  uintptr_t pid;
+  void* paddr;
+  bool writable; // Not copy-on-write
+} mem_tlb_entry_t;
 
 /**
 * \brief Managed real memory
@@ -35,12 +94,61 @@ typedef struct managed_memory_t
   size_t len;
   allocator_t allocator;
   struct managed_memory_t* next;
+
+  // The memory which allocated the block, and the pages mapped over it.
+  unsigned int refs;
+
+  // Private file mapping (see mem_map_file), NULL when the memory follows the header.
+  void* block;
   
 } managed_memory_t;
 
+/**
+* \brief Large page, MEM_LARGE_PAGES pages mapped over a contiguous real memory block.
+*
+* It holds a single reference to its managed block.
+*/
+typedef struct
+{
+  void* paddr;
+  struct managed_memory_t* block;
+  char cow;
+} mem_large_t;
+
 typedef struct {
-  page_tree_t pages;
+  uintptr_t base;
+  size_t len; // 0 if there is no window
+  byte* host;
+} mem_window_t;
+
+/**
+* \brief Device callbacks, offset being relative to the base of its region.
+*
+* A callback returns false to fault the access.
+*/
+typedef struct {
+  bool (*read)(void* self, octa offset, void* dst, size_t size);
+  bool (*write)(void* self, octa offset, const void* src, size_t size);
+  void* self;
+} mem_device_t;
+
+typedef struct {
+  uintptr_t base;
+  size_t len;
+  mem_device_t device;
+} mem_region_t;
+
+typedef struct {
+  mem_window_t window;
+  mem_radix_node_t* radix;
+  mem_tlb_entry_t tlb[MEM_TLB_SIZE];
   managed_memory_t* managed;
+
+  // Device regions, sorted by base
+  mem_region_t* regions;
+  unsigned int region_count;
+  unsigned int region_capacity;
+
   allocator_t page_node_allocator;
 } memory_t;
 
@@ -72,27 +180,331 @@ size_t mem_align(size_t len);
  */
 bool mem_tl(memory_t* mem, void* vaddr, void** out, char* exceptions);
 
+/**
+ * \brief Memory translation for a write, a copy-on-write page is copied first.
+ */
+bool mem_tl_write(memory_t* mem, void* vaddr, void** out, char* exceptions);
+
+/**
+ * \brief Translation of size bytes in the linear window, for reads and writes.
+ *
+ * \return false if they are not all in the window, the page table must be walked then.
+ */
+static inline bool mem_window_tl(const memory_t* mem, const void* vaddr, size_t size, void** out);
+
+/**
+ * \brief Share the pages of src with dst, copy-on-write on both sides.
+ *
+ * No page is copied: the cost is in the number of mapped pages.
+ *
+ * \return false if dst could not map every page.
+ */
+bool mem_clone(memory_t* dst, memory_t* src);
+
+/**
+ * \brief Visit the mapped pages, in the order of their ids.
+ */
+void mem_walk(memory_t* mem, void (*visit)(void* self, uintptr_t pid, const page_t* page), void* self);
+
 /**
  * \brief Map virtual memory to a real memory block.
  */
 void* mem_map(memory_t* mem, void* vaddr, void* paddr, size_t len);
 
+/**
+ * \brief Unmap the pages covering a virtual memory block.
+ */
+void mem_unmap(memory_t* mem, void* vaddr, size_t len);
+
 /**
  * \brief Allocate real memory block and map it to a virtual memory block
  * 
- * The allocated memory is fully managed by the memory device.
+ * The allocated memory is fully managed by the memory device. Blocks from MEM_MMAP_THRESHOLD
+ * are reserved with mmap (MAP_NORESERVE): the host memory is only committed once touched.
+ * Without mmap, they are allocated and cleared as the smaller ones.
  */
 void* mem_alloc_managed(memory_t* mem, allocator_t* allocator, void* vaddr, size_t len);
 
+/**
+ * \brief Map virtual memory to a real memory block, as the linear window of the memory.
+ *
+ * The previous window, if any, stays mapped through the page table.
+ *
+ * \return The realigned virtual base, as mem_map.
+ */
+void* mem_map_window(memory_t* mem, void* vaddr, void* paddr, size_t len);
+
+/**
+ * \brief Allocate real memory block as the linear window of the memory (see mem_alloc_managed).
+ */
+void* mem_alloc_window(memory_t* mem, allocator_t* allocator, void* vaddr, size_t len);
+
+/**
+ * \brief Map a private, copy-on-write, view of a file to a virtual memory block.
+ *
+ * offset must be a multiple of the host page size. The view is managed by the memory device,
+ * the writes never reach the file.
+ *
+ * \return The host address of the view, NULL if the mapping failed or the host has no mmap.
+ */
+void* mem_map_file(memory_t* mem, allocator_t* allocator, void* vaddr, int fd, off_t offset, size_t len);
+
+/**
+ * \brief Bind a device to the region [vaddr, vaddr + len).
+ *
+ * \return false if the region overlaps another one, or could not be allocated.
+ */
+bool mem_attach_device(memory_t* mem, void* vaddr, size_t len, const mem_device_t* device);
+
+/**
+ * \brief Unbind the device of the region starting at vaddr.
+ */
+bool mem_detach_device(memory_t* mem, void* vaddr);
+
+/**
+ * \brief Find the region of the device containing vaddr, NULL if none.
+ */
+mem_region_t* mem_find_device(memory_t* mem, void* vaddr);
+
+/**
+ * \brief Read size bytes from the device bound to vaddr.
+ *
+ * \return false if no device covers the access, or the device faulted.
+ */
+bool mem_device_read(memory_t* mem, void* vaddr, void* dst, size_t size, char* exceptions);
+
+/**
+ * \brief Write size bytes to the device bound to vaddr.
+ */
+bool mem_device_write(memory_t* mem, void* vaddr, const void* src, size_t size, char* exceptions);
+
 /**
  * \brief Free all managed allocated memory
  */
 static void __managed_mem_delete_all(managed_memory_t* managed);
 
+static bool __mem_map_block(memory_t* mem, void* vaddr, void* paddr, size_t len, managed_memory_t* block, char cow);
+static void __mem_block_acquire(managed_memory_t* block);
+static void __mem_block_release(managed_memory_t* block);
+static bool __mem_cow_fault(memory_t* mem, uintptr_t pid, page_t* entry);
+static void __mem_release_table(memory_t* mem, void* table);
+static void __mem_walk_tables(mem_radix_node_t* node, unsigned int level, uintptr_t pid, void (*visit)(void* self, uintptr_t pid, void** slot), void* self);
+
+static void __mem_tlb_flush(memory_t* mem);
+static unsigned int __mem_region_lower_bound(memory_t* mem, uintptr_t addr);
+static mem_region_t* __mem_device_region(memory_t* mem, void* vaddr, size_t size, char* exceptions);
+static void __mem_window_set(memory_t* mem, void* vaddr, void* paddr, size_t len);
+static inline void __mem_window_drop(memory_t* mem, uintptr_t pid, size_t pages);
+static inline void __mem_tlb_invalidate(memory_t* mem, uintptr_t pid);
+static void** __mem_radix_table_slot(memory_t* mem, uintptr_t pid, bool create);
+static bool __mem_radix_search(memory_t* mem, uintptr_t pid, page_t* out);
+static page_t* __mem_radix_insert(memory_t* mem, uintptr_t pid);
+static page_t* __mem_large_split(memory_t* mem, void** slot);
+static void __mem_radix_delete(mem_radix_node_t* node, unsigned int level, allocator_t* allocator);
+
+static void __mem_tlb_flush(memory_t* mem)
+{
+  for(unsigned int i = 0; i < MEM_TLB_SIZE; i++)
+    mem->tlb[i].pid = MEM_TLB_INVALID;
+}
+
+static void __mem_window_set(memory_t* mem, void* vaddr, void* paddr, size_t len)
+{
+  size_t pages = mem_align(len) / PAGE_SIZE;
+
+  mem->window.base = PAGE_ID(vaddr) << 12;
+  mem->window.len = (pages == 0 ? 1 : pages) * PAGE_SIZE;
+  mem->window.host = (byte*) paddr;
+}
+
+// Drop the window if it overlaps the pages.
+static inline void __mem_window_drop(memory_t* mem, uintptr_t pid, size_t pages)
+{
+  uintptr_t first = PAGE_ID(mem->window.base);
+
+  if(mem->window.len > 0 && pid < first + mem->window.len / PAGE_SIZE && first < pid + pages)
+    mem->window.len = 0;
+}
+
+static inline bool mem_window_tl(const memory_t* mem, const void* vaddr, size_t size, void** out)
+{
+  uintptr_t offset = (uintptr_t) vaddr - mem->window.base;
+
+  if(offset >= mem->window.len || mem->window.len - offset < size)
+    return false;
+
+  *out = mem->window.host + offset;
+  return true;
+}
+
+static inline void __mem_tlb_invalidate(memory_t* mem, uintptr_t pid)
+{
+  mem_tlb_entry_t* entry = &mem->tlb[pid & (MEM_TLB_SIZE - 1)];
+  
+  if(entry->pid == pid) 
+    entry->pid = MEM_TLB_INVALID;
+}
+
+static inline bool __mem_is_large(void* slot)
+{
+  return ((uintptr_t) slot & MEM_LARGE_TAG) != 0;
+}
+
+static inline mem_large_t* __mem_large(void* slot)
+{
+  return (mem_large_t*) ((uintptr_t) slot & ~(uintptr_t) MEM_LARGE_TAG);
+}
+
+// Slot of the page table (or large page) of pid, NULL if it does not exist and create is false.
+static void** __mem_radix_table_slot(memory_t* mem, uintptr_t pid, bool create)
+{
+  void** slot = (void**) &mem->radix;
+
+  for(unsigned int level = 0; level < MEM_RADIX_LEVELS - 1; level++)
+  {
+    if(*slot == NULL)
+    {
+      if(!create)
+        return NULL;
+
+      *slot = pmalloc(&mem->page_node_allocator, sizeof(mem_radix_node_t));
+
+      if(*slot == NULL)
+        return NULL;
+
+      memset(*slot, 0, sizeof(mem_radix_node_t));
+    }
+
+    slot = &((mem_radix_node_t*) *slot)->slots[MEM_RADIX_INDEX(pid, level)];
+  }
+
+  return slot;
+}
+
+static bool __mem_radix_search(memory_t* mem, uintptr_t pid, page_t* out)
+{
+  void** slot = __mem_radix_table_slot(mem, pid, false);
+
+  if(slot == NULL || *slot == NULL)
+    return false;
+
+  if(__mem_is_large(*slot))
+  {
+    mem_large_t* large = __mem_large(*slot);
+
+    out->present = 1;
+    out->cow = large->cow;
+    out->paddr = large->paddr + (pid & (MEM_LARGE_PAGES - 1)) * PAGE_SIZE;
+    out->block = large->block;
+
+    return true;
+  }
+
+  *out = ((page_t*) *slot)[MEM_RADIX_INDEX(pid, MEM_RADIX_LEVELS - 1)];
+
+  return out->present;
+}
+
+// Page table entry of pid, the large page holding it is split first.
+static page_t* __mem_radix_insert(memory_t* mem, uintptr_t pid)
+{
+  void** slot = __mem_radix_table_slot(mem, pid, true);
+
+  if(slot == NULL)
+    return NULL;
+
+  if(*slot == NULL)
+  {
+    *slot = pmalloc(&mem->page_node_allocator, sizeof(page_t) * MEM_RADIX_SIZE);
+
+    if(*slot == NULL)
+      return NULL;
+
+    memset(*slot, 0, sizeof(page_t) * MEM_RADIX_SIZE);
+  }
+  else if(__mem_is_large(*slot) && __mem_large_split(mem, slot) == NULL)
+  {
+    return NULL;
+  }
+
+  return ((page_t*) *slot) + MEM_RADIX_INDEX(pid, MEM_RADIX_LEVELS - 1);
+}
+
+static page_t* __mem_large_split(memory_t* mem, void** slot)
+{
+  mem_large_t* large = __mem_large(*slot);
+  page_t* table = (page_t*) pmalloc(&mem->page_node_allocator, sizeof(page_t) * MEM_RADIX_SIZE);
+
+  if(table == NULL)
+    return NULL;
+
+  for(unsigned int i = 0; i < MEM_LARGE_PAGES; i++)
+  {
+    table[i].present = 1;
+    table[i].cow = large->cow;
+    table[i].paddr = large->paddr + (size_t) i * PAGE_SIZE;
+    table[i].block = large->block;
+  }
+
+  // A reference per page
+  if(large->block != NULL)
+    __atomic_add_fetch(&large->block->refs, MEM_LARGE_PAGES - 1, __ATOMIC_RELAXED);
+
+  pfree(&mem->page_node_allocator, large);
+  *slot = table;
+
+  return table;
+}
+
+static void __mem_radix_delete(mem_radix_node_t* node, unsigned int level, allocator_t* allocator)
+{
+  if(node == NULL)
+    return;
+
+  if(__mem_is_large(node))
+  {
+    pfree(allocator, __mem_large(node));
+    return;
+  }
+
+  if(level < MEM_RADIX_LEVELS - 1)
+  {
+    for(unsigned int i = 0; i < MEM_RADIX_SIZE; i++)
+      __mem_radix_delete((mem_radix_node_t*) node->slots[i], level + 1, allocator);
+  }
+
+  pfree(allocator, node);
+}
+
+// Visit the page table slots in use.
+static void __mem_walk_tables(mem_radix_node_t* node, unsigned int level, uintptr_t pid, void (*visit)(void* self, uintptr_t pid, void** slot), void* self)
+{
+  if(node == NULL)
+    return;
+
+  for(unsigned int i = 0; i < MEM_RADIX_SIZE; i++)
+  {
+    if(node->slots[i] == NULL)
+      continue;
+
+    uintptr_t base = pid | ((uintptr_t) i << ((MEM_RADIX_LEVELS - 1 - level) * MEM_RADIX_BITS));
+
+    if(level == MEM_RADIX_LEVELS - 2)
+      visit(self, base, &node->slots[i]);
+    else
+      __mem_walk_tables((mem_radix_node_t*) node->slots[i], level + 1, base, visit, self);
+  }
+}
+
 void __mem_init(memory_t* mem, allocator_t* page_node_allocator)
 {
-  mem->pages = 0;
+  mem->window.base = mem->window.len = 0;
+  mem->window.host = NULL;
+  mem->radix = 0;
   mem->managed = 0;
+  mem->regions = NULL;
+  mem->region_count = mem->region_capacity = 0;
+  __mem_tlb_flush(mem);
 
   mem->page_node_allocator = page_node_allocator == NULL ? NO_ALLOCATOR: allocator_copy(page_node_allocator);
 }
@@ -118,86 +530,326 @@ size_t mem_align(size_t len)
 
 bool mem_tl(memory_t* mem, void* vaddr, void** out, char* exceptions)
 {
-  unsigned long pid = PAGE_ID(vaddr);
-  unsigned long offset = PAGE_OFFSET(vaddr);
+  if(mem_window_tl(mem, vaddr, 1, out))
+    return 1;
+
+  uintptr_t pid = PAGE_ID(vaddr);
+  uintptr_t offset = PAGE_OFFSET(vaddr);
 
-  page_node_t* pnode;
-  page_t* page;
+  mem_tlb_entry_t* entry = &mem->tlb[pid & (MEM_TLB_SIZE - 1)];
 
-  if(!avl_page_search(mem->pages, pid, &pnode))
+  if(entry->pid == pid)
   {
-    *exceptions |= PAGE_NOT_PRESENT;
-    return false;    
+    *out = entry->paddr + offset;
+    return 1;
   }
 
-  page = &pnode->page;
+  page_t page;
 
-  if(!page->present)
+  if(!__mem_radix_search(mem, pid, &page))
   {
     *exceptions |= PAGE_NOT_PRESENT;
     return false;
   }
   
-  *out = page->paddr + offset;
+  entry->pid = pid;
+  entry->paddr = page.paddr;
+  entry->writable = !page.cow;
+
+  *out = page.paddr + offset;
   
   return 1;
 }
 
-void* mem_map(memory_t* mem, void* vaddr, void* paddr, size_t len)
+bool mem_tl_write(memory_t* mem, void* vaddr, void** out, char* exceptions)
 {
-  len = mem_align(len);
+  if(mem_window_tl(mem, vaddr, 1, out))
+    return 1;
+
   uintptr_t pid = PAGE_ID(vaddr);
-  void* vbase = (void*) (pid << 12); // Realign the memory
-  vaddr = vbase;
+  uintptr_t offset = PAGE_OFFSET(vaddr);
 
-  page_node_t* pnode;
+  mem_tlb_entry_t* entry = &mem->tlb[pid & (MEM_TLB_SIZE - 1)];
 
-  do
+  if(entry->pid == pid && entry->writable)
   {
-    pid = PAGE_ID(vaddr);
+    *out = entry->paddr + offset;
+    return 1;
+  }
+
+  page_t page;
 
-    // The page is not created, we create it.
-    if(!avl_page_search(mem->pages, pid, &pnode)) 
+  if(!__mem_radix_search(mem, pid, &page))
+  {
+    *exceptions |= PAGE_NOT_PRESENT;
+    return false;
+  }
+
+  if(page.cow)
+  {
+    page_t* copy = __mem_radix_insert(mem, pid);
+
+    if(copy == NULL || !__mem_cow_fault(mem, pid, copy))
     {
-      pnode = avl_page_insert(&mem->pages, pid, &mem->page_node_allocator);
-      
-      if(!pnode) 
-        return NULL;
+      *exceptions |= PAGE_NOT_PRESENT;
+      return false;
+    }
+
+    page = *copy;
+  }
+
+  entry->pid = pid;
+  entry->paddr = page.paddr;
+  entry->writable = true;
+
+  *out = page.paddr + offset;
+
+  return 1;
+}
+
+static void __mem_block_acquire(managed_memory_t* block)
+{
+  if(block != NULL)
+    __atomic_add_fetch(&block->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void __mem_block_release(managed_memory_t* block)
+{
+  if(block == NULL || __atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
+#ifdef MEM_MMAP_SUPPORTED
+  if(block->block != NULL)
+    munmap(block->block, block->len);
+#endif
+
+  allocator_t allocator = allocator_copy(&block->allocator);
+  allocator_delete(&block->allocator);
+
+  pfree(&allocator, block);
+
+  allocator_delete(&allocator);
+}
+
+// First write to a shared page: copy it, unless it is the last reference to its block.
+static bool __mem_cow_fault(memory_t* mem, uintptr_t pid, page_t* entry)
+{
+  managed_memory_t* block = entry->block;
+
+  // Other pages, or the memory which allocated it, still refer to the block.
+  if(block == NULL || __atomic_load_n(&block->refs, __ATOMIC_ACQUIRE) > 1)
+  {
+    managed_memory_t* frame = (managed_memory_t*) pmalloc(&mem->page_node_allocator, sizeof(managed_memory_t) + PAGE_SIZE);
+
+    if(frame == NULL)
+      return false;
+
+    frame->vaddr = (void*)(pid << 12);
+    frame->len = PAGE_SIZE + sizeof(managed_memory_t);
+    frame->allocator = allocator_copy(&mem->page_node_allocator);
+    frame->next = NULL;
+    frame->refs = 1;
+    frame->block = NULL;
+
+    memcpy(frame + 1, entry->paddr, PAGE_SIZE);
+    __mem_block_release(block);
+
+    entry->paddr = (void*)(frame + 1);
+    entry->block = frame;
+  }
+
+  entry->cow = 0;
+
+  return true;
+}
+
+void* mem_map(memory_t* mem, void* vaddr, void* paddr, size_t len)
+{
+  if(!__mem_map_block(mem, vaddr, paddr, len, NULL, 0))
+    return NULL;
+
+  return (void*) (PAGE_ID(vaddr) << 12); // Realign the memory
+}
+
+static bool __mem_map_block(memory_t* mem, void* vaddr, void* paddr, size_t len, managed_memory_t* block, char cow)
+{
+  uintptr_t pid = PAGE_ID(vaddr);
+  size_t pages = mem_align(len) / PAGE_SIZE;
+
+  if(pages == 0)
+    pages = 1;
+
+  __mem_window_drop(mem, pid, pages);
+
+  for(; pages > 0; pid++, pages--, paddr += PAGE_SIZE)
+  {
+    // A whole span: large page
+    if((pid & (MEM_LARGE_PAGES - 1)) == 0 && pages >= MEM_LARGE_PAGES)
+    {
+      void** slot = __mem_radix_table_slot(mem, pid, true);
+
+      if(slot == NULL)
+        return false;
+
+      mem_large_t* large = (mem_large_t*) pmalloc(&mem->page_node_allocator, sizeof(mem_large_t));
+
+      if(large == NULL)
+        return false;
+
+      // Remapped
+      if(*slot != NULL)
+        __mem_release_table(mem, *slot);
+
+      __mem_block_acquire(block);
+
+      large->paddr = paddr;
+      large->block = block;
+      large->cow = cow;
+      *slot = (void*) ((uintptr_t) large | MEM_LARGE_TAG);
+
+      pid += MEM_LARGE_PAGES - 1;
+      pages -= MEM_LARGE_PAGES - 1;
+      paddr += MEM_LARGE_SIZE - PAGE_SIZE;
+      continue;
     }
 
-    page_t* page = &pnode->page;
+    page_t* entry = __mem_radix_insert(mem, pid);
+
+    if(!entry)
+      return false;
+
+    // Remapped
+    if(entry->present)
+      __mem_block_release(entry->block);
+
+    __mem_block_acquire(block);
+
+    entry->paddr = paddr;
+    entry->present = 1;
+    entry->cow = cow;
+    entry->block = block;
+  }
+
+  __mem_tlb_flush(mem);
+
+  return true;
+}
+
+// Release the blocks of a page table (or large page), and free it.
+static void __mem_release_table(memory_t* mem, void* table)
+{
+  if(__mem_is_large(table))
+  {
+    __mem_block_release(__mem_large(table)->block);
+    pfree(&mem->page_node_allocator, __mem_large(table));
+    return;
+  }
+
+  page_t* pages = (page_t*) table;
+
+  for(unsigned int i = 0; i < MEM_RADIX_SIZE; i++)
+  {
+    if(pages[i].present)
+      __mem_block_release(pages[i].block);
+  }
+
+  pfree(&mem->page_node_allocator, table);
+}
 
-    page->paddr = paddr;
-    page->present = 1;
+void mem_unmap(memory_t* mem, void* vaddr, size_t len)
+{
+  uintptr_t pid = PAGE_ID(vaddr);
+  uintptr_t last = PAGE_ID(vaddr + (len > 0 ? len - 1 : 0));
 
-    if (len > PAGE_SIZE)
-      len -= PAGE_SIZE;
-    else  
-      len = 0;
+  __mem_window_drop(mem, pid, last - pid + 1);
 
-    vaddr = vaddr + PAGE_SIZE;
-    paddr = paddr + PAGE_SIZE;
+  while(pid <= last)
+  {
+    uintptr_t span = pid & ~(uintptr_t)(MEM_LARGE_PAGES - 1);
+    uintptr_t end = span + MEM_LARGE_PAGES - 1; // Last page of the span
+    void** slot = __mem_radix_table_slot(mem, pid, false);
 
-  } while (len > PAGE_SIZE);
+    if(slot == NULL || *slot == NULL)
+    {
+      pid = end + 1;
+      continue;
+    }
 
-  return vbase;
+    // The whole span
+    if(pid == span && last >= end)
+    {
+      __mem_release_table(mem, *slot);
+      *slot = NULL;
+      pid = end + 1;
+      continue;
+    }
+
+    if(__mem_is_large(*slot) && __mem_large_split(mem, slot) == NULL)
+      return;
+
+    for(; pid <= last && pid <= end; pid++)
+    {
+      page_t* entry = ((page_t*) *slot) + MEM_RADIX_INDEX(pid, MEM_RADIX_LEVELS - 1);
+
+      if(entry->present)
+      {
+        __mem_block_release(entry->block);
+        entry->present = 0;
+        entry->block = NULL;
+      }
+    }
+  }
+
+  __mem_tlb_flush(mem);
 }
 
 void* mem_alloc_managed(memory_t* mem, allocator_t* allocator, void* vaddr, size_t len)
 {
-  len = mem_align(len) + sizeof(struct managed_memory_t); // Align the memory
-  struct managed_memory_t* header = (struct managed_memory_t*) pmalloc(allocator, len);
+  len = mem_align(len); // Align the memory
 
-  header->vaddr = vaddr;
-  header->len = len;
-  header->allocator = allocator_copy(allocator);
+#ifdef MEM_MMAP_SUPPORTED
+  bool reserved = len >= MEM_MMAP_THRESHOLD;
+#else
+  bool reserved = false;
+#endif
+  struct managed_memory_t* header = (struct managed_memory_t*) pmalloc(allocator, sizeof(struct managed_memory_t) + (reserved ? 0 : len));
+
+  if(header == NULL)
+    return NULL;
 
   void* paddr = (void*)(header + 1);
 
-  // We clean the allocated memory
-  for(int i = 0; i < len - sizeof(struct managed_memory_t); i++) *(char*)(paddr + i) = 0;
-  
-  mem_map(mem, vaddr, paddr, len); // Map the memory.
+#ifdef MEM_MMAP_SUPPORTED
+  if(reserved)
+  {
+    paddr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if(paddr == MAP_FAILED)
+    {
+      pfree(allocator, header);
+      return NULL;
+    }
+  }
+  else
+#endif
+  {
+    // We clean the allocated memory
+    memset(paddr, 0, len);
+  }
+
+  header->vaddr = vaddr;
+  header->len = reserved ? len : len + sizeof(struct managed_memory_t);
+  header->allocator = allocator_copy(allocator);
+  header->block = reserved ? paddr : NULL;
+  header->refs = 1;
+
+  // Map the memory, or drop the pages mapped so far and the block.
+  if(!__mem_map_block(mem, vaddr, paddr, len, header, 0))
+  {
+    mem_unmap(mem, vaddr, len);
+    __mem_block_release(header);
+    return NULL;
+  }
 
   header->next = mem->managed;
   mem->managed = header;
@@ -205,6 +857,193 @@ void* mem_alloc_managed(memory_t* mem, allocator_t* allocator, void* vaddr, size
   return paddr;
 }
 
+void* mem_map_window(memory_t* mem, void* vaddr, void* paddr, size_t len)
+{
+  if(!__mem_map_block(mem, vaddr, paddr, len, NULL, 0))
+    return NULL;
+
+  __mem_window_set(mem, vaddr, paddr, len);
+
+  return (void*) (PAGE_ID(vaddr) << 12);
+}
+
+void* mem_alloc_window(memory_t* mem, allocator_t* allocator, void* vaddr, size_t len)
+{
+  void* paddr = mem_alloc_managed(mem, allocator, vaddr, len);
+
+  if(paddr != NULL)
+    __mem_window_set(mem, vaddr, paddr, len);
+
+  return paddr;
+}
+
+void* mem_map_file(memory_t* mem, allocator_t* allocator, void* vaddr, int fd, off_t offset, size_t len)
+{
+#ifndef MEM_MMAP_SUPPORTED
+  return NULL;
+#else
+  len = mem_align(len);
+
+  struct managed_memory_t* header = (struct managed_memory_t*) pmalloc(allocator, sizeof(struct managed_memory_t));
+
+  if(header == NULL)
+    return NULL;
+
+  void* block = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+
+  if(block == MAP_FAILED)
+  {
+    pfree(allocator, header);
+    return NULL;
+  }
+
+  header->vaddr = vaddr;
+  header->len = len;
+  header->allocator = allocator_copy(allocator);
+  header->block = block;
+  header->refs = 1;
+
+  if(!__mem_map_block(mem, vaddr, block, len, header, 0))
+  {
+    mem_unmap(mem, vaddr, len);
+    __mem_block_release(header);
+    return NULL;
+  }
+
+  header->next = mem->managed;
+  mem->managed = header;
+
+  return block;
+#endif
+}
+
+// Index of the first region whose base is above addr.
+static unsigned int __mem_region_lower_bound(memory_t* mem, uintptr_t addr)
+{
+  unsigned int lo = 0, hi = mem->region_count;
+
+  while(lo < hi)
+  {
+    unsigned int mid = lo + (hi - lo) / 2;
+
+    if(mem->regions[mid].base <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+bool mem_attach_device(memory_t* mem, void* vaddr, size_t len, const mem_device_t* device)
+{
+  uintptr_t base = (uintptr_t) vaddr;
+
+  if(len == 0 || base + len - 1 < base)
+    return false;
+
+  unsigned int i = __mem_region_lower_bound(mem, base);
+
+  // Overlaps the previous, or the next region
+  if(i > 0 && mem->regions[i - 1].base + mem->regions[i - 1].len - 1 >= base)
+    return false;
+
+  if(i < mem->region_count && mem->regions[i].base <= base + len - 1)
+    return false;
+
+  if(mem->region_count == mem->region_capacity)
+  {
+    unsigned int capacity = mem->region_capacity == 0 ? 4 : mem->region_capacity * 2;
+    mem_region_t* regions = (mem_region_t*) prealloc(&mem->page_node_allocator, mem->regions, capacity * sizeof(mem_region_t));
+
+    if(regions == NULL)
+      return false;
+
+    mem->regions = regions;
+    mem->region_capacity = capacity;
+  }
+
+  memmove(mem->regions + i + 1, mem->regions + i, (mem->region_count - i) * sizeof(mem_region_t));
+
+  mem->regions[i].base = base;
+  mem->regions[i].len = len;
+  mem->regions[i].device = *device;
+  mem->region_count++;
+
+  return true;
+}
+
+bool mem_detach_device(memory_t* mem, void* vaddr)
+{
+  unsigned int i = __mem_region_lower_bound(mem, (uintptr_t) vaddr);
+
+  if(i == 0 || mem->regions[i - 1].base != (uintptr_t) vaddr)
+    return false;
+
+  memmove(mem->regions + i - 1, mem->regions + i, (mem->region_count - i) * sizeof(mem_region_t));
+  mem->region_count--;
+
+  return true;
+}
+
+mem_region_t* mem_find_device(memory_t* mem, void* vaddr)
+{
+  unsigned int i = __mem_region_lower_bound(mem, (uintptr_t) vaddr);
+
+  if(i == 0)
+    return NULL;
+
+  mem_region_t* region = &mem->regions[i - 1];
+
+  return (uintptr_t) vaddr - region->base < region->len ? region : NULL;
+}
+
+// The region covering the whole access, or a fault.
+static mem_region_t* __mem_device_region(memory_t* mem, void* vaddr, size_t size, char* exceptions)
+{
+  mem_region_t* region = mem_find_device(mem, vaddr);
+
+  if(region == NULL || region->len - ((uintptr_t) vaddr - region->base) < size)
+  {
+    *exceptions |= PAGE_NOT_PRESENT;
+    return NULL;
+  }
+
+  return region;
+}
+
+bool mem_device_read(memory_t* mem, void* vaddr, void* dst, size_t size, char* exceptions)
+{
+  mem_region_t* region = __mem_device_region(mem, vaddr, size, exceptions);
+
+  if(region == NULL)
+    return false;
+
+  if(region->device.read == NULL || !region->device.read(region->device.self, (uintptr_t) vaddr - region->base, dst, size))
+  {
+    *exceptions |= PAGE_NOT_PRESENT;
+    return false;
+  }
+
+  return true;
+}
+
+bool mem_device_write(memory_t* mem, void* vaddr, const void* src, size_t size, char* exceptions)
+{
+  mem_region_t* region = __mem_device_region(mem, vaddr, size, exceptions);
+
+  if(region == NULL)
+    return false;
+
+  if(region->device.write == NULL || !region->device.write(region->device.self, (uintptr_t) vaddr - region->base, src, size))
+  {
+    *exceptions |= PAGE_NOT_PRESENT;
+    return false;
+  }
+
+  return true;
+}
+
 static void __managed_mem_delete_all(managed_memory_t* managed)
 {
   struct managed_memory_t* it = managed;
@@ -213,26 +1052,121 @@ static void __managed_mem_delete_all(managed_memory_t* managed)
   {
     struct managed_memory_t* nxt = it->next;
 
-    allocator_t allocator = allocator_copy(&it->allocator);
-    allocator_delete(&it->allocator);
-
-    pfree(&allocator, it);
-    
-    allocator_delete(&allocator);
+    // Freed with the last page mapped over it.
+    __mem_block_release(it);
 
     it = nxt;
   }
 }
 
+typedef struct {
+  void (*visit)(void* self, uintptr_t pid, const page_t* page);
+  void* self;
+} __mem_walk_t;
+
+static void __mem_walk_table(void* self, uintptr_t pid, void** slot)
+{
+  __mem_walk_t* walk = (__mem_walk_t*) self;
+
+  if(__mem_is_large(*slot))
+  {
+    mem_large_t* large = __mem_large(*slot);
+    page_t page = {1, large->cow, large->paddr, large->block};
+
+    for(unsigned int i = 0; i < MEM_LARGE_PAGES; i++, page.paddr += PAGE_SIZE)
+      walk->visit(walk->self, pid + i, &page);
+
+    return;
+  }
+
+  page_t* pages = (page_t*) *slot;
+
+  for(unsigned int i = 0; i < MEM_RADIX_SIZE; i++)
+  {
+    if(pages[i].present)
+      walk->visit(walk->self, pid + i, &pages[i]);
+  }
+}
+
+void mem_walk(memory_t* mem, void (*visit)(void* self, uintptr_t pid, const page_t* page), void* self)
+{
+  __mem_walk_t walk = {visit, self};
+  __mem_walk_tables(mem->radix, 0, 0, __mem_walk_table, &walk);
+}
+
+typedef struct {
+  memory_t* dst;
+  bool ok;
+} __mem_clone_t;
+
+static void __mem_clone_table(void* self, uintptr_t pid, void** slot)
+{
+  __mem_clone_t* clone = (__mem_clone_t*) self;
+
+  if(!clone->ok)
+    return;
+
+  if(__mem_is_large(*slot))
+  {
+    mem_large_t* large = __mem_large(*slot);
+
+    large->cow = 1;
+    clone->ok = __mem_map_block(clone->dst, (void*)(pid << 12), large->paddr, MEM_LARGE_SIZE, large->block, 1);
+
+    return;
+  }
+
+  page_t* pages = (page_t*) *slot;
+
+  for(unsigned int i = 0; i < MEM_RADIX_SIZE && clone->ok; i++)
+  {
+    if(!pages[i].present)
+      continue;
+
+    pages[i].cow = 1;
+    clone->ok = __mem_map_block(clone->dst, (void*)((pid + i) << 12), pages[i].paddr, PAGE_SIZE, pages[i].block, 1);
+  }
+}
+
+bool mem_clone(memory_t* dst, memory_t* src)
+{
+  __mem_clone_t clone = {dst, true};
+
+  __mem_walk_tables(src->radix, 0, 0, __mem_clone_table, &clone);
+
+  // Drop the writable translations
+  src->window.len = 0;
+  __mem_tlb_flush(src);
+
+  return clone.ok;
+}
+
+static void __mem_destroy_table(void* self, uintptr_t pid, void** slot)
+{
+  __mem_release_table((memory_t*) self, *slot);
+  *slot = NULL;
+}
+
 void mem_destroy(memory_t* mem)
 {
-  // Delete all page nodes.
-  avl_page_delete_tree(mem->pages, &mem->page_node_allocator);
-  mem->pages = 0;
+  // Release the blocks of the pages, and the page tables
+  __mem_walk_tables(mem->radix, 0, 0, __mem_destroy_table, mem);
+
+  // Delete the radix table
+  __mem_radix_delete(mem->radix, 0, &mem->page_node_allocator);
+  mem->radix = 0;
+  mem->window.len = 0;
+  __mem_tlb_flush(mem);
 
   // Delete all managed memory.
   __managed_mem_delete_all(mem->managed);
   mem->managed = 0;
+
+  if(mem->regions != NULL)
+    pfree(&mem->page_node_allocator, mem->regions);
+
+  mem->regions = NULL;
+  mem->region_count = mem->region_capacity = 0;
 }
 
 void mem_delete(memory_t* mem, allocator_t* allocator)
@@ -1,10 +1,14 @@
 #ifndef __PAGE_H__
 #define __PAGE_H__
 
+struct managed_memory_t;
+
 typedef struct 
 {
   char present;
+  char cow; // Shared, copied on the first write (see mem_tl_write)
   void* paddr;
+  struct managed_memory_t* block; // Managed block holding a reference for the page, NULL for unmanaged memory
 } page_t;
 
-#endif
\ No newline at end of file
+#endif
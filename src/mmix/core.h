@@ -7,6 +7,7 @@
 
 #include "../system.h"
 #include "../memory/core.h"
+#include "../snapshot.h"
 
 #include "./processor.h"
 #include "./instr.h"
@@ -37,6 +38,11 @@ void mmix_alloc_sim_time(system_t* s, unsigned int ms);
  */
 void mmix_step(system_t* sys);
 
+/**
+ * \brief Execute a system step with the threaded engine, up to a basic block.
+ */
+void mmix_threaded_step(system_t* sys);
+
 /**
  * \brief Restart the system.
  */
@@ -47,10 +53,24 @@ void mmix_restart(system_t* sys);
  */
 void mmix_set_interrupt_handler(system_t* sys, byte ircode, mmix_ivt_hdlr hdlr);
 
+/**
+ * \brief Write the processor state (registers, clock...) for a snapshot.
+ *
+ * The interrupt handlers are host functions, they are kept by the restored system.
+ */
+void mmix_save(system_t* sys, snapshot_stream_t* out);
+
+/**
+ * \brief Read the processor state back, false if the snapshot has not the same count of local registers.
+ */
+bool mmix_load(system_t* sys, snapshot_stream_t* in);
+
 static void __mmix_init(system_t* sys, mmix_cfg_t* cfg);
 
 static inline void __fetch_next_instr(system_t* sys, mmix_processor_t* proc, instr_t* instr);
-static inline void __convert_rel_to_abs_addr(mmix_processor_t* proc, instr_t* instr);
+static inline mmix_decoded_instr_t* __decode_instr(system_t* sys, mmix_processor_t* proc, octa* loc, bool speculative);
+static inline bool __fetch_decoded_instr(system_t* sys, mmix_processor_t* proc, instr_t* instr, mmix_exec_t* exec);
+static inline void __convert_rel_to_abs_addr(octa* instr_ptr, instr_t* instr);
 static inline void __install_operands(system_t* sys, mmix_processor_t* proc, instr_t* instr);
 
 system_t* mmix_create(allocator_t* allocator, mmix_cfg_t* cfg)
@@ -78,8 +98,10 @@ system_t* mmix_create(allocator_t* allocator, mmix_cfg_t* cfg)
 
 static void __mmix_init(system_t* sys, mmix_cfg_t* cfg)
 {
-  sys->step = mmix_step;
-  sys->alloc_sim_time = mmix_alloc_sim_time;
+  sys->vtable.step = cfg->engine == MMIX_ENGINE_THREADED ? mmix_threaded_step : mmix_step;
+  sys->vtable.save = mmix_save;
+  sys->vtable.load = mmix_load;
+  sys->frequency = cfg->frequency;
   
   mmix_processor_t* proc = __get_mmix_proc(sys);
 
@@ -89,7 +111,7 @@ static void __mmix_init(system_t* sys, mmix_cfg_t* cfg)
   proc->lsize     = cfg->lsize;
   proc->l = __get_mmix_lregs(sys);
   
-  for(unsigned char i = 0; i != 0xFF; i++) 
+  for(unsigned int i = 0; i < 256; i++)
   {
     proc->g[i] = 0x00;
     proc->ivt[i].hdlr = NULL;
@@ -120,6 +142,8 @@ static void __mmix_init(system_t* sys, mmix_cfg_t* cfg)
 
   proc->state = 0;
   proc->sclock = octa_zero;
+
+  mmix_icache_flush(&proc->icache);
 }
 
 void mmix_alloc_sim_time(system_t* sys, unsigned int ms)
@@ -138,7 +162,7 @@ void mmix_restart(system_t* sys)
 
   proc->instr_ptr = (octa*) MMIX_START_ADDR;
 
-  for(unsigned char i = 0; i != 0xFF; i++) 
+  for(unsigned int i = 0; i < 256; i++)
   {
     proc->g[i] = 0x00;
     proc->ivt[i].hdlr = NULL;
@@ -169,6 +193,8 @@ void mmix_restart(system_t* sys)
 
   proc->state = 0; 
   proc->sclock = octa_zero;
+
+  mmix_icache_flush(&proc->icache);
 }
 
 
@@ -193,7 +219,52 @@ static inline void __fetch_next_instr(system_t* sys, mmix_processor_t* proc, ins
   }
 }
 
-static inline void __convert_rel_to_abs_addr(mmix_processor_t* proc, instr_t* instr) {
+static inline mmix_decoded_instr_t* __decode_instr(system_t* sys, mmix_processor_t* proc, octa* loc, bool speculative) {
+  mmix_decoded_instr_t* entry = mmix_icache_entry(&proc->icache, (octa) loc);
+  tetra raw_instr;
+  instr_t instr;
+
+  if(entry->loc == (octa) loc)
+    return entry;
+
+  // Looking ahead must not fault.
+  if(speculative) {
+    char exceptions = 0;
+    void* out;
+
+    if(!mem_tl(&sys->mem, loc, &out, &exceptions))
+      return NULL;
+    
+    raw_instr = *(tetra*) out;
+  } else {
+    MMIX_MEM_READ_FAILBACK(sys, loc, tetra, raw_instr, return NULL);
+  }
+
+  // Read the instruction
+  instr = mmix_read_instr(raw_instr);
+  instr.loc = (octa) loc;
+
+  // Convert rel addr to abs addr, it only depends on the location.
+  __convert_rel_to_abs_addr(loc + 1, &instr);
+  mmix_icache_fill(entry, &instr, MMIX_DISPATCH_ROUTER[instr.op]);
+
+  return entry;
+}
+
+static inline bool __fetch_decoded_instr(system_t* sys, mmix_processor_t* proc, instr_t* instr, mmix_exec_t* exec) {
+  mmix_decoded_instr_t* entry = __decode_instr(sys, proc, proc->instr_ptr, false);
+
+  if(entry == NULL)
+    return false;
+
+  mmix_icache_load(entry, instr);
+  proc->instr_ptr++;
+
+  *exec = entry->exec;
+  return true;
+}
+
+static inline void __convert_rel_to_abs_addr(octa* instr_ptr, instr_t* instr) {
   if(instr->f & rel_addr_bit) {
 
     if((instr->op & 0xFE) == JMP) 
@@ -202,7 +273,7 @@ static inline void __convert_rel_to_abs_addr(mmix_processor_t* proc, instr_t* in
     if(instr->op & 1) 
       instr->yz -= (instr->op == JMPB ? 0x1000000 : 0x10000);
 
-    instr->y = (octa) proc->instr_ptr;
+    instr->y = (octa) instr_ptr;
     instr->z = (octa) (instr->loc + (instr->yz << 2));
   }
 }
@@ -285,13 +356,22 @@ void mmix_step(system_t* sys)
 
   instr_t instr;
 
+  mmix_exec_t exec = NULL;
+
   proc = __get_mmix_proc(sys);
 
-  // Resuming from TRIP/TRAP
-  __fetch_next_instr(sys, proc, &instr);
-  
-  // Convert rel addr to abs addr
-  __convert_rel_to_abs_addr(proc, &instr);
+  if(HAS_FLAG(MMIX_RESUMING, proc->state)) 
+  {
+    // Resuming from TRIP/TRAP
+    __fetch_next_instr(sys, proc, &instr);
+    
+    // Convert rel addr to abs addr
+    __convert_rel_to_abs_addr(proc->instr_ptr, &instr);
+  } 
+  else if(!__fetch_decoded_instr(sys, proc, &instr, &exec)) 
+  {
+    return;
+  }
 
   // Install operand fields
   __install_operands(sys, proc, &instr);
@@ -300,7 +380,10 @@ void mmix_step(system_t* sys)
   instr.w = octa_plus(instr.y, instr.z, &overflow);
 
   // Dispatch the instruction.
-  mmix_dispatch(sys, proc, &instr);
+  if(exec != NULL)
+    exec(sys, proc, &instr);
+  else
+    mmix_dispatch(sys, proc, &instr);
   
   // Set the exception
   proc->g[rA] = instr.exc;
@@ -337,4 +420,52 @@ void mmix_set_interrupt_handler(system_t* sys, byte ircode, void (*hdlr)(system_
   proc->ivt[ircode].hdlr = hdlr;
 }
 
+void mmix_save(system_t* sys, snapshot_stream_t* out)
+{
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+
+  snapshot_write(out, &proc->lsize, sizeof(proc->lsize));
+  snapshot_write(out, proc->g, sizeof(proc->g));
+  snapshot_write(out, proc->l, sizeof(octa) * proc->lsize);
+  snapshot_write(out, &proc->instr_ptr, sizeof(proc->instr_ptr));
+  snapshot_write(out, &proc->rounding_mode, sizeof(proc->rounding_mode));
+  snapshot_write(out, &proc->S, sizeof(proc->S));
+  snapshot_write(out, &proc->G, sizeof(proc->G));
+  snapshot_write(out, &proc->L, sizeof(proc->L));
+  snapshot_write(out, &proc->O, sizeof(proc->O));
+  snapshot_write(out, &proc->rop, sizeof(proc->rop));
+  snapshot_write(out, &proc->state, sizeof(proc->state));
+  snapshot_write(out, &proc->sclock, sizeof(proc->sclock));
+  snapshot_write(out, &proc->frequency, sizeof(proc->frequency));
+}
+
+bool mmix_load(system_t* sys, snapshot_stream_t* in)
+{
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+  unsigned int lsize;
+
+  if(!snapshot_read(in, &lsize, sizeof(lsize)) || lsize != proc->lsize)
+    return false;
+
+  bool ok = snapshot_read(in, proc->g, sizeof(proc->g))
+    && snapshot_read(in, proc->l, sizeof(octa) * proc->lsize)
+    && snapshot_read(in, &proc->instr_ptr, sizeof(proc->instr_ptr))
+    && snapshot_read(in, &proc->rounding_mode, sizeof(proc->rounding_mode))
+    && snapshot_read(in, &proc->S, sizeof(proc->S))
+    && snapshot_read(in, &proc->G, sizeof(proc->G))
+    && snapshot_read(in, &proc->L, sizeof(proc->L))
+    && snapshot_read(in, &proc->O, sizeof(proc->O))
+    && snapshot_read(in, &proc->rop, sizeof(proc->rop))
+    && snapshot_read(in, &proc->state, sizeof(proc->state))
+    && snapshot_read(in, &proc->sclock, sizeof(proc->sclock))
+    && snapshot_read(in, &proc->frequency, sizeof(proc->frequency));
+
+  // Decoded from the previous memory
+  mmix_icache_flush(&proc->icache);
+
+  return ok;
+}
+
+#include "./threaded.h"
+
 #endif
\ No newline at end of file
@@ -16,7 +16,7 @@
 typedef void (*mmix_exec_t)(system_t* sys, mmix_processor_t* proc, instr_t* instr);
 #define MEX_ARGS sys, proc, instr
 #define MEX_DEF_ARGS system_t * sys, mmix_processor_t* proc,instr_t * instr
-#define MEXF(op_name) void mmix_ ##op_name (MEX_DEF_ARGS)
+#define MEXF(op_name) static inline void mmix_ ##op_name (MEX_DEF_ARGS)
 #define MEXN(op_name) mmix_##op_name
 
 #define MMEMR(addr, type, out) MMIX_MEM_READ(sys, addr, type, out)
@@ -1239,8 +1239,13 @@ MEXF(SYNCD) {}
 MEXF(SYNCDI) {}
 MEXF(PREST) {}
 MEXF(PRESTI) {}
-MEXF(SYNCID) {}
-MEXF(SYNCIDI) {}
+MEXF(SYNCID) {
+  mmix_icache_invalidate(&proc->icache, instr->w, (octa) instr->xx + 1);
+}
+
+MEXF(SYNCIDI) {
+  mmix_icache_invalidate(&proc->icache, instr->w, (octa) instr->xx + 1);
+}
 MEXF(PUSHGO) {}
 MEXF(PUSHGOI) {}
 
@@ -0,0 +1,178 @@
+#ifndef __MMIX_ICACHE_H__
+#define __MMIX_ICACHE_H__
+
+#include "../../lib/common/include/types.h"
+
+#include "./instr.h"
+#include "./op.h"
+
+/**
+ * Decoded instruction cache.
+ *
+ * Direct-mapped on the instruction address (tetra granularity). An entry keeps
+ * the decoded fields of the instruction, its relative operands already converted
+ * to absolute addresses, and the resolved handler, so a hit skips the fetch and decode.
+ *
+ * Stores and SYNCID invalidate the entries covering the written bytes.
+ *
+ * Basic blocks (used by the threaded engine) are runs of consecutive entries,
+ * cached by their first location and dropped whenever an entry is invalidated.
+ */
+#define MMIX_ICACHE_SIZE 1024 // Power of two
+#define MMIX_ICACHE_INVALID octa_uint_max // Never tetra-aligned
+
+#define MMIX_BLOCK_CACHE_SIZE 256 // Power of two
+#define MMIX_BLOCK_MAX_LEN 32
+
+struct system_t;
+struct mmix_processor_t;
+
+typedef struct {
+  octa loc;
+
+  // Operands y and z after the relative address conversion
+  octa y, z;
+
+  tetra bin, f;
+  byte op, xx, yy, zz;
+  word yz;
+
+  mmix_op_info* info;
+  void (*exec)(struct system_t* sys, struct mmix_processor_t* proc, instr_t* instr);
+} mmix_decoded_instr_t;
+
+/**
+ * \brief Basic block of decoded instructions, starting at loc.
+ * 
+ * Only valid while the generation of the cache has not changed.
+ */
+typedef struct {
+  octa loc;
+  unsigned int generation;
+  unsigned int len;
+  unsigned int max_oops;
+} mmix_block_t;
+
+typedef struct {
+  mmix_decoded_instr_t entries[MMIX_ICACHE_SIZE];
+  mmix_block_t blocks[MMIX_BLOCK_CACHE_SIZE];
+
+  // Bumped each time decoded instructions are dropped
+  unsigned int generation;
+} mmix_icache_t;
+
+/**
+ * \brief Invalidate all the entries.
+ */
+void mmix_icache_flush(mmix_icache_t* icache);
+
+/**
+ * \brief Get the entry the instruction at loc maps to, it is a hit if its loc matches.
+ */
+static inline mmix_decoded_instr_t* mmix_icache_entry(mmix_icache_t* icache, octa loc);
+
+/**
+ * \brief Invalidate the entries of the instructions overlapping [addr, addr + len).
+ */
+static inline void mmix_icache_invalidate(mmix_icache_t* icache, octa addr, octa len);
+
+/**
+ * \brief Get the block entry starting at loc, it is a hit if its loc and generation match.
+ */
+static inline mmix_block_t* mmix_icache_block(mmix_icache_t* icache, octa loc);
+
+/**
+ * \brief Store a decoded instruction into its entry.
+ */
+void mmix_icache_fill(mmix_decoded_instr_t* entry, instr_t* instr, void (*exec)(struct system_t* sys, struct mmix_processor_t* proc, instr_t* instr));
+
+/**
+ * \brief Build an instruction from its decoded template.
+ */
+static inline void mmix_icache_load(mmix_decoded_instr_t* entry, instr_t* instr);
+
+//////////
+// IMPL //
+//////////
+
+void mmix_icache_flush(mmix_icache_t* icache)
+{
+  for(unsigned int i = 0; i < MMIX_ICACHE_SIZE; i++)
+    icache->entries[i].loc = MMIX_ICACHE_INVALID;
+
+  for(unsigned int i = 0; i < MMIX_BLOCK_CACHE_SIZE; i++)
+    icache->blocks[i].loc = MMIX_ICACHE_INVALID;
+
+  icache->generation++;
+}
+
+static inline mmix_decoded_instr_t* mmix_icache_entry(mmix_icache_t* icache, octa loc)
+{
+  return &icache->entries[(loc >> 2) & (MMIX_ICACHE_SIZE - 1)];
+}
+
+static inline void mmix_icache_invalidate(mmix_icache_t* icache, octa addr, octa len)
+{
+  octa loc = addr & ~(octa) 3;
+  octa limit = addr + len;
+
+  // Large ranges wrap around the whole cache.
+  if(len >= (octa) MMIX_ICACHE_SIZE << 2)
+  {
+    mmix_icache_flush(icache);
+    return;
+  }
+
+  for(; loc < limit; loc += 4)
+  {
+    mmix_decoded_instr_t* entry = mmix_icache_entry(icache, loc);
+    
+    if(entry->loc == loc) 
+    {
+      entry->loc = MMIX_ICACHE_INVALID;
+      icache->generation++;
+    }
+  }
+}
+
+static inline mmix_block_t* mmix_icache_block(mmix_icache_t* icache, octa loc)
+{
+  return &icache->blocks[(loc >> 2) & (MMIX_BLOCK_CACHE_SIZE - 1)];
+}
+
+void mmix_icache_fill(mmix_decoded_instr_t* entry, instr_t* instr, void (*exec)(struct system_t* sys, struct mmix_processor_t* proc, instr_t* instr))
+{
+  entry->loc  = instr->loc;
+  entry->y    = instr->y;
+  entry->z    = instr->z;
+  entry->bin  = instr->bin;
+  entry->f    = instr->f;
+  entry->op   = instr->op;
+  entry->xx   = instr->xx;
+  entry->yy   = instr->yy;
+  entry->zz   = instr->zz;
+  entry->yz   = instr->yz;
+  entry->info = instr->info;
+  entry->exec = exec;
+}
+
+static inline void mmix_icache_load(mmix_decoded_instr_t* entry, instr_t* instr)
+{
+  instr->op   = entry->op;
+  instr->xx   = entry->xx;
+  instr->yy   = entry->yy;
+  instr->zz   = entry->zz;
+  instr->yz   = entry->yz;
+  instr->loc  = entry->loc;
+  instr->bin  = entry->bin;
+  instr->f    = entry->f;
+  instr->info = entry->info;
+
+  instr->y = entry->y;
+  instr->z = entry->z;
+  instr->w = instr->x = instr->a = instr->b = 0;
+  instr->exc = instr->ma = instr->mb = 0;
+  instr->x_ptr = NULL;
+}
+
+#endif
@@ -10,28 +10,37 @@
 
 #define PAGE_NOT_PRESENT_BIT (1 << 19);
 
+// In the linear window of the memory, a bounds check and an add.
 #define MMIX_MEM_ACCESS_FAILBACK(sys, addr, type, out, on_failure) {\
   void* __out;\
-  if(!mmix_memtl(sys, addr, &__out)) {\
+  if(!mem_window_tl(&(sys)->mem, (void*)(addr), sizeof(type), &__out) && !mmix_memtl(sys, addr, &__out)) {\
     sys_panic(sys);\
     on_failure;\
   }\
   out = (type*) __out;\
 }
 
+// Out of the window: the page table, then the devices.
 #define MMIX_MEM_READ_FAILBACK(sys, addr, type, out, on_failure) {\
-  type* __out2; \
-  MMIX_MEM_ACCESS_FAILBACK(sys, addr, type, __out2, on_failure);\
-  out = *(type*) __out2; \
+  void* __out;\
+  type __val;\
+  if(mem_window_tl(&(sys)->mem, (void*)(addr), sizeof(type), &__out)) __val = *(type*) __out;\
+  else if(!mmix_mem_read(sys, (void*)(addr), &__val, sizeof(type))) {\
+    sys_panic(sys);\
+    on_failure;\
+  }\
+  out = __val;\
 }
 
 #define MMIX_MEM_WRITE_FAILBACK(sys, addr, type, val, on_failure) {\
   void* __out;\
-  if(!mmix_memtl(sys, addr, &__out)) {\
+  type __val = val;\
+  if(mem_window_tl(&(sys)->mem, (void*)(addr), sizeof(type), &__out)) *(type*) __out = __val;\
+  else if(!mmix_mem_write(sys, (void*)(addr), &__val, sizeof(type))) {\
     sys_panic(sys); \
     on_failure; \
   } \
-  *(type*) __out = val;\
+  mmix_icache_invalidate(&__get_mmix_proc(sys)->icache, (octa)(addr), sizeof(type));\
 }
 
 #define MMIX_MEM_ACCESS(sys, addr, out) MMIX_MEM_ACCESS_FAILBACK(sys, addr, type, out, return)
@@ -55,5 +64,73 @@ bool mmix_memtl(system_t* sys, void* addr, void** out)
   return retres;
 }
 
+/*
+* \brief Get the real addr for a write, a shared page is copied first.
+*/
+bool mmix_memtl_write(system_t* sys, void* addr, void** out)
+{
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+
+  char exceptions = 0;
+
+  bool retres = mem_tl_write(&sys->mem, addr, out, &exceptions);
+
+  if(!retres)
+    proc->g[rA] |= exceptions << 19; // Set the value
+
+  return retres;
+}
+
+/*
+* \brief Read size bytes at addr, from the memory or else from the device bound to it.
+*/
+bool mmix_mem_read(system_t* sys, void* addr, void* dst, size_t size)
+{
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+
+  char exceptions = 0;
+  void* out;
+
+  if(mem_tl(&sys->mem, addr, &out, &exceptions))
+  {
+    memcpy(dst, out, size);
+    return true;
+  }
+
+  exceptions = 0;
+
+  if(mem_device_read(&sys->mem, addr, dst, size, &exceptions))
+    return true;
+
+  proc->g[rA] |= exceptions << 19; // Set the value
+
+  return false;
+}
+
+/*
+* \brief Write size bytes at addr, to the memory or else to the device bound to it.
+*/
+bool mmix_mem_write(system_t* sys, void* addr, const void* src, size_t size)
+{
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+
+  char exceptions = 0;
+  void* out;
+
+  if(mem_tl_write(&sys->mem, addr, &out, &exceptions))
+  {
+    memcpy(out, src, size);
+    return true;
+  }
+
+  exceptions = 0;
+
+  if(mem_device_write(&sys->mem, addr, src, size, &exceptions))
+    return true;
+
+  proc->g[rA] |= exceptions << 19; // Set the value
+
+  return false;
+}
 
 #endif
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "../system.h"
 
 #include "./instr.h"
+#include "./icache.h"
 #include "./reg.h"
 #include "./op.h"
 
@@ -21,13 +22,19 @@ typedef struct {
   void (*hdlr) (system_t* sys, instr_t* instr);
 } mmix_ivte;
 
+typedef enum {
+  MMIX_ENGINE_INTERPRETER,  // One instruction per step
+  MMIX_ENGINE_THREADED      // Threaded dispatch over decoded basic blocks
+} mmix_engine_t;
+
 typedef struct {
   unsigned int lsize;
   unsigned int lmask;
   unsigned int frequency;
+  unsigned int engine;
 } mmix_cfg_t;
 
-typedef struct {
+typedef struct mmix_processor_t {
   octa g[256]; // Global Registers
   octa* l;     // Local Registers
 
@@ -46,6 +53,8 @@ typedef struct {
   unsigned int frequency; // Processor frequency
 
   mmix_ivte ivt[256]; // Interrupt Vector Table (TRAP)
+
+  mmix_icache_t icache; // Decoded instructions
 } mmix_processor_t;
 
 void mmix_cfg_init(mmix_cfg_t* cfg) 
@@ -53,6 +62,7 @@ void mmix_cfg_init(mmix_cfg_t* cfg)
   cfg->lsize = 256;
   cfg->lmask = 255;
   cfg->frequency = 500000000; // 500 MHz
+  cfg->engine = MMIX_ENGINE_INTERPRETER;
 }
 
 mmix_processor_t* __get_mmix_proc(system_t* sys)
@@ -0,0 +1,533 @@
+#ifndef __MMIX_THREADED_H__
+#define __MMIX_THREADED_H__
+
+/**
+ * Threaded execution engine.
+ *
+ * A step runs a basic block of decoded instructions (see icache.h), dispatching
+ * each one with computed gotos to a direct call of its handler, which the compiler
+ * can inline. The clock accounting of the block is applied once when rI cannot
+ * expire within it, and brought up to date before a GET, which may read the clocks.
+ *
+ * A block ends on any instruction which may change the control flow, rI or the code,
+ * and a step never runs more instructions than the system has steps left.
+ *
+ * Included by core.h.
+ */
+
+#define MMIX_THREADED_LABEL(op) &&__mmix_threaded_##op
+#define MMIX_THREADED_CASE(op) __mmix_threaded_##op: MEXN(op)(sys, proc, &instr); goto retire;
+
+static inline bool __mmix_ends_block(byte op);
+static mmix_block_t* __mmix_get_block(system_t* sys, mmix_processor_t* proc, octa* loc);
+static inline void __mmix_account_instr(system_t* sys, mmix_processor_t* proc, instr_t* instr);
+static inline void __mmix_account_folded(mmix_processor_t* proc, unsigned int folded, unsigned int oops, unsigned int mems);
+
+static inline bool __mmix_ends_block(byte op)
+{
+  return op == TRAP || op == TRIP
+    || (op >= BN && op <= PBEVB)
+    || (op >= GO && op <= GOI)
+    || (op >= SYNCID && op <= PUSHGOI)
+    || (op >= JMP && op <= PUSHJB)
+    || (op >= PUT && op <= SYNC);
+}
+
+// Clock accounting of the folded instructions of a block.
+static inline void __mmix_account_folded(mmix_processor_t* proc, unsigned int folded, unsigned int oops, unsigned int mems)
+{
+  bool overflow;
+
+  proc->sclock = octa_plus(proc->sclock, octa_left_shift(uint_to_octa(mems), 32), &overflow);
+  proc->sclock = octa_incr(proc->sclock, oops);
+  proc->g[rU] = octa_incr(proc->g[rU], folded);
+  proc->g[rI] = octa_incr(proc->g[rI], oops);
+}
+
+static mmix_block_t* __mmix_get_block(system_t* sys, mmix_processor_t* proc, octa* loc)
+{
+  mmix_icache_t* icache = &proc->icache;
+  mmix_block_t* block = mmix_icache_block(icache, (octa) loc);
+
+  if(block->loc == (octa) loc && block->generation == icache->generation)
+    return block;
+
+  // The first instruction is the one to execute, it may fault.
+  mmix_decoded_instr_t* entry = __decode_instr(sys, proc, loc, false);
+
+  if(entry == NULL)
+    return NULL;
+
+  // Decoding may have evicted instructions.
+  block->generation = icache->generation;
+  block->loc = (octa) loc;
+  block->len = 0;
+  block->max_oops = 0;
+
+  while(entry != NULL)
+  {
+    block->len++;
+    block->max_oops = MAX(block->max_oops, entry->info->oops);
+
+    if(block->len == MMIX_BLOCK_MAX_LEN || __mmix_ends_block(entry->op))
+      break;
+
+    entry = __decode_instr(sys, proc, loc + block->len, true);
+  }
+
+  return block;
+}
+
+static inline void __mmix_account_instr(system_t* sys, mmix_processor_t* proc, instr_t* instr)
+{
+  if(!__check_sys_timed_interrupt(sys, proc)) 
+  {
+    bool overflow;
+    proc->sclock = octa_plus(
+      proc->sclock, 
+      octa_left_shift(
+        int_to_octa(instr->info->mems), 
+        32
+      ),
+      &overflow
+    );
+
+    proc->g[rU] = octa_incr(proc->g[rU], 1);
+    __mmix_sclock_incr(proc, instr->info->oops);
+    __check_sys_timed_interrupt(sys, proc);
+  }
+}
+
+void mmix_threaded_step(system_t* sys)
+{
+  static void* const labels[256] = {
+    MMIX_THREADED_LABEL(TRAP), MMIX_THREADED_LABEL(FCMP), MMIX_THREADED_LABEL(FUN),
+    MMIX_THREADED_LABEL(FEQL), MMIX_THREADED_LABEL(FADD), MMIX_THREADED_LABEL(FIX),
+    MMIX_THREADED_LABEL(FSUB), MMIX_THREADED_LABEL(FIXU), MMIX_THREADED_LABEL(FLOT),
+    MMIX_THREADED_LABEL(FLOTI), MMIX_THREADED_LABEL(FLOTU), MMIX_THREADED_LABEL(FLOTUI),
+    MMIX_THREADED_LABEL(SFLOT), MMIX_THREADED_LABEL(SFLOTI), MMIX_THREADED_LABEL(SFLOTU),
+    MMIX_THREADED_LABEL(SFLOTUI), MMIX_THREADED_LABEL(FMUL), MMIX_THREADED_LABEL(FCMPE),
+    MMIX_THREADED_LABEL(FUNE), MMIX_THREADED_LABEL(FEQLE), MMIX_THREADED_LABEL(FDIV),
+    MMIX_THREADED_LABEL(FSQRT), MMIX_THREADED_LABEL(FREM), MMIX_THREADED_LABEL(FINT),
+    MMIX_THREADED_LABEL(MUL), MMIX_THREADED_LABEL(MULI), MMIX_THREADED_LABEL(MULU),
+    MMIX_THREADED_LABEL(MULUI), MMIX_THREADED_LABEL(DIV), MMIX_THREADED_LABEL(DIVI),
+    MMIX_THREADED_LABEL(DIVU), MMIX_THREADED_LABEL(DIVUI), MMIX_THREADED_LABEL(ADD),
+    MMIX_THREADED_LABEL(ADDI), MMIX_THREADED_LABEL(ADDU), MMIX_THREADED_LABEL(ADDUI),
+    MMIX_THREADED_LABEL(SUB), MMIX_THREADED_LABEL(SUBI), MMIX_THREADED_LABEL(SUBU),
+    MMIX_THREADED_LABEL(SUBUI), MMIX_THREADED_LABEL(IIADDU), MMIX_THREADED_LABEL(IIADDUI),
+    MMIX_THREADED_LABEL(IVADDU), MMIX_THREADED_LABEL(IVADDUI), MMIX_THREADED_LABEL(VIIIADDU),
+    MMIX_THREADED_LABEL(VIIIADDUI), MMIX_THREADED_LABEL(XVIADDU), MMIX_THREADED_LABEL(XVIADDUI),
+    MMIX_THREADED_LABEL(CMP), MMIX_THREADED_LABEL(CMPI), MMIX_THREADED_LABEL(CMPU),
+    MMIX_THREADED_LABEL(CMPUI), MMIX_THREADED_LABEL(NEG), MMIX_THREADED_LABEL(NEGI),
+    MMIX_THREADED_LABEL(NEGU), MMIX_THREADED_LABEL(NEGUI), MMIX_THREADED_LABEL(SL),
+    MMIX_THREADED_LABEL(SLI), MMIX_THREADED_LABEL(SLU), MMIX_THREADED_LABEL(SLUI),
+    MMIX_THREADED_LABEL(SR), MMIX_THREADED_LABEL(SRI), MMIX_THREADED_LABEL(SRU),
+    MMIX_THREADED_LABEL(SRUI), MMIX_THREADED_LABEL(BN), MMIX_THREADED_LABEL(BNB),
+    MMIX_THREADED_LABEL(BZ), MMIX_THREADED_LABEL(BZB), MMIX_THREADED_LABEL(BP),
+    MMIX_THREADED_LABEL(BPB), MMIX_THREADED_LABEL(BOD), MMIX_THREADED_LABEL(BODB),
+    MMIX_THREADED_LABEL(BNN), MMIX_THREADED_LABEL(BNNB), MMIX_THREADED_LABEL(BNZ),
+    MMIX_THREADED_LABEL(BNZB), MMIX_THREADED_LABEL(BNP), MMIX_THREADED_LABEL(BNPB),
+    MMIX_THREADED_LABEL(BEV), MMIX_THREADED_LABEL(BEVB), MMIX_THREADED_LABEL(PBN),
+    MMIX_THREADED_LABEL(PBNB), MMIX_THREADED_LABEL(PBZ), MMIX_THREADED_LABEL(PBZB),
+    MMIX_THREADED_LABEL(PBP), MMIX_THREADED_LABEL(PBPB), MMIX_THREADED_LABEL(PBOD),
+    MMIX_THREADED_LABEL(PBODB), MMIX_THREADED_LABEL(PBNN), MMIX_THREADED_LABEL(PBNNB),
+    MMIX_THREADED_LABEL(PBNZ), MMIX_THREADED_LABEL(PBNZB), MMIX_THREADED_LABEL(PBNP),
+    MMIX_THREADED_LABEL(PBNPB), MMIX_THREADED_LABEL(PBEV), MMIX_THREADED_LABEL(PBEVB),
+    MMIX_THREADED_LABEL(CSN), MMIX_THREADED_LABEL(CSNI), MMIX_THREADED_LABEL(CSZ),
+    MMIX_THREADED_LABEL(CSZI), MMIX_THREADED_LABEL(CSP), MMIX_THREADED_LABEL(CSPI),
+    MMIX_THREADED_LABEL(CSOD), MMIX_THREADED_LABEL(CSODI), MMIX_THREADED_LABEL(CSNN),
+    MMIX_THREADED_LABEL(CSNNI), MMIX_THREADED_LABEL(CSNZ), MMIX_THREADED_LABEL(CSNZI),
+    MMIX_THREADED_LABEL(CSNP), MMIX_THREADED_LABEL(CSNPI), MMIX_THREADED_LABEL(CSEV),
+    MMIX_THREADED_LABEL(CSEVI), MMIX_THREADED_LABEL(ZSN), MMIX_THREADED_LABEL(ZSNI),
+    MMIX_THREADED_LABEL(ZSZ), MMIX_THREADED_LABEL(ZSZI), MMIX_THREADED_LABEL(ZSP),
+    MMIX_THREADED_LABEL(ZSPI), MMIX_THREADED_LABEL(ZSOD), MMIX_THREADED_LABEL(ZSODI),
+    MMIX_THREADED_LABEL(ZSNN), MMIX_THREADED_LABEL(ZSNNI), MMIX_THREADED_LABEL(ZSNZ),
+    MMIX_THREADED_LABEL(ZSNZI), MMIX_THREADED_LABEL(ZSNP), MMIX_THREADED_LABEL(ZSNPI),
+    MMIX_THREADED_LABEL(ZSEV), MMIX_THREADED_LABEL(ZSEVI), MMIX_THREADED_LABEL(LDB),
+    MMIX_THREADED_LABEL(LDBI), MMIX_THREADED_LABEL(LDBU), MMIX_THREADED_LABEL(LDBUI),
+    MMIX_THREADED_LABEL(LDW), MMIX_THREADED_LABEL(LDWI), MMIX_THREADED_LABEL(LDWU),
+    MMIX_THREADED_LABEL(LDWUI), MMIX_THREADED_LABEL(LDT), MMIX_THREADED_LABEL(LDTI),
+    MMIX_THREADED_LABEL(LDTU), MMIX_THREADED_LABEL(LDTUI), MMIX_THREADED_LABEL(LDO),
+    MMIX_THREADED_LABEL(LDOI), MMIX_THREADED_LABEL(LDOU), MMIX_THREADED_LABEL(LDOUI),
+    MMIX_THREADED_LABEL(LDSF), MMIX_THREADED_LABEL(LDSFI), MMIX_THREADED_LABEL(LDHT),
+    MMIX_THREADED_LABEL(LDHTI), MMIX_THREADED_LABEL(CSWAP), MMIX_THREADED_LABEL(CSWAPI),
+    MMIX_THREADED_LABEL(LDUNC), MMIX_THREADED_LABEL(LDUNCI), MMIX_THREADED_LABEL(LDVTS),
+    MMIX_THREADED_LABEL(LDVTSI), MMIX_THREADED_LABEL(PRELD), MMIX_THREADED_LABEL(PRELDI),
+    MMIX_THREADED_LABEL(PREGO), MMIX_THREADED_LABEL(PREGOI), MMIX_THREADED_LABEL(GO),
+    MMIX_THREADED_LABEL(GOI), MMIX_THREADED_LABEL(STB), MMIX_THREADED_LABEL(STBI),
+    MMIX_THREADED_LABEL(STBU), MMIX_THREADED_LABEL(STBUI), MMIX_THREADED_LABEL(STW),
+    MMIX_THREADED_LABEL(STWI), MMIX_THREADED_LABEL(STWU), MMIX_THREADED_LABEL(STWUI),
+    MMIX_THREADED_LABEL(STT), MMIX_THREADED_LABEL(STTI), MMIX_THREADED_LABEL(STTU),
+    MMIX_THREADED_LABEL(STTUI), MMIX_THREADED_LABEL(STO), MMIX_THREADED_LABEL(STOI),
+    MMIX_THREADED_LABEL(STOU), MMIX_THREADED_LABEL(STOUI), MMIX_THREADED_LABEL(STSF),
+    MMIX_THREADED_LABEL(STSFI), MMIX_THREADED_LABEL(STHT), MMIX_THREADED_LABEL(STHTI),
+    MMIX_THREADED_LABEL(STCO), MMIX_THREADED_LABEL(STCOI), MMIX_THREADED_LABEL(STUNC),
+    MMIX_THREADED_LABEL(STUNCI), MMIX_THREADED_LABEL(SYNCD), MMIX_THREADED_LABEL(SYNCDI),
+    MMIX_THREADED_LABEL(PREST), MMIX_THREADED_LABEL(PRESTI), MMIX_THREADED_LABEL(SYNCID),
+    MMIX_THREADED_LABEL(SYNCIDI), MMIX_THREADED_LABEL(PUSHGO), MMIX_THREADED_LABEL(PUSHGOI),
+    MMIX_THREADED_LABEL(OR), MMIX_THREADED_LABEL(ORI), MMIX_THREADED_LABEL(ORN),
+    MMIX_THREADED_LABEL(ORNI), MMIX_THREADED_LABEL(NOR), MMIX_THREADED_LABEL(NORI),
+    MMIX_THREADED_LABEL(XOR), MMIX_THREADED_LABEL(XORI), MMIX_THREADED_LABEL(AND),
+    MMIX_THREADED_LABEL(ANDI), MMIX_THREADED_LABEL(ANDN), MMIX_THREADED_LABEL(ANDNI),
+    MMIX_THREADED_LABEL(NAND), MMIX_THREADED_LABEL(NANDI), MMIX_THREADED_LABEL(NXOR),
+    MMIX_THREADED_LABEL(NXORI), MMIX_THREADED_LABEL(BDIF), MMIX_THREADED_LABEL(BDIFI),
+    MMIX_THREADED_LABEL(WDIF), MMIX_THREADED_LABEL(WDIFI), MMIX_THREADED_LABEL(TDIF),
+    MMIX_THREADED_LABEL(TDIFI), MMIX_THREADED_LABEL(ODIF), MMIX_THREADED_LABEL(ODIFI),
+    MMIX_THREADED_LABEL(MUX), MMIX_THREADED_LABEL(MUXI), MMIX_THREADED_LABEL(SADD),
+    MMIX_THREADED_LABEL(SADDI), MMIX_THREADED_LABEL(MOR), MMIX_THREADED_LABEL(MORI),
+    MMIX_THREADED_LABEL(MXOR), MMIX_THREADED_LABEL(MXORI), MMIX_THREADED_LABEL(SETH),
+    MMIX_THREADED_LABEL(SETMH), MMIX_THREADED_LABEL(SETML), MMIX_THREADED_LABEL(SETL),
+    MMIX_THREADED_LABEL(INCH), MMIX_THREADED_LABEL(INCMH), MMIX_THREADED_LABEL(INCML),
+    MMIX_THREADED_LABEL(INCL), MMIX_THREADED_LABEL(ORH), MMIX_THREADED_LABEL(ORMH),
+    MMIX_THREADED_LABEL(ORML), MMIX_THREADED_LABEL(ORL), MMIX_THREADED_LABEL(ANDNH),
+    MMIX_THREADED_LABEL(ANDNMH), MMIX_THREADED_LABEL(ANDNML), MMIX_THREADED_LABEL(ANDNL),
+    MMIX_THREADED_LABEL(JMP), MMIX_THREADED_LABEL(JMPB), MMIX_THREADED_LABEL(PUSHJ),
+    MMIX_THREADED_LABEL(PUSHJB), MMIX_THREADED_LABEL(GETA), MMIX_THREADED_LABEL(GETAB),
+    MMIX_THREADED_LABEL(PUT), MMIX_THREADED_LABEL(PUTI), MMIX_THREADED_LABEL(POP),
+    MMIX_THREADED_LABEL(RESUME), MMIX_THREADED_LABEL(SAVE), MMIX_THREADED_LABEL(UNSAVE),
+    MMIX_THREADED_LABEL(SYNC), MMIX_THREADED_LABEL(SWYM), MMIX_THREADED_LABEL(GET),
+    MMIX_THREADED_LABEL(TRIP)
+  };
+
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+
+  // Resuming from TRIP/TRAP
+  if(HAS_FLAG(MMIX_RESUMING, proc->state))
+  {
+    mmix_step(sys);
+    return;
+  }
+
+  mmix_block_t* block = __mmix_get_block(sys, proc, proc->instr_ptr);
+
+  if(block == NULL)
+    return;
+
+  // The step itself, and the steps left.
+  unsigned int budget = block->len;
+  unsigned int left = sys->steps < UINT_MAX - 1 ? (unsigned int) sys->steps : UINT_MAX - 1;
+  if(budget > left + 1) budget = left + 1;
+
+  // rI only increases while it is above the cost of each instruction.
+  bool fold = octa_unsigned_cmp(proc->g[rI], uint_to_octa(block->max_oops)) > 0;
+  unsigned int executed = 0, folded = 0, oops = 0, mems = 0;
+
+  int state = sys->state;
+  octa loc = block->loc;
+  mmix_decoded_instr_t* entry;
+  instr_t instr;
+  bool overflow;
+
+next:
+  entry = mmix_icache_entry(&proc->icache, loc);
+
+  if(executed == budget || entry->loc != loc || block->generation != proc->icache.generation)
+    goto done;
+
+  mmix_icache_load(entry, &instr);
+  proc->instr_ptr++;
+
+  __install_operands(sys, proc, &instr);
+  instr.w = octa_plus(instr.y, instr.z, &overflow);
+
+  // GET reads the clocks, which the folded instructions have to reach first.
+  if(instr.op == GET && folded > 0)
+  {
+    __mmix_account_folded(proc, folded, oops, mems);
+    folded = oops = mems = 0;
+  }
+
+  goto *labels[instr.op];
+
+  MMIX_THREADED_CASE(TRAP)
+  MMIX_THREADED_CASE(FCMP)
+  MMIX_THREADED_CASE(FUN)
+  MMIX_THREADED_CASE(FEQL)
+  MMIX_THREADED_CASE(FADD)
+  MMIX_THREADED_CASE(FIX)
+  MMIX_THREADED_CASE(FSUB)
+  MMIX_THREADED_CASE(FIXU)
+  MMIX_THREADED_CASE(FLOT)
+  MMIX_THREADED_CASE(FLOTI)
+  MMIX_THREADED_CASE(FLOTU)
+  MMIX_THREADED_CASE(FLOTUI)
+  MMIX_THREADED_CASE(SFLOT)
+  MMIX_THREADED_CASE(SFLOTI)
+  MMIX_THREADED_CASE(SFLOTU)
+  MMIX_THREADED_CASE(SFLOTUI)
+  MMIX_THREADED_CASE(FMUL)
+  MMIX_THREADED_CASE(FCMPE)
+  MMIX_THREADED_CASE(FUNE)
+  MMIX_THREADED_CASE(FEQLE)
+  MMIX_THREADED_CASE(FDIV)
+  MMIX_THREADED_CASE(FSQRT)
+  MMIX_THREADED_CASE(FREM)
+  MMIX_THREADED_CASE(FINT)
+  MMIX_THREADED_CASE(MUL)
+  MMIX_THREADED_CASE(MULI)
+  MMIX_THREADED_CASE(MULU)
+  MMIX_THREADED_CASE(MULUI)
+  MMIX_THREADED_CASE(DIV)
+  MMIX_THREADED_CASE(DIVI)
+  MMIX_THREADED_CASE(DIVU)
+  MMIX_THREADED_CASE(DIVUI)
+  MMIX_THREADED_CASE(ADD)
+  MMIX_THREADED_CASE(ADDI)
+  MMIX_THREADED_CASE(ADDU)
+  MMIX_THREADED_CASE(ADDUI)
+  MMIX_THREADED_CASE(SUB)
+  MMIX_THREADED_CASE(SUBI)
+  MMIX_THREADED_CASE(SUBU)
+  MMIX_THREADED_CASE(SUBUI)
+  MMIX_THREADED_CASE(IIADDU)
+  MMIX_THREADED_CASE(IIADDUI)
+  MMIX_THREADED_CASE(IVADDU)
+  MMIX_THREADED_CASE(IVADDUI)
+  MMIX_THREADED_CASE(VIIIADDU)
+  MMIX_THREADED_CASE(VIIIADDUI)
+  MMIX_THREADED_CASE(XVIADDU)
+  MMIX_THREADED_CASE(XVIADDUI)
+  MMIX_THREADED_CASE(CMP)
+  MMIX_THREADED_CASE(CMPI)
+  MMIX_THREADED_CASE(CMPU)
+  MMIX_THREADED_CASE(CMPUI)
+  MMIX_THREADED_CASE(NEG)
+  MMIX_THREADED_CASE(NEGI)
+  MMIX_THREADED_CASE(NEGU)
+  MMIX_THREADED_CASE(NEGUI)
+  MMIX_THREADED_CASE(SL)
+  MMIX_THREADED_CASE(SLI)
+  MMIX_THREADED_CASE(SLU)
+  MMIX_THREADED_CASE(SLUI)
+  MMIX_THREADED_CASE(SR)
+  MMIX_THREADED_CASE(SRI)
+  MMIX_THREADED_CASE(SRU)
+  MMIX_THREADED_CASE(SRUI)
+  MMIX_THREADED_CASE(BN)
+  MMIX_THREADED_CASE(BNB)
+  MMIX_THREADED_CASE(BZ)
+  MMIX_THREADED_CASE(BZB)
+  MMIX_THREADED_CASE(BP)
+  MMIX_THREADED_CASE(BPB)
+  MMIX_THREADED_CASE(BOD)
+  MMIX_THREADED_CASE(BODB)
+  MMIX_THREADED_CASE(BNN)
+  MMIX_THREADED_CASE(BNNB)
+  MMIX_THREADED_CASE(BNZ)
+  MMIX_THREADED_CASE(BNZB)
+  MMIX_THREADED_CASE(BNP)
+  MMIX_THREADED_CASE(BNPB)
+  MMIX_THREADED_CASE(BEV)
+  MMIX_THREADED_CASE(BEVB)
+  MMIX_THREADED_CASE(PBN)
+  MMIX_THREADED_CASE(PBNB)
+  MMIX_THREADED_CASE(PBZ)
+  MMIX_THREADED_CASE(PBZB)
+  MMIX_THREADED_CASE(PBP)
+  MMIX_THREADED_CASE(PBPB)
+  MMIX_THREADED_CASE(PBOD)
+  MMIX_THREADED_CASE(PBODB)
+  MMIX_THREADED_CASE(PBNN)
+  MMIX_THREADED_CASE(PBNNB)
+  MMIX_THREADED_CASE(PBNZ)
+  MMIX_THREADED_CASE(PBNZB)
+  MMIX_THREADED_CASE(PBNP)
+  MMIX_THREADED_CASE(PBNPB)
+  MMIX_THREADED_CASE(PBEV)
+  MMIX_THREADED_CASE(PBEVB)
+  MMIX_THREADED_CASE(CSN)
+  MMIX_THREADED_CASE(CSNI)
+  MMIX_THREADED_CASE(CSZ)
+  MMIX_THREADED_CASE(CSZI)
+  MMIX_THREADED_CASE(CSP)
+  MMIX_THREADED_CASE(CSPI)
+  MMIX_THREADED_CASE(CSOD)
+  MMIX_THREADED_CASE(CSODI)
+  MMIX_THREADED_CASE(CSNN)
+  MMIX_THREADED_CASE(CSNNI)
+  MMIX_THREADED_CASE(CSNZ)
+  MMIX_THREADED_CASE(CSNZI)
+  MMIX_THREADED_CASE(CSNP)
+  MMIX_THREADED_CASE(CSNPI)
+  MMIX_THREADED_CASE(CSEV)
+  MMIX_THREADED_CASE(CSEVI)
+  MMIX_THREADED_CASE(ZSN)
+  MMIX_THREADED_CASE(ZSNI)
+  MMIX_THREADED_CASE(ZSZ)
+  MMIX_THREADED_CASE(ZSZI)
+  MMIX_THREADED_CASE(ZSP)
+  MMIX_THREADED_CASE(ZSPI)
+  MMIX_THREADED_CASE(ZSOD)
+  MMIX_THREADED_CASE(ZSODI)
+  MMIX_THREADED_CASE(ZSNN)
+  MMIX_THREADED_CASE(ZSNNI)
+  MMIX_THREADED_CASE(ZSNZ)
+  MMIX_THREADED_CASE(ZSNZI)
+  MMIX_THREADED_CASE(ZSNP)
+  MMIX_THREADED_CASE(ZSNPI)
+  MMIX_THREADED_CASE(ZSEV)
+  MMIX_THREADED_CASE(ZSEVI)
+  MMIX_THREADED_CASE(LDB)
+  MMIX_THREADED_CASE(LDBI)
+  MMIX_THREADED_CASE(LDBU)
+  MMIX_THREADED_CASE(LDBUI)
+  MMIX_THREADED_CASE(LDW)
+  MMIX_THREADED_CASE(LDWI)
+  MMIX_THREADED_CASE(LDWU)
+  MMIX_THREADED_CASE(LDWUI)
+  MMIX_THREADED_CASE(LDT)
+  MMIX_THREADED_CASE(LDTI)
+  MMIX_THREADED_CASE(LDTU)
+  MMIX_THREADED_CASE(LDTUI)
+  MMIX_THREADED_CASE(LDO)
+  MMIX_THREADED_CASE(LDOI)
+  MMIX_THREADED_CASE(LDOU)
+  MMIX_THREADED_CASE(LDOUI)
+  MMIX_THREADED_CASE(LDSF)
+  MMIX_THREADED_CASE(LDSFI)
+  MMIX_THREADED_CASE(LDHT)
+  MMIX_THREADED_CASE(LDHTI)
+  MMIX_THREADED_CASE(CSWAP)
+  MMIX_THREADED_CASE(CSWAPI)
+  MMIX_THREADED_CASE(LDUNC)
+  MMIX_THREADED_CASE(LDUNCI)
+  MMIX_THREADED_CASE(LDVTS)
+  MMIX_THREADED_CASE(LDVTSI)
+  MMIX_THREADED_CASE(PRELD)
+  MMIX_THREADED_CASE(PRELDI)
+  MMIX_THREADED_CASE(PREGO)
+  MMIX_THREADED_CASE(PREGOI)
+  MMIX_THREADED_CASE(GO)
+  MMIX_THREADED_CASE(GOI)
+  MMIX_THREADED_CASE(STB)
+  MMIX_THREADED_CASE(STBI)
+  MMIX_THREADED_CASE(STBU)
+  MMIX_THREADED_CASE(STBUI)
+  MMIX_THREADED_CASE(STW)
+  MMIX_THREADED_CASE(STWI)
+  MMIX_THREADED_CASE(STWU)
+  MMIX_THREADED_CASE(STWUI)
+  MMIX_THREADED_CASE(STT)
+  MMIX_THREADED_CASE(STTI)
+  MMIX_THREADED_CASE(STTU)
+  MMIX_THREADED_CASE(STTUI)
+  MMIX_THREADED_CASE(STO)
+  MMIX_THREADED_CASE(STOI)
+  MMIX_THREADED_CASE(STOU)
+  MMIX_THREADED_CASE(STOUI)
+  MMIX_THREADED_CASE(STSF)
+  MMIX_THREADED_CASE(STSFI)
+  MMIX_THREADED_CASE(STHT)
+  MMIX_THREADED_CASE(STHTI)
+  MMIX_THREADED_CASE(STCO)
+  MMIX_THREADED_CASE(STCOI)
+  MMIX_THREADED_CASE(STUNC)
+  MMIX_THREADED_CASE(STUNCI)
+  MMIX_THREADED_CASE(SYNCD)
+  MMIX_THREADED_CASE(SYNCDI)
+  MMIX_THREADED_CASE(PREST)
+  MMIX_THREADED_CASE(PRESTI)
+  MMIX_THREADED_CASE(SYNCID)
+  MMIX_THREADED_CASE(SYNCIDI)
+  MMIX_THREADED_CASE(PUSHGO)
+  MMIX_THREADED_CASE(PUSHGOI)
+  MMIX_THREADED_CASE(OR)
+  MMIX_THREADED_CASE(ORI)
+  MMIX_THREADED_CASE(ORN)
+  MMIX_THREADED_CASE(ORNI)
+  MMIX_THREADED_CASE(NOR)
+  MMIX_THREADED_CASE(NORI)
+  MMIX_THREADED_CASE(XOR)
+  MMIX_THREADED_CASE(XORI)
+  MMIX_THREADED_CASE(AND)
+  MMIX_THREADED_CASE(ANDI)
+  MMIX_THREADED_CASE(ANDN)
+  MMIX_THREADED_CASE(ANDNI)
+  MMIX_THREADED_CASE(NAND)
+  MMIX_THREADED_CASE(NANDI)
+  MMIX_THREADED_CASE(NXOR)
+  MMIX_THREADED_CASE(NXORI)
+  MMIX_THREADED_CASE(BDIF)
+  MMIX_THREADED_CASE(BDIFI)
+  MMIX_THREADED_CASE(WDIF)
+  MMIX_THREADED_CASE(WDIFI)
+  MMIX_THREADED_CASE(TDIF)
+  MMIX_THREADED_CASE(TDIFI)
+  MMIX_THREADED_CASE(ODIF)
+  MMIX_THREADED_CASE(ODIFI)
+  MMIX_THREADED_CASE(MUX)
+  MMIX_THREADED_CASE(MUXI)
+  MMIX_THREADED_CASE(SADD)
+  MMIX_THREADED_CASE(SADDI)
+  MMIX_THREADED_CASE(MOR)
+  MMIX_THREADED_CASE(MORI)
+  MMIX_THREADED_CASE(MXOR)
+  MMIX_THREADED_CASE(MXORI)
+  MMIX_THREADED_CASE(SETH)
+  MMIX_THREADED_CASE(SETMH)
+  MMIX_THREADED_CASE(SETML)
+  MMIX_THREADED_CASE(SETL)
+  MMIX_THREADED_CASE(INCH)
+  MMIX_THREADED_CASE(INCMH)
+  MMIX_THREADED_CASE(INCML)
+  MMIX_THREADED_CASE(INCL)
+  MMIX_THREADED_CASE(ORH)
+  MMIX_THREADED_CASE(ORMH)
+  MMIX_THREADED_CASE(ORML)
+  MMIX_THREADED_CASE(ORL)
+  MMIX_THREADED_CASE(ANDNH)
+  MMIX_THREADED_CASE(ANDNMH)
+  MMIX_THREADED_CASE(ANDNML)
+  MMIX_THREADED_CASE(ANDNL)
+  MMIX_THREADED_CASE(JMP)
+  MMIX_THREADED_CASE(JMPB)
+  MMIX_THREADED_CASE(PUSHJ)
+  MMIX_THREADED_CASE(PUSHJB)
+  MMIX_THREADED_CASE(GETA)
+  MMIX_THREADED_CASE(GETAB)
+  MMIX_THREADED_CASE(PUT)
+  MMIX_THREADED_CASE(PUTI)
+  MMIX_THREADED_CASE(POP)
+  MMIX_THREADED_CASE(RESUME)
+  MMIX_THREADED_CASE(SAVE)
+  MMIX_THREADED_CASE(UNSAVE)
+  MMIX_THREADED_CASE(SYNC)
+  MMIX_THREADED_CASE(SWYM)
+  MMIX_THREADED_CASE(GET)
+  MMIX_THREADED_CASE(TRIP)
+
+retire:
+  proc->g[rA] = instr.exc;
+  executed++;
+
+  if(fold && !__mmix_ends_block(instr.op))
+  {
+    folded++;
+    oops += instr.info->oops;
+    mems += instr.info->mems;
+  }
+  else
+  {
+    __mmix_account_instr(sys, proc, &instr);
+  }
+
+  if(instr.op != RESUME && HAS_FLAG(MMIX_RESUMING, proc->state)) {
+    FLAG_OFF(MMIX_RESUMING, proc->state);
+  }
+
+  loc += sizeof(octa);
+
+  if(sys->state != state || (octa) proc->instr_ptr != loc)
+    goto done;
+
+  goto next;
+
+done:
+  if(folded > 0)
+    __mmix_account_folded(proc, folded, oops, mems);
+
+  if(executed > 1)
+    sys_advance(sys, executed - 1);
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef __PLATFORM_H__
+#define __PLATFORM_H__
+
+#include "../lib/common/include/allocator.h"
+#include "../lib/common/include/types.h"
+
+#include "./system.h"
+
+/**
+ * Platform, a system made of several components (a core, a bus, a memory controller, devices...).
+ *
+ * Each component is a complete system, with its own clock domain: its frequency.
+ * The platform has a clock of its own, the timebase of the scheduler: a component of
+ * frequency f ticks f times per second of platform time, on the platform cycles
+ * floor(k * F / f), F being the frequency of the platform. The ticks fall on exact
+ * phases when F is a multiple of every frequency (the fastest one, most of the time).
+ *
+ * Stepping the platform ticks the components due on the current cycle, then the platform
+ * sleeps until the next tick (see sys_sleep): a 100 MHz bus next to a 2 GHz core is only
+ * stepped 100M times per second, and a platform of slow devices skips the idle cycles
+ * at once. Components due on the same cycle are stepped in the order they were attached.
+ *
+ * The platform owns its components, and halts once none is running.
+ */
+#define PLATFORM_MAX_COMPONENTS 32
+
+typedef struct {
+  system_t* sys;
+
+  // Platform cycle of the next tick
+  octa next;
+
+  // Platform cycles between two ticks: period + rem / frequency
+  octa period;
+  octa rem;
+  octa acc;
+} platform_domain_t;
+
+typedef struct {
+  platform_domain_t domains[PLATFORM_MAX_COMPONENTS];
+  unsigned int count;
+  allocator_t allocator;
+} platform_t;
+
+/**
+ * \brief Create a platform, clocked at frequency (cycles per second).
+ */
+system_t* platform_new(allocator_t* allocator, octa frequency);
+
+/**
+ * \brief Attach a component, clocked at its own frequency (the one of the platform if none is set).
+ *
+ * The platform takes the ownership of the component, which must be allocated with the allocator of the platform.
+ *
+ * \return false if the platform is full.
+ */
+bool platform_attach(system_t* sys, system_t* component);
+
+/**
+ * \brief Get the component of index i, in the order of attachment.
+ */
+system_t* platform_component(system_t* sys, unsigned int i);
+
+void platform_step(system_t* sys);
+void platform_destroy(system_t* sys);
+
+static void __platform_tick(platform_domain_t* domain);
+
+//////////
+// IMPL //
+//////////
+
+platform_t* __get_platform(system_t* sys)
+{
+  return (platform_t*) (sys + 1);
+}
+
+system_t* platform_new(allocator_t* allocator, octa frequency)
+{
+  if(frequency == 0)
+    return NULL;
+
+  system_t* sys = (system_t*) pmalloc(allocator, sizeof(system_t) + sizeof(platform_t));
+
+  if(!sys) return NULL;
+
+  __sys_init(sys, allocator);
+
+  platform_t* platform = __get_platform(sys);
+
+  platform->count = 0;
+  platform->allocator = allocator_copy(allocator);
+
+  sys->frequency = frequency;
+  sys->vtable.step = platform_step;
+  sys->vtable.destroy = platform_destroy;
+
+  return sys;
+}
+
+bool platform_attach(system_t* sys, system_t* component)
+{
+  platform_t* platform = __get_platform(sys);
+
+  if(platform->count >= PLATFORM_MAX_COMPONENTS)
+    return false;
+
+  if(component->frequency == 0)
+    component->frequency = sys->frequency;
+
+  platform_domain_t* domain = &platform->domains[platform->count++];
+
+  domain->sys = component;
+  domain->period = sys->frequency / component->frequency;
+  domain->rem = sys->frequency % component->frequency;
+  domain->acc = 0;
+
+  // First tick on the current cycle
+  domain->next = sys->cycle;
+
+  // Driven by the platform
+  component->state = SYS_RUNNING;
+
+  // Wake the platform up for the tick
+  sys_wake(sys);
+
+  return true;
+}
+
+system_t* platform_component(system_t* sys, unsigned int i)
+{
+  platform_t* platform = __get_platform(sys);
+  return i < platform->count ? platform->domains[i].sys : NULL;
+}
+
+void platform_destroy(system_t* sys)
+{
+  platform_t* platform = __get_platform(sys);
+
+  for(unsigned int i = 0; i < platform->count; i++)
+    sys_delete(platform->domains[i].sys, &platform->allocator);
+
+  platform->count = 0;
+}
+
+// Schedule the next tick of the domain, floor(k * F / f) without the product.
+static void __platform_tick(platform_domain_t* domain)
+{
+  domain->next += domain->period;
+  domain->acc += domain->rem;
+
+  if(domain->acc >= domain->sys->frequency)
+  {
+    domain->acc -= domain->sys->frequency;
+    domain->next++;
+  }
+}
+
+void platform_step(system_t* sys)
+{
+  platform_t* platform = __get_platform(sys);
+
+  // sys_step accounted the cycle already.
+  octa cycle = sys->cycle - 1;
+  octa next = 0;
+  bool running = false;
+
+  for(unsigned int i = 0; i < platform->count; i++)
+  {
+    platform_domain_t* domain = &platform->domains[i];
+    system_t* component = domain->sys;
+
+    // Faster than the platform, several ticks per cycle.
+    while(component->state == SYS_RUNNING && domain->next <= cycle)
+    {
+      sys_step(component);
+      __platform_tick(domain);
+    }
+
+    if(component->state != SYS_RUNNING)
+      continue;
+
+    if(!running || domain->next < next)
+      next = domain->next;
+
+    running = true;
+  }
+
+  if(!running)
+  {
+    sys_halt(sys);
+    return;
+  }
+
+  // Idle until the next tick
+  octa idle = next - cycle - 1;
+  sys_sleep(sys, idle < SYS_SLEEP_FOREVER ? (unsigned int) idle : SYS_SLEEP_FOREVER - 1);
+}
+
+#endif
@@ -4,20 +4,63 @@
 #include "../../lib/common/include/types.h"
 #include "../../lib/common/include/transaction.h"
 
+#include <assert.h>
 #include <limits.h>
+#include <string.h>
+
+/**
+ * Set-associative, line-based data cache.
+ *
+ * An address is split into [ tag | set index | line offset ].
+ * A lookup only walks the ways of a single set, each line keeps a per-byte
+ * valid/dirty mask (hence line_size <= 64), and the victim of a set is
+ * picked by LRU among its clean, non-pending lines. A set without one sends
+ * its least recently used dirty line back to the memory, and the access retries.
+ *
+ * The cache is non-blocking: each missing line holds a miss status holding
+ * register (MSHR) until it is filled, and a step requests every line in
+ * flight, so up to DATA_CACHE_MSHRS fills overlap. The accesses to other
+ * lines keep hitting meanwhile, a miss to a line in flight is merged with
+ * it, and a miss with every MSHR busy is not requested (the access retries).
+ * A core with nothing to do but wait on the fills can skip the steps until the
+ * earliest request at once (data_cache_idle_steps, data_cache_skip).
+ *
+ * A write-through cache (cfg.write_through) sends each line it stores to on the
+ * next step, from its write buffer: a store to another line with the buffer full
+ * retries, as a miss with every MSHR busy.
+ */
+
+#define DATA_CACHE_MAX_LINE_SIZE 64
+#define DATA_CACHE_MSHRS 8
+#define DATA_CACHE_WRITE_BUFFER 8
 
 typedef enum data_cache_event_t {
     DATA_CACHE_EVENT_FETCH,
     DATA_CACHE_EVENT_SEND
 } data_cache_event_t;
 
-typedef struct data_cache_entry_t {
-    bool invalid;
-    bool dirty;
-    octa addr;
-    byte data;
+typedef struct data_cache_cfg_t {
+    unsigned int line_size; // Bytes per line, power of two in [8, 64]
+    unsigned int sets;      // Number of sets, power of two
+    unsigned int ways;      // Lines per set
+    unsigned int fill_latency; // Steps from a miss to the request of its line (0 or 1: the next step)
+    bool write_through;        // Send the stored lines on the next step
+} data_cache_cfg_t;
+
+typedef struct data_cache_line_t {
+    octa tag;       // Line address (addr >> line_shift)
+    octa valid;     // Per-byte valid mask
+    octa dirty;     // Per-byte dirty mask
+    bool present;   // The line is allocated to the tag
+    bool pending;   // A fetch has been requested for the line
     unsigned int lru_counter;
-} data_cache_entry_t;
+} data_cache_line_t;
+
+typedef struct data_cache_mshr_t {
+    octa tag;           // Line address
+    unsigned int clock; // Step of the miss
+    bool busy;
+} data_cache_mshr_t;
 
 typedef struct data_cache_event_payload_t {
     union {
@@ -26,17 +69,40 @@ typedef struct data_cache_event_payload_t {
         } fetch;
 
         struct {
-            octa addr, data;
+            octa addr;        // Line address
+            const byte* data; // Bytes of the line
+            octa dirty;       // Bytes to write back, see data_cache_clean
         } send;
     };
 } data_cache_event_payload_t;
 
 struct data_cache_t;
+
+// Write back the dirty bytes (per the mask) of a line of len bytes at addr, false if it failed.
+typedef bool (*data_cache_writeback_t)(void* self, octa addr, const byte* data, octa dirty, size_t len);
 typedef void (*data_cache_event_handler_t)(void* self, struct data_cache_t* data_cache, transaction_t* transaction, data_cache_event_payload_t payload);
 
 typedef struct data_cache_t {
-    size_t length;
-    data_cache_entry_t* base;
+    data_cache_cfg_t cfg;
+
+    unsigned int line_shift;
+    octa set_mask;
+    octa full_mask;
+
+    data_cache_line_t* lines; // sets * ways lines
+    byte* data;               // sets * ways * line_size bytes
+
+    // LRU clock, advanced once per step
+    unsigned int clock;
+
+    // Misses in flight, written outside of the transaction so that the misses of a step see each other
+    data_cache_mshr_t mshrs[DATA_CACHE_MSHRS];
+    // Write-back scan position
+    size_t cursor;
+
+    // Lines stored to in this step (write-through), written outside of the transaction as the MSHRs
+    size_t writes[DATA_CACHE_WRITE_BUFFER];
+    unsigned int write_count;
 
     struct {
         void* self;
@@ -46,7 +112,28 @@ typedef struct data_cache_t {
 
 static unsigned int EVENT_HANDLERS_COUNT = 2;
 
-void data_cache_create(data_cache_t* data_cache, data_cache_entry_t *base, size_t length);
+void data_cache_cfg_init(data_cache_cfg_t* cfg);
+size_t data_cache_lines_count(const data_cache_cfg_t* cfg);
+size_t data_cache_data_size(const data_cache_cfg_t* cfg);
+
+/**
+ * \brief Create a data cache over caller-provided storage.
+ *
+ * lines must hold data_cache_lines_count(cfg) entries, data must hold data_cache_data_size(cfg) bytes and be octa-aligned.
+ * The data is not cleared: the valid mask of each line keeps its bytes from being read before a fill.
+ */
+void data_cache_create(data_cache_t* data_cache, const data_cache_cfg_t* cfg, data_cache_line_t* lines, octa* data);
+
+/**
+ * \brief True if a fill of the line holding addr is in flight.
+ */
+bool data_cache_pending(data_cache_t* data_cache, octa addr);
+
+/**
+ * \brief Number of MSHRs in use.
+ */
+unsigned int data_cache_misses(const data_cache_t* data_cache);
+
 bool data_cache_read(data_cache_t* data_cache, octa addr, byte* data, transaction_t* transaction);
 bool data_cache_read_word(data_cache_t* data_cache, octa addr, word* data, transaction_t* transaction);
 bool data_cache_read_tetra(data_cache_t* data_cache, octa addr, tetra* data, transaction_t* transaction);
@@ -56,246 +143,733 @@ bool data_cache_write_word(data_cache_t* data_cache, octa addr, word data, trans
 bool data_cache_write_tetra(data_cache_t* data_cache, octa addr, tetra data, transaction_t* transaction);
 bool data_cache_write_octa(data_cache_t* data_cache, octa addr, octa data, transaction_t* transaction);
 bool data_cache_update(data_cache_t* data_cache, octa addr, byte data, transaction_t* transaction);
+bool data_cache_update_word(data_cache_t* data_cache, octa addr, word data, transaction_t* transaction);
+bool data_cache_update_tetra(data_cache_t* data_cache, octa addr, tetra data, transaction_t* transaction);
+bool data_cache_update_octa(data_cache_t* data_cache, octa addr, octa data, transaction_t* transaction);
+
+/**
+ * \brief Fill the line at addr (line aligned) with the bytes of data given by mask, in a single step.
+ *
+ * The dirty bytes are kept, as for data_cache_update.
+ */
+bool data_cache_fill(data_cache_t* data_cache, octa addr, const byte* data, octa mask, transaction_t* transaction);
+
+/**
+ * \brief Clear the dirty bytes given by mask of the line at addr, once they are written back.
+ */
+bool data_cache_clean(data_cache_t* data_cache, octa addr, octa mask, transaction_t* transaction);
+
+/**
+ * \brief Drop the clean bytes given by mask of the line at addr, written to the memory by another cache.
+ *
+ * The dirty bytes are kept, the reads of the dropped ones miss and fetch them again.
+ */
+bool data_cache_invalidate(data_cache_t* data_cache, octa addr, octa mask, transaction_t* transaction);
+void data_cache_step(data_cache_t* data_cache, transaction_t* transaction);
+
+/**
+ * \brief Steps after the current one before a busy MSHR requests its line, 0 if none is busy.
+ */
+unsigned int data_cache_idle_steps(const data_cache_t* data_cache);
+
+/**
+ * \brief Account steps idle steps after the current one, past its data_cache_step.
+ *
+ * The clock moves on, and the dirty lines the SEND cursor would pass over are sent at once.
+ */
+void data_cache_skip(data_cache_t* data_cache, unsigned int steps, transaction_t* transaction);
+
+/**
+ * \brief Hand every dirty line to writeback, then drop the lines (not transactional).
+ *
+ * A line whose write-back failed is kept, with only its dirty bytes left valid.
+ */
+void data_cache_flush(data_cache_t* data_cache, void* self, data_cache_writeback_t writeback);
+
+//////////
+// IMPL //
+//////////
+
+static inline void __data_cache_launch_event(data_cache_t* data_cache, transaction_t* transaction, unsigned int event, data_cache_event_payload_t payload);
+static void __data_cache_send(data_cache_t* data_cache, data_cache_line_t* line, transaction_t* transaction);
+
+static inline octa __data_cache_tag(data_cache_t* data_cache, octa addr)
+{
+    return addr >> data_cache->line_shift;
+}
+
+static inline unsigned int __data_cache_offset(data_cache_t* data_cache, octa addr)
+{
+    return addr & (data_cache->cfg.line_size - 1);
+}
 
-static bool __data_cache_lru(data_cache_t* data_cache, size_t* out)
+static inline data_cache_line_t* __data_cache_set(data_cache_t* data_cache, octa tag)
 {
-    data_cache_entry_t* it = data_cache->base;
-    data_cache_entry_t* limit = data_cache->base + data_cache->length - 1;    
+    return data_cache->lines + (tag & data_cache->set_mask) * data_cache->cfg.ways;
+}
+
+static inline byte* __data_cache_line_data(data_cache_t* data_cache, data_cache_line_t* line)
+{
+    return data_cache->data + (size_t)(line - data_cache->lines) * data_cache->cfg.line_size;
+}
+
+static inline octa __data_cache_mask(data_cache_t* data_cache, unsigned int offset, size_t len)
+{
+    octa mask = len >= 64 ? data_cache->full_mask : (((octa) 1 << len) - 1);
+    return mask << offset;
+}
+
+static bool __data_cache_lookup(data_cache_t* data_cache, octa tag, data_cache_line_t** out)
+{
+    data_cache_line_t* it = __data_cache_set(data_cache, tag);
+    data_cache_line_t* limit = it + data_cache->cfg.ways;
 
-    unsigned int lru_cache = UINT_MAX;
-    data_cache_entry_t* candidate = 0;
-    size_t idx = 0;
-    
-    for(unsigned int i = 0; it != limit; it++, i++) 
+    for(; it != limit; it++)
     {
-        if(it->invalid == false && it->dirty == false && it->lru_counter < lru_cache) 
+        if(it->present && it->tag == tag)
         {
-            candidate = it;
-            idx = i;
-            lru_cache = it->lru_counter;
+            *out = it;
+            return true;
         }
     }
 
-    if(candidate == 0) return false;
-    
-    *out = idx;
-    return true;
+    return false;
 }
-static bool __data_cache_access(data_cache_t* data_cache, octa addr, data_cache_entry_t** out)
+
+// Victim of the set of tag, or false after sending the least recently used dirty line back (the access retries).
+static bool __data_cache_lru(data_cache_t* data_cache, octa tag, data_cache_line_t** out, transaction_t* transaction)
 {
-    data_cache_entry_t* it = data_cache->base;
-    data_cache_entry_t* limit = data_cache->base + data_cache->length - 1;
+    data_cache_line_t* it = __data_cache_set(data_cache, tag);
+    data_cache_line_t* limit = it + data_cache->cfg.ways;
 
-    for(;it != limit; it++) 
+    unsigned int lru_cache = UINT_MAX, lru_dirty = UINT_MAX;
+    data_cache_line_t* candidate = 0;
+    data_cache_line_t* dirty = 0;
+
+    for(; it != limit; it++)
     {
-        if(it->addr == addr && it->invalid == false) 
+        if(!it->present)
         {
             *out = it;
             return true;
         }
+
+        if(it->pending)
+            continue;
+
+        if(it->dirty == 0 && it->lru_counter <= lru_cache)
+        {
+            candidate = it;
+            lru_cache = it->lru_counter;
+        }
+
+        if(it->dirty != 0 && it->lru_counter <= lru_dirty)
+        {
+            dirty = it;
+            lru_dirty = it->lru_counter;
+        }
     }
 
-    return false;
+    if(candidate == 0)
+    {
+        if(dirty != 0)
+            __data_cache_send(data_cache, dirty, transaction);
+
+        return false;
+    }
+
+    *out = candidate;
+    return true;
 }
 
-static inline void __data_cache_launch_event(data_cache_t* data_cache, transaction_t* transaction, unsigned int event, data_cache_event_payload_t payload)
+static inline void __data_cache_touch(data_cache_t* data_cache, data_cache_line_t* line, transaction_t* transaction)
 {
-    if(event >= EVENT_HANDLERS_COUNT) return;
-    if(!data_cache->event_handlers[event].hdlr == 0) return;
+    tst_update_uint(transaction, &line->lru_counter, data_cache->clock);
+}
 
-    data_cache->event_handlers[event].hdlr(data_cache->event_handlers[event].self, data_cache, transaction, payload);
+static void __data_cache_install(data_cache_t* data_cache, data_cache_line_t* line, octa tag, bool pending, transaction_t* transaction)
+{
+    tst_update_octa(transaction, &line->tag, tag);
+    tst_update_octa(transaction, &line->valid, 0);
+    tst_update_octa(transaction, &line->dirty, 0);
+    tst_update_bool(transaction, &line->present, true);
+    tst_update_bool(transaction, &line->pending, pending);
+    __data_cache_touch(data_cache, line, transaction);
 }
 
-void data_cache_create(data_cache_t* data_cache, data_cache_entry_t *base, size_t length)
+// MSHR of the line in flight, or a free one.
+static data_cache_mshr_t* __data_cache_mshr(data_cache_t* data_cache, octa tag)
 {
-    data_cache->base = base;
-    data_cache->length = length;
-    
-    for(size_t i = 0; i < length; i++) 
+    data_cache_mshr_t* available = 0;
+
+    for(unsigned int i = 0; i < DATA_CACHE_MSHRS; i++)
     {
-        data_cache_entry_t* it = base + i;
+        data_cache_mshr_t* mshr = &data_cache->mshrs[i];
 
-        it->addr = 0;
-        it->data = 0;
-        it->dirty = 0;
-        it->invalid = 0;
-        it->lru_counter = 0;
+        if(mshr->busy && mshr->tag == tag)
+            return mshr;
+
+        if(!mshr->busy && available == 0)
+            available = mshr;
     }
 
-    for(unsigned char i = 0; i < EVENT_HANDLERS_COUNT; i++) 
+    return available;
+}
+
+// Request the missing bytes of a line, allocating it if required.
+static void __data_cache_miss(data_cache_t* data_cache, octa tag, data_cache_line_t* line, transaction_t* transaction)
+{
+    data_cache_mshr_t* mshr = __data_cache_mshr(data_cache, tag);
+
+    // Every MSHR busy, or merged with the miss in flight
+    if(mshr == 0 || mshr->busy)
+        return;
+
+    if(line != 0)
+        tst_update_bool(transaction, &line->pending, true);
+    else if(__data_cache_lru(data_cache, tag, &line, transaction))
+        __data_cache_install(data_cache, line, tag, true, transaction);
+    else
+        return;
+
+    mshr->tag = tag;
+    mshr->clock = data_cache->clock;
+    mshr->busy = true;
+}
+
+// Bytes of a hit for len bytes which do not cross a line boundary, or NULL after requesting the missing line.
+static byte* __data_cache_read_prepare(data_cache_t* data_cache, octa addr, size_t len, transaction_t* transaction)
+{
+    octa tag = __data_cache_tag(data_cache, addr);
+    unsigned int offset = __data_cache_offset(data_cache, addr);
+    octa mask = __data_cache_mask(data_cache, offset, len);
+    data_cache_line_t* line = 0;
+
+    if(!__data_cache_lookup(data_cache, tag, &line) || (line->valid & mask) != mask)
     {
-        data_cache->event_handlers[i].self = 0;
-        data_cache->event_handlers[i].hdlr = 0;
+        __data_cache_miss(data_cache, tag, line, transaction);
+        return NULL;
     }
+
+    __data_cache_touch(data_cache, line, transaction);
+    return __data_cache_line_data(data_cache, line) + offset;
 }
 
-bool data_cache_read(data_cache_t* data_cache, octa addr, byte* data, transaction_t* transaction)
-{       
-    data_cache_entry_t* entry;
-    
-    if(!__data_cache_access(data_cache, addr, &entry)) 
-    {
-        size_t idx = 0;
-        
-        if(__data_cache_lru(data_cache, &idx)) 
-        {
-            entry = &data_cache->base[idx];
-            
-            tst_update_octa(transaction, &entry->addr, addr);
-            tst_update_uchar(transaction, &entry->data, 0);
-            tst_update_bool(transaction, &entry->invalid, true);
-            tst_update_bool(transaction, &entry->dirty, false);
-            tst_update_uint(transaction, &entry->lru_counter, 0);
-        }
+// Queue the line for the write-through of the next step, false if the write buffer is full.
+static bool __data_cache_buffer(data_cache_t* data_cache, data_cache_line_t* line)
+{
+    size_t index = line - data_cache->lines;
+
+    for(unsigned int i = 0; i < data_cache->write_count; i++)
+        if(data_cache->writes[i] == index)
+            return true;
 
+    if(data_cache->write_count == DATA_CACHE_WRITE_BUFFER)
         return false;
-    }
 
-    *data = entry->data;
-    tst_update_uint(transaction, &entry->lru_counter, entry->lru_counter + 1);
+    data_cache->writes[data_cache->write_count++] = index;
     return true;
 }
-bool data_cache_read_word(data_cache_t* data_cache, octa addr, word* data, transaction_t* transaction)
+
+// Destination of len bytes which do not cross a line boundary, allocating the line on a miss.
+static byte* __data_cache_write_prepare(data_cache_t* data_cache, octa addr, size_t len, transaction_t* transaction)
 {
-    byte bytes[2];
-    if(!data_cache_read(data_cache, addr, &bytes[0], transaction) || !data_cache_read(data_cache, addr + 1, &bytes[1], transaction))
+    octa tag = __data_cache_tag(data_cache, addr);
+    unsigned int offset = __data_cache_offset(data_cache, addr);
+    octa mask = __data_cache_mask(data_cache, offset, len);
+    data_cache_line_t* line;
+    octa valid = 0, dirty = 0;
+
+    if(__data_cache_lookup(data_cache, tag, &line))
+    {
+        valid = line->valid, dirty = line->dirty;
+    }
+    else
+    {
+        if(data_cache->cfg.write_through && data_cache->write_count == DATA_CACHE_WRITE_BUFFER)
+            return NULL;
+
+        if(!__data_cache_lru(data_cache, tag, &line, transaction))
+            return NULL;
+
+        __data_cache_install(data_cache, line, tag, false, transaction);
+    }
+
+    if(data_cache->cfg.write_through && !__data_cache_buffer(data_cache, line))
+        return NULL;
+
+    tst_update_octa(transaction, &line->valid, valid | mask);
+    tst_update_octa(transaction, &line->dirty, dirty | mask);
+    __data_cache_touch(data_cache, line, transaction);
+
+    return __data_cache_line_data(data_cache, line) + offset;
+}
+
+static bool __data_cache_read_line(data_cache_t* data_cache, octa addr, byte* data, size_t len, transaction_t* transaction)
+{
+    byte* src = __data_cache_read_prepare(data_cache, addr, len, transaction);
+
+    if(src == NULL)
         return false;
-    
-    *data = byte_to_word(bytes[1], bytes[0]);
+
+    memcpy(data, src, len);
     return true;
 }
-bool data_cache_read_tetra(data_cache_t* data_cache, octa addr, tetra* data, transaction_t* transaction)
+
+static bool __data_cache_write_line(data_cache_t* data_cache, octa addr, const byte* data, size_t len, transaction_t* transaction)
 {
-    word words[2];
-    if(!data_cache_read_word(data_cache, addr, &words[0], transaction) || !data_cache_read_word(data_cache, addr + 2, &words[1], transaction))
+    byte* dest = __data_cache_write_prepare(data_cache, addr, len, transaction);
+
+    if(dest == NULL)
         return false;
-    
-    *data = word_to_tetra(words[1], words[0]);
+
+    for(size_t i = 0; i < len; i++)
+        tst_update_byte(transaction, dest + i, data[i]);
+
     return true;
 }
-bool data_cache_read_octa(data_cache_t* data_cache, octa addr, octa* data, transaction_t* transaction)
+
+static bool __data_cache_read_span(data_cache_t* data_cache, octa addr, byte* data, size_t len, transaction_t* transaction)
 {
-    tetra tetras[2];
-    if(!data_cache_read_tetra(data_cache, addr, &tetras[0], transaction) || !data_cache_read_tetra(data_cache, addr + 4, &tetras[1], transaction))
-        return false;
-    
-    *data = tetra_to_octa(tetras[1], tetras[0]);
+    bool hit = true;
+
+    while(len)
+    {
+        size_t n = MIN(len, data_cache->cfg.line_size - __data_cache_offset(data_cache, addr));
+
+        // Keep going on a miss so that every missing line gets requested.
+        if(!__data_cache_read_line(data_cache, addr, data, n, transaction))
+            hit = false;
+
+        addr += n, data += n, len -= n;
+    }
+
+    return hit;
+}
+
+static bool __data_cache_write_span(data_cache_t* data_cache, octa addr, const byte* data, size_t len, transaction_t* transaction)
+{
+    while(len)
+    {
+        size_t n = MIN(len, data_cache->cfg.line_size - __data_cache_offset(data_cache, addr));
+
+        if(!__data_cache_write_line(data_cache, addr, data, n, transaction))
+            return false;
+
+        addr += n, data += n, len -= n;
+    }
+
     return true;
 }
 
-bool data_cache_write(data_cache_t* data_cache, octa addr, byte data, transaction_t* transaction)
+static inline void __data_cache_launch_event(data_cache_t* data_cache, transaction_t* transaction, unsigned int event, data_cache_event_payload_t payload)
+{
+    if(event >= EVENT_HANDLERS_COUNT) return;
+    if(data_cache->event_handlers[event].hdlr == 0) return;
+
+    data_cache->event_handlers[event].hdlr(data_cache->event_handlers[event].self, data_cache, transaction, payload);
+}
+
+// SEND the dirty bytes of a line to the memory, which cleans them (see data_cache_clean).
+static void __data_cache_send(data_cache_t* data_cache, data_cache_line_t* line, transaction_t* transaction)
+{
+    data_cache_event_payload_t payload;
+
+    payload.send.addr = line->tag << data_cache->line_shift;
+    payload.send.data = __data_cache_line_data(data_cache, line);
+    payload.send.dirty = line->dirty;
+    __data_cache_launch_event(data_cache, transaction, DATA_CACHE_EVENT_SEND, payload);
+}
+
+void data_cache_cfg_init(data_cache_cfg_t* cfg)
 {
-    data_cache_entry_t* entry;
-    
-    if(!__data_cache_access(data_cache, addr, &entry)) 
+    cfg->line_size = 64;
+    cfg->sets = 64;
+    cfg->ways = 8;
+    cfg->fill_latency = 1;
+    cfg->write_through = false;
+}
+
+size_t data_cache_lines_count(const data_cache_cfg_t* cfg)
+{
+    return (size_t) cfg->sets * cfg->ways;
+}
+
+size_t data_cache_data_size(const data_cache_cfg_t* cfg)
+{
+    return data_cache_lines_count(cfg) * cfg->line_size;
+}
+
+void data_cache_create(data_cache_t* data_cache, const data_cache_cfg_t* cfg, data_cache_line_t* lines, octa* data)
+{
+    assert(cfg->line_size >= sizeof(octa) && cfg->line_size <= DATA_CACHE_MAX_LINE_SIZE);
+    assert((cfg->line_size & (cfg->line_size - 1)) == 0);
+    assert(cfg->sets > 0 && (cfg->sets & (cfg->sets - 1)) == 0);
+    assert(cfg->ways > 0);
+
+    data_cache->cfg = *cfg;
+    data_cache->lines = lines;
+    data_cache->data = (byte*) data;
+
+    data_cache->line_shift = 0;
+    while((1u << data_cache->line_shift) < cfg->line_size) data_cache->line_shift++;
+
+    data_cache->set_mask = cfg->sets - 1;
+    data_cache->full_mask = cfg->line_size >= 64 ? octa_uint_max : (((octa) 1 << cfg->line_size) - 1);
+
+    data_cache->clock = 0;
+    data_cache->cursor = 0;
+    data_cache->write_count = 0;
+
+    memset(data_cache->mshrs, 0, sizeof(data_cache->mshrs));
+
+    size_t count = data_cache_lines_count(cfg);
+
+    for(size_t i = 0; i < count; i++)
     {
-        size_t idx = 0;
-        
-        if(__data_cache_lru(data_cache, &idx)) 
-        {
-            entry = &data_cache->base[idx];
-            
-            tst_update_octa(transaction, &entry->addr, addr);
-            tst_update_uchar(transaction, &entry->data, data);
-            tst_update_bool(transaction, &entry->invalid, false);
-            tst_update_bool(transaction, &entry->dirty, true);
-            tst_update_uint(transaction, &entry->lru_counter, 0);
+        data_cache_line_t* it = lines + i;
+
+        it->tag = 0;
+        it->valid = 0;
+        it->dirty = 0;
+        it->present = false;
+        it->pending = false;
+        it->lru_counter = 0;
+    }
+
+    for(unsigned char i = 0; i < EVENT_HANDLERS_COUNT; i++)
+    {
+        data_cache->event_handlers[i].self = 0;
+        data_cache->event_handlers[i].hdlr = 0;
+    }
+}
+
+bool data_cache_pending(data_cache_t* data_cache, octa addr)
+{
+    data_cache_mshr_t* mshr = __data_cache_mshr(data_cache, __data_cache_tag(data_cache, addr));
+    return mshr != 0 && mshr->busy;
+}
+
+unsigned int data_cache_misses(const data_cache_t* data_cache)
+{
+    unsigned int count = 0;
+
+    for(unsigned int i = 0; i < DATA_CACHE_MSHRS; i++)
+        count += data_cache->mshrs[i].busy;
+
+    return count;
+}
+
+bool data_cache_read(data_cache_t* data_cache, octa addr, byte* data, transaction_t* transaction)
+{
+    return __data_cache_read_line(data_cache, addr, data, sizeof(byte), transaction);
+}
 
+bool data_cache_write(data_cache_t* data_cache, octa addr, byte data, transaction_t* transaction)
+{
+    return __data_cache_write_line(data_cache, addr, &data, sizeof(byte), transaction);
+}
+
+bool data_cache_update(data_cache_t* data_cache, octa addr, byte data, transaction_t* transaction)
+{
+    octa tag = __data_cache_tag(data_cache, addr);
+    unsigned int offset = __data_cache_offset(data_cache, addr);
+    octa mask = __data_cache_mask(data_cache, offset, 1);
+    data_cache_line_t* line;
+    octa valid = 0;
+
+    if(__data_cache_lookup(data_cache, tag, &line))
+    {
+        // The cached byte is newer than the memory one.
+        if(line->dirty & mask)
             return true;
-        }
-        
-        return false;
+
+        valid = line->valid;
+    }
+    else
+    {
+        if(!__data_cache_lru(data_cache, tag, &line, transaction))
+            return false;
+
+        __data_cache_install(data_cache, line, tag, false, transaction);
     }
 
-    tst_update_uchar(transaction, &entry->data, data);
-    tst_update_bool(transaction, &entry->dirty, true);
+    tst_update_byte(transaction, __data_cache_line_data(data_cache, line) + offset, data);
+    tst_update_octa(transaction, &line->valid, valid | mask);
 
-    return false;
+    if((valid | mask) == data_cache->full_mask)
+        tst_update_bool(transaction, &line->pending, false);
+
+    return true;
+}
+
+/**
+ * Multi-byte accesses.
+ *
+ * A naturally aligned access never crosses a line (line_size >= 8), so it costs one set lookup
+ * and, for writes, one typed log entry for the data. Misaligned accesses take the span path.
+ * Values are kept in host byte order, which is the guest's little-endian order on our hosts.
+ */
+#define decl_data_cache_access(type, typename) \
+bool data_cache_read_##typename(data_cache_t* data_cache, octa addr, type* data, transaction_t* transaction)\
+{\
+    if(addr & (sizeof(type) - 1))\
+        return __data_cache_read_span(data_cache, addr, (byte*) data, sizeof(type), transaction);\
+\
+    type* src = (type*) __data_cache_read_prepare(data_cache, addr, sizeof(type), transaction);\
+\
+    if(src == NULL)\
+        return false;\
+\
+    *data = *src;\
+    return true;\
+}\
+\
+bool data_cache_write_##typename(data_cache_t* data_cache, octa addr, type data, transaction_t* transaction)\
+{\
+    if(addr & (sizeof(type) - 1))\
+        return __data_cache_write_span(data_cache, addr, (const byte*) &data, sizeof(type), transaction);\
+\
+    type* dest = (type*) __data_cache_write_prepare(data_cache, addr, sizeof(type), transaction);\
+\
+    if(dest == NULL)\
+        return false;\
+\
+    tst_update_##typename(transaction, dest, data);\
+    return true;\
+}\
+\
+bool data_cache_update_##typename(data_cache_t* data_cache, octa addr, type data, transaction_t* transaction)\
+{\
+    octa tag = __data_cache_tag(data_cache, addr);\
+    unsigned int offset = __data_cache_offset(data_cache, addr);\
+    octa mask = __data_cache_mask(data_cache, offset, sizeof(type));\
+    data_cache_line_t* line;\
+    bool stored = true;\
+\
+    /* Misaligned, or merging with dirty bytes: byte per byte */\
+    if((addr & (sizeof(type) - 1)) || (__data_cache_lookup(data_cache, tag, &line) && (line->dirty & mask)))\
+    {\
+        for(unsigned char i = 0; i < sizeof(type); i++)\
+            stored &= data_cache_update(data_cache, addr + i, ((byte*) &data)[i], transaction);\
+\
+        return stored;\
+    }\
+\
+    octa valid = 0;\
+\
+    if(__data_cache_lookup(data_cache, tag, &line))\
+    {\
+        valid = line->valid;\
+    }\
+    else\
+    {\
+        if(!__data_cache_lru(data_cache, tag, &line, transaction))\
+            return false;\
+\
+        __data_cache_install(data_cache, line, tag, false, transaction);\
+    }\
+\
+    tst_update_##typename(transaction, (type*)(__data_cache_line_data(data_cache, line) + offset), data);\
+    tst_update_octa(transaction, &line->valid, valid | mask);\
+\
+    if((valid | mask) == data_cache->full_mask)\
+        tst_update_bool(transaction, &line->pending, false);\
+\
+    return true;\
 }
-bool data_cache_write_word(data_cache_t* data_cache, octa addr, word data, transaction_t* transaction)
+
+decl_data_cache_access(word, word)
+decl_data_cache_access(tetra, tetra)
+decl_data_cache_access(octa, octa)
+
+bool data_cache_fill(data_cache_t* data_cache, octa addr, const byte* data, octa mask, transaction_t* transaction)
 {
-    byte bytes[2];
+    octa tag = __data_cache_tag(data_cache, addr);
+    data_cache_line_t* line;
+    octa valid = 0, dirty = 0;
+
+    if(__data_cache_lookup(data_cache, tag, &line))
+    {
+        valid = line->valid, dirty = line->dirty;
+    }
+    else
+    {
+        if(!__data_cache_lru(data_cache, tag, &line, transaction))
+            return false;
 
-    bytes[0] = data & 0xFF;
-    bytes[1] = (data >> 8) & 0xFF;
+        __data_cache_install(data_cache, line, tag, false, transaction);
+    }
+
+    byte* dest = __data_cache_line_data(data_cache, line);
+    mask &= data_cache->full_mask;
+
+    // Octa per octa, byte per byte around the dirty ones
+    for(unsigned int offset = 0; offset < data_cache->cfg.line_size; offset += sizeof(octa))
+    {
+        octa octa_mask = __data_cache_mask(data_cache, offset, sizeof(octa));
+        octa fill = mask & ~dirty & octa_mask;
+
+        if(fill == octa_mask)
+        {
+            tst_update_octa(transaction, (octa*)(dest + offset), *(const octa*)(data + offset));
+            continue;
+        }
+
+        for(unsigned int i = offset; i < offset + sizeof(octa) && fill; i++)
+        {
+            if(fill & ((octa) 1 << i))
+                tst_update_byte(transaction, dest + i, data[i]);
+        }
+    }
+
+    tst_update_octa(transaction, &line->valid, valid | mask);
+
+    if((valid | mask) == data_cache->full_mask)
+        tst_update_bool(transaction, &line->pending, false);
 
-    if(!data_cache_write(data_cache, addr, bytes[0], transaction) || !data_cache_write(data_cache, addr + 1, bytes[1], transaction))
-        return false;
-    
     return true;
 }
-bool data_cache_write_tetra(data_cache_t* data_cache, octa addr, tetra data, transaction_t* transaction)
+
+bool data_cache_clean(data_cache_t* data_cache, octa addr, octa mask, transaction_t* transaction)
 {
-    word words[2];
-    
-    words[0] = data & 0xFFFF;
-    words[1] = (data >> 16) & 0xFFFF;
+    data_cache_line_t* line;
 
-    if(!data_cache_write_word(data_cache, addr, words[0], transaction) || !data_cache_write_word(data_cache, addr + 2, words[1], transaction))
+    if(!__data_cache_lookup(data_cache, __data_cache_tag(data_cache, addr), &line))
         return false;
-    
+
+    tst_update_octa(transaction, &line->dirty, line->dirty & ~mask);
     return true;
 }
-bool data_cache_write_octa(data_cache_t* data_cache, octa addr, octa data, transaction_t* transaction)
+
+bool data_cache_invalidate(data_cache_t* data_cache, octa addr, octa mask, transaction_t* transaction)
 {
-    tetra tetras[2];
-    
-    tetras[0] = data & 0xFFFFFFFF;
-    tetras[1] = (data >> 32) & 0xFFFFFFFF;
+    data_cache_line_t* line;
 
-    if(!data_cache_write_tetra(data_cache, addr, tetras[0], transaction) || !data_cache_write_tetra(data_cache, addr + 4, tetras[1], transaction))
+    if(!__data_cache_lookup(data_cache, __data_cache_tag(data_cache, addr), &line))
         return false;
-    
+
+    tst_update_octa(transaction, &line->valid, line->valid & ~(mask & ~line->dirty));
     return true;
 }
 
-bool data_cache_update(data_cache_t* data_cache, octa addr, byte data, transaction_t* transaction)
+void data_cache_step(data_cache_t* data_cache, transaction_t* transaction)
 {
-    data_cache_entry_t* entry;
-    
-    if(!__data_cache_access(data_cache, addr, &entry)) 
+    data_cache_event_payload_t payload;
+    size_t count = data_cache_lines_count(&data_cache->cfg);
+
+    tst_update_uint(transaction, &data_cache->clock, data_cache->clock + 1);
+
+    // FETCH the lines in flight from the memory, until they are filled
+    for(unsigned int i = 0; i < DATA_CACHE_MSHRS; i++)
     {
-        size_t idx = 0;
-        
-        if(__data_cache_lru(data_cache, &idx)) 
+        data_cache_mshr_t* mshr = &data_cache->mshrs[i];
+        data_cache_line_t* line;
+
+        if(!mshr->busy)
+            continue;
+
+        // Filled, or lost to another miss of the same step
+        if(!__data_cache_lookup(data_cache, mshr->tag, &line) || !line->pending)
         {
-            entry = &data_cache->base[idx];
-            
-            tst_update_octa(transaction, &entry->addr, addr);
-            tst_update_uchar(transaction, &entry->data, data);
-            tst_update_bool(transaction, &entry->invalid, false);
-            tst_update_bool(transaction, &entry->dirty, false);
-            tst_update_uint(transaction, &entry->lru_counter, 0);
+            mshr->busy = false;
+            continue;
         }
-        return false;
+
+        if(data_cache->clock - mshr->clock < data_cache->cfg.fill_latency)
+            continue;
+
+        payload.fetch.addr = mshr->tag << data_cache->line_shift;
+        __data_cache_launch_event(data_cache, transaction, DATA_CACHE_EVENT_FETCH, payload);
+    }
+
+    // SEND the lines stored to in the last step (write-through)
+    for(unsigned int i = 0; i < data_cache->write_count; i++)
+    {
+        data_cache_line_t* line = data_cache->lines + data_cache->writes[i];
+
+        if(line->present && line->dirty)
+            __data_cache_send(data_cache, line, transaction);
     }
 
-    tst_update_uchar(transaction, &entry->data, data);
-    tst_update_bool(transaction, &entry->dirty, false);
-    tst_update_bool(transaction, &entry->invalid, false);
+    data_cache->write_count = 0;
 
-    return false;
+    // SEND the dirty bytes of a line to the memory, one line per step
+    data_cache_line_t* line = data_cache->lines + data_cache->cursor;
+    data_cache->cursor = (data_cache->cursor + 1) % count;
+
+    if(line->present && line->dirty)
+        __data_cache_send(data_cache, line, transaction);
 }
 
-void data_cache_step(data_cache_t* data_cache, transaction_t* transaction)
+unsigned int data_cache_idle_steps(const data_cache_t* data_cache)
 {
-    data_cache_entry_t* it = data_cache->base;
-    data_cache_entry_t* limit = data_cache->base + data_cache->length - 1;
-    data_cache_event_payload_t payload;
+    unsigned int idle = UINT_MAX;
+
+    // Lines to send on the next step
+    if(data_cache->write_count > 0)
+        return 0;
 
-    for(;it != limit; it++) 
+    for(unsigned int i = 0; i < DATA_CACHE_MSHRS; i++)
     {
-        if(it->invalid) { // FETCH data from the memory
-            payload.fetch.addr = it->addr;
-            __data_cache_launch_event(data_cache, transaction, DATA_CACHE_EVENT_FETCH, payload);
-            return;
-        } else if(it->dirty) { // SEND data to the memory
-            payload.send.addr = it->addr;
-            payload.send.data = it->data;
-            __data_cache_launch_event(data_cache, transaction, DATA_CACHE_EVENT_SEND, payload);
-            return;
+        const data_cache_mshr_t* mshr = &data_cache->mshrs[i];
+        unsigned int elapsed = data_cache->clock - mshr->clock;
+
+        if(!mshr->busy)
+            continue;
+
+        // Requested by the next step, or already
+        if(elapsed + 1 >= data_cache->cfg.fill_latency)
+            return 0;
+
+        if(data_cache->cfg.fill_latency - elapsed - 1 < idle)
+            idle = data_cache->cfg.fill_latency - elapsed - 1;
+    }
+
+    return idle == UINT_MAX ? 0 : idle;
+}
+
+void data_cache_skip(data_cache_t* data_cache, unsigned int steps, transaction_t* transaction)
+{
+    size_t count = data_cache_lines_count(&data_cache->cfg);
+
+    // On top of the increment of the current step
+    tst_update_uint(transaction, &data_cache->clock, data_cache->clock + 1 + steps);
+
+    for(unsigned int i = 0; i < steps && i < count; i++)
+    {
+        data_cache_line_t* line = data_cache->lines + (data_cache->cursor + i) % count;
+
+        if(line->present && line->dirty)
+            __data_cache_send(data_cache, line, transaction);
+    }
+
+    data_cache->cursor = (data_cache->cursor + steps) % count;
+}
+
+void data_cache_flush(data_cache_t* data_cache, void* self, data_cache_writeback_t writeback)
+{
+    data_cache_line_t* it = data_cache->lines;
+    data_cache_line_t* limit = it + data_cache_lines_count(&data_cache->cfg);
+
+    for(; it != limit; it++)
+    {
+        if(!it->present)
+            continue;
+
+        if(it->dirty && !writeback(self, it->tag << data_cache->line_shift, __data_cache_line_data(data_cache, it), it->dirty, data_cache->cfg.line_size))
+        {
+            it->valid = it->dirty;
+            it->pending = false;
+            continue;
         }
+
+        it->present = it->pending = false;
+        it->valid = it->dirty = 0;
     }
+
+    memset(data_cache->mshrs, 0, sizeof(data_cache->mshrs));
+    data_cache->write_count = 0;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -2,5 +2,6 @@
 #define __RISCV_H__
 
 #include "./riscv/api.h"
+#include "./riscv/smp.h"
 
 #endif
\ No newline at end of file
@@ -1,13 +1,34 @@
 #ifndef __RISCV_API_H__
 #define __RISCV_API_H__
 
+#include "../snapshot.h"
 #include "./model.h"
 #include "./pipeline.h"
+#include "./ooo.h"
+#include "./functional.h"
 
 system_t* riscv_new(allocator_t* allocator, riscv_processor_cfg_t* cfg);
 void riscv_step(system_t* sys);
+void riscv_destroy(system_t* sys);
 
-static void __riscv_init(system_t* sys, riscv_processor_cfg_t* cfg);
+/**
+ * \brief Release the processor before a new init in place, keeping the L1 storage.
+ */
+void riscv_reset(system_t* sys);
+
+/**
+ * \brief Write the processor state (registers, CSRs, pipeline latches, out-of-order core, predictor, interface, L1) for a snapshot.
+ */
+void riscv_save(system_t* sys, snapshot_stream_t* out);
+
+/**
+ * \brief Read the processor state back, false if the snapshot L1 geometry is not the one of the processor.
+ *
+ * The decoded blocks and their translations are dropped.
+ */
+bool riscv_load(system_t* sys, snapshot_stream_t* in);
+
+static bool __riscv_init(system_t* sys, riscv_processor_cfg_t* cfg);
 
 static void __riscv_on_itf_interrupt(system_t* sys, processor_itf_t* itf, transaction_t* transaction, processor_itf_event_payload_t payload);
 static void __riscv_on_itf_data_read(system_t* sys, processor_itf_t* itf, transaction_t* transaction, processor_itf_event_payload_t payload);
@@ -25,20 +46,42 @@ system_t* riscv_new(allocator_t* allocator, riscv_processor_cfg_t* cfg)
   if(!sys) return NULL;
 
   __sys_init(sys, allocator);
-  __riscv_init(sys, cfg);
+  __get_riscv_proc(sys)->l1.lines = NULL;
+
+  if(!__riscv_init(sys, cfg))
+  {
+    sys_delete(sys, allocator);
+    return NULL;
+  }
  
   return sys;
 }
 
-static void __riscv_init(system_t* sys, riscv_processor_cfg_t* cfg) 
+static bool __riscv_init(system_t* sys, riscv_processor_cfg_t* cfg) 
 {
     riscv_processor_t* proc = __get_riscv_proc(sys);
+    const data_cache_cfg_t* l1_cfg = &cfg->l1;
+
+    // Ahead of the checks, riscv_destroy may run on a failed init.
+    riscv_jit_create(&proc->jit, 0); // Disabled until riscv_jit_enable
+
+    if(l1_cfg->line_size < sizeof(octa) || l1_cfg->line_size > DATA_CACHE_MAX_LINE_SIZE || (l1_cfg->line_size & (l1_cfg->line_size - 1))
+      || l1_cfg->sets == 0 || (l1_cfg->sets & (l1_cfg->sets - 1)) || l1_cfg->ways == 0)
+        return false;
+
+    if(cfg->issue_width == 0 || cfg->issue_width > RISCV_MAX_ISSUE_WIDTH)
+        return false;
 
     // V-Table
     sys->vtable.step = riscv_step;
+    sys->vtable.destroy = riscv_destroy;
+    sys->vtable.reset = riscv_reset;
+    sys->vtable.save = riscv_save;
+    sys->vtable.load = riscv_load;
     
     proc->frequency = cfg->frequency;
     proc->pc        = cfg->boot_address;
+    proc->mode      = proc->next_mode = RISCV_MODE_PIPELINE;
 
     for(unsigned int i = 0; i < 32; i++)   proc->regs[i] = 0;
     for(unsigned int i = 0; i < 4096; i++) proc->csrs[i] = 0;
@@ -46,10 +89,17 @@ static void __riscv_init(system_t* sys, riscv_processor_cfg_t* cfg)
     //proc->regs[2]   = cfg->memory_size;
     proc->regs[0]   = octa_zero;
     
-    sys->atomic_time = 1.0 / (float)(cfg->frequency);
+    sys->frequency = cfg->frequency;
 
     // Setup the pipeline
-    riscv_pipeline_create(&proc->pipeline);
+    proc->core = cfg->core;
+    riscv_pipeline_create(&proc->pipeline, cfg->issue_width);
+    riscv_ooo_create(&proc->ooo, cfg->issue_width);
+
+    if(!riscv_bp_create(&proc->bp, &cfg->bp))
+        return false;
+
+    riscv_block_cache_flush(&proc->blocks);
 
     // Setup the interface
     processor_itf_create(&proc->itf);
@@ -61,8 +111,23 @@ static void __riscv_init(system_t* sys, riscv_processor_cfg_t* cfg)
     proc->itf.event_handlers[PROC_ITF_EVENT_INTERRUPT].self = sys;
     proc->itf.event_handlers[PROC_ITF_EVENT_INTERRUPT].hdlr = (processor_itf_event_handler_t) __riscv_on_itf_interrupt;
 
-    // Setup the L1 cache
-    data_cache_create(&proc->l1, (data_cache_entry_t*) &proc->__l1_entries, sizeof(proc->__l1_entries) / sizeof(data_cache_entry_t));
+    // Setup the L1 cache, the data is only touched by the line fills.
+    size_t lines_size = data_cache_lines_count(l1_cfg) * sizeof(data_cache_line_t);
+    lines_size = (lines_size + sizeof(octa) - 1) & ~(sizeof(octa) - 1);
+
+    // Storage kept by riscv_reset, for the same geometry
+    if(proc->l1.lines != NULL && (proc->l1.cfg.line_size != l1_cfg->line_size || proc->l1.cfg.sets != l1_cfg->sets || proc->l1.cfg.ways != l1_cfg->ways))
+    {
+        pfree(&sys->allocator, proc->l1.lines);
+        proc->l1.lines = NULL;
+    }
+
+    byte* l1_storage = proc->l1.lines != NULL ? (byte*) proc->l1.lines : (byte*) pmalloc(&sys->allocator, lines_size + data_cache_data_size(l1_cfg));
+
+    if(!l1_storage)
+        return false;
+
+    data_cache_create(&proc->l1, l1_cfg, (data_cache_line_t*) l1_storage, (octa*)(l1_storage + lines_size));
 
     // Setup a handler for the FETCH/SEND events from proc L1 cache.
     proc->l1.event_handlers[DATA_CACHE_EVENT_FETCH].self = sys;
@@ -70,6 +135,8 @@ static void __riscv_init(system_t* sys, riscv_processor_cfg_t* cfg)
 
     proc->l1.event_handlers[DATA_CACHE_EVENT_SEND].self = sys;
     proc->l1.event_handlers[DATA_CACHE_EVENT_SEND].hdlr = (data_cache_event_handler_t) __riscv_on_l1_send;
+
+    return true;
 }
 
 static void __riscv_on_itf_interrupt(system_t* sys, processor_itf_t* itf, transaction_t* transaction, processor_itf_event_payload_t payload)
@@ -82,18 +149,30 @@ static void __riscv_on_itf_data_read(system_t* sys, processor_itf_t* itf, transa
   riscv_processor_t* proc = __get_riscv_proc(sys);
 
   // Update the data cache
-  data_cache_update(&proc->l1, payload.read.addr, payload.read.data, transaction);
+  data_cache_update_octa(&proc->l1, payload.read.addr, payload.read.data, transaction);
 }
 
 static void __riscv_on_l1_send(system_t* sys, data_cache_t* l1, transaction_t* transaction, data_cache_event_payload_t payload)
 {
-  //riscv_processor_t* proc = __get_riscv_proc(sys);
-
+  // Write the dirty bytes back to the system memory, they stay dirty if it is not mapped.
+  if(__riscv_writeback_line(sys, payload.send.addr, payload.send.data, payload.send.dirty, l1->cfg.line_size))
+    data_cache_clean(l1, payload.send.addr, payload.send.dirty, transaction);
 }
 
 static void __riscv_on_l1_fetch(system_t* sys, data_cache_t* l1, transaction_t* transaction, data_cache_event_payload_t payload)
 {
-  //riscv_processor_t* proc = __get_riscv_proc(sys);
+  octa data[DATA_CACHE_MAX_LINE_SIZE / sizeof(octa)];
+  octa mask = 0;
+
+  // Fill the line from the system memory, unmapped bytes are left missing.
+  for(unsigned int offset = 0; offset < l1->cfg.line_size; offset += sizeof(octa))
+  {
+    if(riscv_mem_copy(sys, payload.fetch.addr + offset, &data[offset / sizeof(octa)], sizeof(octa), false))
+      mask |= (octa) 0xFF << offset;
+  }
+
+  if(mask)
+    data_cache_fill(l1, payload.fetch.addr, (const byte*) data, mask, transaction);
 }
 
 void riscv_step(system_t* sys)
@@ -103,6 +182,14 @@ void riscv_step(system_t* sys)
   // Set zero at each cycle
   proc->regs[0] = 0;
 
+  riscv_sync_mode(sys, proc);
+
+  if(proc->mode == RISCV_MODE_FUNCTIONAL)
+  {
+    riscv_functional_step(sys, proc);
+    return;
+  }
+
   // Data cache step
   data_cache_step(&proc->l1, &sys->transaction);
 
@@ -110,7 +197,111 @@ void riscv_step(system_t* sys)
   processor_itf_step(&proc->itf, &sys->transaction);
 
   // Pipeline step
-  riscv_pipeline_step(sys, proc, &proc->pipeline, &sys->transaction);
+  if(proc->core == RISCV_CORE_OUT_OF_ORDER)
+    riscv_ooo_step(sys, proc, &proc->ooo, &sys->transaction);
+  else
+    riscv_pipeline_step(sys, proc, &proc->pipeline, &sys->transaction);
+}
+
+void riscv_destroy(system_t* sys)
+{
+  riscv_processor_t* proc = __get_riscv_proc(sys);
+
+  riscv_jit_destroy(&proc->jit);
+
+  if(proc->l1.lines != NULL)
+    pfree(&sys->allocator, proc->l1.lines);
+
+  proc->l1.lines = NULL;
+}
+
+void riscv_reset(system_t* sys)
+{
+  riscv_processor_t* proc = __get_riscv_proc(sys);
+
+  riscv_jit_destroy(&proc->jit);
+}
+
+void riscv_save(system_t* sys, snapshot_stream_t* out)
+{
+  riscv_processor_t* proc = __get_riscv_proc(sys);
+  processor_itf_t* itf = &proc->itf;
+  data_cache_t* l1 = &proc->l1;
+
+  snapshot_write(out, &l1->cfg, sizeof(l1->cfg));
+
+  snapshot_write(out, proc->regs, sizeof(proc->regs));
+  snapshot_write(out, proc->csrs, sizeof(proc->csrs));
+  snapshot_write(out, &proc->pc, sizeof(proc->pc));
+  snapshot_write(out, &proc->mode, sizeof(proc->mode));
+  snapshot_write(out, &proc->next_mode, sizeof(proc->next_mode));
+  snapshot_write(out, &proc->core, sizeof(proc->core));
+  snapshot_write(out, &proc->pipeline, sizeof(proc->pipeline));
+  snapshot_write(out, &proc->ooo, sizeof(proc->ooo));
+  snapshot_write(out, &proc->bp, sizeof(proc->bp));
+  snapshot_write(out, &proc->remaining_cycles, sizeof(proc->remaining_cycles));
+
+  // Interface, without its bus and handlers
+  snapshot_write(out, &itf->hw_interrupt, sizeof(itf->hw_interrupt));
+  snapshot_write(out, &itf->mar, sizeof(itf->mar));
+  snapshot_write(out, &itf->mbr, sizeof(itf->mbr));
+  snapshot_write(out, &itf->origin, sizeof(itf->origin));
+  snapshot_write(out, &itf->cmd, sizeof(itf->cmd));
+  snapshot_write(out, &itf->status, sizeof(itf->status));
+  snapshot_write(out, &itf->leadership, sizeof(itf->leadership));
+
+  // L1
+  snapshot_write(out, &l1->clock, sizeof(l1->clock));
+  snapshot_write(out, l1->mshrs, sizeof(l1->mshrs));
+  snapshot_write(out, &l1->cursor, sizeof(l1->cursor));
+  snapshot_write(out, l1->writes, sizeof(l1->writes));
+  snapshot_write(out, &l1->write_count, sizeof(l1->write_count));
+  snapshot_write(out, l1->lines, data_cache_lines_count(&l1->cfg) * sizeof(data_cache_line_t));
+  snapshot_write(out, l1->data, data_cache_data_size(&l1->cfg));
+}
+
+bool riscv_load(system_t* sys, snapshot_stream_t* in)
+{
+  riscv_processor_t* proc = __get_riscv_proc(sys);
+  processor_itf_t* itf = &proc->itf;
+  data_cache_t* l1 = &proc->l1;
+  data_cache_cfg_t cfg;
+
+  if(!snapshot_read(in, &cfg, sizeof(cfg)))
+    return false;
+
+  if(cfg.line_size != l1->cfg.line_size || cfg.sets != l1->cfg.sets || cfg.ways != l1->cfg.ways)
+    return false;
+
+  bool ok = snapshot_read(in, proc->regs, sizeof(proc->regs))
+    && snapshot_read(in, proc->csrs, sizeof(proc->csrs))
+    && snapshot_read(in, &proc->pc, sizeof(proc->pc))
+    && snapshot_read(in, &proc->mode, sizeof(proc->mode))
+    && snapshot_read(in, &proc->next_mode, sizeof(proc->next_mode))
+    && snapshot_read(in, &proc->core, sizeof(proc->core))
+    && snapshot_read(in, &proc->pipeline, sizeof(proc->pipeline))
+    && snapshot_read(in, &proc->ooo, sizeof(proc->ooo))
+    && snapshot_read(in, &proc->bp, sizeof(proc->bp))
+    && snapshot_read(in, &proc->remaining_cycles, sizeof(proc->remaining_cycles))
+    && snapshot_read(in, &itf->hw_interrupt, sizeof(itf->hw_interrupt))
+    && snapshot_read(in, &itf->mar, sizeof(itf->mar))
+    && snapshot_read(in, &itf->mbr, sizeof(itf->mbr))
+    && snapshot_read(in, &itf->origin, sizeof(itf->origin))
+    && snapshot_read(in, &itf->cmd, sizeof(itf->cmd))
+    && snapshot_read(in, &itf->status, sizeof(itf->status))
+    && snapshot_read(in, &itf->leadership, sizeof(itf->leadership))
+    && snapshot_read(in, &l1->clock, sizeof(l1->clock))
+    && snapshot_read(in, l1->mshrs, sizeof(l1->mshrs))
+    && snapshot_read(in, &l1->cursor, sizeof(l1->cursor))
+    && snapshot_read(in, l1->writes, sizeof(l1->writes))
+    && snapshot_read(in, &l1->write_count, sizeof(l1->write_count))
+    && snapshot_read(in, l1->lines, data_cache_lines_count(&l1->cfg) * sizeof(data_cache_line_t))
+    && snapshot_read(in, l1->data, data_cache_data_size(&l1->cfg));
+
+  // Decoded from the previous memory
+  riscv_block_cache_flush(&proc->blocks);
+
+  return ok;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef __RISCV_BLOCK_H__
+#define __RISCV_BLOCK_H__
+
+#include "../../lib/common/include/types.h"
+
+#include "./instr.h"
+#include "./opcode.h"
+
+/**
+ * Decoded basic block cache, used by the functional mode.
+ *
+ * A block is a run of decoded instructions starting at pc, and ending after the
+ * first one writing the pc, halting or idling the simulation, or fencing the instruction stream.
+ * Blocks are direct-mapped on their first pc.
+ *
+ * The cache keeps the bounds of the code it decoded: a store falling inside them,
+ * or a FENCE.I, drops every block and bumps the generation.
+ *
+ * Each block also counts its executions, and keeps its native translation once hot (see jit.h).
+ */
+#define RISCV_BLOCK_CACHE_SIZE 128 // Power of two
+#define RISCV_BLOCK_MAX_LEN 16
+#define RISCV_BLOCK_INVALID octa_uint_max // Never tetra-aligned
+
+/**
+ * \brief Exit of a translated block to a known pc.
+ *
+ * jump is the rel32 of the exit jump, patched to chain the target translation, NULL once chained.
+ */
+typedef struct {
+  octa target;
+  byte* jump;
+} riscv_block_exit_t;
+
+typedef struct {
+  octa pc;
+  unsigned int len;
+  riscv_decoded_instr_t instrs[RISCV_BLOCK_MAX_LEN];
+
+  // Translation
+  unsigned int hits;
+  void* code;
+  riscv_block_exit_t exits[2];
+} riscv_block_t;
+
+typedef struct {
+  riscv_block_t blocks[RISCV_BLOCK_CACHE_SIZE];
+
+  // Bounds [lo, hi) of the decoded code
+  octa lo, hi;
+
+  // Bumped each time the blocks are dropped
+  unsigned int generation;
+} riscv_block_cache_t;
+
+/**
+ * \brief Drop all the blocks.
+ */
+void riscv_block_cache_flush(riscv_block_cache_t* cache);
+
+/**
+ * \brief Reset an entry to an empty block, without translation.
+ */
+static inline void riscv_block_clear(riscv_block_t* block);
+
+/**
+ * \brief Get the block entry starting at pc, it is a hit if its pc matches.
+ */
+static inline riscv_block_t* riscv_block_cache_entry(riscv_block_cache_t* cache, octa pc);
+
+/**
+ * \brief Drop all the blocks if [addr, addr + len) overlaps decoded code.
+ */
+static inline void riscv_block_cache_invalidate(riscv_block_cache_t* cache, octa addr, octa len);
+
+/**
+ * \brief Check if the instruction ends a block.
+ */
+static inline bool riscv_block_ends(const riscv_decoded_instr_t* instr);
+
+//////////
+// IMPL //
+//////////
+
+static inline void riscv_block_clear(riscv_block_t* block)
+{
+  block->pc = RISCV_BLOCK_INVALID;
+  block->len = 0;
+  block->hits = 0;
+  block->code = NULL;
+  block->exits[0].jump = block->exits[1].jump = NULL;
+}
+
+void riscv_block_cache_flush(riscv_block_cache_t* cache)
+{
+  for(unsigned int i = 0; i < RISCV_BLOCK_CACHE_SIZE; i++)
+    riscv_block_clear(&cache->blocks[i]);
+
+  cache->lo = octa_uint_max;
+  cache->hi = 0;
+  cache->generation++;
+}
+
+static inline riscv_block_t* riscv_block_cache_entry(riscv_block_cache_t* cache, octa pc)
+{
+  return &cache->blocks[(pc >> 2) & (RISCV_BLOCK_CACHE_SIZE - 1)];
+}
+
+static inline void riscv_block_cache_invalidate(riscv_block_cache_t* cache, octa addr, octa len)
+{
+  if(addr < cache->hi && addr + len > cache->lo)
+    riscv_block_cache_flush(cache);
+}
+
+static inline bool riscv_block_ends(const riscv_decoded_instr_t* instr)
+{
+  switch(instr->op)
+  {
+    case RISCV_EBREAK: case RISCV_ECALL: case RISCV_FENCE_I: case RISCV_WFI:
+      return true;
+    default:
+      return instr->write_pc;
+  }
+}
+
+#endif
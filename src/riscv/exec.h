@@ -0,0 +1,92 @@
+#ifndef __RISCV_EXEC_H__
+#define __RISCV_EXEC_H__
+
+#include "../../lib/common/include/types.h"
+#include "../../lib/common/include/alu.h"
+
+#include "./opcode.h"
+#include "./pipeline/model.h"
+
+/**
+ * \brief Compute the results of an instruction, shared by the pipeline and the functional engine.
+ *
+ * pc holds the address of the following instruction, and is replaced by the target of jumps and taken branches.
+ * Loads and stores only fill memory_op (and, for stores, the value in result[0]).
+ *
+ * \return true if the instruction halts the simulation.
+ */
+static inline bool riscv_exec(int op, octa a, octa b, octa imm, octa* pc, octa result[2], riscv_memory_op_t* memory_op);
+
+/**
+ * \brief Target of a JAL or a taken branch, pc holding the address of the following instruction.
+ */
+static inline octa riscv_exec_target(int op, octa pc, octa imm);
+
+//////////
+// IMPL //
+//////////
+
+static inline octa riscv_exec_target(int op, octa pc, octa imm)
+{
+    if(op == RISCV_JAL)
+        return octa_plus_expr(octa_incr_expr(pc, -4), octa_left_shift_expr(imm, 2));
+
+    return octa_plus_expr(pc, octa_left_shift_expr(imm, 2));
+}
+
+static inline bool riscv_exec(int op, octa a, octa b, octa imm, octa* pc, octa result[2], riscv_memory_op_t* memory_op)
+{
+    switch(op)
+    {
+        case RISCV_LUI: result[0] = imm; break; // OK
+        case RISCV_AUIPC:
+            result[0] = octa_plus_expr(*pc - 4 , octa_left_shift_expr(imm, 12));
+        break;
+        // jump
+        case RISCV_JAL:
+            result[0] = *pc, *pc = riscv_exec_target(op, *pc, b);
+        break; // OK
+        case RISCV_JALR: result[0] = *pc, *pc = octa_and_expr(octa_plus_expr(a, octa_left_shift_expr(b, 2)), octa_compl_expr(3)); break; // OK
+        // branch
+        case RISCV_BEQ: if(octa_eq_expr(a, b) == true) *pc = riscv_exec_target(op, *pc, imm); break;
+        case RISCV_BNE: if(octa_eq_expr(a, b) == false) *pc = riscv_exec_target(op, *pc, imm); break; // OK
+        case RISCV_BLT: if(octa_signed_cmp_expr(a, b) == -1) *pc = riscv_exec_target(op, *pc, imm); break;
+        case RISCV_BLTU: if(octa_unsigned_cmp_expr(a, b) == -1) *pc = riscv_exec_target(op, *pc, imm); break;
+        case RISCV_BGE: if(octa_signed_cmp_expr(a, b) != -1) *pc = riscv_exec_target(op, *pc, imm); break;
+        case RISCV_BGEU: if(octa_unsigned_cmp_expr(a, b) != -1) *pc = riscv_exec_target(op, *pc, imm); break;
+        // load
+        case RISCV_LBU: case RISCV_LB: case RISCV_LHU: case RISCV_LH: case RISCV_LW: case RISCV_LWU: case RISCV_LD: memory_op->op = 2, memory_op->addr = octa_plus_expr(a, b); break;
+        // store
+        case RISCV_SB: case RISCV_SH: case RISCV_SW: case RISCV_SD: memory_op->op = 1, memory_op->addr = octa_plus_expr(a, imm), result[0] = b; break;
+        // add
+        case RISCV_ADD:  case RISCV_ADDW: case RISCV_ADDI: case RISCV_ADDIW: result[0] = octa_plus_expr(a, b); break;
+        // sub
+        case RISCV_SUB: case RISCV_SUBW: result[0] = octa_minus_expr(a, b); break;
+        // compare lt
+        case RISCV_SLT: case RISCV_SLTI: result[0] = octa_signed_cmp_expr(a, b) == -1; break;
+        case RISCV_SLTU: case RISCV_SLTIU: result[0] = octa_unsigned_cmp_expr(a, b) == -1; break;
+        // xor
+        case RISCV_XORI: case RISCV_XOR: result[0] =  octa_xor_expr(a, b); break;
+        // or
+        case RISCV_ORI: case RISCV_OR: result[0] = octa_or_expr(a, b); break;
+        // and
+        case RISCV_ANDI: case RISCV_AND:  result[0] = octa_and_expr(a, b); break;
+        // shift left
+        case RISCV_SLL: case RISCV_SLLW:  result[0] = octa_left_shift_expr(a, b); break;
+        case RISCV_SLLI: case RISCV_SLLIW: result[0] = octa_left_shift_expr(a, octa_and_expr(b, 0x1f)); break;
+        // shift right
+        case RISCV_SRL: case RISCV_SRA: case RISCV_SRAW: result[0] = octa_right_shift_expr(a, b, 0); break;
+        case RISCV_SRLIW: case RISCV_SRAIW: case RISCV_SRAI: case RISCV_SRLI: result[0] = octa_right_shift_expr(a, octa_and_expr(b, 0x1f), 0); break;
+        // Halt the simulation
+        case RISCV_EBREAK: return true;
+        case RISCV_FENCE_I: break;
+        case RISCV_CSRRW:
+            result[0] = b, result[1] = a;
+            break;
+        default: break;
+    }
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef __RISCV_FUNCTIONAL_H__
+#define __RISCV_FUNCTIONAL_H__
+
+#include "../../lib/common/include/types.h"
+#include "../memory/core.h"
+#include "../system.h"
+
+#include "./model.h"
+#include "./block.h"
+#include "./exec.h"
+#include "./jit.h"
+#include "./mem.h"
+#include "./pipeline.h"
+#include "./ooo.h"
+
+#include <string.h>
+
+/**
+ * Functional fast mode.
+ *
+ * Guest code is decoded into basic blocks (see block.h) run by a direct interpreter
+ * over proc->regs, proc->csrs and proc->pc: the pipeline, the L1 and the transaction
+ * log are bypassed, and the guest memory is accessed through sys->mem, so the program
+ * has to live in mapped memory. An instruction retires per step.
+ *
+ * WFI puts the system to sleep until sys_wake (the pipeline runs it as a NOP).
+ *
+ * Modes only switch between blocks. Entering the functional mode waits for the pipeline
+ * to drain, then writes the dirty L1 lines back; leaving it restarts an empty pipeline at proc->pc.
+ *
+ * Once enabled, hot blocks are translated to native code (see jit.h), the interpreter
+ * remaining the fallback.
+ */
+
+/**
+ * \brief Request a mode, it takes effect at the next block boundary.
+ */
+void riscv_set_mode(system_t* sys, riscv_mode_t mode);
+
+/**
+ * \brief Switch to the requested mode, if the processor is at a block boundary.
+ */
+void riscv_sync_mode(system_t* sys, riscv_processor_t* proc);
+
+/**
+ * \brief Enable the translation of hot blocks, with a code buffer of capacity bytes.
+ *
+ * \return false if the host is not supported.
+ */
+bool riscv_jit_enable(system_t* sys, size_t capacity);
+
+/**
+ * \brief Run (at most) a block, or a chain of translated ones.
+ */
+void riscv_functional_step(system_t* sys, riscv_processor_t* proc);
+
+static bool __riscv_writeback_line(system_t* sys, octa addr, const byte* data, octa dirty, size_t len);
+static bool __riscv_pipeline_drained(riscv_pipeline_t* pipeline);
+bool riscv_jit_enable(system_t* sys, size_t capacity)
+{
+  riscv_processor_t* proc = __get_riscv_proc(sys);
+
+  riscv_jit_destroy(&proc->jit);
+
+  if(!riscv_jit_create(&proc->jit, capacity))
+    return false;
+
+  riscv_jit_reset(&proc->jit, &proc->blocks);
+  return true;
+}
+
+static riscv_block_t* __riscv_get_block(system_t* sys, riscv_processor_t* proc, octa pc);
+static inline bool __riscv_functional_exec(system_t* sys, riscv_processor_t* proc, riscv_decoded_instr_t* instr, octa* pc);
+
+//////////
+// IMPL //
+//////////
+
+static bool __riscv_writeback_line(system_t* sys, octa addr, const byte* data, octa dirty, size_t len)
+{
+  for(size_t i = 0; i < len; i++)
+  {
+    if(((dirty >> i) & 1) && !riscv_mem_copy(sys, addr + i, (byte*) data + i, 1, true))
+      return false;
+  }
+
+  return true;
+}
+
+static bool __riscv_pipeline_drained(riscv_pipeline_t* pipeline)
+{
+  for(unsigned int i = 0; i < pipeline->width; i++)
+  {
+    if(!pipeline->current.decode[i].control.invalid
+      || !pipeline->current.read[i].control.invalid
+      || !pipeline->current.execute[i].control.invalid
+      || !pipeline->current.memory[i].control.invalid
+      || !pipeline->current.writeback[i].control.invalid)
+      return false;
+  }
+
+  for(unsigned int i = 0; i < RISCV_PIPELINE_MISSES; i++)
+  {
+    if(pipeline->misses[i].valid)
+      return false;
+  }
+
+  return true;
+}
+
+void riscv_set_mode(system_t* sys, riscv_mode_t mode)
+{
+  __get_riscv_proc(sys)->next_mode = mode;
+}
+
+void riscv_sync_mode(system_t* sys, riscv_processor_t* proc)
+{
+  if(proc->mode == proc->next_mode)
+    return;
+
+  if(proc->next_mode == RISCV_MODE_FUNCTIONAL)
+  {
+    // The fetch stage stops while draining, proc->pc is then the next instruction.
+    bool drained = proc->core == RISCV_CORE_OUT_OF_ORDER ? riscv_ooo_drained(&proc->ooo) : __riscv_pipeline_drained(&proc->pipeline);
+
+    if(!drained)
+      return;
+
+    data_cache_flush(&proc->l1, sys, (data_cache_writeback_t) __riscv_writeback_line);
+    riscv_block_cache_flush(&proc->blocks);
+  }
+  else
+  {
+    riscv_pipeline_create(&proc->pipeline, proc->pipeline.width);
+    riscv_ooo_create(&proc->ooo, proc->ooo.width);
+  }
+
+  proc->mode = proc->next_mode;
+}
+
+static riscv_block_t* __riscv_get_block(system_t* sys, riscv_processor_t* proc, octa pc)
+{
+  riscv_block_t* block = riscv_block_cache_entry(&proc->blocks, pc);
+
+  if(block->pc == pc)
+    return block;
+
+  octa loc = pc;
+  tetra raw;
+
+  riscv_block_clear(block);
+
+  while(block->len < RISCV_BLOCK_MAX_LEN && riscv_mem_copy(sys, loc, &raw, sizeof(tetra), false))
+  {
+    riscv_decoded_instr_t* instr = &block->instrs[block->len++];
+    *instr = decode(raw);
+    loc += 4;
+
+    if(riscv_block_ends(instr))
+      break;
+  }
+
+  if(block->len == 0)
+    return NULL;
+
+  block->pc = pc;
+
+  if(pc < proc->blocks.lo) proc->blocks.lo = pc;
+  if(loc > proc->blocks.hi) proc->blocks.hi = loc;
+
+  return block;
+}
+
+// Execute an instruction, pc holds its address and receives the next one.
+// Returns false if the simulation halted or panicked.
+static inline bool __riscv_functional_exec(system_t* sys, riscv_processor_t* proc, riscv_decoded_instr_t* instr, octa* pc)
+{
+  octa result[2] = {0, 0};
+  riscv_memory_op_t memory_op = {0, 0};
+  octa next = *pc + 4;
+  size_t len = 0;
+
+  octa a = instr->sregs[0].type == 0 ? proc->regs[instr->sregs[0].addr] : proc->csrs[instr->sregs[0].addr];
+  octa b = instr->arg1_is_imm ? instr->imm : (instr->sregs[1].type == 0 ? proc->regs[instr->sregs[1].addr] : proc->csrs[instr->sregs[1].addr]);
+
+  bool halt = riscv_exec(instr->op, a, b, instr->imm, &next, result, &memory_op);
+
+  switch(instr->op)
+  {
+    case RISCV_LBU: case RISCV_LB: case RISCV_SB: len = sizeof(byte); break;
+    case RISCV_LHU: case RISCV_LH: case RISCV_SH: len = sizeof(word); break;
+    case RISCV_LW: case RISCV_LWU: case RISCV_SW: len = sizeof(tetra); break;
+    case RISCV_LD: case RISCV_SD: len = sizeof(octa); break;
+    case RISCV_FENCE_I: riscv_block_cache_flush(&proc->blocks); break;
+    case RISCV_WFI: sys_sleep(sys, SYS_SLEEP_FOREVER); break; // Until an interrupt
+  }
+
+  // Loads only fill the low bytes, as the pipeline does.
+  if(memory_op.op != 0)
+  {
+    if(!riscv_mem_access(sys, memory_op.addr, &result[0], len, memory_op.op == 1))
+    {
+      sys_panic(sys);
+      return false;
+    }
+
+    if(memory_op.op == 1)
+      riscv_block_cache_invalidate(&proc->blocks, memory_op.addr, len);
+  }
+
+  for(unsigned char i = 0; i < 2; i++)
+  {
+    octa* reg = instr->dregs[i].type == 0 ? &proc->regs[instr->dregs[i].addr] : &proc->csrs[instr->dregs[i].addr];
+    *reg = result[i];
+  }
+
+  proc->regs[0] = 0;
+  *pc = next;
+
+  if(halt)
+  {
+    sys_halt(sys);
+    return false;
+  }
+
+  return true;
+}
+
+void riscv_functional_step(system_t* sys, riscv_processor_t* proc)
+{
+  octa pc = proc->pc;
+  riscv_block_t* block = __riscv_get_block(sys, proc, pc);
+
+  if(block == NULL)
+  {
+    sys_panic(sys);
+    return;
+  }
+
+  // The step itself, and the steps left.
+  unsigned int budget = block->len;
+  unsigned int left = sys->steps < UINT_MAX - 1 ? (unsigned int) sys->steps : UINT_MAX - 1;
+  if(budget > left + 1) budget = left + 1;
+
+  unsigned int executed = 0;
+  riscv_decoded_instr_t* instr = block->instrs;
+
+  if(proc->jit.base != NULL)
+  {
+    if(block->code == NULL && ++block->hits == RISCV_JIT_THRESHOLD)
+      riscv_jit_compile(&proc->jit, &proc->blocks, block);
+
+    executed = riscv_jit_run(&proc->jit, sys, proc->regs, &proc->blocks, block, left + 1, &pc);
+
+    if(executed > 0)
+    {
+      proc->pc = pc;
+      sys_advance(sys, executed - 1);
+      return;
+    }
+  }
+
+  while(executed < budget)
+  {
+    octa fallthrough = pc + 4;
+    executed++;
+
+    if(!__riscv_functional_exec(sys, proc, instr++, &pc))
+      break;
+
+    // Taken branch, or the block was dropped by a store.
+    if(pc != fallthrough || block->pc == RISCV_BLOCK_INVALID)
+      break;
+  }
+
+  proc->pc = pc;
+  sys_advance(sys, executed - 1);
+}
+
+#endif
@@ -272,6 +272,7 @@ riscv_decoded_instr_t decode(tetra raw)
                 switch(decoded.rs2) {
                     case 0x0: decoded.op = RISCV_ECALL; goto __end;
                     case 0x1: decoded.op = RISCV_EBREAK; goto __end;
+                    case 0x5: if(decoded.funct7 == 0b0001000) decoded.op = RISCV_WFI; goto __end;
                     default: goto __end;
                 }
             }
@@ -0,0 +1,565 @@
+#ifndef __RISCV_JIT_H__
+#define __RISCV_JIT_H__
+
+#include "../../lib/common/include/types.h"
+#include "../system.h"
+
+#include "./block.h"
+#include "./mem.h"
+#include "./opcode.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Native translation of hot blocks (x86-64, Linux).
+ *
+ * Blocks of the functional mode executed RISCV_JIT_THRESHOLD times are translated into
+ * a single mmap'd code buffer. The translation follows riscv_exec, guest registers live
+ * in proc->regs (pointed by rbx), the instruction budget in r12 and the run context in r13.
+ *
+ * A translation starts by checking that the budget covers the whole block, and bails out
+ * to the interpreter otherwise. Exits to a known pc are chained lazily: the first time one
+ * is taken, its jump is patched to the target translation, if any.
+ *
+ * Memory accesses call back into C through sys->mem. CSR accesses, ECALL, EBREAK, FENCE.I
+ * and the opcodes outside RV64I are left to the interpreter: a block is only translated
+ * up to its first such instruction.
+ *
+ * The buffer is dropped whenever the block cache is, or when it is full.
+ */
+#if defined(__x86_64__) && defined(__linux__)
+#define RISCV_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+#define RISCV_JIT_THRESHOLD 16
+#define RISCV_JIT_DEFAULT_CAPACITY (1 << 20)
+
+// Largest translation of a block (prologue, instructions and exits).
+#define RISCV_JIT_MAX_BLOCK_SIZE (64 + RISCV_BLOCK_MAX_LEN * 96)
+
+typedef struct riscv_jit_ctx_t {
+  octa budget;
+  riscv_block_exit_t* exit; // Chainable exit taken, if any
+  system_t* sys;
+  riscv_block_cache_t* cache;
+  octa scratch;
+} riscv_jit_ctx_t;
+
+typedef struct {
+  byte* base;
+  size_t size, capacity;
+
+  // Start of the translations, after the entry and exit stubs.
+  size_t start;
+  byte* exit;
+
+  // Generation of the block cache the translations come from
+  unsigned int generation;
+} riscv_jit_t;
+
+/**
+ * \brief Map the code buffer, false if the host is not supported or the mapping failed.
+ */
+bool riscv_jit_create(riscv_jit_t* jit, size_t capacity);
+void riscv_jit_destroy(riscv_jit_t* jit);
+
+/**
+ * \brief Drop all the translations.
+ */
+void riscv_jit_reset(riscv_jit_t* jit, riscv_block_cache_t* cache);
+
+/**
+ * \brief Translate a block, false if none of its instructions is supported or the buffer is full.
+ */
+bool riscv_jit_compile(riscv_jit_t* jit, riscv_block_cache_t* cache, riscv_block_t* block);
+
+/**
+ * \brief Run translated blocks from block, for at most budget instructions.
+ *
+ * \return The number of instructions executed, pc receives the next one.
+ */
+unsigned int riscv_jit_run(riscv_jit_t* jit, system_t* sys, octa* regs, riscv_block_cache_t* cache, riscv_block_t* block, unsigned int budget, octa* pc);
+
+//////////
+// IMPL //
+//////////
+
+#ifdef RISCV_JIT_SUPPORTED
+
+// x86-64 registers
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+#define JIT_RBX 3
+#define JIT_RSI 6
+#define JIT_RDI 7
+
+typedef octa (*riscv_jit_entry_t)(octa* regs, riscv_jit_ctx_t* ctx, void* code);
+
+static inline void __jit_byte(riscv_jit_t* jit, byte b)
+{
+  jit->base[jit->size++] = b;
+}
+
+static inline void __jit_bytes(riscv_jit_t* jit, const byte* bytes, size_t len)
+{
+  memcpy(jit->base + jit->size, bytes, len);
+  jit->size += len;
+}
+
+static inline void __jit_tetra(riscv_jit_t* jit, tetra t)
+{
+  memcpy(jit->base + jit->size, &t, sizeof(tetra));
+  jit->size += sizeof(tetra);
+}
+
+static inline void __jit_octa(riscv_jit_t* jit, octa o)
+{
+  memcpy(jit->base + jit->size, &o, sizeof(octa));
+  jit->size += sizeof(octa);
+}
+
+// Address of a rel32 just emitted, pointing to target.
+static inline void __jit_patch(byte* rel32, const byte* target)
+{
+  tetra rel = (tetra)(target - (rel32 + sizeof(tetra)));
+  memcpy(rel32, &rel, sizeof(tetra));
+}
+
+// mov r, [rbx + 8 * idx]
+static inline void __jit_load_reg(riscv_jit_t* jit, byte r, unsigned int idx)
+{
+  __jit_byte(jit, 0x48);
+  __jit_byte(jit, 0x8B);
+  __jit_byte(jit, 0x80 | (r << 3) | JIT_RBX);
+  __jit_tetra(jit, idx * sizeof(octa));
+}
+
+// mov [rbx + 8 * idx], r
+static inline void __jit_store_reg(riscv_jit_t* jit, byte r, unsigned int idx)
+{
+  __jit_byte(jit, 0x48);
+  __jit_byte(jit, 0x89);
+  __jit_byte(jit, 0x80 | (r << 3) | JIT_RBX);
+  __jit_tetra(jit, idx * sizeof(octa));
+}
+
+// mov r, imm64
+static inline void __jit_mov_imm(riscv_jit_t* jit, byte r, octa imm)
+{
+  __jit_byte(jit, 0x48);
+  __jit_byte(jit, 0xB8 + r);
+  __jit_octa(jit, imm);
+}
+
+// <op> dst, src (op is the r/m64, r64 opcode)
+static inline void __jit_alu(riscv_jit_t* jit, byte op, byte dst, byte src)
+{
+  __jit_byte(jit, 0x48);
+  __jit_byte(jit, op);
+  __jit_byte(jit, 0xC0 | (src << 3) | dst);
+}
+
+// <op> r12, imm32 (op is the /digit of 81 /digit)
+static inline void __jit_budget(riscv_jit_t* jit, byte digit, tetra imm)
+{
+  __jit_byte(jit, 0x49);
+  __jit_byte(jit, 0x81);
+  __jit_byte(jit, 0xC0 | (digit << 3) | 4);
+  __jit_tetra(jit, imm);
+}
+
+// jmp rel32 / jcc rel32, returns the address of the rel32
+static inline byte* __jit_jump(riscv_jit_t* jit, byte cc)
+{
+  if(cc == 0) __jit_byte(jit, 0xE9);
+  else __jit_byte(jit, 0x0F), __jit_byte(jit, cc);
+
+  byte* rel32 = jit->base + jit->size;
+  __jit_tetra(jit, 0);
+  return rel32;
+}
+
+// Leave with the next pc in rax, and no chainable exit.
+static void __jit_leave(riscv_jit_t* jit)
+{
+  static const byte xor_edx_edx[] = {0x31, 0xD2};
+
+  __jit_bytes(jit, xor_edx_edx, sizeof(xor_edx_edx));
+  __jit_patch(__jit_jump(jit, 0), jit->exit);
+}
+
+// Leave to pc, restoring remaining instructions to the budget.
+static void __jit_exit(riscv_jit_t* jit, octa pc, unsigned int remaining)
+{
+  if(remaining) __jit_budget(jit, 0, remaining); // add r12, remaining
+  __jit_mov_imm(jit, JIT_RAX, pc);
+  __jit_leave(jit);
+}
+
+// Chainable exit to target, through a jump patched once the target is translated.
+static void __jit_chain(riscv_jit_t* jit, riscv_block_exit_t* exit, octa target)
+{
+  byte* jump = __jit_jump(jit, 0);
+  __jit_patch(jump, jit->base + jit->size);
+
+  __jit_mov_imm(jit, JIT_RAX, target);
+  __jit_mov_imm(jit, JIT_RDX, (octa)(uintptr_t) exit);
+  __jit_patch(__jit_jump(jit, 0), jit->exit);
+
+  exit->target = target;
+  exit->jump = jump;
+}
+
+// Memory accesses, 1 on success.
+static int __riscv_jit_load(riscv_jit_ctx_t* ctx, octa addr, octa* dest, octa len)
+{
+  octa value = 0;
+
+  if(!riscv_mem_access(ctx->sys, addr, &value, len, false))
+    return 0;
+
+  *dest = value;
+  return 1;
+}
+
+static int __riscv_jit_store(riscv_jit_ctx_t* ctx, octa addr, octa value, octa len)
+{
+  unsigned int generation = ctx->cache->generation;
+
+  if(!riscv_mem_access(ctx->sys, addr, &value, len, true))
+    return 0;
+
+  riscv_block_cache_invalidate(ctx->cache, addr, len);
+
+  // The translations are stale, leave.
+  return generation == ctx->cache->generation ? 1 : 2;
+}
+
+static bool __riscv_jit_supported(const riscv_decoded_instr_t* instr)
+{
+  if(instr->sregs[0].type != 0 || instr->sregs[1].type != 0 || instr->dregs[0].type != 0 || instr->dregs[1].type != 0)
+    return false;
+
+  switch(instr->op)
+  {
+    case RISCV_ECALL: case RISCV_EBREAK: case RISCV_FENCE_I:
+    case RISCV_CSRRW: case RISCV_CSRRS: case RISCV_CSRRC: case RISCV_CSRRWI: case RISCV_CSRRSI: case RISCV_CSRRCI:
+      return false;
+    default:
+      return instr->op < RISCV_FENCE_I;
+  }
+}
+
+static unsigned int __riscv_jit_access_len(int op)
+{
+  switch(op)
+  {
+    case RISCV_LBU: case RISCV_LB: case RISCV_SB: return sizeof(byte);
+    case RISCV_LHU: case RISCV_LH: case RISCV_SH: return sizeof(word);
+    case RISCV_LW: case RISCV_LWU: case RISCV_SW: return sizeof(tetra);
+    default: return sizeof(octa);
+  }
+}
+
+// Call a memory helper, leaving at the instruction on failure.
+static void __jit_call(riscv_jit_t* jit, void* helper, octa pc, unsigned int remaining)
+{
+  static const byte mov_rdi_r13[] = {0x4C, 0x89, 0xEF};
+  static const byte call_rax[]    = {0xFF, 0xD0};
+  static const byte cmp_eax_1[]   = {0x83, 0xF8, 0x01};
+
+  __jit_bytes(jit, mov_rdi_r13, sizeof(mov_rdi_r13));
+  __jit_mov_imm(jit, JIT_RAX, (octa)(uintptr_t) helper);
+  __jit_bytes(jit, call_rax, sizeof(call_rax));
+  __jit_bytes(jit, cmp_eax_1, sizeof(cmp_eax_1));
+
+  byte* ok = __jit_jump(jit, 0x84); // je
+  // Replaying a store is harmless, the interpreter picks up from the instruction.
+  __jit_exit(jit, pc, remaining);
+  __jit_patch(ok, jit->base + jit->size);
+}
+
+static void __jit_instr(riscv_jit_t* jit, riscv_block_t* block, unsigned int i, unsigned int len, bool last)
+{
+  static const byte shl_rax_cl[] = {0x48, 0xD3, 0xE0};
+  static const byte shr_rax_cl[] = {0x48, 0xD3, 0xE8};
+  static const byte and_ecx_1f[] = {0x83, 0xE1, 0x1F};
+  static const byte setl_al[]    = {0x0F, 0x9C, 0xC0};
+  static const byte setb_al[]    = {0x0F, 0x92, 0xC0};
+  static const byte movzx_al[]   = {0x0F, 0xB6, 0xC0};
+  static const byte shl_rcx_2[]  = {0x48, 0xC1, 0xE1, 0x02};
+  static const byte and_rax_m3[] = {0x48, 0x83, 0xE0, 0xFD};
+
+  riscv_decoded_instr_t* instr = &block->instrs[i];
+  octa pc = block->pc + (i << 2);
+  octa next = pc + 4;
+  unsigned int rd = instr->dregs[0].addr;
+  bool write = true;
+
+  // a in rax, b in rcx
+  __jit_load_reg(jit, JIT_RAX, instr->sregs[0].addr);
+
+  if(instr->arg1_is_imm) __jit_mov_imm(jit, JIT_RCX, instr->imm);
+  else __jit_load_reg(jit, JIT_RCX, instr->sregs[1].addr);
+
+  switch(instr->op)
+  {
+    case RISCV_LUI: __jit_mov_imm(jit, JIT_RAX, instr->imm); break;
+    case RISCV_AUIPC: __jit_mov_imm(jit, JIT_RAX, pc + (instr->imm << 12)); break;
+    // jump
+    case RISCV_JAL:
+      __jit_mov_imm(jit, JIT_RAX, next);
+      if(rd != 0) __jit_store_reg(jit, JIT_RAX, rd);
+      __jit_chain(jit, &block->exits[0], pc + (instr->imm << 2));
+      return;
+    case RISCV_JALR:
+      __jit_bytes(jit, shl_rcx_2, sizeof(shl_rcx_2));
+      __jit_alu(jit, 0x01, JIT_RAX, JIT_RCX);
+      __jit_bytes(jit, and_rax_m3, sizeof(and_rax_m3));
+      __jit_mov_imm(jit, JIT_RCX, next);
+      if(rd != 0) __jit_store_reg(jit, JIT_RCX, rd);
+      __jit_leave(jit);
+      return;
+    // branch
+    case RISCV_BEQ: case RISCV_BNE: case RISCV_BLT: case RISCV_BLTU: case RISCV_BGE: case RISCV_BGEU:
+    {
+      byte cc = 0;
+
+      __jit_alu(jit, 0x39, JIT_RAX, JIT_RCX); // cmp rax, rcx
+
+      switch(instr->op)
+      {
+        case RISCV_BEQ:  cc = 0x84; break; // je
+        case RISCV_BNE:  cc = 0x85; break; // jne
+        case RISCV_BLT:  cc = 0x8C; break; // jl
+        case RISCV_BLTU: cc = 0x82; break; // jb
+        case RISCV_BGE:  cc = 0x8D; break; // jge
+        case RISCV_BGEU: cc = 0x83; break; // jae
+        default: break;
+      }
+
+      byte* taken = __jit_jump(jit, cc);
+      __jit_chain(jit, &block->exits[1], next);
+      __jit_patch(taken, jit->base + jit->size);
+
+      __jit_chain(jit, &block->exits[0], next + (instr->imm << 2));
+      return;
+    }
+    // load
+    case RISCV_LBU: case RISCV_LB: case RISCV_LHU: case RISCV_LH: case RISCV_LW: case RISCV_LWU: case RISCV_LD:
+    {
+      static const byte lea_rdx_r13[] = {0x49, 0x8D, 0x55, offsetof(riscv_jit_ctx_t, scratch)};
+      static const byte lea_rdx_rbx[] = {0x48, 0x8D, 0x93};
+
+      __jit_alu(jit, 0x01, JIT_RAX, JIT_RCX);
+      __jit_alu(jit, 0x89, JIT_RSI, JIT_RAX);
+
+      if(rd != 0) __jit_bytes(jit, lea_rdx_rbx, sizeof(lea_rdx_rbx)), __jit_tetra(jit, rd * sizeof(octa));
+      else __jit_bytes(jit, lea_rdx_r13, sizeof(lea_rdx_r13));
+
+      __jit_mov_imm(jit, JIT_RCX, __riscv_jit_access_len(instr->op));
+      __jit_call(jit, (void*) __riscv_jit_load, pc, len - i);
+      write = false;
+      break;
+    }
+    // store
+    case RISCV_SB: case RISCV_SH: case RISCV_SW: case RISCV_SD:
+      __jit_alu(jit, 0x89, JIT_RDX, JIT_RCX);
+      __jit_mov_imm(jit, JIT_RSI, instr->imm);
+      __jit_alu(jit, 0x01, JIT_RSI, JIT_RAX);
+      __jit_mov_imm(jit, JIT_RCX, __riscv_jit_access_len(instr->op));
+      __jit_call(jit, (void*) __riscv_jit_store, pc, len - i);
+      write = false;
+      break;
+    // add
+    case RISCV_ADD:  case RISCV_ADDW: case RISCV_ADDI: case RISCV_ADDIW: __jit_alu(jit, 0x01, JIT_RAX, JIT_RCX); break;
+    // sub
+    case RISCV_SUB: case RISCV_SUBW: __jit_alu(jit, 0x29, JIT_RAX, JIT_RCX); break;
+    // compare lt
+    case RISCV_SLT: case RISCV_SLTI:
+      __jit_alu(jit, 0x39, JIT_RAX, JIT_RCX);
+      __jit_bytes(jit, setl_al, sizeof(setl_al));
+      __jit_bytes(jit, movzx_al, sizeof(movzx_al));
+      break;
+    case RISCV_SLTU: case RISCV_SLTIU:
+      __jit_alu(jit, 0x39, JIT_RAX, JIT_RCX);
+      __jit_bytes(jit, setb_al, sizeof(setb_al));
+      __jit_bytes(jit, movzx_al, sizeof(movzx_al));
+      break;
+    // xor, or, and
+    case RISCV_XORI: case RISCV_XOR: __jit_alu(jit, 0x31, JIT_RAX, JIT_RCX); break;
+    case RISCV_ORI: case RISCV_OR: __jit_alu(jit, 0x09, JIT_RAX, JIT_RCX); break;
+    case RISCV_ANDI: case RISCV_AND: __jit_alu(jit, 0x21, JIT_RAX, JIT_RCX); break;
+    // shift left
+    case RISCV_SLLI: case RISCV_SLLIW: __jit_bytes(jit, and_ecx_1f, sizeof(and_ecx_1f));
+    case RISCV_SLL: case RISCV_SLLW: __jit_bytes(jit, shl_rax_cl, sizeof(shl_rax_cl)); break;
+    // shift right
+    case RISCV_SRLIW: case RISCV_SRAIW: case RISCV_SRAI: case RISCV_SRLI: __jit_bytes(jit, and_ecx_1f, sizeof(and_ecx_1f));
+    case RISCV_SRL: case RISCV_SRA: case RISCV_SRAW: __jit_bytes(jit, shr_rax_cl, sizeof(shr_rax_cl)); break;
+    // No result (NOP, FENCE, ...)
+    default: write = false; break;
+  }
+
+  if(write && rd != 0)
+    __jit_store_reg(jit, JIT_RAX, rd);
+
+  // Falls through the end of the block
+  if(last)
+    __jit_chain(jit, &block->exits[0], next);
+}
+
+bool riscv_jit_create(riscv_jit_t* jit, size_t capacity)
+{
+  // push rbx; push r12; push r13 (the stack is then aligned for the helper calls)
+  // mov rbx, rdi; mov r13, rsi; mov r12, [r13 + budget]; jmp rdx
+  static const byte entry[] = {
+    0x53, 0x41, 0x54, 0x41, 0x55,
+    0x48, 0x89, 0xFB, 0x49, 0x89, 0xF5,
+    0x4D, 0x8B, 0x65, offsetof(riscv_jit_ctx_t, budget),
+    0xFF, 0xE2
+  };
+  // mov [r13 + budget], r12; mov [r13 + exit], rdx; pop r13; pop r12; pop rbx; ret
+  static const byte exit[] = {
+    0x4D, 0x89, 0x65, offsetof(riscv_jit_ctx_t, budget),
+    0x49, 0x89, 0x55, offsetof(riscv_jit_ctx_t, exit),
+    0x41, 0x5D, 0x41, 0x5C, 0x5B,
+    0xC3
+  };
+
+  jit->base = NULL;
+  jit->size = jit->capacity = jit->start = 0;
+
+  if(capacity < sizeof(entry) + sizeof(exit) + RISCV_JIT_MAX_BLOCK_SIZE)
+    return false;
+
+  void* base = mmap(NULL, capacity, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if(base == MAP_FAILED)
+    return false;
+
+  jit->base = (byte*) base;
+  jit->capacity = capacity;
+
+  __jit_bytes(jit, entry, sizeof(entry));
+  jit->exit = jit->base + jit->size;
+  __jit_bytes(jit, exit, sizeof(exit));
+
+  jit->start = jit->size;
+  return true;
+}
+
+void riscv_jit_destroy(riscv_jit_t* jit)
+{
+  if(jit->base != NULL)
+    munmap(jit->base, jit->capacity);
+
+  jit->base = NULL;
+  jit->size = jit->capacity = jit->start = 0;
+}
+
+void riscv_jit_reset(riscv_jit_t* jit, riscv_block_cache_t* cache)
+{
+  for(unsigned int i = 0; i < RISCV_BLOCK_CACHE_SIZE; i++)
+  {
+    riscv_block_t* block = &cache->blocks[i];
+    block->code = NULL;
+    block->exits[0].jump = block->exits[1].jump = NULL;
+  }
+
+  jit->size = jit->start;
+  jit->generation = cache->generation;
+}
+
+bool riscv_jit_compile(riscv_jit_t* jit, riscv_block_cache_t* cache, riscv_block_t* block)
+{
+  unsigned int len = 0;
+
+  if(jit->base == NULL)
+    return false;
+
+  // The translations of dropped blocks may have been chained together.
+  if(jit->generation != cache->generation)
+    riscv_jit_reset(jit, cache);
+
+  if(jit->size + RISCV_JIT_MAX_BLOCK_SIZE > jit->capacity)
+    riscv_jit_reset(jit, cache);
+
+  while(len < block->len && __riscv_jit_supported(&block->instrs[len]))
+    len++;
+
+  if(len == 0)
+    return false;
+
+  byte* code = jit->base + jit->size;
+
+  // Leave to the interpreter if the budget does not cover the block.
+  __jit_budget(jit, 7, len); // cmp r12, len
+  byte* enough = __jit_jump(jit, 0x83); // jae
+  __jit_exit(jit, block->pc, 0);
+  __jit_patch(enough, jit->base + jit->size);
+  __jit_budget(jit, 5, len); // sub r12, len
+
+  for(unsigned int i = 0; i < len; i++)
+    __jit_instr(jit, block, i, len, i == len - 1 && !block->instrs[i].write_pc);
+
+  block->code = code;
+  return true;
+}
+
+unsigned int riscv_jit_run(riscv_jit_t* jit, system_t* sys, octa* regs, riscv_block_cache_t* cache, riscv_block_t* block, unsigned int budget, octa* pc)
+{
+  riscv_jit_ctx_t ctx;
+
+  if(block->code == NULL || jit->generation != cache->generation)
+    return 0;
+
+  ctx.budget = budget;
+  ctx.exit = NULL;
+  ctx.sys = sys;
+  ctx.cache = cache;
+
+  *pc = ((riscv_jit_entry_t) jit->base)(regs, &ctx, block->code);
+
+  // Chain the exit taken, if its target is translated.
+  if(ctx.exit != NULL && ctx.exit->jump != NULL && jit->generation == cache->generation)
+  {
+    riscv_block_t* target = riscv_block_cache_entry(cache, ctx.exit->target);
+
+    if(target->pc == ctx.exit->target && target->code != NULL)
+    {
+      __jit_patch(ctx.exit->jump, (byte*) target->code);
+      ctx.exit->jump = NULL;
+    }
+  }
+
+  return budget - (unsigned int) ctx.budget;
+}
+
+#else
+
+bool riscv_jit_create(riscv_jit_t* jit, size_t capacity)
+{
+  jit->base = NULL;
+  jit->size = jit->capacity = jit->start = 0;
+  return false;
+}
+
+void riscv_jit_destroy(riscv_jit_t* jit) {}
+void riscv_jit_reset(riscv_jit_t* jit, riscv_block_cache_t* cache) {}
+
+bool riscv_jit_compile(riscv_jit_t* jit, riscv_block_cache_t* cache, riscv_block_t* block)
+{
+  return false;
+}
+
+unsigned int riscv_jit_run(riscv_jit_t* jit, system_t* sys, octa* regs, riscv_block_cache_t* cache, riscv_block_t* block, unsigned int budget, octa* pc)
+{
+  return 0;
+}
+
+#endif
+
+#endif
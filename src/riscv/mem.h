@@ -0,0 +1,68 @@
+#ifndef __RISCV_MEM_H__
+#define __RISCV_MEM_H__
+
+#include "../../lib/common/include/types.h"
+#include "../memory/core.h"
+#include "../system.h"
+
+#include <string.h>
+
+/**
+ * \brief Copy len bytes between the guest memory at addr and buf (into the memory if store).
+ *
+ * \return false on a fault.
+ */
+static bool riscv_mem_copy(system_t* sys, octa addr, void* buf, size_t len, bool store);
+
+/**
+ * \brief Load or store of the core, to the guest memory or else to the device bound to addr.
+ *
+ * \return false on a fault.
+ */
+static bool riscv_mem_access(system_t* sys, octa addr, void* buf, size_t len, bool store);
+
+//////////
+// IMPL //
+//////////
+
+static bool riscv_mem_copy(system_t* sys, octa addr, void* buf, size_t len, bool store)
+{
+  void* paddr;
+  char exceptions = 0;
+
+  // Crossing a page: byte per byte
+  if(PAGE_OFFSET(addr) + len > PAGE_SIZE)
+  {
+    for(size_t i = 0; i < len; i++)
+      if(!riscv_mem_copy(sys, addr + i, (byte*) buf + i, 1, store)) return false;
+
+    return true;
+  }
+
+  // A store copies a shared page first
+  bool translated = store
+    ? mem_tl_write(&sys->mem, (void*)(uintptr_t) addr, &paddr, &exceptions)
+    : mem_tl(&sys->mem, (void*)(uintptr_t) addr, &paddr, &exceptions);
+
+  if(!translated)
+    return false;
+
+  if(store) memcpy(paddr, buf, len);
+  else memcpy(buf, paddr, len);
+
+  return true;
+}
+
+static bool riscv_mem_access(system_t* sys, octa addr, void* buf, size_t len, bool store)
+{
+  char exceptions = 0;
+
+  if(riscv_mem_copy(sys, addr, buf, len, store))
+    return true;
+
+  return store
+    ? mem_device_write(&sys->mem, (void*)(uintptr_t) addr, buf, len, &exceptions)
+    : mem_device_read(&sys->mem, (void*)(uintptr_t) addr, buf, len, &exceptions);
+}
+
+#endif
@@ -7,21 +7,51 @@
 #include "../processor/itf.h"
 #include "../system.h"
 #include "./pipeline/model.h"
+#include "./pipeline/predictor.h"
+#include "./ooo/model.h"
+#include "./block.h"
+#include "./jit.h"
 
 #define RISCV_START_ADDRESS 0x20000000
 
+// Default L1 geometry: 64 sets of 8 ways of 64-byte lines (32 KiB)
+#define RISCV_L1_LINE_SIZE 64
+#define RISCV_L1_SETS 64
+#define RISCV_L1_WAYS 8
+#define RISCV_L1_FILL_LATENCY 1
+
+typedef enum riscv_mode_t {
+    RISCV_MODE_PIPELINE,    // Cycle-level pipeline over the L1
+    RISCV_MODE_FUNCTIONAL   // Basic blocks run directly over the registers and the system memory
+} riscv_mode_t;
+
+// Timing model of the pipeline mode
+typedef enum riscv_core_t {
+    RISCV_CORE_IN_ORDER,    // Five-stage pipeline
+    RISCV_CORE_OUT_OF_ORDER // Reorder buffer, issue queue and load/store queue (see ooo/model.h)
+} riscv_core_t;
+
 typedef struct {
     octa regs[32];
     octa csrs[4096];
 
     octa pc;
 
+    // Current mode, and the one requested by riscv_set_mode
+    riscv_mode_t mode, next_mode;
+
+    riscv_core_t core;
     riscv_pipeline_t pipeline;
+    riscv_ooo_t ooo;
+    riscv_bp_t bp;
     processor_itf_t itf;
 
-    // L1 cache
+    // L1 cache, its lines and data are a single block from the system allocator
     data_cache_t l1;
-    data_cache_entry_t __l1_entries[1000000]; // 1 mo of cache 
+
+    // Functional mode
+    riscv_block_cache_t blocks;
+    riscv_jit_t jit; // Mapped by riscv_jit_enable
 
     // Simulation
     unsigned int frequency; // Hz
@@ -31,8 +61,25 @@ typedef struct {
 typedef struct riscv_processor_cfg_t {
   unsigned int frequency;
   unsigned int boot_address;
+  data_cache_cfg_t l1;
+  riscv_bp_cfg_t bp;
+  unsigned int issue_width; // Instructions per cycle of the pipeline, 1 to RISCV_MAX_ISSUE_WIDTH
+  riscv_core_t core;
 } riscv_processor_cfg_t;
 
+void riscv_processor_cfg_init(riscv_processor_cfg_t* cfg)
+{
+  cfg->frequency = 1000;
+  cfg->boot_address = 0;
+  cfg->l1.line_size = RISCV_L1_LINE_SIZE;
+  cfg->l1.sets = RISCV_L1_SETS;
+  cfg->l1.ways = RISCV_L1_WAYS;
+  cfg->l1.fill_latency = RISCV_L1_FILL_LATENCY;
+  riscv_bp_cfg_init(&cfg->bp);
+  cfg->issue_width = 1;
+  cfg->core = RISCV_CORE_IN_ORDER;
+}
+
 riscv_processor_t* __get_riscv_proc(system_t* sys)
 {
   return (riscv_processor_t*) (sys + 1);
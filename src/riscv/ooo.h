@@ -0,0 +1,7 @@
+#ifndef __RISCV_OOO_H__
+#define __RISCV_OOO_H__
+
+#include "./ooo/model.h"
+#include "./ooo/api.h"
+
+#endif
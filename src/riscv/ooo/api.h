@@ -0,0 +1,469 @@
+#ifndef __RISCV_OOO_API_H__
+#define __RISCV_OOO_API_H__
+
+#include "../model.h"
+#include "../opcode.h"
+#include "../instr.h"
+#include "../exec.h"
+#include "../pipeline/api.h"
+#include "./model.h"
+
+#include "../../../lib/common/include/transaction.h"
+
+/**
+ * \brief Empty the core, the general registers being the ones of proc->regs.
+ */
+void riscv_ooo_create(riscv_ooo_t* ooo, unsigned int width);
+
+/**
+ * \brief True if no instruction is in flight.
+ */
+bool riscv_ooo_drained(const riscv_ooo_t* ooo);
+
+void riscv_ooo_step(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction);
+
+static inline void riscv_ooo_memory(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction);
+static inline void riscv_ooo_issue(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction);
+static inline void riscv_ooo_dispatch(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction);
+static inline void riscv_ooo_fetch(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction);
+static inline void riscv_ooo_commit(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction);
+
+/**
+ * \brief Wake up the issue queue with the results of the cycle.
+ */
+static inline void riscv_ooo_wakeup(riscv_ooo_t* ooo);
+
+/**
+ * \brief Drop every instruction in flight, the ones after a mispredicted instruction.
+ */
+static inline void riscv_ooo_squash(riscv_ooo_t* ooo);
+
+static inline void __riscv_ooo_exec(riscv_ooo_t* ooo, unsigned int rob, octa a, octa b);
+static inline void __riscv_ooo_complete(riscv_ooo_t* ooo, unsigned int rob);
+static inline bool __riscv_ooo_is_serial(const riscv_decoded_instr_t* instr);
+static inline size_t __riscv_ooo_access_len(int op);
+static inline bool __riscv_ooo_load(riscv_processor_t* proc, riscv_ooo_t* ooo, unsigned int i, transaction_t* transaction);
+static inline void __riscv_ooo_write(transaction_t* transaction, octa* dest, octa value);
+
+//////////
+// IMPL //
+//////////
+
+void riscv_ooo_create(riscv_ooo_t* ooo, unsigned int width)
+{
+    ooo->fetch_head = ooo->fetch_count = 0;
+    ooo->rob_head = ooo->rob_count = 0;
+    ooo->lsq_head = ooo->lsq_count = 0;
+    ooo->completed_count = 0;
+    ooo->width = width;
+    ooo->retired = 0;
+
+    for(unsigned int i = 0; i < RISCV_OOO_IQ_SIZE; i++)
+        ooo->iq[i].valid = false;
+
+    for(unsigned int r = 0; r < 32; r++)
+        ooo->rat[r] = RISCV_OOO_NONE;
+}
+
+bool riscv_ooo_drained(const riscv_ooo_t* ooo)
+{
+    return ooo->rob_count == 0 && ooo->fetch_count == 0;
+}
+
+// Instructions over CSRs, and the ones changing the way instructions are fetched.
+static inline bool __riscv_ooo_is_serial(const riscv_decoded_instr_t* instr)
+{
+    return instr->sregs[0].type || instr->sregs[1].type || instr->dregs[0].type || instr->dregs[1].type
+        || instr->op == RISCV_FENCE_I || instr->op == RISCV_ECALL || instr->op == RISCV_WFI;
+}
+
+static inline size_t __riscv_ooo_access_len(int op)
+{
+    switch(op)
+    {
+        case RISCV_LBU: case RISCV_LB: case RISCV_SB: return sizeof(byte);
+        case RISCV_LHU: case RISCV_LH: case RISCV_SH: return sizeof(word);
+        case RISCV_LW: case RISCV_LWU: case RISCV_SW: return sizeof(tetra);
+        case RISCV_LD: case RISCV_SD: return sizeof(octa);
+        default: return 0;
+    }
+}
+
+static inline void __riscv_ooo_write(transaction_t* transaction, octa* dest, octa value)
+{
+    // In program order, the youngest write of the cycle wins even with the current value.
+    tst_log_invalid(transaction, dest, sizeof(octa));
+    tst_update_octa(transaction, dest, value);
+}
+
+static inline void __riscv_ooo_complete(riscv_ooo_t* ooo, unsigned int rob)
+{
+    ooo->rob[rob].done = true;
+    ooo->completed[ooo->completed_count++] = rob;
+}
+
+static inline void __riscv_ooo_exec(riscv_ooo_t* ooo, unsigned int rob, octa a, octa b)
+{
+    riscv_rob_entry_t* entry = &ooo->rob[rob];
+    riscv_decoded_instr_t* instr = &entry->instr;
+
+    entry->results[0] = entry->results[1] = 0;
+    entry->memory_op.op = 0;
+    entry->next_pc = entry->pc + 4;
+    entry->halt = riscv_exec(instr->op, a, instr->arg1_is_imm ? instr->imm : b, instr->imm, &entry->next_pc, entry->results, &entry->memory_op);
+}
+
+static inline void riscv_ooo_wakeup(riscv_ooo_t* ooo)
+{
+    for(unsigned int c = 0; c < ooo->completed_count; c++)
+    {
+        unsigned int rob = ooo->completed[c];
+
+        for(unsigned int i = 0; i < RISCV_OOO_IQ_SIZE; i++)
+        {
+            riscv_iq_entry_t* entry = &ooo->iq[i];
+
+            for(unsigned char j = 0; j < 2 && entry->valid; j++)
+            {
+                if(entry->tags[j] == rob)
+                    entry->values[j] = ooo->rob[rob].results[0], entry->tags[j] = RISCV_OOO_NONE;
+            }
+        }
+    }
+
+    ooo->completed_count = 0;
+}
+
+static inline void riscv_ooo_squash(riscv_ooo_t* ooo)
+{
+    ooo->fetch_count = 0;
+    ooo->rob_count = 0;
+    ooo->lsq_count = 0;
+    ooo->completed_count = 0;
+
+    for(unsigned int i = 0; i < RISCV_OOO_IQ_SIZE; i++)
+        ooo->iq[i].valid = false;
+
+    for(unsigned int r = 0; r < 32; r++)
+        ooo->rat[r] = RISCV_OOO_NONE;
+}
+
+// Load i of the queue, false if it has to wait.
+static inline bool __riscv_ooo_load(riscv_processor_t* proc, riscv_ooo_t* ooo, unsigned int i, transaction_t* transaction)
+{
+    riscv_lsq_entry_t* load = &ooo->lsq[(ooo->lsq_head + i) % RISCV_OOO_LSQ_SIZE];
+    riscv_rob_entry_t* entry = &ooo->rob[load->rob];
+    octa addr = entry->memory_op.addr;
+    octa value = 0;
+    bool forwarded = false;
+
+    // The older stores, the youngest wins.
+    for(unsigned int k = 0; k < i; k++)
+    {
+        riscv_lsq_entry_t* store = &ooo->lsq[(ooo->lsq_head + k) % RISCV_OOO_LSQ_SIZE];
+        riscv_rob_entry_t* older = &ooo->rob[store->rob];
+
+        if(!store->store)
+            continue;
+
+        if(!store->ready)
+            return false;
+
+        octa store_addr = older->memory_op.addr;
+
+        if(store_addr + store->len <= addr || addr + load->len <= store_addr)
+            continue;
+
+        // Partial overlap, wait for the store to reach the L1.
+        if(store_addr != addr || store->len != load->len)
+            return false;
+
+        value = older->results[0];
+        forwarded = true;
+    }
+
+    if(forwarded)
+    {
+        if(load->len < sizeof(octa))
+            value &= ((octa) 1 << (load->len * 8)) - 1;
+    }
+    else if(!riscv_pipeline_access(&proc->l1, entry->instr.op, addr, &value, transaction))
+    {
+        load->missed = true;
+        return false;
+    }
+
+    entry->results[0] = value;
+    __riscv_ooo_complete(ooo, load->rob);
+
+    return true;
+}
+
+static inline void riscv_ooo_memory(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction)
+{
+    unsigned int waiting = RISCV_OOO_NONE;
+
+    // The oldest load ready, a single L1 port. The loads which missed wait for their line, the younger ones go on.
+    for(unsigned int i = 0; i < ooo->lsq_count; i++)
+    {
+        riscv_lsq_entry_t* load = &ooo->lsq[(ooo->lsq_head + i) % RISCV_OOO_LSQ_SIZE];
+
+        if(load->store || !load->ready || ooo->rob[load->rob].done)
+            continue;
+
+        if(load->missed && data_cache_pending(&proc->l1, ooo->rob[load->rob].memory_op.addr))
+        {
+            if(waiting == RISCV_OOO_NONE) waiting = i;
+            continue;
+        }
+
+        __riscv_ooo_load(proc, ooo, i, transaction);
+        return;
+    }
+
+    // Idle port
+    if(waiting != RISCV_OOO_NONE)
+        __riscv_ooo_load(proc, ooo, waiting, transaction);
+}
+
+static inline void riscv_ooo_issue(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction)
+{
+    for(unsigned int n = 0; n < ooo->width; n++)
+    {
+        riscv_iq_entry_t* oldest = NULL;
+        unsigned int age = RISCV_OOO_ROB_SIZE;
+
+        for(unsigned int i = 0; i < RISCV_OOO_IQ_SIZE; i++)
+        {
+            riscv_iq_entry_t* entry = &ooo->iq[i];
+
+            if(!entry->valid || entry->tags[0] != RISCV_OOO_NONE || entry->tags[1] != RISCV_OOO_NONE)
+                continue;
+
+            unsigned int entry_age = (entry->rob + RISCV_OOO_ROB_SIZE - ooo->rob_head) % RISCV_OOO_ROB_SIZE;
+
+            if(entry_age < age)
+                oldest = entry, age = entry_age;
+        }
+
+        if(oldest == NULL)
+            return;
+
+        oldest->valid = false;
+        __riscv_ooo_exec(ooo, oldest->rob, oldest->values[0], oldest->values[1]);
+
+        riscv_rob_entry_t* entry = &ooo->rob[oldest->rob];
+
+        // Loads wait for the memory stage, stores for the commit.
+        if(entry->memory_op.op != 0)
+        {
+            for(unsigned int i = 0; i < ooo->lsq_count; i++)
+            {
+                riscv_lsq_entry_t* access = &ooo->lsq[(ooo->lsq_head + i) % RISCV_OOO_LSQ_SIZE];
+
+                if(access->rob == oldest->rob)
+                    access->ready = true;
+            }
+        }
+
+        if(entry->memory_op.op != 2)
+            __riscv_ooo_complete(ooo, oldest->rob);
+    }
+}
+
+static inline void riscv_ooo_dispatch(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction)
+{
+    for(unsigned int n = 0; n < ooo->width && ooo->fetch_count > 0 && ooo->rob_count < RISCV_OOO_ROB_SIZE; n++)
+    {
+        riscv_ooo_fetched_t* fetched = &ooo->fetched[ooo->fetch_head];
+        riscv_decoded_instr_t instr = decode(fetched->raw);
+        size_t len = __riscv_ooo_access_len(instr.op);
+        bool serial = __riscv_ooo_is_serial(&instr);
+        riscv_iq_entry_t* slot = NULL;
+
+        if(len != 0 && ooo->lsq_count == RISCV_OOO_LSQ_SIZE)
+            return;
+
+        for(unsigned int i = 0; i < RISCV_OOO_IQ_SIZE && !serial && slot == NULL; i++)
+        {
+            if(!ooo->iq[i].valid)
+                slot = &ooo->iq[i];
+        }
+
+        if(!serial && slot == NULL)
+            return;
+
+        unsigned int rob = (ooo->rob_head + ooo->rob_count) % RISCV_OOO_ROB_SIZE;
+        riscv_rob_entry_t* entry = &ooo->rob[rob];
+
+        entry->instr = instr;
+        entry->pc = fetched->pc;
+        entry->prediction = fetched->prediction;
+        entry->done = false;
+        entry->serial = serial;
+        entry->halt = false;
+
+        // Rename the sources: the registers, or the instructions in flight writing them
+        if(slot != NULL)
+        {
+            slot->valid = true;
+            slot->rob = rob;
+
+            for(unsigned char j = 0; j < 2; j++)
+            {
+                unsigned int reg = (unsigned int) instr.sregs[j].addr;
+                unsigned int producer = reg == 0 ? RISCV_OOO_NONE : ooo->rat[reg];
+
+                slot->tags[j] = RISCV_OOO_NONE;
+                slot->values[j] = proc->regs[reg];
+
+                if(producer != RISCV_OOO_NONE && ooo->rob[producer].done)
+                    slot->values[j] = ooo->rob[producer].results[0];
+                else if(producer != RISCV_OOO_NONE)
+                    slot->tags[j] = producer;
+            }
+        }
+
+        if(len != 0)
+        {
+            riscv_lsq_entry_t* access = &ooo->lsq[(ooo->lsq_head + ooo->lsq_count) % RISCV_OOO_LSQ_SIZE];
+
+            access->rob = rob;
+            access->len = len;
+            access->store = __riscv_pipeline_is_store(instr.op);
+            access->ready = false;
+            access->missed = false;
+            ooo->lsq_count++;
+        }
+
+        if(instr.dregs[0].type == 0 && instr.dregs[0].addr != 0)
+            ooo->rat[instr.dregs[0].addr] = rob;
+
+        ooo->rob_count++;
+        ooo->fetch_head = (ooo->fetch_head + 1) % RISCV_OOO_FETCH_QUEUE_SIZE;
+        ooo->fetch_count--;
+    }
+}
+
+static inline void riscv_ooo_fetch(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction)
+{
+    // Drain the core before switching modes
+    if(proc->next_mode != proc->mode)
+        return;
+
+    octa pc = proc->pc;
+
+    // Consecutive instructions, up to a cache miss or a jump predicted taken
+    for(unsigned int n = 0; n < ooo->width && ooo->fetch_count < RISCV_OOO_FETCH_QUEUE_SIZE; n++)
+    {
+        tetra raw;
+
+        if(!data_cache_read_tetra(&proc->l1, pc, &raw, transaction))
+            break;
+
+        riscv_ooo_fetched_t* fetched = &ooo->fetched[(ooo->fetch_head + ooo->fetch_count) % RISCV_OOO_FETCH_QUEUE_SIZE];
+
+        fetched->pc = pc;
+        fetched->raw = raw;
+        fetched->prediction = riscv_bp_predict(&proc->bp, pc, raw);
+        ooo->fetch_count++;
+
+        pc = fetched->prediction.target;
+
+        if(pc != fetched->pc + 4)
+            break;
+    }
+
+    tst_update_octa(transaction, &proc->pc, pc);
+}
+
+static inline void riscv_ooo_commit(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction)
+{
+    bool stored = false;
+
+    for(unsigned int n = 0; n < ooo->width && ooo->rob_count > 0; n++)
+    {
+        unsigned int rob = ooo->rob_head;
+        riscv_rob_entry_t* entry = &ooo->rob[rob];
+        riscv_decoded_instr_t* instr = &entry->instr;
+
+        // Alone at the head, over the state committed by the previous cycles
+        if(entry->serial && !entry->done)
+        {
+            if(n == 0)
+            {
+                octa a = instr->sregs[0].type == 0 ? proc->regs[instr->sregs[0].addr] : proc->csrs[instr->sregs[0].addr];
+                octa b = instr->sregs[1].type == 0 ? proc->regs[instr->sregs[1].addr] : proc->csrs[instr->sregs[1].addr];
+
+                __riscv_ooo_exec(ooo, rob, a, b);
+                __riscv_ooo_complete(ooo, rob);
+                riscv_ooo_wakeup(ooo);
+            }
+
+            return;
+        }
+
+        if(!entry->done)
+            return;
+
+        // Stores reach the L1 in order, one per cycle, waiting for a miss to be filled.
+        if(entry->memory_op.op == 1)
+        {
+            if(stored || !riscv_pipeline_access(&proc->l1, instr->op, entry->memory_op.addr, &entry->results[0], transaction))
+                return;
+
+            stored = true;
+        }
+
+        for(unsigned char i = 0; i < 2; i++)
+        {
+            if(instr->dregs[i].type == 0 && instr->dregs[i].addr == 0)
+                continue;
+
+            octa* reg = instr->dregs[i].type == 0 ? &proc->regs[instr->dregs[i].addr] : &proc->csrs[instr->dregs[i].addr];
+            __riscv_ooo_write(transaction, reg, entry->results[i]);
+        }
+
+        if(instr->dregs[0].type == 0 && ooo->rat[instr->dregs[0].addr] == rob)
+            ooo->rat[instr->dregs[0].addr] = RISCV_OOO_NONE;
+
+        if(entry->memory_op.op != 0)
+        {
+            ooo->lsq_head = (ooo->lsq_head + 1) % RISCV_OOO_LSQ_SIZE;
+            ooo->lsq_count--;
+        }
+
+        ooo->rob_head = (ooo->rob_head + 1) % RISCV_OOO_ROB_SIZE;
+        ooo->rob_count--;
+        ooo->retired++;
+
+        if(entry->halt)
+        {
+            sys_halt(sys);
+            return;
+        }
+
+        // Mispredicted, fetch the target. Overrides the pc fetched this cycle.
+        if(!riscv_bp_update(&proc->bp, entry->pc, instr->op, &entry->prediction, entry->next_pc))
+        {
+            riscv_ooo_squash(ooo);
+            __riscv_ooo_write(transaction, &proc->pc, entry->next_pc);
+            return;
+        }
+    }
+}
+
+void riscv_ooo_step(system_t* sys, riscv_processor_t* proc, riscv_ooo_t* ooo, transaction_t* transaction)
+{
+    riscv_ooo_memory(sys, proc, ooo, transaction);
+    riscv_ooo_issue(sys, proc, ooo, transaction);
+
+    // Results of the cycle, to the next one
+    riscv_ooo_wakeup(ooo);
+
+    riscv_ooo_dispatch(sys, proc, ooo, transaction);
+    riscv_ooo_fetch(sys, proc, ooo, transaction);
+    riscv_ooo_commit(sys, proc, ooo, transaction);
+}
+
+#endif
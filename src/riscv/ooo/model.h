@@ -0,0 +1,104 @@
+#ifndef __RISCV_OOO_MODEL_H__
+#define __RISCV_OOO_MODEL_H__
+
+#include "../../../lib/common/include/types.h"
+
+#include "../instr.h"
+#include "../pipeline/model.h"
+
+/**
+ * Out-of-order core, next to the in-order pipeline.
+ *
+ * Each cycle:
+ *
+ *   memory   : the load/store queue sends a load whose address is known to the L1, or
+ *              forwards it the data of an older store to the same address; the loads
+ *              which missed wait for their line while the younger ones go on (hit under miss);
+ *   issue    : up to width instructions whose operands are ready leave the issue queue,
+ *              the oldest first, and run riscv_exec;
+ *   dispatch : up to width instructions of the fetch queue are decoded, renamed and
+ *              entered in the reorder buffer, the issue queue and the load/store queue;
+ *   fetch    : up to width instructions are read from the L1, through the branch predictor;
+ *   commit   : up to width instructions leave the head of the reorder buffer, in order,
+ *              and write the registers, the CSRs and (stores) the L1.
+ *
+ * The general registers are renamed to the reorder buffer entries of the instructions
+ * writing them: a source is read from proc->regs when no instruction in flight writes it,
+ * from the entry of the youngest one otherwise, or waits for its result. The results of a
+ * cycle wake up the issue queue at the end of the cycle.
+ *
+ * The predictions are checked at commit: a miss squashes the younger instructions and
+ * redirects the fetch. The instructions over CSRs run alone at the head of the reorder
+ * buffer, over the architectural state.
+ */
+#define RISCV_OOO_ROB_SIZE 32
+#define RISCV_OOO_IQ_SIZE 16
+#define RISCV_OOO_LSQ_SIZE 16
+#define RISCV_OOO_FETCH_QUEUE_SIZE 8
+
+// No instruction in flight
+#define RISCV_OOO_NONE ((unsigned int) -1)
+
+typedef struct {
+  octa pc;
+  tetra raw;
+  riscv_prediction_t prediction;
+} riscv_ooo_fetched_t;
+
+typedef struct {
+  riscv_decoded_instr_t instr;
+  octa pc; // Address of the instruction
+  riscv_prediction_t prediction;
+
+  bool done, serial, halt;
+  octa results[2];
+  octa next_pc;
+  riscv_memory_op_t memory_op;
+} riscv_rob_entry_t;
+
+typedef struct {
+  bool valid;
+  unsigned int rob;
+
+  // Operands, known once their tag is RISCV_OOO_NONE
+  octa values[2];
+  unsigned int tags[2];
+} riscv_iq_entry_t;
+
+typedef struct {
+  unsigned int rob;
+  size_t len;
+  bool store;
+  bool ready; // Address known, and the data of a store
+  bool missed; // Load waiting for its line
+} riscv_lsq_entry_t;
+
+typedef struct {
+  // Fetch queue
+  riscv_ooo_fetched_t fetched[RISCV_OOO_FETCH_QUEUE_SIZE];
+  unsigned int fetch_head, fetch_count;
+
+  // Reorder buffer, in program order
+  riscv_rob_entry_t rob[RISCV_OOO_ROB_SIZE];
+  unsigned int rob_head, rob_count;
+
+  riscv_iq_entry_t iq[RISCV_OOO_IQ_SIZE];
+
+  // Load/store queue, in program order
+  riscv_lsq_entry_t lsq[RISCV_OOO_LSQ_SIZE];
+  unsigned int lsq_head, lsq_count;
+
+  // Youngest entry of the reorder buffer writing each general register
+  unsigned int rat[32];
+
+  // Entries done this cycle, to wake up the issue queue
+  unsigned int completed[RISCV_OOO_ROB_SIZE];
+  unsigned int completed_count;
+
+  unsigned int width;
+
+  // Instructions committed
+  octa retired;
+} riscv_ooo_t;
+
+#endif
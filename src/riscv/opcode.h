@@ -20,7 +20,9 @@ typedef enum riscv_opcode_t {
     // RV32M Standard Extension
     RISCV_MUL, RISCV_MULH, RISCV_MULHSU, RISCV_MULHU, RISCV_DIV, RISCV_DIVU, RISCV_REM, RISCV_REMU,
     // RV64M Standard Extension
-    RISCV_MULW, RISCV_DIVW, RISCV_DIVUW, RISCV_REMW, RISCV_REMUW 
+    RISCV_MULW, RISCV_DIVW, RISCV_DIVUW, RISCV_REMW, RISCV_REMUW,
+    // Privileged Instruction Set
+    RISCV_WFI
 } riscv_opcode_t;
 
 #define ARG0_IS_RS1             0b010 
@@ -50,12 +52,12 @@ struct riscv_instr_info_t riscv_instr_infos[] = {
     {"AUIPC",   ARG1_IS_IMMEDIATE | OUT0_WRITE_REG}, 
     {"JAL",     ARG1_IS_IMMEDIATE | OUT0_WRITE_REG | WRITE_PC}, 
     {"JALR",    ARG0_IS_RS1 | ARG1_IS_IMMEDIATE | OUT0_WRITE_REG | WRITE_PC},
-    {"BEQ",     ARG0_IS_RS1 | ARG1_IS_RS2 | OUT0_WRITE_REG | WRITE_PC}, 
-    {"BNE",     ARG0_IS_RS1 | ARG1_IS_RS2 | OUT0_WRITE_REG | WRITE_PC}, 
-    {"BLT",     ARG0_IS_RS1 | ARG1_IS_RS2 | OUT0_WRITE_REG | WRITE_PC}, 
-    {"BGE",     ARG0_IS_RS1 | ARG1_IS_RS2 | OUT0_WRITE_REG | WRITE_PC}, 
-    {"BLTU",    ARG0_IS_RS1 | ARG1_IS_RS2 | OUT0_WRITE_REG | WRITE_PC}, 
-    {"BGEU",    ARG0_IS_RS1 | ARG1_IS_RS2 | OUT0_WRITE_REG | WRITE_PC},
+    {"BEQ",     ARG0_IS_RS1 | ARG1_IS_RS2 | WRITE_PC}, 
+    {"BNE",     ARG0_IS_RS1 | ARG1_IS_RS2 | WRITE_PC}, 
+    {"BLT",     ARG0_IS_RS1 | ARG1_IS_RS2 | WRITE_PC}, 
+    {"BGE",     ARG0_IS_RS1 | ARG1_IS_RS2 | WRITE_PC}, 
+    {"BLTU",    ARG0_IS_RS1 | ARG1_IS_RS2 | WRITE_PC}, 
+    {"BGEU",    ARG0_IS_RS1 | ARG1_IS_RS2 | WRITE_PC},
     {"LB",      ARG0_IS_RS1 | ARG1_IS_IMMEDIATE | OUT0_WRITE_REG}, 
     {"LH",      ARG0_IS_RS1 | ARG1_IS_IMMEDIATE | OUT0_WRITE_REG}, 
     {"LW",      ARG0_IS_RS1 | ARG1_IS_IMMEDIATE | OUT0_WRITE_REG}, 
@@ -106,7 +108,8 @@ struct riscv_instr_info_t riscv_instr_infos[] = {
     {"CSRRSI", 0}, 
     {"CSRRCI", 0},
     {"MUL", 0}, {"MULH", 0}, {"MULHSU", 0}, {"MULHU", 0}, {"DIV", 0}, {"DIVU", 0}, {"REM", 0}, {"REMU", 0},
-    {"MULW", 0}, {"DIVW", 0}, {"DIVUW", 0}, {"REMW", 0}, {"REMUW", 0} 
+    {"MULW", 0}, {"DIVW", 0}, {"DIVUW", 0}, {"REMW", 0}, {"REMUW", 0},
+    {"WFI", 0}
 };
 
 #endif
\ No newline at end of file
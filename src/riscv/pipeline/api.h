@@ -5,7 +5,9 @@
 #include "../opcode.h"
 #include "../instr.h"
 #include "../csr.h"
+#include "../exec.h"
 #include "./model.h"
+#include "./predictor.h"
 
 #include "../../../lib/common/include/transaction.h"
 #include "../../../lib/common/include/alu.h"
@@ -17,25 +19,106 @@ void riscv_pipeline_stage_execute_create(riscv_stage_execute_t* execute);
 void riscv_pipeline_stage_memory_create(riscv_stage_memory_t* memory);
 void riscv_pipeline_stage_writeback_create(riscv_stage_writeback_t* writeback);
 
-void riscv_pipeline_create(riscv_pipeline_t* pipeline);
+void riscv_pipeline_create(riscv_pipeline_t* pipeline, unsigned int width);
 
 static inline void riscv_stage_fetch_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
-static inline void riscv_stage_decode_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
-static inline void riscv_stage_read_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
-static inline void riscv_stage_execute_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
-static inline void riscv_stage_memory_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
-static inline void riscv_stage_writeback_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
+static inline void riscv_stage_decode_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane);
+static inline void riscv_stage_read_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane);
+static inline void riscv_stage_execute_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane);
+
+/**
+ * \brief Access the L1, a load miss going to the miss buffer.
+ *
+ * \return false if the pipeline stalls on the access, the lane then stays in the memory stage.
+ */
+static inline bool riscv_stage_memory_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane);
+static inline void riscv_stage_writeback_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane);
 
 void riscv_pipeline_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
 
-void riscv_pipeline_create(riscv_pipeline_t* pipeline)
+/**
+ * \brief Bypass network: forward a result not yet written back to a source register.
+ *
+ * The results of the execute stage are forwarded from the Execute/Memory register, except
+ * the ones of loads, known at the end of the memory stage; the results of the memory stage
+ * from the Memory/Writeback register. The read stage gets both, as the registers are only
+ * written at the end of the writeback cycle, and the execute stage gets them again for the
+ * instructions which were still ahead of the read stage.
+ *
+ * Within a stage, the youngest lane wins.
+ *
+ * \return true if value was forwarded.
+ */
+static inline bool riscv_pipeline_forward(riscv_pipeline_regs_t* regs, riscv_reg_addr_t sreg, octa* value);
+
+/**
+ * \brief Access the L1 for a load or a store, the loaded bytes go to the low bytes of data.
+ *
+ * \return false on a cache miss.
+ */
+static inline bool riscv_pipeline_access(data_cache_t* l1, int op, octa addr, octa* data, transaction_t* transaction);
+
+/**
+ * \brief Issue the lanes of the read stage, in order, up to the first one which cannot go to execute this cycle.
+ *
+ * A lane waits for the results it needs which cannot be forwarded yet (scoreboard), among them the ones of
+ * the older lanes of its group. A group holds a single memory access (one L1 port), and the instructions
+ * over CSRs are issued alone.
+ *
+ * \return The number of lanes issued, bubbles included.
+ */
+static inline unsigned int riscv_pipeline_issue(riscv_pipeline_t* pipeline);
+
+/**
+ * \brief Hold the stages up to memory, from the lane of the memory stage which cannot access the L1.
+ *
+ * The older lanes of the memory stage go to writeback, and the operands of the execute stage
+ * get the results written back this cycle.
+ */
+static inline void riscv_pipeline_stall(riscv_pipeline_t* pipeline, unsigned int lane);
+
+/**
+ * \brief Write back the loads of the miss buffer whose line is in the L1.
+ */
+static inline void riscv_pipeline_complete_misses(riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction);
+
+static inline bool __riscv_pipeline_park(riscv_pipeline_t* pipeline, const riscv_stage_memory_t* memory);
+static inline bool __riscv_pipeline_missing_line(riscv_processor_t* proc, riscv_pipeline_t* pipeline, octa addr);
+static inline bool __riscv_pipeline_missing(riscv_pipeline_t* pipeline);
+static inline bool __riscv_pipeline_filling(riscv_processor_t* proc, riscv_pipeline_t* pipeline);
+
+static inline bool __riscv_pipeline_is_load(int op);
+static inline bool __riscv_pipeline_is_store(int op);
+
+void riscv_pipeline_create(riscv_pipeline_t* pipeline, unsigned int width)
 {
-    riscv_pipeline_stage_fetch_create(&pipeline->fetch);
-    riscv_pipeline_stage_decode_create(&pipeline->decode);
-    riscv_pipeline_stage_read_create(&pipeline->read);
-    riscv_pipeline_stage_execute_create(&pipeline->execute);
-    riscv_pipeline_stage_memory_create(&pipeline->memory);
-    riscv_pipeline_stage_writeback_create(&pipeline->writeback);  
+    riscv_pipeline_stage_fetch_create(&pipeline->current.fetch);
+
+    for(unsigned int i = 0; i < RISCV_MAX_ISSUE_WIDTH; i++)
+    {
+        riscv_pipeline_stage_decode_create(&pipeline->current.decode[i]);
+        riscv_pipeline_stage_read_create(&pipeline->current.read[i]);
+        riscv_pipeline_stage_execute_create(&pipeline->current.execute[i]);
+        riscv_pipeline_stage_memory_create(&pipeline->current.memory[i]);
+        riscv_pipeline_stage_writeback_create(&pipeline->current.writeback[i]);
+
+        // Lanes over the issue width stay empty
+        if(i >= width)
+        {
+            pipeline->current.decode[i].control.invalid = true;
+            pipeline->current.read[i].control.invalid = true;
+            pipeline->current.execute[i].control.invalid = true;
+            pipeline->current.memory[i].control.invalid = true;
+            pipeline->current.writeback[i].control.invalid = true;
+        }
+    }
+
+    pipeline->next = pipeline->current;
+    pipeline->width = width;
+    pipeline->retired = 0;
+
+    memset(&pipeline->scoreboard, 0, sizeof(pipeline->scoreboard));
+    memset(pipeline->misses, 0, sizeof(pipeline->misses));
 }
 
 void riscv_load_csr(system_t* sys, riscv_processor_t* proc, unsigned int addr, octa* out)
@@ -63,6 +146,7 @@ void riscv_pipeline_stage_decode_create(riscv_stage_decode_t* decode)
 {
   decode->pc = 0;
   decode->raw = 0;
+  decode->prediction = (riscv_prediction_t) {0, 0, 0, RISCV_BP_SOURCE_NONE};
   decode->control.stall = false;
   decode->control.invalid = false;
   decode->debug.current_pc = 0;
@@ -70,7 +154,9 @@ void riscv_pipeline_stage_decode_create(riscv_stage_decode_t* decode)
 void riscv_pipeline_stage_read_create(riscv_stage_read_t* read)
 {
     read->pc = 0;
+    read->prediction = (riscv_prediction_t) {0, 0, 0, RISCV_BP_SOURCE_NONE};
     read->control.imm = 0;
+    read->control.op = 0;
     read->control.sregs[0].addr = 0;
     read->control.sregs[0].type = 0;
     read->control.sregs[1].addr = 0;
@@ -90,6 +176,7 @@ void riscv_pipeline_stage_execute_create(riscv_stage_execute_t* execute)
     execute->args[0] = 0;
     execute->args[1] = 0;
     execute->pc = 0;
+    execute->prediction = (riscv_prediction_t) {0, 0, 0, RISCV_BP_SOURCE_NONE};
     execute->control.imm = 0;
     execute->control.op = 0;
     execute->control.sregs[0].addr = 0;
@@ -140,140 +227,139 @@ void riscv_pipeline_stage_writeback_create(riscv_stage_writeback_t* writeback)
 
 static inline void riscv_stage_fetch_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
 {
-    riscv_stage_fetch_t* in     = &pipeline->fetch;
-    riscv_stage_decode_t* out   = &pipeline->decode;
+    riscv_stage_fetch_t* in     = &pipeline->current.fetch;
 
     if(in->control.stall)
-        return;        
+        return;
+
+    // Drain the pipeline before switching modes
+    if(proc->next_mode != proc->mode)
+    {
+        for(unsigned int i = 0; i < pipeline->width; i++)
+            riscv_latch(pipeline, decode[i].control.invalid, true);
 
-    tetra raw;
+        return;
+    }
 
-    bool cache_miss = data_cache_read_tetra(&proc->l1, proc->pc, &raw, transaction);
+    octa pc = proc->pc;
+    bool fetching = true;
 
-    // We have a cache miss, we need to fetch data
-    if(cache_miss) 
+    // Consecutive instructions, up to a cache miss or a jump predicted taken
+    for(unsigned int i = 0; i < pipeline->width; i++)
     {
-        tst_update_tetra(transaction, &out->raw, 0);
-    } else {
-        tst_update_octa(transaction, &proc->pc, proc->pc + 4);
-        tst_update_octa(transaction, &out->debug.current_pc, proc->pc);
-        tst_update_octa(transaction, &out->pc, proc->pc + 4);
-        tst_update_tetra(transaction, &out->raw, raw);
-        tst_update_bool(transaction, &out->control.invalid, false);
+        tetra raw;
+
+        if(fetching && data_cache_read_tetra(&proc->l1, pc, &raw, transaction))
+        {
+            riscv_prediction_t prediction = riscv_bp_predict(&proc->bp, pc, raw);
+
+            pipeline->next.decode[i].prediction = prediction;
+            riscv_latch(pipeline, decode[i].debug.current_pc, pc);
+            riscv_latch(pipeline, decode[i].pc, pc + 4);
+            riscv_latch(pipeline, decode[i].raw, raw);
+            riscv_latch(pipeline, decode[i].control.invalid, false);
+
+            fetching = prediction.target == pc + 4;
+            pc = prediction.target;
+        }
+        else
+        {
+            fetching = false;
+            riscv_latch(pipeline, decode[i].control.invalid, true);
+        }
     }
+
+    tst_update_octa(transaction, &proc->pc, pc);
 }
-static inline void riscv_stage_decode_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
+static inline void riscv_stage_decode_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane)
 {
-    riscv_stage_decode_t* in = &pipeline->decode;
-    riscv_stage_read_t* out = &pipeline->read;
+    riscv_stage_decode_t* in = &pipeline->current.decode[lane];
 
     if(in->control.stall)
         return;
 
-    tst_update_bool(transaction, &out->control.invalid, in->control.invalid);
+    riscv_latch(pipeline, read[lane].control.invalid, in->control.invalid);
 
     if(in->control.invalid)
         return;
 
     // Setup control
     riscv_decoded_instr_t decoded = decode(in->raw);
-    
-    tst_update_int(transaction, &out->control.op, decoded.op);
-    tst_update_char(transaction, &out->control.sregs[0].type, decoded.sregs[0].type);
-    tst_update_int(transaction, &out->control.sregs[0].addr, decoded.sregs[0].addr);
-    tst_update_char(transaction, &out->control.sregs[1].type, decoded.sregs[1].type);
-    tst_update_int(transaction, &out->control.sregs[1].addr, decoded.sregs[1].addr);
-    tst_update_char(transaction, &out->control.dregs[0].type, decoded.dregs[0].type);
-    tst_update_int(transaction, &out->control.dregs[0].addr, decoded.dregs[0].addr);
-    tst_update_char(transaction, &out->control.dregs[1].type, decoded.dregs[1].type);
-    tst_update_int(transaction, &out->control.dregs[1].addr, decoded.dregs[1].addr);
-    tst_update_bool(transaction, &out->control.arg1_is_imm, decoded.arg1_is_imm);
+
+    riscv_latch(pipeline, read[lane].control.op, decoded.op);
+    riscv_latch(pipeline, read[lane].control.sregs[0].type, decoded.sregs[0].type);
+    riscv_latch(pipeline, read[lane].control.sregs[0].addr, decoded.sregs[0].addr);
+    riscv_latch(pipeline, read[lane].control.sregs[1].type, decoded.sregs[1].type);
+    riscv_latch(pipeline, read[lane].control.sregs[1].addr, decoded.sregs[1].addr);
+    riscv_latch(pipeline, read[lane].control.dregs[0].type, decoded.dregs[0].type);
+    riscv_latch(pipeline, read[lane].control.dregs[0].addr, decoded.dregs[0].addr);
+    riscv_latch(pipeline, read[lane].control.dregs[1].type, decoded.dregs[1].type);
+    riscv_latch(pipeline, read[lane].control.dregs[1].addr, decoded.dregs[1].addr);
+    riscv_latch(pipeline, read[lane].control.arg1_is_imm, decoded.arg1_is_imm);
 
     // Fill the control block
-    tst_update_octa(transaction, &out->pc, in->pc);
-    tst_update_octa(transaction, &out->control.imm, decoded.imm);
-    tst_update_bool(transaction, &out->control.write_pc, decoded.write_pc);
+    riscv_latch(pipeline, read[lane].pc, in->pc);
+    pipeline->next.read[lane].prediction = in->prediction;
+    riscv_latch(pipeline, read[lane].control.imm, decoded.imm);
+    riscv_latch(pipeline, read[lane].control.write_pc, decoded.write_pc);
 
     // Fill the debug block
-    tst_update_octa(transaction, &out->debug.current_pc, in->debug.current_pc);
-
-    // Check any data hazards
-    riscv_reg_addr_t forward_regs[6] = {
-       pipeline->execute.control.dregs[0],
-       pipeline->execute.control.dregs[1],
-       pipeline->memory.control.dregs[0],
-       pipeline->memory.control.dregs[1],
-       pipeline->writeback.control.dregs[0], 
-       pipeline->writeback.control.dregs[1]
-    };
-
-    for(unsigned char i = 0; i < 6; i++) 
-    {
-        for(unsigned char j = 0; j < 2; j++) 
-        {
-            if(forward_regs[i].addr == 0 && forward_regs[i].type == 0)
-                continue;
- 
-            // Data hazard !
-            if(forward_regs[i].type == pipeline->read.control.sregs[j].type && forward_regs[i].addr == pipeline->read.control.sregs[j].addr) 
-            {
-                tst_update_bool(transaction, &pipeline->fetch.control.stall,    true);
-                tst_update_bool(transaction, &pipeline->decode.control.stall,   true);
-                tst_update_bool(transaction, &pipeline->read.control.stall,     true);
-                break;
-            }
-        }
-    }
+    riscv_latch(pipeline, read[lane].debug.current_pc, in->debug.current_pc);
 }
-static inline void riscv_stage_read_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
+static inline void riscv_stage_read_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane)
 {
-    riscv_stage_read_t* in = &pipeline->read;
-    riscv_stage_execute_t* out = &pipeline->execute;
+    riscv_stage_read_t* in = &pipeline->current.read[lane];
 
     if(in->control.stall)
         return;
 
-    tst_update_bool(transaction, &out->control.invalid, in->control.invalid);
+    riscv_latch(pipeline, execute[lane].control.invalid, in->control.invalid);
 
-    if(in->control.invalid) 
+    if(in->control.invalid)
         return;
 
-    // Read registers
-    tst_update_octa(transaction, &out->args[0], in->control.sregs[0].type == 0 ? proc->regs[in->control.sregs[0].addr]: proc->csrs[in->control.sregs[0].addr]);
-    tst_update_octa(transaction, &out->args[1], in->control.sregs[1].type == 0 ? proc->regs[in->control.sregs[1].addr]: proc->csrs[in->control.sregs[1].addr]);
+    // Read registers, or the results in flight
+    for(unsigned char j = 0; j < 2; j++)
+    {
+        riscv_reg_addr_t sreg = in->control.sregs[j];
+        octa value = sreg.type == 0 ? proc->regs[sreg.addr]: proc->csrs[sreg.addr];
+
+        riscv_pipeline_forward(&pipeline->current, sreg, &value);
+        riscv_latch(pipeline, execute[lane].args[j], value);
+    }
 
     // Copy target
-    tst_update_octa(transaction, &out->pc, in->pc);
+    riscv_latch(pipeline, execute[lane].pc, in->pc);
+    pipeline->next.execute[lane].prediction = in->prediction;
 
     // Transfer control to control
-    tst_update_int(transaction, &out->control.op, in->control.op);
-
-    tst_update_char(transaction, &out->control.sregs[0].type, in->control.sregs[0].type);
-    tst_update_int(transaction, &out->control.sregs[0].addr, in->control.sregs[0].addr);
-    tst_update_char(transaction, &out->control.sregs[1].type, in->control.sregs[1].type);
-    tst_update_int(transaction, &out->control.sregs[1].addr, in->control.sregs[1].addr);
-    tst_update_char(transaction, &out->control.dregs[0].type, in->control.dregs[0].type);
-    tst_update_int(transaction, &out->control.dregs[0].addr, in->control.dregs[0].addr);
-    tst_update_char(transaction, &out->control.dregs[1].type, in->control.dregs[1].type);
-    tst_update_int(transaction, &out->control.dregs[1].addr, in->control.dregs[1].addr);
-    tst_update_octa(transaction, &out->control.imm, in->control.imm);
-    tst_update_bool(transaction, &out->control.write_pc, in->control.write_pc);
-    tst_update_bool(transaction, &out->control.arg1_is_imm, in->control.arg1_is_imm);
+    riscv_latch(pipeline, execute[lane].control.op, in->control.op);
+
+    riscv_latch(pipeline, execute[lane].control.sregs[0].type, in->control.sregs[0].type);
+    riscv_latch(pipeline, execute[lane].control.sregs[0].addr, in->control.sregs[0].addr);
+    riscv_latch(pipeline, execute[lane].control.sregs[1].type, in->control.sregs[1].type);
+    riscv_latch(pipeline, execute[lane].control.sregs[1].addr, in->control.sregs[1].addr);
+    riscv_latch(pipeline, execute[lane].control.dregs[0].type, in->control.dregs[0].type);
+    riscv_latch(pipeline, execute[lane].control.dregs[0].addr, in->control.dregs[0].addr);
+    riscv_latch(pipeline, execute[lane].control.dregs[1].type, in->control.dregs[1].type);
+    riscv_latch(pipeline, execute[lane].control.dregs[1].addr, in->control.dregs[1].addr);
+    riscv_latch(pipeline, execute[lane].control.imm, in->control.imm);
+    riscv_latch(pipeline, execute[lane].control.write_pc, in->control.write_pc);
+    riscv_latch(pipeline, execute[lane].control.arg1_is_imm, in->control.arg1_is_imm);
 
     // Fill the debug block
-    tst_update_octa(transaction, &out->debug.current_pc, in->debug.current_pc);
+    riscv_latch(pipeline, execute[lane].debug.current_pc, in->debug.current_pc);
 
 }
-static inline void riscv_stage_execute_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
+static inline void riscv_stage_execute_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane)
 {
-    riscv_stage_execute_t* in = &pipeline->execute;
-    riscv_stage_memory_t* out = &pipeline->memory;
+    riscv_stage_execute_t* in = &pipeline->current.execute[lane];
 
     if(in->control.stall)
         return;
 
-    tst_update_bool(transaction, &out->simulation.halt, false);
-    tst_update_bool(transaction, &out->control.invalid, in->control.invalid);
+    riscv_latch(pipeline, memory[lane].simulation.halt, false);
+    riscv_latch(pipeline, memory[lane].control.invalid, in->control.invalid);
 
     if(in->control.invalid)
         return;
@@ -281,156 +367,100 @@ static inline void riscv_stage_execute_step(system_t* sys, riscv_processor_t* pr
     octa result[2], a, b, pc, imm;
     riscv_memory_op_t memory_op = {0, 0};
 
-    a = in->args[0];
-    b = in->control.arg1_is_imm ? in->control.imm : in->args[1];
+    octa args[2] = {in->args[0], in->args[1]};
+
+    // Results of the instructions ahead, unknown when the operands were read
+    riscv_pipeline_forward(&pipeline->current, in->control.sregs[0], &args[0]);
+    riscv_pipeline_forward(&pipeline->current, in->control.sregs[1], &args[1]);
+
+    a = args[0];
+    b = in->control.arg1_is_imm ? in->control.imm : args[1];
 
     pc  = in->pc;
     imm = in->control.imm;
     result[0] = result[1] = 0;
 
-    switch(in->control.op) 
-    {
-        case RISCV_LUI: result[0] = imm; break; // OK
-        case RISCV_AUIPC: 
-            result[0] = octa_plus_expr(pc - 4 , octa_left_shift_expr(imm, 12)); 
-        break;
-        // jump
-        case RISCV_JAL: 
-            result[0] = pc, pc = octa_plus_expr(octa_incr_expr(pc, -4), octa_left_shift_expr(b, 2)); 
-        break; // OK
-        case RISCV_JALR: result[0] = pc, pc = octa_and_expr(octa_plus_expr(a, octa_left_shift_expr(b, 2)), octa_compl_expr(3)); break; // OK
-        // branch
-        case RISCV_BEQ: if(octa_eq_expr(a, b) == true) pc = octa_plus_expr(pc, octa_left_shift_expr(imm, 2)); break;
-        case RISCV_BNE: if(octa_eq_expr(a, b) == false) pc = octa_plus_expr(pc, octa_left_shift_expr(imm, 2)); break; // OK
-        case RISCV_BLT: if(octa_signed_cmp_expr(a, b) == -1) pc = octa_plus_expr(pc, octa_left_shift_expr(imm, 2)); break;
-        case RISCV_BLTU: if(octa_unsigned_cmp_expr(a, b) == -1) pc = octa_plus_expr(pc, octa_left_shift_expr(imm, 2)); break;
-        case RISCV_BGE: if(octa_signed_cmp_expr(a, b) >= 0) pc = octa_plus_expr(pc, octa_left_shift_expr(imm, 2)); break;
-        case RISCV_BGEU: if(octa_unsigned_cmp_expr(a, b) >= 0) pc = octa_plus_expr(pc, octa_left_shift_expr(imm, 2)); break;
-        // load
-        case RISCV_LBU: case RISCV_LB: case RISCV_LHU: case RISCV_LH: case RISCV_LW: case RISCV_LWU: case RISCV_LD: memory_op.op = 2, memory_op.addr = octa_plus_expr(a, b); break;
-        // store
-        case RISCV_SB: case RISCV_SH: case RISCV_SW: case RISCV_SD: memory_op.op = 1, memory_op.addr = octa_plus_expr(a, imm), result[0] = b; break;
-        // add
-        case RISCV_ADD:  case RISCV_ADDW: case RISCV_ADDI: case RISCV_ADDIW: result[0] = octa_plus_expr(a, b); break;
-        // sub
-        case RISCV_SUB: case RISCV_SUBW: result[0] = octa_minus_expr(a, b); break;
-        // compare lt
-        case RISCV_SLT: case RISCV_SLTI: result[0] = octa_signed_cmp_expr(a, b) == -1; break;         
-        case RISCV_SLTU: case RISCV_SLTIU: result[0] = octa_unsigned_cmp_expr(a, b) == -1; break;
-        // xor
-        case RISCV_XORI: case RISCV_XOR: result[0] =  octa_xor_expr(a, b); break;
-        // or
-        case RISCV_ORI: case RISCV_OR: result[0] = octa_or_expr(a, b); break;
-        // and
-        case RISCV_ANDI: case RISCV_AND:  result[0] = octa_and_expr(a, b); break;
-        // shift left
-        case RISCV_SLL: case RISCV_SLLW:  result[0] = octa_left_shift_expr(a, b); break;
-        case RISCV_SLLI: case RISCV_SLLIW: result[0] = octa_left_shift_expr(a, octa_and_expr(b, 0x1f)); break;
-        // shift right
-        case RISCV_SRL: case RISCV_SRA: case RISCV_SRAW: result[0] = octa_right_shift_expr(a, b, 0); break;
-        case RISCV_SRLIW: case RISCV_SRAIW: case RISCV_SRAI: case RISCV_SRLI: result[0] = octa_right_shift_expr(a, octa_and_expr(b, 0x1f), 0); break;
-        // Halt the simulation
-        case RISCV_EBREAK: tst_update_bool(transaction, &out->simulation.halt, true);
-        case RISCV_FENCE_I: break;
-        case RISCV_CSRRW: 
-            result[0] = b, result[1] = a; 
-            break;
-        default: break;
-    }
-    
+    if(riscv_exec(in->control.op, a, b, imm, &pc, result, &memory_op))
+        riscv_latch(pipeline, memory[lane].simulation.halt, true);
+
     // Write data
-    tst_update_octa(transaction, &out->results[0], result[0]);
-    tst_update_octa(transaction, &out->results[1], result[1]);
-    tst_update_octa(transaction, &out->pc, pc);
-    
+    riscv_latch(pipeline, memory[lane].results[0], result[0]);
+    riscv_latch(pipeline, memory[lane].results[1], result[1]);
+    riscv_latch(pipeline, memory[lane].pc, pc);
+
     // Write control
-    tst_update_int(transaction, &out->control.op, in->control.op);
-    tst_update_char(transaction, &out->control.memory_op.op, memory_op.op);
-    tst_update_octa(transaction, &out->control.memory_op.addr, memory_op.addr);
+    riscv_latch(pipeline, memory[lane].control.op, in->control.op);
+    riscv_latch(pipeline, memory[lane].control.memory_op.op, memory_op.op);
+    riscv_latch(pipeline, memory[lane].control.memory_op.addr, memory_op.addr);
 
-    tst_update_char(transaction, &out->control.dregs[0].type, in->control.dregs[0].type);
-    tst_update_int(transaction, &out->control.dregs[0].addr,  in->control.dregs[0].addr);
-    tst_update_char(transaction, &out->control.dregs[1].type, in->control.dregs[1].type);
-    tst_update_int(transaction, &out->control.dregs[1].addr,  in->control.dregs[1].addr);
+    riscv_latch(pipeline, memory[lane].control.dregs[0].type, in->control.dregs[0].type);
+    riscv_latch(pipeline, memory[lane].control.dregs[0].addr,  in->control.dregs[0].addr);
+    riscv_latch(pipeline, memory[lane].control.dregs[1].type, in->control.dregs[1].type);
+    riscv_latch(pipeline, memory[lane].control.dregs[1].addr,  in->control.dregs[1].addr);
 
     // Fill the debug block
-    tst_update_octa(transaction, &out->debug.current_pc, in->debug.current_pc);
+    riscv_latch(pipeline, memory[lane].debug.current_pc, in->debug.current_pc);
 
 }
-static inline void riscv_stage_memory_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
+static inline bool riscv_stage_memory_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane)
 {
     octa result[2];
     octa addr;
 
-    riscv_stage_memory_t* in = &pipeline->memory;
-    riscv_stage_writeback_t* out = &pipeline->writeback;
+    riscv_stage_memory_t* in = &pipeline->current.memory[lane];
 
     if(in->control.stall)
-        return;
+        return true;
 
-    tst_update_bool(transaction, &out->simulation.halt, false);
-    tst_update_bool(transaction, &out->control.invalid, in->control.invalid);
+    riscv_latch(pipeline, writeback[lane].simulation.halt, false);
+    riscv_latch(pipeline, writeback[lane].control.invalid, in->control.invalid);
 
-    if(out->control.invalid)
-        return;
+    if(in->control.invalid)
+        return true;
 
     result[0] = in->results[0];
     result[1] = in->results[1];
-    
+
     addr = in->control.memory_op.addr;
 
-    bool cache_miss = false;
+    // A store waits for the loads of its line to read it, a halt for every parked load.
+    bool wait = (in->control.memory_op.op == 1 && __riscv_pipeline_missing_line(proc, pipeline, addr))
+        || (in->simulation.halt && __riscv_pipeline_missing(pipeline));
+    bool missed = !wait && !riscv_pipeline_access(&proc->l1, in->control.op, addr, &result[0], transaction);
 
-    switch(in->control.op) 
+    if(missed && in->control.memory_op.op == 2 && __riscv_pipeline_park(pipeline, in))
     {
-        // load
-        case RISCV_LBU: case RISCV_LB: cache_miss = data_cache_read(&proc->l1, addr, (byte*) &result[0], transaction); break;
-        case RISCV_LHU: case RISCV_LH: cache_miss = data_cache_read_word(&proc->l1, addr, (word*) &result[0], transaction); break;
-        case RISCV_LW: case RISCV_LWU: cache_miss = data_cache_read_tetra(&proc->l1, addr, (tetra*) &result[0], transaction); break;
-        case RISCV_LD: cache_miss = data_cache_read_octa(&proc->l1, addr, &result[0], transaction); break;
-        // store
-        case RISCV_SB: cache_miss = data_cache_write(&proc->l1, addr, (byte) result[0], transaction); break;
-        case RISCV_SH: cache_miss = data_cache_write_word(&proc->l1, addr, (word) result[0], transaction); break;
-        case RISCV_SW: cache_miss = data_cache_write_tetra(&proc->l1, addr, (tetra) result[0], transaction); break;
-        case RISCV_SD: cache_miss = data_cache_write_octa(&proc->l1, addr, result[0], transaction); break;
+        // Written back by the miss buffer
+        riscv_latch(pipeline, writeback[lane].control.invalid, true);
+        return true;
     }
 
     // We need to wait
-    if(cache_miss) {
-        in->control.wait = true;
-        // Invalid the rest of the pipeline
-        tst_update_bool(transaction, &out->control.invalid, true);
-        
-        tst_update_octa(transaction, &out->results[0], 0);
-        tst_update_octa(transaction, &out->results[1], 0);
-        
-        // Write control
-        tst_update_char(transaction, &out->control.dregs[0].type, 0);
-        tst_update_int(transaction, &out->control.dregs[0].addr,  0);
-        tst_update_char(transaction, &out->control.dregs[1].type, 0);
-        tst_update_int(transaction, &out->control.dregs[1].addr,  0);
-
-        // Write debug
-        tst_update_octa(transaction, &out->debug.current_pc, 0);
-    } else {
-        in->control.wait = false;
-        //
-        tst_update_octa(transaction, &out->results[0], result[0]);
-        tst_update_octa(transaction, &out->results[1], result[1]);
-        
-        // Write control
-        tst_update_char(transaction, &out->control.dregs[0].type, in->control.dregs[0].type);
-        tst_update_int(transaction, &out->control.dregs[0].addr,  in->control.dregs[0].addr);
-        tst_update_char(transaction, &out->control.dregs[1].type, in->control.dregs[1].type);
-        tst_update_int(transaction, &out->control.dregs[1].addr,  in->control.dregs[1].addr);
-
-        // Write debug
-        tst_update_octa(transaction, &out->debug.current_pc, in->debug.current_pc);
+    if(wait || missed) {
+        riscv_latch(pipeline, memory[lane].control.wait, true);
+        riscv_latch(pipeline, writeback[lane].control.invalid, true);
+        return false;
     }
+
+    riscv_latch(pipeline, memory[lane].control.wait, false);
+    riscv_latch(pipeline, writeback[lane].simulation.halt, in->simulation.halt);
+    riscv_latch(pipeline, writeback[lane].results[0], result[0]);
+    riscv_latch(pipeline, writeback[lane].results[1], result[1]);
+
+    // Write control
+    riscv_latch(pipeline, writeback[lane].control.dregs[0].type, in->control.dregs[0].type);
+    riscv_latch(pipeline, writeback[lane].control.dregs[0].addr,  in->control.dregs[0].addr);
+    riscv_latch(pipeline, writeback[lane].control.dregs[1].type, in->control.dregs[1].type);
+    riscv_latch(pipeline, writeback[lane].control.dregs[1].addr,  in->control.dregs[1].addr);
+
+    // Write debug
+    riscv_latch(pipeline, writeback[lane].debug.current_pc, in->debug.current_pc);
+
+    return true;
 }
-static inline void riscv_stage_writeback_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
+static inline void riscv_stage_writeback_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction, unsigned int lane)
 {
-   riscv_stage_writeback_t* in = &pipeline->writeback;
+   riscv_stage_writeback_t* in = &pipeline->current.writeback[lane];
 
     if(in->control.stall)
         return;
@@ -438,64 +468,358 @@ static inline void riscv_stage_writeback_step(system_t* sys, riscv_processor_t*
     if(in->control.invalid)
         return;
 
-    for(unsigned char i = 0; i < 2; i++) 
+    for(unsigned char i = 0; i < 2; i++)
     {
         octa* reg = in->control.dregs[i].type == 0 ? &proc->regs[in->control.dregs[i].addr] : &proc->csrs[in->control.dregs[i].addr];
+
+        // Retired in order, the youngest lane wins even with the current value.
+        if(lane > 0) tst_log_invalid(transaction, reg, sizeof(octa));
+
         tst_update_octa(transaction, reg, in->results[i]);
     }
+
+    pipeline->retired++;
+}
+
+static inline bool riscv_pipeline_access(data_cache_t* l1, int op, octa addr, octa* data, transaction_t* transaction)
+{
+    switch(op)
+    {
+        // load
+        case RISCV_LBU: case RISCV_LB: return data_cache_read(l1, addr, (byte*) data, transaction);
+        case RISCV_LHU: case RISCV_LH: return data_cache_read_word(l1, addr, (word*) data, transaction);
+        case RISCV_LW: case RISCV_LWU: return data_cache_read_tetra(l1, addr, (tetra*) data, transaction);
+        case RISCV_LD: return data_cache_read_octa(l1, addr, data, transaction);
+        // store
+        case RISCV_SB: return data_cache_write(l1, addr, (byte) *data, transaction);
+        case RISCV_SH: return data_cache_write_word(l1, addr, (word) *data, transaction);
+        case RISCV_SW: return data_cache_write_tetra(l1, addr, (tetra) *data, transaction);
+        case RISCV_SD: return data_cache_write_octa(l1, addr, *data, transaction);
+        default: return true;
+    }
+}
+
+static inline bool __riscv_pipeline_park(riscv_pipeline_t* pipeline, const riscv_stage_memory_t* memory)
+{
+    for(unsigned int i = 0; i < RISCV_PIPELINE_MISSES; i++)
+    {
+        riscv_miss_t* miss = &pipeline->misses[i];
+
+        if(miss->valid)
+            continue;
+
+        miss->valid = true;
+        miss->op = memory->control.op;
+        miss->addr = memory->control.memory_op.addr;
+        miss->reg = memory->control.dregs[0].addr;
+
+        if(miss->reg != 0)
+            pipeline->scoreboard.missing[miss->reg] = true;
+
+        return true;
+    }
+
+    return false;
+}
+
+static inline bool __riscv_pipeline_missing_line(riscv_processor_t* proc, riscv_pipeline_t* pipeline, octa addr)
+{
+    for(unsigned int i = 0; i < RISCV_PIPELINE_MISSES; i++)
+    {
+        riscv_miss_t* miss = &pipeline->misses[i];
+
+        if(miss->valid && (miss->addr >> proc->l1.line_shift) == (addr >> proc->l1.line_shift))
+            return true;
+    }
+
+    return false;
+}
+
+static inline bool __riscv_pipeline_missing(riscv_pipeline_t* pipeline)
+{
+    for(unsigned int i = 0; i < RISCV_PIPELINE_MISSES; i++)
+        if(pipeline->misses[i].valid)
+            return true;
+
+    return false;
+}
+
+// The first lane of the memory stage waits on the fill of a line: in the miss buffer, or of its own load.
+static inline bool __riscv_pipeline_filling(riscv_processor_t* proc, riscv_pipeline_t* pipeline)
+{
+    riscv_stage_memory_t* in = &pipeline->current.memory[0];
+    octa addr = in->control.memory_op.addr;
+
+    if(in->control.memory_op.op == 1 && __riscv_pipeline_missing_line(proc, pipeline, addr))
+        return true;
+
+    if(in->simulation.halt && __riscv_pipeline_missing(pipeline))
+        return true;
+
+    // A load waits on its line in flight, or on a fill with every MSHR busy. A store retries next step.
+    return in->control.memory_op.op == 2 && (data_cache_pending(&proc->l1, addr) || data_cache_misses(&proc->l1) == DATA_CACHE_MSHRS);
+}
+
+static inline void riscv_pipeline_complete_misses(riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
+{
+    for(unsigned int i = 0; i < RISCV_PIPELINE_MISSES; i++)
+    {
+        riscv_miss_t* miss = &pipeline->misses[i];
+        octa value = 0;
+
+        if(!miss->valid || !riscv_pipeline_access(&proc->l1, miss->op, miss->addr, &value, transaction))
+            continue;
+
+        // After the writeback stage, which only holds older instructions
+        if(miss->reg != 0)
+        {
+            tst_log_invalid(transaction, &proc->regs[miss->reg], sizeof(octa));
+            tst_update_octa(transaction, &proc->regs[miss->reg], value);
+            pipeline->scoreboard.missing[miss->reg] = false;
+        }
+
+        miss->valid = false;
+        pipeline->retired++;
+    }
 }
 
-static inline void riscv_check_memory_wait(riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
+static inline bool riscv_pipeline_forward(riscv_pipeline_regs_t* regs, riscv_reg_addr_t sreg, octa* value)
 {
-    riscv_stage_memory_t* memory    = &pipeline->memory;
-    riscv_stage_execute_t* execute  = &pipeline->execute;
-    riscv_stage_read_t* read        = &pipeline->read;
-    riscv_stage_decode_t* decode    = &pipeline->decode;
-    riscv_stage_fetch_t* fetch      = &pipeline->fetch;
+    bool forwarded = false;
+
+    // x0
+    if(sreg.addr == 0 && sreg.type == 0)
+        return false;
 
-    if(memory->control.wait) 
+    // The oldest first, the youngest wins.
+    for(unsigned int lane = 0; lane < RISCV_MAX_ISSUE_WIDTH; lane++)
     {
-        // Invalid all changes
-        tst_update_octa(transaction, &proc->pc, proc->pc);
-        tst_update_riscv_stage_fetch(transaction, fetch, *fetch);
-        tst_update_riscv_stage_decode(transaction, decode, *decode);
-        tst_update_riscv_stage_read(transaction, read, *read);
-        tst_update_riscv_stage_execute(transaction, execute, *execute);
-        tst_update_riscv_stage_memory(transaction, memory, *memory);
+        riscv_stage_writeback_t* writeback = &regs->writeback[lane];
+
+        for(unsigned char i = 0; i < 2 && !writeback->control.invalid; i++)
+        {
+            if(writeback->control.dregs[i].type == sreg.type && writeback->control.dregs[i].addr == sreg.addr)
+                *value = writeback->results[i], forwarded = true;
+        }
+    }
+
+    for(unsigned int lane = 0; lane < RISCV_MAX_ISSUE_WIDTH; lane++)
+    {
+        riscv_stage_memory_t* memory = &regs->memory[lane];
+
+        for(unsigned char i = 0; i < 2 && !memory->control.invalid && memory->control.memory_op.op != 2; i++)
+        {
+            if(memory->control.dregs[i].type == sreg.type && memory->control.dregs[i].addr == sreg.addr)
+                *value = memory->results[i], forwarded = true;
+        }
+    }
+
+    return forwarded;
+}
+
+static inline bool __riscv_pipeline_is_load(int op)
+{
+    switch(op)
+    {
+        case RISCV_LBU: case RISCV_LB: case RISCV_LHU: case RISCV_LH: case RISCV_LW: case RISCV_LWU: case RISCV_LD: return true;
+        default: return false;
+    }
+}
+
+static inline bool __riscv_pipeline_is_store(int op)
+{
+    switch(op)
+    {
+        case RISCV_SB: case RISCV_SH: case RISCV_SW: case RISCV_SD: return true;
+        default: return false;
+    }
+}
+
+static inline unsigned int riscv_pipeline_issue(riscv_pipeline_t* pipeline)
+{
+    riscv_scoreboard_t* scoreboard = &pipeline->scoreboard;
+    bool memory = false;
+    unsigned int lane = 0;
+
+    for(; lane < pipeline->width; lane++)
+    {
+        riscv_stage_read_t* read = &pipeline->current.read[lane];
+
+        if(read->control.invalid)
+            continue;
+
+        bool csr = read->control.sregs[0].type || read->control.sregs[1].type || read->control.dregs[1].type;
+        bool access = __riscv_pipeline_is_load(read->control.op) || __riscv_pipeline_is_store(read->control.op);
+
+        riscv_reg_addr_t sregs[2] = {read->control.sregs[0], read->control.sregs[1]};
+        riscv_reg_addr_t dreg = read->control.dregs[0];
+
+        // Results not ready, or not forwarded yet
+        if((sregs[0].type == 0 && (scoreboard->pending[sregs[0].addr] || scoreboard->missing[sregs[0].addr]))
+            || (sregs[1].type == 0 && (scoreboard->pending[sregs[1].addr] || scoreboard->missing[sregs[1].addr])))
+            break;
+
+        // Overwriting the register of a load which may miss
+        if(dreg.type == 0 && dreg.addr != 0 && (scoreboard->loads[dreg.addr] || scoreboard->missing[dreg.addr]))
+            break;
+
+        // Structural hazards
+        if((access && memory) || (csr && lane > 0))
+            break;
+
+        memory |= access;
+
+        // Loads are forwarded a cycle later than the other results.
+        bool load = __riscv_pipeline_is_load(read->control.op);
+        byte latency = load ? 2 : 1;
+
+        if(dreg.type == 0 && dreg.addr != 0 && scoreboard->pending[dreg.addr] < latency)
+            scoreboard->pending[dreg.addr] = latency;
+
+        if(dreg.type == 0 && dreg.addr != 0 && load)
+            scoreboard->loads[dreg.addr] = 2;
+
+        if(csr)
+            return lane + 1;
     }
+
+    return lane;
 }
 
 static inline void riscv_check_control_hazard(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
 {
-    riscv_stage_execute_t* execute  = &pipeline->execute;
-    riscv_stage_memory_t* memory    = &pipeline->memory;
-    riscv_stage_read_t* read        = &pipeline->read;
-    riscv_stage_decode_t* decode    = &pipeline->decode;
-    
-    // Write target
-    if(execute->control.write_pc == true && read->pc - 4 != memory->pc)
+    for(unsigned int lane = 0; lane < pipeline->width; lane++)
     {
-        tst_update_octa(transaction, &proc->pc, memory->pc);
-        tst_update_bool(transaction, &decode->control.invalid, true);
-        tst_update_bool(transaction, &read->control.invalid, true);
-        tst_update_bool(transaction, &execute->control.invalid, true);
+        riscv_stage_execute_t* execute  = &pipeline->current.execute[lane];
+
+        if(execute->control.stall || execute->control.invalid)
+            continue;
+
+        // Resolved by the execute stage, this cycle
+        octa target = pipeline->next.memory[lane].pc;
+
+        if(riscv_bp_update(&proc->bp, execute->pc - 4, execute->control.op, &execute->prediction, target))
+            continue;
+
+        // Mispredicted, fetch the target. Overrides the pc fetched this cycle, even if it was the target.
+        tst_log_invalid(transaction, &proc->pc, sizeof(octa));
+        tst_update_octa(transaction, &proc->pc, target);
+
+        // Squash the younger instructions
+        for(unsigned int i = 0; i < pipeline->width; i++)
+        {
+            riscv_latch(pipeline, decode[i].control.invalid, true);
+            riscv_latch(pipeline, read[i].control.invalid, true);
+            riscv_latch(pipeline, execute[i].control.invalid, true);
+
+            if(i > lane) riscv_latch(pipeline, memory[i].control.invalid, true);
+        }
+
+        // The misses of the older loads stay.
+        memset(pipeline->scoreboard.pending, 0, sizeof(pipeline->scoreboard.pending));
+        memset(pipeline->scoreboard.loads, 0, sizeof(pipeline->scoreboard.loads));
+        return;
+    }
+}
+
+static inline void riscv_pipeline_stall(riscv_pipeline_t* pipeline, unsigned int lane)
+{
+    for(unsigned int i = 0; i < pipeline->width; i++)
+    {
+        riscv_stage_execute_t* execute = &pipeline->current.execute[i];
+
+        if(i < lane)
+            riscv_latch(pipeline, memory[i].control.invalid, true);
+        else
+            riscv_latch(pipeline, writeback[i].control.invalid, true);
+
+        for(unsigned char j = 0; j < 2 && !execute->control.invalid; j++)
+        {
+            octa value = execute->args[j];
+
+            riscv_pipeline_forward(&pipeline->current, execute->control.sregs[j], &value);
+            riscv_latch(pipeline, execute[i].args[j], value);
+        }
     }
 }
 
 void riscv_pipeline_step(system_t* sys, riscv_processor_t* proc, riscv_pipeline_t* pipeline, transaction_t* transaction)
 {
-  riscv_stage_fetch_step(sys, proc, pipeline, transaction);
-  riscv_stage_decode_step(sys, proc, pipeline, transaction);
-  riscv_stage_read_step(sys, proc, pipeline, transaction);
-  riscv_stage_execute_step(sys, proc, pipeline, transaction);
-  riscv_stage_memory_step(sys, proc, pipeline, transaction);
-  riscv_stage_writeback_step(sys, proc, pipeline, transaction);
+  unsigned int width = pipeline->width;
+  unsigned int stalled = 0;
+
+  // The memory stage first, its misses hold the registers of the lanes issued this cycle.
+  while(stalled < width && riscv_stage_memory_step(sys, proc, pipeline, transaction, stalled))
+    stalled++;
+
+  if(stalled < width)
+  {
+    riscv_pipeline_stall(pipeline, stalled);
+  }
+  else
+  {
+    // A cycle closer to the results in flight
+    for(unsigned int r = 0; r < 32; r++)
+    {
+      if(pipeline->scoreboard.pending[r]) pipeline->scoreboard.pending[r]--;
+      if(pipeline->scoreboard.loads[r]) pipeline->scoreboard.loads[r]--;
+    }
+
+    // The lanes not issued this cycle hold the front end, bubbles go to execute.
+    unsigned int issued = riscv_pipeline_issue(pipeline);
+
+    if(issued == width)
+    {
+      riscv_stage_fetch_step(sys, proc, pipeline, transaction);
+
+      for(unsigned int i = 0; i < width; i++)
+        riscv_stage_decode_step(sys, proc, pipeline, transaction, i);
+    }
+
+    for(unsigned int i = 0; i < width; i++)
+    {
+      if(i >= issued)
+      {
+        riscv_latch(pipeline, execute[i].control.invalid, true);
+        continue;
+      }
+
+      riscv_stage_read_step(sys, proc, pipeline, transaction, i);
+
+      // Gone to execute, while the rest of its group waits
+      if(issued < width)
+        riscv_latch(pipeline, read[i].control.invalid, true);
+    }
+
+    for(unsigned int i = 0; i < width; i++)
+      riscv_stage_execute_step(sys, proc, pipeline, transaction, i);
+  }
+
+  for(unsigned int i = 0; i < width; i++)
+    riscv_stage_writeback_step(sys, proc, pipeline, transaction, i);
+
+  if(stalled == width)
+    riscv_check_control_hazard(sys, proc, pipeline, transaction);
+
+  riscv_pipeline_complete_misses(proc, pipeline, transaction);
+
+  // Every lane waits on a fill: idle until the L1 requests the earliest line in flight.
+  if(stalled == 0 && __riscv_pipeline_filling(proc, pipeline))
+  {
+    unsigned int idle = data_cache_idle_steps(&proc->l1);
+
+    if(idle > 0)
+    {
+      data_cache_skip(&proc->l1, idle, transaction);
+      sys_sleep(sys, idle);
+    }
+  }
 
-  riscv_check_control_hazard(sys, proc, pipeline, transaction);
-  riscv_check_memory_wait(proc, pipeline, transaction);
+  for(unsigned int i = 0; i < width; i++)
+    if(pipeline->current.writeback[i].simulation.halt && pipeline->current.writeback[i].control.invalid == false) sys_halt(sys);
 
-  if(pipeline->writeback.simulation.halt && pipeline->writeback.control.invalid == false) sys_halt(sys);
+  riscv_pipeline_swap(pipeline);
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -14,6 +14,72 @@ typedef struct {
   octa addr;
 } riscv_memory_op_t;
 
+/**
+ * Branch prediction, in the fetch stage.
+ *
+ * The direction of the conditional branches comes from a static rule or from tables of
+ * 2-bit saturating counters. The targets of the jumps (JAL, JALR) come from a direct-mapped
+ * branch target buffer, the returns (JALR x0, x1 or x5) from a return-address stack.
+ * The predictions are resolved in the execute stage, which trains the predictor and
+ * redirects the fetch on a miss.
+ */
+typedef enum {
+  RISCV_BP_NOT_TAKEN,   // Always the next instruction
+  RISCV_BP_BTFN,        // Backward taken, forward not taken
+  RISCV_BP_BIMODAL,     // Counters indexed by the pc
+  RISCV_BP_GSHARE       // Counters indexed by the pc xor the global history
+} riscv_bp_kind_t;
+
+#define RISCV_BP_MAX_BITS 12
+#define RISCV_BTB_SIZE 64
+#define RISCV_RAS_SIZE 16
+
+typedef enum {
+  RISCV_BP_SOURCE_NONE,
+  RISCV_BP_SOURCE_DIRECTION,
+  RISCV_BP_SOURCE_BTB,
+  RISCV_BP_SOURCE_RAS
+} riscv_bp_source_t;
+
+typedef struct {
+  riscv_bp_kind_t kind;
+  unsigned int bits;          // Counters: 1 << bits
+  unsigned int history_bits;  // Global history of gshare, at most bits
+  bool btb, ras;
+} riscv_bp_cfg_t;
+
+typedef struct {
+  octa hits, misses;
+} riscv_bp_counter_t;
+
+typedef struct {
+  riscv_bp_cfg_t cfg;
+
+  byte counters[1 << RISCV_BP_MAX_BITS];
+  octa history;
+
+  struct {
+    octa pc, target;
+  } btb[RISCV_BTB_SIZE];
+
+  octa ras[RISCV_RAS_SIZE];
+  unsigned int ras_top;
+
+  struct {
+    riscv_bp_counter_t direction, btb, ras;
+  } stats;
+} riscv_bp_t;
+
+/**
+ * \brief A prediction, following its instruction down to the execute stage.
+ */
+typedef struct {
+  octa target;
+  unsigned int index;   // Counter
+  unsigned int ras_top; // After the instruction, restored on a miss
+  char source;
+} riscv_prediction_t;
+
 typedef struct {
   struct {
     bool stall;
@@ -23,6 +89,7 @@ typedef struct {
 typedef struct {
   octa pc;
   tetra raw;
+  riscv_prediction_t prediction;
   struct {
     bool stall, invalid;
   } control;
@@ -33,6 +100,7 @@ typedef struct {
 
 typedef struct {
   octa pc;
+  riscv_prediction_t prediction;
   struct {
       bool stall, invalid;
       int op;
@@ -49,6 +117,7 @@ typedef struct {
 typedef struct {
   octa    pc;
   octa   args[2];
+  riscv_prediction_t prediction;
   struct {
       bool stall, invalid;
       int op;
@@ -93,33 +162,102 @@ typedef struct {
   } simulation;
 } riscv_stage_writeback_t;
 
+/**
+ * Issue width: the stages after fetch hold up to RISCV_MAX_ISSUE_WIDTH lanes, of an
+ * instruction each. Within a stage, the lower lanes hold the older instructions.
+ */
+#define RISCV_MAX_ISSUE_WIDTH 4
+
 typedef struct 
 { 
     // Fetch register
     riscv_stage_fetch_t fetch;
 
     // Fetch/Decode Register
-    riscv_stage_decode_t decode;
+    riscv_stage_decode_t decode[RISCV_MAX_ISSUE_WIDTH];
 
     // Decode/Read Register
-    riscv_stage_read_t read;
+    riscv_stage_read_t read[RISCV_MAX_ISSUE_WIDTH];
 
     // Read/Execute Register
-    riscv_stage_execute_t execute;
+    riscv_stage_execute_t execute[RISCV_MAX_ISSUE_WIDTH];
 
     // Execute/Memory Register
-    riscv_stage_memory_t memory;
+    riscv_stage_memory_t memory[RISCV_MAX_ISSUE_WIDTH];
 
     //Memory/Writeback Register
-    riscv_stage_writeback_t writeback;
+    riscv_stage_writeback_t writeback[RISCV_MAX_ISSUE_WIDTH];
+
+} riscv_pipeline_regs_t;
+
+/**
+ * \brief Scoreboard of the general registers: cycles before the result of the youngest instruction
+ * writing them can be forwarded to the execute stage, and the ones waiting for a load miss.
+ */
+typedef struct {
+    byte pending[32];
+    byte loads[32];    // Cycles before the load writing them leaves the memory stage
+    bool missing[32];  // Written by a load miss
+} riscv_scoreboard_t;
 
+/**
+ * Load misses.
+ *
+ * A load missing the L1 leaves the memory stage for a miss buffer, with its destination
+ * register held in the scoreboard, and the pipeline goes on (hit under miss): the
+ * instructions reading or writing the register wait for the line. The load writes the
+ * register at the end of the cycle the line is in the L1. The instructions writing the
+ * register of a load wait for it to leave the memory stage, a miss cannot overwrite them.
+ *
+ * The memory stage stalls the pipeline instead for a store which cannot be written,
+ * a store to a line a load waits for, or a load with the miss buffer full.
+ */
+#define RISCV_PIPELINE_MISSES 4
+
+typedef struct {
+    bool valid;
+    int op;
+    octa addr;
+    int reg; // Destination general register
+} riscv_miss_t;
+
+/**
+ * Pipeline registers, double buffered.
+ *
+ * Stages read the current registers, and latch their outputs into the next ones;
+ * riscv_pipeline_swap makes them current at the end of the cycle. Both copies are equal
+ * between cycles, so fields not latched during a cycle keep their value.
+ *
+ * The transaction log is left to the architectural state (registers, CSRs, pc) and the L1.
+ */
+typedef struct
+{
+    riscv_pipeline_regs_t current, next;
+
+    // Lanes in use, at most RISCV_MAX_ISSUE_WIDTH
+    unsigned int width;
+    riscv_scoreboard_t scoreboard;
+    riscv_miss_t misses[RISCV_PIPELINE_MISSES];
+
+    // Instructions written back
+    octa retired;
 } riscv_pipeline_t;
 
-decl_tst_update_type(riscv_stage_fetch_t, riscv_stage_fetch)
-decl_tst_update_type(riscv_stage_decode_t, riscv_stage_decode)
-decl_tst_update_type(riscv_stage_read_t, riscv_stage_read)
-decl_tst_update_type(riscv_stage_execute_t, riscv_stage_execute)
-decl_tst_update_type(riscv_stage_memory_t, riscv_stage_memory)
-decl_tst_update_type(riscv_stage_writeback_t, riscv_stage_writeback)
+/**
+ * \brief Latch a value into a field of the next registers.
+ *
+ * The last write of the cycle wins.
+ */
+#define riscv_latch(pipeline, field, value) do { \
+    (pipeline)->next.field = (value); \
+} while(0)
+
+/**
+ * \brief End the cycle, the next registers become current.
+ */
+static inline void riscv_pipeline_swap(riscv_pipeline_t* pipeline)
+{
+    pipeline->current = pipeline->next;
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,187 @@
+#ifndef __RISCV_PIPELINE_PREDICTOR_H__
+#define __RISCV_PIPELINE_PREDICTOR_H__
+
+#include "../../../lib/common/include/types.h"
+
+#include "../opcode.h"
+#include "../instr.h"
+#include "../exec.h"
+#include "./model.h"
+
+#define RISCV_OPCODE_BRANCH 0b1100011
+#define RISCV_OPCODE_JAL    0b1101111
+#define RISCV_OPCODE_JALR   0b1100111
+
+/**
+ * \brief Default predictor: bimodal, 4096 counters, with a BTB and a return-address stack.
+ */
+void riscv_bp_cfg_init(riscv_bp_cfg_t* cfg);
+
+/**
+ * \brief Reset the predictor, false if the configuration is out of bounds.
+ */
+bool riscv_bp_create(riscv_bp_t* bp, const riscv_bp_cfg_t* cfg);
+
+/**
+ * \brief Predict the address fetched after the instruction raw, at pc.
+ */
+static inline riscv_prediction_t riscv_bp_predict(riscv_bp_t* bp, octa pc, tetra raw);
+
+/**
+ * \brief Train the predictor with the resolved target of the instruction at pc.
+ *
+ * \return false on a miss, the return-address stack is then restored.
+ */
+static inline bool riscv_bp_update(riscv_bp_t* bp, octa pc, int op, const riscv_prediction_t* prediction, octa target);
+
+static inline bool __riscv_bp_is_link(unsigned int reg);
+static inline void __riscv_bp_count(riscv_bp_counter_t* counter, bool hit);
+
+//////////
+// IMPL //
+//////////
+
+void riscv_bp_cfg_init(riscv_bp_cfg_t* cfg)
+{
+    cfg->kind = RISCV_BP_BIMODAL;
+    cfg->bits = RISCV_BP_MAX_BITS;
+    cfg->history_bits = 8;
+    cfg->btb = true;
+    cfg->ras = true;
+}
+
+bool riscv_bp_create(riscv_bp_t* bp, const riscv_bp_cfg_t* cfg)
+{
+    if(cfg->bits > RISCV_BP_MAX_BITS || cfg->history_bits > cfg->bits)
+        return false;
+
+    bp->cfg = *cfg;
+    bp->history = 0;
+    bp->ras_top = 0;
+
+    // Weakly not taken
+    memset(bp->counters, 1, sizeof(bp->counters));
+    memset(bp->btb, 0xFF, sizeof(bp->btb));
+    memset(bp->ras, 0, sizeof(bp->ras));
+    memset(&bp->stats, 0, sizeof(bp->stats));
+
+    return true;
+}
+
+// x1 and x5 hold the return addresses.
+static inline bool __riscv_bp_is_link(unsigned int reg)
+{
+    return reg == 1 || reg == 5;
+}
+
+static inline void __riscv_bp_count(riscv_bp_counter_t* counter, bool hit)
+{
+    if(hit) counter->hits++;
+    else counter->misses++;
+}
+
+static inline riscv_prediction_t riscv_bp_predict(riscv_bp_t* bp, octa pc, tetra raw)
+{
+    riscv_prediction_t prediction = {pc + 4, 0, bp->ras_top, RISCV_BP_SOURCE_NONE};
+    byte opcode = raw & 0x7F;
+
+    if(bp->cfg.kind == RISCV_BP_NOT_TAKEN && !bp->cfg.btb && !bp->cfg.ras)
+        return prediction;
+
+    if(opcode == RISCV_OPCODE_BRANCH)
+    {
+        riscv_decoded_instr_t decoded = decode(raw);
+        octa target = riscv_exec_target(decoded.op, pc + 4, decoded.imm);
+        octa mask = ((octa) 1 << bp->cfg.bits) - 1;
+        bool taken = false;
+
+        switch(bp->cfg.kind)
+        {
+            case RISCV_BP_NOT_TAKEN: break;
+            case RISCV_BP_BTFN: taken = target < pc; break;
+            case RISCV_BP_BIMODAL: prediction.index = (unsigned int) ((pc >> 2) & mask); break;
+            case RISCV_BP_GSHARE: prediction.index = (unsigned int) (((pc >> 2) ^ bp->history) & mask); break;
+        }
+
+        if(bp->cfg.kind == RISCV_BP_BIMODAL || bp->cfg.kind == RISCV_BP_GSHARE)
+            taken = bp->counters[prediction.index] >= 2;
+
+        prediction.source = RISCV_BP_SOURCE_DIRECTION;
+        prediction.target = taken ? target : pc + 4;
+
+        return prediction;
+    }
+
+    if(opcode != RISCV_OPCODE_JAL && opcode != RISCV_OPCODE_JALR)
+        return prediction;
+
+    unsigned int rd = (raw >> 7) & 0x1F;
+    unsigned int rs1 = (raw >> 15) & 0x1F;
+
+    // Return
+    if(bp->cfg.ras && opcode == RISCV_OPCODE_JALR && rd == 0 && __riscv_bp_is_link(rs1))
+    {
+        bp->ras_top--;
+        prediction.target = bp->ras[bp->ras_top % RISCV_RAS_SIZE];
+        prediction.source = RISCV_BP_SOURCE_RAS;
+    }
+    else if(bp->cfg.btb)
+    {
+        unsigned int i = (unsigned int) ((pc >> 2) % RISCV_BTB_SIZE);
+
+        if(bp->btb[i].pc == pc)
+            prediction.target = bp->btb[i].target;
+
+        prediction.source = RISCV_BP_SOURCE_BTB;
+    }
+
+    // Call
+    if(bp->cfg.ras && __riscv_bp_is_link(rd))
+    {
+        bp->ras[bp->ras_top % RISCV_RAS_SIZE] = pc + 4;
+        bp->ras_top++;
+    }
+
+    prediction.ras_top = bp->ras_top;
+
+    return prediction;
+}
+
+static inline bool riscv_bp_update(riscv_bp_t* bp, octa pc, int op, const riscv_prediction_t* prediction, octa target)
+{
+    bool hit = prediction->target == target;
+
+    switch(prediction->source)
+    {
+        case RISCV_BP_SOURCE_DIRECTION:
+        {
+            bool taken = target != pc + 4;
+            byte* counter = &bp->counters[prediction->index];
+
+            if(taken && *counter < 3) (*counter)++;
+            if(!taken && *counter > 0) (*counter)--;
+
+            bp->history = ((bp->history << 1) | taken) & (((octa) 1 << bp->cfg.history_bits) - 1);
+            __riscv_bp_count(&bp->stats.direction, hit);
+            break;
+        }
+        case RISCV_BP_SOURCE_BTB: __riscv_bp_count(&bp->stats.btb, hit); break;
+        case RISCV_BP_SOURCE_RAS: __riscv_bp_count(&bp->stats.ras, hit); break;
+    }
+
+    if(bp->cfg.btb && (op == RISCV_JAL || op == RISCV_JALR))
+    {
+        unsigned int i = (unsigned int) ((pc >> 2) % RISCV_BTB_SIZE);
+
+        bp->btb[i].pc = pc;
+        bp->btb[i].target = target;
+    }
+
+    // Drop the calls and returns of the wrong path
+    if(!hit)
+        bp->ras_top = prediction->ras_top;
+
+    return hit;
+}
+
+#endif
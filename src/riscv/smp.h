@@ -0,0 +1,345 @@
+#ifndef __RISCV_SMP_H__
+#define __RISCV_SMP_H__
+
+#include "../../lib/common/include/allocator.h"
+#include "../memory/core.h"
+#include "../system.h"
+
+#include "./api.h"
+#include "./csr.h"
+
+#include <pthread.h>
+
+/**
+ * Multi-hart RISC-V system.
+ *
+ * Each hart is a complete RISC-V system (registers, L1, interface, transaction log),
+ * with its MHARTID CSR set to its index. The guest memory is allocated once, in the memory
+ * of the SMP system, and mapped at the same address into the memory of every hart.
+ *
+ * The harts run the functional mode by default, straight over the shared memory. In the
+ * pipeline mode, each hart keeps its own L1, made coherent over the shared memory:
+ * - the L1s are write-through, a line stored to is sent on the next step;
+ * - the SMP system snoops the lines sent, and invalidates the clean copies of their bytes
+ *   in the L1s of the other harts (the next reads miss and fetch them again).
+ * As on real harts, code written by another hart needs a FENCE.I to be seen.
+ *
+ * Stepping the SMP system steps every running hart by a cycle, on the calling thread.
+ * riscv_smp_run runs each hart of the functional mode on its own thread instead, the harts
+ * meeting at a barrier every quantum cycles: no hart gets more than a quantum ahead of
+ * another. The pipeline harts, which invalidate the L1s of each other, stay in lockstep
+ * on the calling thread.
+ */
+#define RISCV_SMP_MAX_HARTS 64
+#define RISCV_SMP_DEFAULT_QUANTUM 1000
+
+typedef struct riscv_smp_cfg_t {
+  riscv_processor_cfg_t hart;
+  unsigned int harts;
+  int mode; // Of the harts, RISCV_MODE_FUNCTIONAL or RISCV_MODE_PIPELINE
+
+  // Shared guest memory, base is page-aligned
+  octa memory_base;
+  size_t memory_size;
+
+  unsigned int quantum; // Cycles between two synchronizations of the threads
+} riscv_smp_cfg_t;
+
+struct riscv_smp_t;
+
+typedef struct {
+  struct riscv_smp_t* smp;
+  unsigned int index; // Of its hart, count for the calling thread (see riscv_smp_run)
+} riscv_smp_worker_t;
+
+typedef struct riscv_smp_t {
+  system_t* harts[RISCV_SMP_MAX_HARTS];
+  unsigned int count;
+  unsigned int quantum;
+  int mode;
+
+  void* memory;
+  allocator_t allocator;
+
+  // Threaded run, the threads wait at the gate until the barrier is sized.
+  pthread_barrier_t barrier;
+  pthread_mutex_t gate;
+  riscv_smp_worker_t workers[RISCV_SMP_MAX_HARTS + 1];
+  bool threaded[RISCV_SMP_MAX_HARTS]; // The hart has its own thread
+  unsigned int epochs;
+  bool done[2][RISCV_SMP_MAX_HARTS]; // Per epoch parity, see __riscv_smp_thread
+} riscv_smp_t;
+
+void riscv_smp_cfg_init(riscv_smp_cfg_t* cfg);
+
+system_t* riscv_smp_new(allocator_t* allocator, riscv_smp_cfg_t* cfg);
+void riscv_smp_step(system_t* sys);
+void riscv_smp_destroy(system_t* sys);
+
+/**
+ * \brief Get the hart of index i.
+ */
+system_t* riscv_smp_hart(system_t* sys, unsigned int i);
+
+/**
+ * \brief Get the host address of the shared guest memory.
+ */
+void* riscv_smp_memory(system_t* sys);
+
+/**
+ * \brief Run every hart on its own thread for ms milliseconds, or until they all stop.
+ *
+ * The harts whose thread could not be started run on the calling thread. The pipeline
+ * harts all run on the calling thread, as sys_run does.
+ */
+void riscv_smp_run(system_t* sys, unsigned int ms);
+
+static void __riscv_smp_on_l1_send(riscv_smp_worker_t* worker, data_cache_t* l1, transaction_t* transaction, data_cache_event_payload_t payload);
+static bool __riscv_smp_owns(riscv_smp_t* smp, unsigned int worker, unsigned int hart);
+static void* __riscv_smp_thread(void* arg);
+
+//////////
+// IMPL //
+//////////
+
+riscv_smp_t* __get_riscv_smp(system_t* sys)
+{
+  return (riscv_smp_t*) (sys + 1);
+}
+
+void riscv_smp_cfg_init(riscv_smp_cfg_t* cfg)
+{
+  riscv_processor_cfg_init(&cfg->hart);
+  cfg->harts = 1;
+  cfg->mode = RISCV_MODE_FUNCTIONAL;
+  cfg->memory_base = 0;
+  cfg->memory_size = PAGE_SIZE;
+  cfg->quantum = RISCV_SMP_DEFAULT_QUANTUM;
+}
+
+system_t* riscv_smp_new(allocator_t* allocator, riscv_smp_cfg_t* cfg)
+{
+  if(cfg->harts == 0 || cfg->harts > RISCV_SMP_MAX_HARTS || PAGE_OFFSET(cfg->memory_base)
+    || (cfg->mode != RISCV_MODE_FUNCTIONAL && cfg->mode != RISCV_MODE_PIPELINE))
+    return NULL;
+
+  system_t* sys = (system_t*) pmalloc(allocator, sizeof(system_t) + sizeof(riscv_smp_t));
+
+  if(!sys) return NULL;
+
+  __sys_init(sys, allocator);
+
+  riscv_smp_t* smp = __get_riscv_smp(sys);
+
+  smp->count = 0;
+  smp->quantum = cfg->quantum > 0 ? cfg->quantum : RISCV_SMP_DEFAULT_QUANTUM;
+  smp->mode = cfg->mode;
+  smp->allocator = allocator_copy(allocator);
+  smp->memory = mem_alloc_window(&sys->mem, allocator, (void*)(uintptr_t) cfg->memory_base, cfg->memory_size);
+
+  if(!smp->memory)
+  {
+    sys_delete(sys, allocator);
+    return NULL;
+  }
+
+  sys->frequency = cfg->hart.frequency;
+  sys->vtable.step = riscv_smp_step;
+  sys->vtable.destroy = riscv_smp_destroy;
+
+  riscv_processor_cfg_t hart_cfg = cfg->hart;
+  hart_cfg.l1.write_through = cfg->mode == RISCV_MODE_PIPELINE;
+
+  for(unsigned int i = 0; i < cfg->harts; i++)
+  {
+    system_t* hart = riscv_new(allocator, &hart_cfg);
+
+    if(!hart)
+    {
+      sys_delete(sys, allocator);
+      return NULL;
+    }
+
+    // mem_map_window returns the base, NULL when it is 0.
+    mem_map_window(&hart->mem, (void*)(uintptr_t) cfg->memory_base, smp->memory, cfg->memory_size);
+
+    riscv_processor_t* proc = __get_riscv_proc(hart);
+    proc->csrs[MHARTID] = i;
+    proc->mode = proc->next_mode = cfg->mode;
+
+    smp->workers[i].smp = smp;
+    smp->workers[i].index = i;
+
+    // Snoop the lines sent to the shared memory
+    proc->l1.event_handlers[DATA_CACHE_EVENT_SEND].self = &smp->workers[i];
+    proc->l1.event_handlers[DATA_CACHE_EVENT_SEND].hdlr = (data_cache_event_handler_t) __riscv_smp_on_l1_send;
+
+    // Driven by the SMP system
+    hart->state = SYS_RUNNING;
+
+    smp->harts[smp->count++] = hart;
+  }
+
+  return sys;
+}
+
+system_t* riscv_smp_hart(system_t* sys, unsigned int i)
+{
+  riscv_smp_t* smp = __get_riscv_smp(sys);
+  return i < smp->count ? smp->harts[i] : NULL;
+}
+
+void* riscv_smp_memory(system_t* sys)
+{
+  return __get_riscv_smp(sys)->memory;
+}
+
+void riscv_smp_destroy(system_t* sys)
+{
+  riscv_smp_t* smp = __get_riscv_smp(sys);
+
+  for(unsigned int i = 0; i < smp->count; i++)
+    sys_delete(smp->harts[i], &smp->allocator);
+
+  smp->count = 0;
+}
+
+void riscv_smp_step(system_t* sys)
+{
+  riscv_smp_t* smp = __get_riscv_smp(sys);
+  bool running = false;
+
+  for(unsigned int i = 0; i < smp->count; i++)
+  {
+    system_t* hart = smp->harts[i];
+
+    if(hart->state != SYS_RUNNING)
+      continue;
+
+    sys_step(hart);
+    running = true;
+  }
+
+  if(!running)
+    sys_halt(sys);
+}
+
+static void __riscv_smp_on_l1_send(riscv_smp_worker_t* worker, data_cache_t* l1, transaction_t* transaction, data_cache_event_payload_t payload)
+{
+  riscv_smp_t* smp = worker->smp;
+
+  __riscv_on_l1_send(smp->harts[worker->index], l1, transaction, payload);
+
+  // The other harts are between two steps: their L1s are updated in place.
+  for(unsigned int i = 0; i < smp->count; i++)
+  {
+    if(i != worker->index)
+      data_cache_invalidate(&__get_riscv_proc(smp->harts[i])->l1, payload.send.addr, payload.send.dirty, NULL);
+  }
+}
+
+static bool __riscv_smp_owns(riscv_smp_t* smp, unsigned int worker, unsigned int hart)
+{
+  return worker < smp->count ? worker == hart : !smp->threaded[hart];
+}
+
+static void* __riscv_smp_thread(void* arg)
+{
+  riscv_smp_worker_t* worker = (riscv_smp_worker_t*) arg;
+  riscv_smp_t* smp = worker->smp;
+  unsigned int index = worker->index;
+
+  pthread_mutex_lock(&smp->gate);
+  pthread_mutex_unlock(&smp->gate);
+
+  for(unsigned int epoch = 0; epoch < smp->epochs; epoch++)
+  {
+    for(unsigned int h = 0; h < smp->count; h++)
+    {
+      system_t* hart = smp->harts[h];
+
+      if(!__riscv_smp_owns(smp, index, h))
+        continue;
+
+      hart->steps = smp->quantum;
+
+      while(hart->state == SYS_RUNNING && hart->steps > 0)
+      {
+        sys_skip_idle(hart);
+
+        if(hart->steps > 0)
+          sys_step(hart);
+      }
+
+      // The flags of an epoch parity are only written again two barriers later,
+      // once every thread has read them: all threads take the same decision.
+      smp->done[epoch & 1][h] = hart->state != SYS_RUNNING;
+    }
+
+    pthread_barrier_wait(&smp->barrier);
+
+    bool done = true;
+    for(unsigned int i = 0; i < smp->count; i++)
+      done = done && smp->done[epoch & 1][i];
+
+    if(done)
+      break;
+  }
+
+  return NULL;
+}
+
+void riscv_smp_run(system_t* sys, unsigned int ms)
+{
+  riscv_smp_t* smp = __get_riscv_smp(sys);
+  pthread_t threads[RISCV_SMP_MAX_HARTS];
+  octa steps = (octa) ms * sys->frequency / 1000;
+
+  unsigned int started = 0;
+
+  if(sys->state == SYS_STOPPED)
+    return;
+
+  if(smp->mode != RISCV_MODE_FUNCTIONAL)
+  {
+    sys_run(sys, ms);
+    return;
+  }
+
+  sys->state = SYS_RUNNING;
+  smp->epochs = (steps + smp->quantum - 1) / smp->quantum;
+
+  pthread_mutex_init(&smp->gate, NULL);
+  pthread_mutex_lock(&smp->gate);
+
+  for(unsigned int i = 0; i < smp->count; i++)
+  {
+    smp->threaded[i] = pthread_create(&threads[i], NULL, __riscv_smp_thread, &smp->workers[i]) == 0;
+    started += smp->threaded[i];
+  }
+
+  // The calling thread takes the harts left without a thread.
+  bool fallback = started < smp->count;
+
+  smp->workers[smp->count].smp = smp;
+  smp->workers[smp->count].index = smp->count;
+
+  pthread_barrier_init(&smp->barrier, NULL, started + fallback);
+  pthread_mutex_unlock(&smp->gate);
+
+  if(fallback)
+    __riscv_smp_thread(&smp->workers[smp->count]);
+
+  for(unsigned int i = 0; i < smp->count; i++)
+  {
+    if(smp->threaded[i])
+      pthread_join(threads[i], NULL);
+  }
+
+  pthread_barrier_destroy(&smp->barrier);
+  pthread_mutex_destroy(&smp->gate);
+
+  sys_halt(sys);
+}
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "../lib/common/include/allocator.h"
+#include "../lib/common/include/types.h"
+
+#include "./memory/core.h"
+#include "./system.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef MEM_MMAP_SUPPORTED
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Snapshots of a system, to restore it in place or fork many runs from a booted state.
+ *
+ * A snapshot is a flat image:
+ *
+ *   [ header | component state | page ids | padding | pages ]
+ *
+ * The component state is written by the save hook of the system vtable (registers, CSRs,
+ * pipeline latches, caches...) and read back by its load hook; the pages are every page
+ * mapped in the memory of the system, in the order of their ids, and start on a page boundary.
+ *
+ * An image saved to a file is opened with a read-only mapping (snapshot_open). Restoring
+ * a system from it maps private views of the file as guest memory: the pages are shared by
+ * every restored system, until one writes them (copy-on-write). Restoring from an in-memory
+ * snapshot copies the pages instead. Without mmap (MEM_MMAP_SUPPORTED), snapshot files are
+ * written but cannot be opened.
+ *
+ * The restored memory is owned by the system: pages which were shared with another system,
+ * or mapped twice, before the snapshot are restored as private copies. The devices bound to
+ * the memory are host objects, out of the snapshot: they are kept by the restored system.
+ */
+#define SNAPSHOT_MAGIC 0x534B4C50 // PLKS
+#define SNAPSHOT_VERSION 1
+
+typedef struct {
+  tetra magic;
+  tetra version;
+
+  // System
+  int state;
+  unsigned int sleep;
+  octa cycle;
+  octa frequency;
+
+  // Component state
+  octa state_offset;
+  octa state_len;
+
+  // Page ids (octa), then their data, PAGE_SIZE-aligned
+  octa table_offset;
+  octa pages;
+  octa data_offset;
+
+  octa size;
+} snapshot_header_t;
+
+typedef struct {
+  byte* image;
+  size_t size;
+
+  // File of a snapshot opened by snapshot_open, -1 otherwise.
+  int fd;
+
+  allocator_t allocator;
+} snapshot_t;
+
+/**
+ * \brief Component state stream, written by the save hooks and read by the load hooks.
+ *
+ * Writing to a stream without data only measures the state.
+ */
+typedef struct snapshot_stream_t {
+  byte* data;
+  size_t len;
+  size_t pos;
+} snapshot_stream_t;
+
+void snapshot_write(snapshot_stream_t* out, const void* src, size_t len);
+
+/**
+ * \brief Read len bytes of the state, false if the stream is too short.
+ */
+bool snapshot_read(snapshot_stream_t* in, void* dst, size_t len);
+
+/**
+ * \brief Take a snapshot of the system, between two steps.
+ *
+ * \return The snapshot, NULL if the component has no save hook or the allocation failed.
+ */
+snapshot_t* sys_snapshot(system_t* sys, allocator_t* allocator);
+
+/**
+ * \brief Restore a snapshot into the system, replacing its memory.
+ *
+ * The system must be of the same kind and configuration (L1 geometry, local registers...)
+ * as the one of the snapshot.
+ *
+ * \return false if the snapshot does not fit the component, or the memory could not be restored.
+ */
+bool sys_restore(system_t* sys, const snapshot_t* snapshot);
+
+/**
+ * \brief Write the snapshot image to a file.
+ */
+bool snapshot_save(const snapshot_t* snapshot, const char* path);
+
+/**
+ * \brief Open a snapshot file, mapped read-only.
+ *
+ * \return The snapshot, NULL if the file could not be mapped (no mmap on the host) or is not a snapshot.
+ */
+snapshot_t* snapshot_open(allocator_t* allocator, const char* path);
+
+void snapshot_delete(snapshot_t* snapshot);
+
+static void __snapshot_count_page(void* self, uintptr_t pid, const page_t* page);
+static void __snapshot_copy_page(void* self, uintptr_t pid, const page_t* page);
+
+//////////
+// IMPL //
+//////////
+
+typedef struct {
+  snapshot_header_t* header;
+  byte* image;
+  octa index;
+} __snapshot_walk_t;
+
+void snapshot_write(snapshot_stream_t* out, const void* src, size_t len)
+{
+  if(out->data != NULL)
+    memcpy(out->data + out->pos, src, len);
+
+  out->pos += len;
+}
+
+bool snapshot_read(snapshot_stream_t* in, void* dst, size_t len)
+{
+  if(in->pos + len > in->len)
+    return false;
+
+  memcpy(dst, in->data + in->pos, len);
+  in->pos += len;
+
+  return true;
+}
+
+static void __snapshot_count_page(void* self, uintptr_t pid, const page_t* page)
+{
+  (*(octa*) self)++;
+}
+
+static void __snapshot_copy_page(void* self, uintptr_t pid, const page_t* page)
+{
+  __snapshot_walk_t* walk = (__snapshot_walk_t*) self;
+  octa* table = (octa*)(walk->image + walk->header->table_offset);
+
+  table[walk->index] = pid;
+  memcpy(walk->image + walk->header->data_offset + walk->index * PAGE_SIZE, page->paddr, PAGE_SIZE);
+
+  walk->index++;
+}
+
+snapshot_t* sys_snapshot(system_t* sys, allocator_t* allocator)
+{
+  if(sys->vtable.save == 0)
+    return NULL;
+
+  snapshot_header_t header;
+  snapshot_stream_t out = {NULL, 0, 0};
+  octa pages = 0;
+
+  // Measure the component state
+  sys->vtable.save(sys, &out);
+  mem_walk(&sys->mem, __snapshot_count_page, &pages);
+
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  header.state = sys->state;
+  header.sleep = sys->sleep;
+  header.cycle = sys->cycle;
+  header.frequency = sys->frequency;
+  header.state_offset = sizeof(snapshot_header_t);
+  header.state_len = out.pos;
+  header.table_offset = (header.state_offset + header.state_len + sizeof(octa) - 1) & ~(octa)(sizeof(octa) - 1);
+  header.pages = pages;
+  header.data_offset = mem_align(header.table_offset + pages * sizeof(octa));
+  header.size = header.data_offset + pages * PAGE_SIZE;
+
+  snapshot_t* snapshot = (snapshot_t*) pmalloc(allocator, sizeof(snapshot_t));
+
+  if(snapshot == NULL)
+    return NULL;
+
+  snapshot->image = (byte*) pmalloc(allocator, header.size);
+
+  if(snapshot->image == NULL)
+  {
+    pfree(allocator, snapshot);
+    return NULL;
+  }
+
+  snapshot->size = header.size;
+  snapshot->fd = -1;
+  snapshot->allocator = allocator_copy(allocator);
+
+  memset(snapshot->image, 0, header.data_offset);
+  memcpy(snapshot->image, &header, sizeof(snapshot_header_t));
+
+  out.data = snapshot->image + header.state_offset;
+  out.len = header.state_len;
+  out.pos = 0;
+  sys->vtable.save(sys, &out);
+
+  __snapshot_walk_t walk = {(snapshot_header_t*) snapshot->image, snapshot->image, 0};
+  mem_walk(&sys->mem, __snapshot_copy_page, &walk);
+
+  return snapshot;
+}
+
+bool sys_restore(system_t* sys, const snapshot_t* snapshot)
+{
+  const snapshot_header_t* header = (const snapshot_header_t*) snapshot->image;
+
+  if(sys->vtable.load == 0)
+    return false;
+
+  snapshot_stream_t in = {snapshot->image + header->state_offset, header->state_len, 0};
+
+  if(!sys->vtable.load(sys, &in))
+    return false;
+
+  sys->state = header->state;
+  sys->sleep = header->sleep;
+  sys->cycle = header->cycle;
+  sys->frequency = header->frequency;
+  sys->steps = 0;
+  sys->transaction.size = sys->transaction.blob_size = 0;
+
+  // Replace the memory, keeping its allocator and its devices
+  allocator_t page_node_allocator = allocator_copy(&sys->mem.page_node_allocator);
+  mem_region_t* regions = sys->mem.regions;
+  unsigned int region_count = sys->mem.region_count, region_capacity = sys->mem.region_capacity;
+
+  sys->mem.regions = NULL;
+  mem_destroy(&sys->mem);
+  __mem_init(&sys->mem, &page_node_allocator);
+
+  sys->mem.regions = regions;
+  sys->mem.region_count = region_count;
+  sys->mem.region_capacity = region_capacity;
+
+  const octa* table = (const octa*)(snapshot->image + header->table_offset);
+
+  // A block per run of contiguous pages
+  for(octa i = 0, j; i < header->pages; i = j)
+  {
+    for(j = i + 1; j < header->pages && table[j] == table[j - 1] + 1; j++);
+
+    void* vaddr = (void*)(uintptr_t)(table[i] << 12);
+    size_t len = (size_t)(j - i) * PAGE_SIZE;
+    off_t offset = (off_t)(header->data_offset + i * PAGE_SIZE);
+
+    if(snapshot->fd >= 0)
+    {
+      if(mem_map_file(&sys->mem, &sys->allocator, vaddr, snapshot->fd, offset, len) == NULL)
+        return false;
+    }
+    else
+    {
+      void* block = mem_alloc_managed(&sys->mem, &sys->allocator, vaddr, len);
+
+      if(block == NULL)
+        return false;
+
+      memcpy(block, snapshot->image + offset, len);
+    }
+  }
+
+  return true;
+}
+
+bool snapshot_save(const snapshot_t* snapshot, const char* path)
+{
+  FILE* file = fopen(path, "wb");
+
+  if(file == NULL)
+    return false;
+
+  size_t written = fwrite(snapshot->image, 1, snapshot->size, file);
+
+  return fclose(file) == 0 && written == snapshot->size;
+}
+
+snapshot_t* snapshot_open(allocator_t* allocator, const char* path)
+{
+#ifndef MEM_MMAP_SUPPORTED
+  return NULL;
+#else
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  if(fd < 0)
+    return NULL;
+
+  if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(snapshot_header_t))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  byte* image = (byte*) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if(image == MAP_FAILED)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  const snapshot_header_t* header = (const snapshot_header_t*) image;
+  snapshot_t* snapshot = NULL;
+
+  if(header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION && header->size == (octa) st.st_size)
+    snapshot = (snapshot_t*) pmalloc(allocator, sizeof(snapshot_t));
+
+  if(snapshot == NULL)
+  {
+    munmap(image, (size_t) st.st_size);
+    close(fd);
+    return NULL;
+  }
+
+  snapshot->image = image;
+  snapshot->size = (size_t) st.st_size;
+  snapshot->fd = fd;
+  snapshot->allocator = allocator_copy(allocator);
+
+  return snapshot;
+#endif
+}
+
+void snapshot_delete(snapshot_t* snapshot)
+{
+  allocator_t allocator = snapshot->allocator;
+
+#ifdef MEM_MMAP_SUPPORTED
+  if(snapshot->fd >= 0)
+  {
+    munmap(snapshot->image, snapshot->size);
+    close(snapshot->fd);
+  }
+  else
+#endif
+  {
+    pfree(&allocator, snapshot->image);
+  }
+
+  pfree(&allocator, snapshot);
+}
+
+#endif
@@ -2,11 +2,21 @@
 #define __SYS_H__
 
 #include "../lib/common/include/allocator.h"
+#include "../lib/common/include/arena.h"
 #include "../lib/common/include/transaction.h"
 #include "./memory/core.h"
 
+#include <limits.h>
 #include <string.h>
 
+// Writes a single step may log before the transaction has to grow.
+#define SYS_TRANSACTION_CAPACITY 1024
+// Bytes reserved for logged values wider than an octa (pipeline stages...).
+#define SYS_TRANSACTION_BLOB_CAPACITY (64 * 1024)
+
+// Idle until sys_wake
+#define SYS_SLEEP_FOREVER UINT_MAX
+
 typedef enum {
   SYS_READY,
   SYS_STOPPED,
@@ -15,38 +25,86 @@ typedef enum {
   SYS_PANICKED
 } system_state_t;
 
+struct snapshot_stream_t;
+
 typedef struct system_t
 {
   // System state
   int state;
-  float steps;   // Time left
-  float atomic_time; // Smallest unit of time possible (unit: s)
+  octa steps;     // Cycles left in the current run
+  octa cycle;     // Cycles elapsed
+  octa frequency; // Cycles per second
+  unsigned int sleep; // Idle steps before the next event, see sys_sleep
 
   // State transaction
   transaction_t transaction;
 
+  // Backing storage of the transaction, reserved once.
+  arena_t arena;
+
+  // Virtual memory
+  memory_t mem;
+
   // Keep track of the allocator.
   allocator_t allocator;
   
   // VTable
   struct {
     void (*step)(struct system_t* sys);
+    void (*destroy)(struct system_t* sys); // Release the component resources, if any
+    void (*reset)(struct system_t* sys);   // Release the resources a new init in place cannot reuse, see sys_reset
+    void (*save)(struct system_t* sys, struct snapshot_stream_t* out); // Write the component state, see sys_snapshot
+    bool (*load)(struct system_t* sys, struct snapshot_stream_t* in);  // Read it back, false if it does not fit the component
   } vtable;
 
 } system_t;
 
 void __sys_init(system_t* sys, allocator_t* transaction_allocator)
 {
-  transaction_create(&sys->transaction, transaction_allocator, 1000);
+  arena_create(&sys->arena, transaction_allocator, SYS_TRANSACTION_CAPACITY * sizeof(transaction_log_t) + SYS_TRANSACTION_BLOB_CAPACITY);
+  transaction_create_from_arena(&sys->transaction, &sys->arena, transaction_allocator, SYS_TRANSACTION_CAPACITY, SYS_TRANSACTION_BLOB_CAPACITY);
   sys->state = SYS_READY;
-  sys->steps = sys->atomic_time = 0;
+  sys->steps = sys->cycle = sys->frequency = 0;
+  sys->sleep = 0;
   sys->vtable.step = 0;
+  sys->vtable.destroy = 0;
+  sys->vtable.reset = 0;
+  sys->vtable.save = 0;
+  sys->vtable.load = 0;
+  sys->allocator = allocator_copy(transaction_allocator);
+  __mem_init(&sys->mem, transaction_allocator);
 }
 
 void sys_destroy(system_t* sys)
 {
+  if(sys->vtable.destroy != 0)
+    sys->vtable.destroy(sys);
+
   // Delete the memory.
   transaction_destroy(&sys->transaction);
+  arena_destroy(&sys->arena);
+  mem_destroy(&sys->mem);
+}
+
+// Release the component, keeping the transaction storage and the memory mappings,
+// so that a component can be initialised again in place. A component with a reset
+// hook keeps the resources it reuses.
+void sys_reset(system_t* sys)
+{
+  if(sys->vtable.reset != 0)
+    sys->vtable.reset(sys);
+  else if(sys->vtable.destroy != 0)
+    sys->vtable.destroy(sys);
+
+  sys->transaction.size = sys->transaction.blob_size = 0;
+  sys->state = SYS_READY;
+  sys->steps = 0;
+  sys->sleep = 0;
+  sys->vtable.step = 0;
+  sys->vtable.destroy = 0;
+  sys->vtable.reset = 0;
+  sys->vtable.save = 0;
+  sys->vtable.load = 0;
 }
 
 void sys_delete(system_t* sys, allocator_t* allocator)
@@ -60,10 +118,51 @@ void sys_commit(system_t* sys)
   tst_commit(&sys->transaction);
 }
 
+// The component has nothing to do for the next steps (SYS_SLEEP_FOREVER: until sys_wake).
+// The run loops jump over them at once.
+void sys_sleep(system_t* sys, unsigned int steps)
+{
+  sys->sleep = steps;
+}
+
+// Event for a sleeping component (an interrupt...), it is stepped again from the next step.
+void sys_wake(system_t* sys)
+{
+  sys->sleep = 0;
+}
+
+// Account cycles run by the component, the budget of the run is consumed as well.
+static inline void sys_advance(system_t* sys, octa cycles)
+{
+  sys->steps -= cycles < sys->steps ? cycles : sys->steps;
+  sys->cycle += cycles;
+}
+
+// Consume the idle steps left in the time budget, without stepping the component.
+void sys_skip_idle(system_t* sys)
+{
+  if(sys->sleep == 0 || sys->steps == 0)
+    return;
+
+  octa skipped = sys->sleep == SYS_SLEEP_FOREVER || sys->sleep > sys->steps ? sys->steps : sys->sleep;
+
+  sys_advance(sys, skipped);
+
+  if(sys->sleep != SYS_SLEEP_FOREVER)
+    sys->sleep -= (unsigned int) skipped;
+}
+
 void sys_step(system_t* sys) 
 {
-  if(sys->steps > 0) 
-    sys->steps = sys->steps - 1;
+  sys_advance(sys, 1);
+
+  if(sys->sleep > 0)
+  {
+    if(sys->sleep != SYS_SLEEP_FOREVER)
+      sys->sleep--;
+
+    return;
+  }
   
   if(sys->vtable.step == 0) 
     return;
@@ -78,7 +177,14 @@ void sys_loop(system_t* sys)
     return;
 
   while(sys->state == SYS_RUNNING) 
+  {
+    // Nothing will wake it up.
+    if(sys->sleep == SYS_SLEEP_FOREVER)
+      break;
+
+    sys->sleep = 0;
     sys_step(sys);
+  }
 }
 
 void sys_stop(system_t* sys)
@@ -97,7 +203,8 @@ void sys_panic(system_t* sys)
   sys->state = SYS_PANICKED;
 }
 
-void sys_run(system_t* sys, unsigned int ms)
+// Run for n cycles, or the cycles left if the system is already running.
+void sys_run_cycles(system_t* sys, octa n)
 {
   if(sys->state == SYS_STOPPED)
     return;
@@ -105,15 +212,30 @@ void sys_run(system_t* sys, unsigned int ms)
   if(sys->state == SYS_HALTED || sys->state == SYS_READY) 
   {
     sys->state = SYS_RUNNING;
-    sys->steps = (int)(((float)(ms) / 1000.0) / sys->atomic_time);
+    sys->steps = n;
   }
 
   while(sys->state == SYS_RUNNING && sys->steps > 0) 
   {
-    sys_step(sys);
+    sys_skip_idle(sys);
+
+    if(sys->steps > 0)
+      sys_step(sys);
   }
 
   sys_halt(sys);
 }
 
+// Run until the cycle counter reaches target.
+void sys_run_until(system_t* sys, octa target)
+{
+  if(target > sys->cycle)
+    sys_run_cycles(sys, target - sys->cycle);
+}
+
+void sys_run(system_t* sys, unsigned int ms)
+{
+  sys_run_cycles(sys, (octa) ms * sys->frequency / 1000);
+}
+
 #endif
\ No newline at end of file
@@ -1,4 +1,4 @@
-gcc -Wall -Werror -g3 "./test.c"  -o"./build/test.exe" 
+gcc -Wall -Werror -g3 "./test.c"  -o"./build/test.exe" -fno-strict-aliasing -Wno-uninitialized -pthread
 cd build 
 test.exe 
 cd ..
@@ -9,14 +9,25 @@
 #include "test_riscv.h"
 #include "test_system.h"
 #include "test_data_cache.h"
+#include "test_memory.h"
+#include "test_mmix.h"
+#include "test_batch.h"
+#include "test_platform.h"
+#include "test_snapshot.h"
 
 set_tests(
-  data_cache, 
-  transaction, 
+  data_caches, 
+  transaction, transaction_arena,
   riscv, 
-  system
+  riscv_ooo,
+  system, system_sleep, system_cycles,
+  memory,
+  mmix,
+  mmix_threaded,
+  batch,
+  platform,
+  snapshot
   //, string, buffer 
-  //, arith, memory
-  //, mmix
+  //, arith
   //, lexer
 );
@@ -0,0 +1,138 @@
+#include "../lib/common/include/testing/utils.h"
+#include "../lib/common/include/allocator.h"
+
+#include "../src/batch.h"
+
+#define BATCH_TEST_JOBS 16
+
+define_test(batch_run, test_print("Batch runner"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // Store x3 := 5 + 7 (a), or x3 := 5 + 9 (b), at 0x100
+    tetra prog_a[] = {
+      riscv_addi(0, 1, 5),
+      riscv_addi(0, 2, 7),
+      riscv_add(3, 1, 2),
+      riscv_addi(0, 7, 0x100),
+      riscv_sd(7, 3, 0),
+      riscv_ebreak()
+    };
+
+    tetra prog_b[] = {
+      riscv_addi(0, 1, 5),
+      riscv_addi(0, 2, 9),
+      riscv_add(3, 1, 2),
+      riscv_addi(0, 7, 0x100),
+      riscv_sd(7, 3, 0),
+      riscv_ebreak()
+    };
+
+    octa prog_mmix[] = {
+      __mmix_instr(ADDUI, 0xC0, 0xC0, 1),
+      __mmix_instr(ADDUI, 0xC0, 0xC0, 2),
+      __mmix_instr(ADDUI, 0xC0, 0xC0, 3)
+    };
+
+    batch_job_t jobs[BATCH_TEST_JOBS];
+    batch_result_t results[BATCH_TEST_JOBS];
+    batch_result_t ref[BATCH_TEST_JOBS];
+
+    for(unsigned int i = 0; i < BATCH_TEST_JOBS; i++)
+    {
+      batch_job_t* job = &jobs[i];
+
+      if(i % 4 == 3)
+      {
+        job->kind = BATCH_MMIX;
+        mmix_cfg_init(&job->cfg.mmix);
+        job->image = prog_mmix;
+        job->image_len = sizeof(prog_mmix);
+        job->load_address = MMIX_START_ADDR;
+        job->cycles = 3;
+      }
+      else
+      {
+        job->kind = BATCH_RISCV;
+        riscv_processor_cfg_init(&job->cfg.riscv);
+        job->image = i % 2 ? (void*) prog_b : (void*) prog_a;
+        job->image_len = sizeof(prog_a);
+        job->load_address = 0;
+        job->cycles = 1000;
+      }
+
+      job->memory_size = PAGE_SIZE;
+    }
+
+    bool ok_ref = batch_run(&allocator, jobs, ref, BATCH_TEST_JOBS, 1);
+    bool ok = batch_run(&allocator, jobs, results, BATCH_TEST_JOBS, 4);
+
+    test_check(
+      test_print("Check that every job ran"),
+      ok && ok_ref,
+      test_failure("Expecting no panicked job")
+    );
+
+    for(unsigned int i = 0; i < BATCH_TEST_JOBS; i++)
+    {
+      test_check(
+        test_print("Check that job %u has the same digests over 1 and 4 workers", i),
+        results[i].regs_digest == ref[i].regs_digest && results[i].memory_digest == ref[i].memory_digest && results[i].cycles == ref[i].cycles,
+        test_failure("Expecting %llx/%llx, got %llx/%llx", ref[i].regs_digest, ref[i].memory_digest, results[i].regs_digest, results[i].memory_digest)
+      );
+
+      // The RISC-V programs end on EBREAK, the MMIX ones run out of budget.
+      if(jobs[i].kind == BATCH_RISCV)
+      {
+        test_check(
+          test_print("Check that job %u halted before its budget", i),
+          results[i].state == SYS_HALTED && results[i].cycles < jobs[i].cycles,
+          test_failure("Expecting state %d before %u cycles, got %d after %u cycles", SYS_HALTED, jobs[i].cycles, results[i].state, results[i].cycles)
+        );
+      }
+      else
+      {
+        test_check(
+          test_print("Check that job %u ran out of its budget", i),
+          results[i].state == SYS_RUNNING && results[i].cycles == jobs[i].cycles,
+          test_failure("Expecting state %d after %u cycles, got %d after %u cycles", SYS_RUNNING, jobs[i].cycles, results[i].state, results[i].cycles)
+        );
+      }
+    }
+
+    test_check(
+      test_print("Check that a reused system gives the digests of a fresh one"),
+      results[0].regs_digest == results[4].regs_digest && results[0].memory_digest == results[4].memory_digest
+        && results[3].regs_digest == results[7].regs_digest,
+      test_failure("Expecting equal digests for the same program")
+    );
+
+    // Guest memory of each program after its run
+    byte memory_a[PAGE_SIZE], memory_b[PAGE_SIZE];
+    octa value_a = 12, value_b = 14;
+
+    memset(memory_a, 0, PAGE_SIZE);
+    memset(memory_b, 0, PAGE_SIZE);
+    memcpy(memory_a, prog_a, sizeof(prog_a));
+    memcpy(memory_b, prog_b, sizeof(prog_b));
+    memcpy(memory_a + 0x100, &value_a, sizeof(octa));
+    memcpy(memory_b + 0x100, &value_b, sizeof(octa));
+
+    octa digest_a = batch_digest(0xcbf29ce484222325ULL, memory_a, PAGE_SIZE);
+    octa digest_b = batch_digest(0xcbf29ce484222325ULL, memory_b, PAGE_SIZE);
+
+    test_check(
+      test_print("Check that the programs store their values"),
+      results[0].memory_digest == digest_a && results[1].memory_digest == digest_b,
+      test_failure("Expecting %llx/%llx, got %llx/%llx", digest_a, digest_b, results[0].memory_digest, results[1].memory_digest)
+    );
+
+    test_success;
+    test_teardown;
+    test_end;
+}
+
+define_test_chapter(
+  batch, test_print("Batch"),
+  batch_run
+)
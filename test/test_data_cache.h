@@ -2,14 +2,18 @@
 #include "../lib/common/include/types.h"
 #include "../src/processor/cache.h"
 
-define_test(data_cache, test_print("Data cache")) 
+define_test(data_cache, test_print("Data cache"))
 {
     data_cache_t cache;
+    data_cache_cfg_t cfg;
     allocator_t allocator = GLOBAL_ALLOCATOR;
-    data_cache_entry_t* base = pmalloc(&allocator, sizeof(data_cache_entry_t) * 256);
+
+    data_cache_cfg_init(&cfg);
+    data_cache_line_t* lines = pmalloc(&allocator, sizeof(data_cache_line_t) * data_cache_lines_count(&cfg));
+    octa* data = pmalloc(&allocator, data_cache_data_size(&cfg));
     byte b = 0;
 
-    data_cache_create(&cache, base, 256);
+    data_cache_create(&cache, &cfg, lines, data);
 
     test_check(
         test_print("Check that we have a cache miss at 0xAB"),
@@ -30,13 +34,276 @@ define_test(data_cache, test_print("Data cache"))
     );
 
     test_check(
-        test_print("Check cached value at address 0xAB"), 
-        b == 100, 
+        test_print("Check cached value at address 0xAB"),
+        b == 100,
         test_failure("Expecting 100, got %d", b)
     );
 
     test_success;
     test_teardown;
-    pfree(&allocator, base);
+    pfree(&allocator, lines);
+    pfree(&allocator, data);
+    test_end;
+}
+
+define_test(data_cache_lru, test_print("Data cache set associativity"))
+{
+    data_cache_t cache;
+    data_cache_cfg_t cfg = {16, 4, 2};
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    data_cache_line_t* lines = pmalloc(&allocator, sizeof(data_cache_line_t) * data_cache_lines_count(&cfg));
+    octa* data = pmalloc(&allocator, data_cache_data_size(&cfg));
+    octa stride = cfg.line_size * cfg.sets; // Same set, next tag
+    octa o = 0;
+    byte b = 0;
+
+    data_cache_create(&cache, &cfg, lines, data);
+
+    // Fill both ways of set #0 with clean lines
+    for(unsigned int i = 0; i < 2; i++)
+    {
+        for(unsigned int j = 0; j < cfg.line_size; j++)
+            data_cache_update(&cache, i * stride + j, i + 1, 0);
+
+        data_cache_step(&cache, 0);
+    }
+
+    test_check(
+        test_print("Check that both ways of the set are hits"),
+        data_cache_read(&cache, 0, &b, 0) && b == 1 && data_cache_read(&cache, stride, &b, 0) && b == 2,
+        test_failure("Expecting two hits")
+    );
+
+    data_cache_step(&cache, 0);
+    data_cache_read(&cache, 0, &b, 0); // Way holding tag #0 is now the most recently used
+
+    test_check(
+        test_print("Check that a third tag in the same set is a miss"),
+        !data_cache_read(&cache, 2 * stride, &b, 0),
+        test_failure("Expecting a miss")
+    );
+
+    test_check(
+        test_print("Check that the least recently used line has been evicted"),
+        data_cache_read(&cache, 0, &b, 0) && !data_cache_read(&cache, stride, &b, 0),
+        test_failure("Expecting tag #1 to be evicted")
+    );
+
+    test_check(
+        test_print("Check that an octa crossing two lines is written and read back"),
+        data_cache_write_octa(&cache, 3 * cfg.line_size - 4, 0x0123456789ABCDEF, 0)
+            && data_cache_read_octa(&cache, 3 * cfg.line_size - 4, &o, 0)
+            && o == 0x0123456789ABCDEF,
+        test_failure("Expecting 0x0123456789ABCDEF")
+    );
+
+    test_success;
+    test_teardown;
+    pfree(&allocator, lines);
+    pfree(&allocator, data);
+    test_end;
+}
+
+define_test(data_cache_words, test_print("Data cache word accesses"))
+{
+    data_cache_t cache;
+    data_cache_cfg_t cfg = {16, 4, 2};
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    data_cache_line_t* lines = pmalloc(&allocator, sizeof(data_cache_line_t) * data_cache_lines_count(&cfg));
+    octa* data = pmalloc(&allocator, data_cache_data_size(&cfg));
+    octa o = 0;
+    tetra t = 0;
+    byte b = 0;
+
+    data_cache_create(&cache, &cfg, lines, data);
+
+    test_check(
+        test_print("Check that an aligned octa read is a miss"),
+        !data_cache_read_octa(&cache, 0x10, &o, 0),
+        test_failure("No cache miss...")
+    );
+
+    data_cache_update_octa(&cache, 0x10, 0x0123456789ABCDEF, 0);
+    data_cache_update_octa(&cache, 0x18, 0xFEDCBA9876543210, 0);
+
+    test_check(
+        test_print("Check that the line is no longer pending once filled by two octas"),
+        !lines[1 * cfg.ways].pending && lines[1 * cfg.ways].valid == cache.full_mask,
+        test_failure("Expecting a complete line")
+    );
+
+    test_check(
+        test_print("Check aligned tetra and byte reads of the filled line"),
+        data_cache_read_tetra(&cache, 0x14, &t, 0) && t == 0x01234567 && data_cache_read(&cache, 0x18, &b, 0) && b == 0x10,
+        test_failure("Expecting 0x01234567 and 0x10")
+    );
+
+    test_check(
+        test_print("Check a misaligned tetra read within the line"),
+        data_cache_read_tetra(&cache, 0x16, &t, 0) && t == 0x32100123,
+        test_failure("Expecting 0x32100123, got %x", t)
+    );
+
+    data_cache_write_tetra(&cache, 0x10, 0xCAFEBABE, 0);
+    data_cache_update_octa(&cache, 0x10, 0, 0);
+
+    test_check(
+        test_print("Check that a fill does not overwrite dirty bytes"),
+        data_cache_read_octa(&cache, 0x10, &o, 0) && o == 0x00000000CAFEBABE,
+        test_failure("Expecting 0x00000000CAFEBABE")
+    );
+
+    test_success;
+    test_teardown;
+    pfree(&allocator, lines);
+    pfree(&allocator, data);
+    test_end;
+}
+
+static void __test_data_cache_count_fetch(void* self, data_cache_t* data_cache, transaction_t* transaction, data_cache_event_payload_t payload)
+{
+    (*(unsigned int*) self)++;
+}
+
+define_test(data_cache_mshrs, test_print("Data cache misses in flight"))
+{
+    data_cache_t cache;
+    data_cache_cfg_t cfg;
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    data_cache_cfg_init(&cfg);
+    cfg.fill_latency = 3;
+
+    data_cache_line_t* lines = pmalloc(&allocator, sizeof(data_cache_line_t) * data_cache_lines_count(&cfg));
+    octa* data = pmalloc(&allocator, data_cache_data_size(&cfg));
+    octa line[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    unsigned int fetches = 0;
+    byte b = 0;
+
+    data_cache_create(&cache, &cfg, lines, data);
+    cache.event_handlers[DATA_CACHE_EVENT_FETCH].self = &fetches;
+    cache.event_handlers[DATA_CACHE_EVENT_FETCH].hdlr = __test_data_cache_count_fetch;
+
+    data_cache_write(&cache, 0x400, 42, 0);
+
+    // Three lines, and a second miss to the first one
+    data_cache_read(&cache, 0x000, &b, 0);
+    data_cache_read(&cache, 0x040, &b, 0);
+    data_cache_read(&cache, 0x080, &b, 0);
+    data_cache_read(&cache, 0x008, &b, 0);
+
+    test_check(
+        test_print("Check that a miss to a line in flight is merged"),
+        data_cache_misses(&cache) == 3 && data_cache_pending(&cache, 0x048) && !data_cache_pending(&cache, 0x0C0),
+        test_failure("Expecting 3 misses, got %u", data_cache_misses(&cache))
+    );
+
+    test_check(
+        test_print("Check that the other lines hit under the misses"),
+        data_cache_read(&cache, 0x400, &b, 0) && b == 42,
+        test_failure("Expecting a hit")
+    );
+
+    data_cache_step(&cache, 0);
+    data_cache_step(&cache, 0);
+    unsigned int early = fetches;
+    data_cache_step(&cache, 0);
+
+    test_check(
+        test_print("Check that the lines in flight are requested in the same step, after the fill latency"),
+        early == 0 && fetches == 3,
+        test_failure("Expecting 0 then 3 requests, got %u and %u", early, fetches)
+    );
+
+    data_cache_fill(&cache, 0x040, (const byte*) line, cache.full_mask, 0);
+    data_cache_step(&cache, 0);
+
+    test_check(
+        test_print("Check that a filled line releases its MSHR"),
+        data_cache_read(&cache, 0x048, &b, 0) && b == 2 && data_cache_misses(&cache) == 2,
+        test_failure("Expecting a hit and 2 misses, got %u", data_cache_misses(&cache))
+    );
+
+    for(octa addr = 0x1000; addr < 0x1000 + DATA_CACHE_MSHRS * cfg.line_size; addr += cfg.line_size)
+        data_cache_read(&cache, addr, &b, 0);
+
+    test_check(
+        test_print("Check that a miss is not requested with every MSHR busy"),
+        data_cache_misses(&cache) == DATA_CACHE_MSHRS && !data_cache_pending(&cache, 0x1000 + (DATA_CACHE_MSHRS - 1) * cfg.line_size),
+        test_failure("Expecting %u misses, got %u", DATA_CACHE_MSHRS, data_cache_misses(&cache))
+    );
+
+    test_success;
+    test_teardown;
+    pfree(&allocator, lines);
+    pfree(&allocator, data);
     test_end;
-}
\ No newline at end of file
+}
+
+// Memory behind the cache of data_cache_writeback
+static byte __test_data_cache_memory[0x100];
+
+static void __test_data_cache_send(void* self, data_cache_t* data_cache, transaction_t* transaction, data_cache_event_payload_t payload)
+{
+    for(unsigned int i = 0; i < data_cache->cfg.line_size; i++)
+    {
+        if(payload.send.dirty & ((octa) 1 << i))
+            __test_data_cache_memory[payload.send.addr + i] = payload.send.data[i];
+    }
+
+    data_cache_clean(data_cache, payload.send.addr, payload.send.dirty, transaction);
+    (*(unsigned int*) self)++;
+}
+
+define_test(data_cache_writeback, test_print("Data cache write-back"))
+{
+    data_cache_t cache;
+    data_cache_cfg_t cfg;
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    data_cache_cfg_init(&cfg);
+
+    data_cache_line_t* lines = pmalloc(&allocator, sizeof(data_cache_line_t) * data_cache_lines_count(&cfg));
+    octa* data = pmalloc(&allocator, data_cache_data_size(&cfg));
+    unsigned int sends = 0;
+
+    memset(__test_data_cache_memory, 0, sizeof(__test_data_cache_memory));
+
+    data_cache_create(&cache, &cfg, lines, data);
+    cache.event_handlers[DATA_CACHE_EVENT_SEND].self = &sends;
+    cache.event_handlers[DATA_CACHE_EVENT_SEND].hdlr = __test_data_cache_send;
+
+    data_cache_write(&cache, 0x02, 7, 0);
+    data_cache_write_octa(&cache, 0x08, 0x1122334455667788ULL, 0);
+
+    // The write-back scan starts from the first line, the one of 0x00
+    data_cache_step(&cache, 0);
+
+    octa value;
+    memcpy(&value, __test_data_cache_memory + 0x08, sizeof(octa));
+
+    test_check(
+        test_print("Check that the dirty bytes of a line are written back in one step"),
+        sends == 1 && __test_data_cache_memory[0x02] == 7 && value == 0x1122334455667788ULL && __test_data_cache_memory[0x01] == 0,
+        test_failure("Expecting one write-back of the dirty bytes, got %u", sends)
+    );
+
+    test_check(
+        test_print("Check that the written back bytes are clean"),
+        lines[0].present && lines[0].dirty == 0,
+        test_failure("Expecting a clean line, got %llx", lines[0].dirty)
+    );
+
+    test_success;
+    test_teardown;
+    pfree(&allocator, lines);
+    pfree(&allocator, data);
+    test_end;
+}
+
+define_test_chapter(
+    data_caches, test_print("Data cache"),
+    data_cache, data_cache_lru, data_cache_words, data_cache_mshrs, data_cache_writeback
+)
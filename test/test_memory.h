@@ -11,6 +11,11 @@ memory_t mem_boostrap()
   return mem;
 }
 
+void mem_count_page(void* self, uintptr_t pid, const page_t* page)
+{
+  (*(int*) self)++;
+}
+
 define_test(
   page_node, test_print("Page node basics")
 ) {
@@ -183,7 +188,361 @@ define_test(
   test_end;
 }
 
+define_test(
+  mem_unmap,
+  test_print("Memory unmap")
+) {
+  char exceptions = 0;
+  void* out = 0;
+  byte block[3 * PAGE_SIZE];
+  void* vbase = (void*) 0x2000000000000000;
+
+  memory_t mem = mem_boostrap();
+
+  mem_map(&mem, vbase, block, sizeof(block));
+
+  test_check(
+    test_print("Check that the last page of a 3-pages block is mapped."),
+    mem_tl(&mem, vbase + 2 * PAGE_SIZE + 1, &out, &exceptions) && out == block + 2 * PAGE_SIZE + 1,
+    test_failure("Expecting %p, got %p.", block + 2 * PAGE_SIZE + 1, out)
+  );
+
+  // Warm the translation cache, then unmap.
+  mem_tl(&mem, vbase + PAGE_SIZE, &out, &exceptions);
+  mem_unmap(&mem, vbase + PAGE_SIZE, PAGE_SIZE);
+
+  test_check(
+    test_print("Check that an unmapped page causes a page fault."),
+    !mem_tl(&mem, vbase + PAGE_SIZE, &out, &exceptions),
+    test_failure("Should be a page fault")
+  );
+
+  mem_map(&mem, vbase, block + PAGE_SIZE, PAGE_SIZE);
+
+  test_check(
+    test_print("Check that a remapped page is translated to its new block."),
+    mem_tl(&mem, vbase, &out, &exceptions) && out == block + PAGE_SIZE,
+    test_failure("Expecting %p, got %p.", block + PAGE_SIZE, out)
+  );
+
+  test_success;
+  
+  test_teardown {
+    mem_destroy(&mem);
+  }
+
+  test_end;
+}
+
+define_test(
+  mem_clone,
+  test_print("Memory copy-on-write clone")
+) {
+  char exceptions = 0;
+  octa* out[2];
+  octa* written;
+  void* vbase = (void*) 0x10000;
+
+  memory_t src = mem_boostrap();
+  memory_t dst = mem_boostrap();
+  allocator_t allocator = GLOBAL_ALLOCATOR;
+
+  octa* block = (octa*) mem_alloc_managed(&src, &allocator, vbase, 2 * PAGE_SIZE);
+  block[0] = 0xCAFE;
+  block[PAGE_SIZE / sizeof(octa)] = 0xBEEF;
+
+  test_check(
+    test_print("Check that the memory is cloned."),
+    mem_clone(&dst, &src),
+    test_failure("Should be true")
+  );
+
+  mem_tl(&src, vbase, (void**) &out[0], &exceptions);
+  mem_tl(&dst, vbase, (void**) &out[1], &exceptions);
+
+  test_check(
+    test_print("Check that the clone shares the pages of the source."),
+    out[0] == out[1] && *out[1] == 0xCAFE,
+    test_failure("Expecting %p, got %p.", out[0], out[1])
+  );
+
+  mem_tl_write(&dst, vbase, (void**) &written, &exceptions);
+  *written = 0xF00D;
+
+  test_check(
+    test_print("Check that the first write of the clone copies the page."),
+    written != out[0] && *out[0] == 0xCAFE && *written == 0xF00D,
+    test_failure("Expecting a copy, got %p and %llx.", written, *out[0])
+  );
+
+  mem_tl_write(&dst, vbase + 8, (void**) &out[1], &exceptions);
+
+  test_check(
+    test_print("Check that a page copied once is written in place."),
+    out[1] == written + 1,
+    test_failure("Expecting %p, got %p.", written + 1, out[1])
+  );
+
+  mem_tl_write(&src, vbase + PAGE_SIZE, (void**) &written, &exceptions);
+  *written = 0xD00D;
+  mem_destroy(&src);
+
+  mem_tl(&dst, vbase + PAGE_SIZE, (void**) &out[1], &exceptions);
+
+  test_check(
+    test_print("Check that the source copies its shared pages, and that they outlive it."),
+    exceptions == 0 && *out[1] == 0xBEEF,
+    test_failure("Expecting 0xBEEF, got %llx.", *out[1])
+  );
+
+  mem_tl_write(&dst, vbase + PAGE_SIZE, (void**) &written, &exceptions);
+
+  test_check(
+    test_print("Check that the last page over a block is written in place."),
+    written == out[1],
+    test_failure("Expecting %p, got %p.", out[1], written)
+  );
+
+  test_success;
+  
+  test_teardown {
+    mem_destroy(&dst);
+  }
+
+  test_end;
+}
+
+define_test(
+  mem_large,
+  test_print("Memory large regions")
+) {
+  char exceptions = 0;
+  octa* out;
+  octa* written;
+
+  // 1 GiB, from 3 pages below a large page boundary
+  void* vbase = (void*) (0x100000000 - 3 * PAGE_SIZE);
+  size_t len = 1024 * 1024 * 1024;
+
+  memory_t mem = mem_boostrap();
+  memory_t fork = mem_boostrap();
+  allocator_t allocator = GLOBAL_ALLOCATOR;
+
+  byte* block = (byte*) mem_alloc_managed(&mem, &allocator, vbase, len);
+
+  test_check(
+    test_print("Check that a 1 GiB region is allocated and mapped."),
+    block != NULL,
+    test_failure("Should not be NULL")
+  );
+
+  test_check(
+    test_print("Check that the pages before, within and after the large pages are translated."),
+    mem_tl(&mem, vbase + 8, (void**) &out, &exceptions) && (byte*) out == block + 8
+      && mem_tl(&mem, vbase + 3 * PAGE_SIZE + MEM_LARGE_SIZE + 16, (void**) &out, &exceptions) && (byte*) out == block + 3 * PAGE_SIZE + MEM_LARGE_SIZE + 16
+      && mem_tl(&mem, vbase + len - 8, (void**) &out, &exceptions) && (byte*) out == block + len - 8 && *out == 0,
+    test_failure("Expecting %p, got %p.", block + len - 8, out)
+  );
+
+  test_check(
+    test_print("Check that the region past the end is not mapped."),
+    !mem_tl(&mem, vbase + len, (void**) &out, &exceptions),
+    test_failure("Should be a page fault")
+  );
+
+  exceptions = 0;
+  mem_unmap(&mem, vbase + 3 * PAGE_SIZE + MEM_LARGE_SIZE + PAGE_SIZE, PAGE_SIZE);
+
+  test_check(
+    test_print("Check that a page unmapped from a large page causes a page fault, and not its neighbours."),
+    !mem_tl(&mem, vbase + 3 * PAGE_SIZE + MEM_LARGE_SIZE + PAGE_SIZE, (void**) &out, &exceptions)
+      && mem_tl(&mem, vbase + 3 * PAGE_SIZE + MEM_LARGE_SIZE + 2 * PAGE_SIZE, (void**) &out, &exceptions)
+      && (byte*) out == block + 3 * PAGE_SIZE + MEM_LARGE_SIZE + 2 * PAGE_SIZE,
+    test_failure("Expecting the neighbour page at %p, got %p.", block + 3 * PAGE_SIZE + MEM_LARGE_SIZE + 2 * PAGE_SIZE, out)
+  );
+
+  exceptions = 0;
+  mem_clone(&fork, &mem);
+  mem_tl_write(&fork, vbase + 3 * PAGE_SIZE + 2 * MEM_LARGE_SIZE, (void**) &written, &exceptions);
+  *written = 0xCAFE;
+
+  mem_tl(&mem, vbase + 3 * PAGE_SIZE + 2 * MEM_LARGE_SIZE, (void**) &out, &exceptions);
+
+  test_check(
+    test_print("Check that a write to a cloned large page copies a single page."),
+    exceptions == 0 && *out == 0 && *written == 0xCAFE && (byte*) out == block + 3 * PAGE_SIZE + 2 * MEM_LARGE_SIZE
+      && mem_tl(&fork, vbase + 4 * PAGE_SIZE + 2 * MEM_LARGE_SIZE, (void**) &written, &exceptions) && (byte*) written == block + 4 * PAGE_SIZE + 2 * MEM_LARGE_SIZE,
+    test_failure("Expecting 0 in the source, got %llx.", *out)
+  );
+
+  test_success;
+  
+  test_teardown {
+    mem_destroy(&fork);
+    mem_destroy(&mem);
+  }
+
+  test_end;
+}
+
+define_test(
+  mem_window,
+  test_print("Memory linear window")
+) {
+  char exceptions = 0;
+  octa* out;
+  octa* written;
+  void* vbase = (void*) 0x10000;
+  size_t len = 16 * PAGE_SIZE;
+  octa mmio[PAGE_SIZE / sizeof(octa)];
+
+  memory_t mem = mem_boostrap();
+  memory_t fork = mem_boostrap();
+  allocator_t allocator = GLOBAL_ALLOCATOR;
+
+  byte* block = (byte*) mem_alloc_window(&mem, &allocator, vbase, len);
+  mem_map(&mem, vbase + len, mmio, sizeof(mmio));
+
+  test_check(
+    test_print("Check that the window is translated by an offset, and the pages out of it through the page table."),
+    block != NULL && mem.window.base == (uintptr_t) vbase && mem.window.len == len
+      && mem_tl(&mem, vbase + len - 8, (void**) &out, &exceptions) && (byte*) out == block + len - 8
+      && mem_tl(&mem, vbase + len + 8, (void**) &out, &exceptions) && out == mmio + 1,
+    test_failure("Expecting %p, got %p.", (void*)(mmio + 1), out)
+  );
+
+  void* paddr;
+
+  test_check(
+    test_print("Check that an access crossing the end of the window is not translated by the window."),
+    !mem_window_tl(&mem, vbase + len - 4, sizeof(octa), &paddr) && mem_window_tl(&mem, vbase + len - 8, sizeof(octa), &paddr),
+    test_failure("Should fall back to the page table")
+  );
+
+  int pages = 0;
+  mem_walk(&mem, mem_count_page, &pages);
+
+  test_check(
+    test_print("Check that the pages of the window are walked."),
+    pages == 17,
+    test_failure("Expecting 17 pages, got %d.", pages)
+  );
+
+  exceptions = 0;
+  mem_clone(&fork, &mem);
+  mem_tl_write(&mem, vbase, (void**) &written, &exceptions);
+  *written = 0xCAFE;
+  mem_tl(&fork, vbase, (void**) &out, &exceptions);
+
+  test_check(
+    test_print("Check that a cloned window is dropped, its writes being copy-on-write."),
+    exceptions == 0 && mem.window.len == 0 && *out == 0 && (byte*) out == block && (byte*) written != block,
+    test_failure("Expecting 0 in the clone, got %llx.", *out)
+  );
+
+  mem_destroy(&fork);
+  mem_destroy(&mem);
+
+  mem = mem_boostrap();
+  block = (byte*) mem_alloc_window(&mem, &allocator, vbase, len);
+  mem_unmap(&mem, vbase + PAGE_SIZE, PAGE_SIZE);
+
+  test_check(
+    test_print("Check that unmapping a page of the window drops it."),
+    mem.window.len == 0 && !mem_tl(&mem, vbase + PAGE_SIZE, (void**) &out, &exceptions)
+      && mem_tl(&mem, vbase, (void**) &out, &exceptions) && (byte*) out == block,
+    test_failure("Should be a page fault")
+  );
+
+  test_success;
+
+  test_teardown {
+    mem_destroy(&fork);
+    mem_destroy(&mem);
+  }
+
+  test_end;
+}
+
+static bool mem_test_device_read(void* self, octa offset, void* dst, size_t size)
+{
+  memcpy(dst, (byte*) self + offset, size);
+  return true;
+}
+
+static bool mem_test_device_write(void* self, octa offset, const void* src, size_t size)
+{
+  memcpy((byte*) self + offset, src, size);
+  return true;
+}
+
+define_test(
+  mem_device,
+  test_print("Memory device regions")
+) {
+  char exceptions = 0;
+  void* out;
+  octa regs[8][4] = {{0}};
+  byte ram[PAGE_SIZE];
+  octa value = 0xCAFE;
+  octa read = 0;
+
+  memory_t mem = mem_boostrap();
+  mem_map(&mem, (void*) 0x1000, ram, sizeof(ram));
+
+  // Bound in a shuffled order
+  bool attached = true;
+
+  for(unsigned int i = 0; i < 8; i++)
+  {
+    unsigned int j = (i * 5) % 8;
+    mem_device_t device = {mem_test_device_read, mem_test_device_write, regs[j]};
+    attached = attached && mem_attach_device(&mem, (void*)(uintptr_t)(0x10000 + j * 0x100), sizeof(regs[j]), &device);
+  }
+
+  test_check(
+    test_print("Check that the devices are bound, and overlapping regions rejected."),
+    attached && mem.region_count == 8
+      && !mem_attach_device(&mem, (void*) 0x10018, 16, &mem.regions[0].device)
+      && !mem_attach_device(&mem, (void*) 0xFFF8, 16, &mem.regions[0].device),
+    test_failure("Expecting 8 regions, got %u.", mem.region_count)
+  );
+
+  test_check(
+    test_print("Check that the accesses are dispatched to their device."),
+    mem_find_device(&mem, (void*) 0x10318) == &mem.regions[3] && mem_find_device(&mem, (void*) 0x10320) == NULL
+      && mem_device_write(&mem, (void*) 0x10508, &value, sizeof(value), &exceptions) && regs[5][1] == 0xCAFE
+      && mem_device_read(&mem, (void*) 0x10508, &read, sizeof(read), &exceptions) && read == 0xCAFE,
+    test_failure("Expecting 0xCAFE, got %llx.", read)
+  );
+
+  test_check(
+    test_print("Check that the accesses out of the devices, or crossing their end, fault."),
+    !mem_device_read(&mem, (void*) 0x10340, &read, sizeof(read), &exceptions)
+      && !mem_device_read(&mem, (void*) 0x1051C, &read, sizeof(read), &exceptions)
+      && !mem_device_read(&mem, (void*) 0x1000, &read, sizeof(read), &exceptions) && exceptions != 0,
+    test_failure("Should be a fault")
+  );
+
+  exceptions = 0;
+
+  test_check(
+    test_print("Check that a detached device is not dispatched, and the RAM is still translated."),
+    mem_detach_device(&mem, (void*) 0x10500) && mem_find_device(&mem, (void*) 0x10508) == NULL && mem.region_count == 7
+      && mem_tl(&mem, (void*) 0x1008, &out, &exceptions) && out == ram + 8,
+    test_failure("Expecting %p, got %p.", ram + 8, out)
+  );
+
+  test_success;
+
+  test_teardown {
+    mem_destroy(&mem);
+  }
+
+  test_end;
+}
+
 define_test_chapter(
   memory, test_print("Memory"), 
-  page_node, mem_tl, mem_map, mem_alloc_managed
+  page_node, mem_tl, mem_map, mem_alloc_managed, mem_unmap, mem_clone, mem_large, mem_window, mem_device
 )
@@ -23,6 +23,9 @@ void* mmix_install_memory(system_t* sys, void* vaddr, size_t len)
   return (pblock + offset);
 }
 
+// Engine of the systems created by mmix_bootstrap
+unsigned int mmix_test_engine = MMIX_ENGINE_INTERPRETER;
+
 system_t* mmix_bootstrap(octa* prog, size_t len)
 {
   len *= sizeof(octa);
@@ -30,6 +33,7 @@ system_t* mmix_bootstrap(octa* prog, size_t len)
   allocator_t allocator = GLOBAL_ALLOCATOR;
 
   mmix_cfg_t cfg; mmix_cfg_init(&cfg);
+  cfg.engine = mmix_test_engine;
   system_t* sys = mmix_create(&allocator, &cfg);
 
   assert(sys != NULL);
@@ -48,6 +52,12 @@ system_t* mmix_bootstrap(octa* prog, size_t len)
   return sys;
 }
 
+void mmix_shutdown(system_t* sys)
+{
+  allocator_t allocator = GLOBAL_ALLOCATOR;
+  sys_delete(sys, &allocator);
+}
+
 define_test(mmix_mux, test_print("MUX")) {
   char se[32], s0[32];
   octa e;
@@ -96,7 +106,7 @@ define_test(mmix_mux, test_print("MUX")) {
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -143,7 +153,7 @@ define_test(mmix_muxi, test_print("MUXI")) {
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -181,7 +191,7 @@ define_test(mmix_or, test_print("OR")) {
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -219,7 +229,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -258,7 +268,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -296,7 +306,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -335,7 +345,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -373,7 +383,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -422,7 +432,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -465,7 +475,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -520,7 +530,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -569,7 +579,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -623,7 +633,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -671,7 +681,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -725,7 +735,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -773,7 +783,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -827,7 +837,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -875,7 +885,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -926,7 +936,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -971,7 +981,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -1026,7 +1036,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -1075,7 +1085,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -1130,7 +1140,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -1179,7 +1189,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -1234,7 +1244,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -1283,7 +1293,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end; 
 }
@@ -1369,7 +1379,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1455,7 +1465,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1529,7 +1539,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1601,7 +1611,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1642,7 +1652,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1682,7 +1692,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1752,7 +1762,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1820,7 +1830,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1859,7 +1869,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1898,7 +1908,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1937,7 +1947,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -1949,7 +1959,7 @@ define_test(
   octa x, e;
 
   octa prog [] = {
-    __mmix_instr(MULUI, 0xC0, 0xC1, 0xC2)
+    __mmix_instr(MULUI, 0xC0, 0xC1, 0x05)
   };
 
   system_t* sys = mmix_bootstrap(prog, 1);  
@@ -1959,7 +1969,6 @@ define_test(
 
   mmix_set_regv(proc, int_to_octa(0), 0xC0);
   mmix_set_regv(proc, int_to_octa(6), 0xC1);
-  mmix_set_regv(proc, int_to_octa(5), 0xC2);
 
   // Execute the instruction
   sys_step(sys);
@@ -1970,14 +1979,14 @@ define_test(
   octa_str(x, sx, 32), octa_str(e, se, 32);
 
   test_check(
-    test_print("Execute MULUI 0XC0 0XC1 0XC2; Expecint reg[0xC0] == 30"),
+    test_print("Execute MULUI 0XC0 0XC1 0X05; Expecint reg[0xC0] == 30"),
     x == e,
     test_failure("Expecting %s, got %s", se, sx)
   )
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2027,7 +2036,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2073,7 +2082,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2110,7 +2119,7 @@ define_test(
   test_print("Set reg[0xC1] to %s\n", s[2]);
   test_print("Set reg[0xC2] to %s\n", s[3]);
 
-  test_print("Execute DIVUI 0XC0 0XC1 0XC2\n")
+  test_print("Execute DIVUI 0XC0 0XC1 0XC2\n");
   test_check(
     test_print("reg[0xC0] should be 2"),
     mmix_get_regv(proc, 0xC0) == int_to_octa(2),
@@ -2127,7 +2136,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2152,7 +2161,7 @@ define_test(
   mmix_set_regv(proc, int_to_octa(1), 0xC1);
 
   octa e = tetra_to_octa(1 << 31, 0);
-  test_print("Execute DIVUI 0xC0 0xC1 0x02\n")
+  test_print("Execute DIVUI 0xC0 0xC1 0x02\n");
 
   sys_step(sys);
 
@@ -2179,7 +2188,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2218,7 +2227,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2251,7 +2260,7 @@ define_test(
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2295,7 +2304,7 @@ define_test(mmix_ldb, test_print("LDB"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2339,7 +2348,7 @@ define_test(mmix_ldw, test_print("LDW"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2383,7 +2392,7 @@ define_test(mmix_ldt, test_print("LDT"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2426,7 +2435,7 @@ define_test(mmix_ldo, test_print("LDO"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2474,7 +2483,7 @@ define_test(mmix_stb, test_print("STB"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2522,7 +2531,7 @@ define_test(mmix_stw, test_print("STW"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2570,7 +2579,7 @@ define_test(mmix_stt, test_print("STT"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2618,7 +2627,96 @@ define_test(mmix_sto, test_print("STO"))
 
   test_success;  
   test_teardown {
-    sys_delete(sys);
+    mmix_shutdown(sys);
+  }
+  test_end;
+}
+
+define_test(mmix_icache, test_print("Decoded instruction cache"))
+{
+  octa prog [] = {
+    __mmix_instr(ADDUI, 0xC0, 0xC0, 1),
+    __mmix_instr(STTUI, 0xC1, 0xC2, 0)
+  };
+
+  system_t* sys = mmix_bootstrap(prog, 2);
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+
+  mmix_set_regv(proc, 0, 0xC0);
+  mmix_set_regv(proc, __mmix_instr(ADDUI, 0xC0, 0xC0, 10), 0xC1);
+  mmix_set_regv(proc, MMIX_START_ADDR, 0xC2);
+
+  // Execute ADDUI twice, the second time from the cache.
+  sys_step(sys);
+  proc->instr_ptr = (octa*) MMIX_START_ADDR;
+  sys_step(sys);
+
+  test_check(
+    test_print("Check that the cached instruction is executed again"),
+    mmix_get_regv(proc, 0xC0) == 2,
+    test_failure("Expecting 2, got %llu", mmix_get_regv(proc, 0xC0))
+  );
+
+  // Overwrite ADDUI, then execute it again.
+  sys_step(sys);
+  proc->instr_ptr = (octa*) MMIX_START_ADDR;
+  sys_step(sys);
+
+  test_check(
+    test_print("Check that a store to the code invalidates the decoded instruction"),
+    mmix_get_regv(proc, 0xC0) == 12,
+    test_failure("Expecting 12, got %llu", mmix_get_regv(proc, 0xC0))
+  );
+
+  test_success;
+  test_teardown {
+    mmix_shutdown(sys);
+  }
+  test_end;
+}
+
+define_test(mmix_threaded_block, test_print("Threaded engine basic block"))
+{
+  octa prog [] = {
+    __mmix_instr(ADDUI, 0xC0, 0xC0, 1),
+    __mmix_instr(ADDUI, 0xC0, 0xC0, 2),
+    __mmix_instr(ADDUI, 0xC0, 0xC0, 3)
+  };
+
+  mmix_test_engine = MMIX_ENGINE_INTERPRETER;
+  system_t* ref = mmix_bootstrap(prog, 3);
+  mmix_test_engine = MMIX_ENGINE_THREADED;
+  system_t* sys = mmix_bootstrap(prog, 3);
+
+  mmix_processor_t* ref_proc = __get_mmix_proc(ref);
+  mmix_processor_t* proc = __get_mmix_proc(sys);
+
+  mmix_alloc_sim_time(ref, 1000);
+  mmix_alloc_sim_time(sys, 1000);
+
+  for(unsigned int i = 0; i < 3; i++)
+    sys_step(ref);
+
+  // A budget of three steps, consumed by a single call.
+  sys->steps = 3;
+  sys_step(sys);
+
+  test_check(
+    test_print("Check that the whole block has been executed in a single step"),
+    mmix_get_regv(proc, 0xC0) == 6 && sys->steps == 0,
+    test_failure("Expecting 6, got %llu", mmix_get_regv(proc, 0xC0))
+  );
+
+  test_check(
+    test_print("Check that the block cost matches the interpreter one"),
+    proc->sclock == ref_proc->sclock && proc->g[rU] == ref_proc->g[rU] && proc->g[rI] == ref_proc->g[rI],
+    test_failure("Expecting the same sclock, rU and rI")
+  );
+
+  test_success;
+  test_teardown {
+    mmix_shutdown(ref);
+    mmix_shutdown(sys);
   }
   test_end;
 }
@@ -2697,5 +2795,15 @@ define_test_chapter(
   mmix, test_print("MMIX"),
   mmix_arith,
   mmix_flow_control,
-  mmix_load_store
+  mmix_load_store,
+  mmix_icache
 )
+
+// Same suite, run by the threaded engine.
+void test_mmix_threaded(test_context_t* __test_context)
+{
+  mmix_test_engine = MMIX_ENGINE_THREADED;
+  test_mmix(__test_context);
+  exec_test(mmix_threaded_block);
+  mmix_test_engine = MMIX_ENGINE_INTERPRETER;
+}
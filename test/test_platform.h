@@ -0,0 +1,132 @@
+#include "../lib/common/include/testing/utils.h"
+#include "../lib/common/include/allocator.h"
+
+#include "../src/platform.h"
+
+typedef struct {
+  unsigned int count;
+  unsigned int limit; // Halts after limit steps, 0 for never
+} __test_platform_counter_t;
+
+void __test_platform_counter_step(system_t* sys)
+{
+  __test_platform_counter_t* counter = (__test_platform_counter_t*)(sys + 1);
+
+  counter->count++;
+
+  if(counter->limit > 0 && counter->count >= counter->limit)
+    sys_halt(sys);
+}
+
+system_t* __test_platform_counter_new(allocator_t* allocator, octa frequency, unsigned int limit)
+{
+  system_t* sys = (system_t*) pmalloc(allocator, sizeof(system_t) + sizeof(__test_platform_counter_t));
+  __test_platform_counter_t* counter = (__test_platform_counter_t*)(sys + 1);
+
+  __sys_init(sys, allocator);
+  sys->frequency = frequency;
+  sys->vtable.step = __test_platform_counter_step;
+  counter->count = 0;
+  counter->limit = limit;
+
+  return sys;
+}
+
+unsigned int __test_platform_count(system_t* sys, unsigned int i)
+{
+  return ((__test_platform_counter_t*)(platform_component(sys, i) + 1))->count;
+}
+
+define_test(platform_clock_domains, test_print("Platform clock domains"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+    system_t* sys = platform_new(&allocator, 2000000000); // 2 GHz
+
+    platform_attach(sys, __test_platform_counter_new(&allocator, 2000000000, 0)); // Core
+    platform_attach(sys, __test_platform_counter_new(&allocator, 100000000, 0));  // Bus
+    platform_attach(sys, __test_platform_counter_new(&allocator, 300000000, 0));  // Device, not a divisor of the platform clock
+
+    sys_run(sys, 1);
+
+    test_check(
+      test_print("Check that the platform ran 1 ms"),
+      sys->cycle == 2000000,
+      test_failure("Expecting 2000000 cycles, got %llu", sys->cycle)
+    );
+
+    test_check(
+      test_print("Check that each component ticked at its own rate"),
+      __test_platform_count(sys, 0) == 2000000 && __test_platform_count(sys, 1) == 100000 && __test_platform_count(sys, 2) == 300000,
+      test_failure("Expecting 2000000/100000/300000 steps, got %u/%u/%u", __test_platform_count(sys, 0), __test_platform_count(sys, 1), __test_platform_count(sys, 2))
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test(platform_idle, test_print("Platform of slow components"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+    system_t* sys = platform_new(&allocator, 2000000000); // 2 GHz
+
+    platform_attach(sys, __test_platform_counter_new(&allocator, 100000000, 0)); // Bus
+    platform_attach(sys, __test_platform_counter_new(&allocator, 32768, 0));     // RTC
+
+    sys_run(sys, 10);
+
+    test_check(
+      test_print("Check that the slow components ticked at their own rate"),
+      sys->cycle == 20000000 && __test_platform_count(sys, 0) == 1000000 && __test_platform_count(sys, 1) == 328,
+      test_failure("Expecting 1000000/328 steps, got %u/%u", __test_platform_count(sys, 0), __test_platform_count(sys, 1))
+    );
+
+    sys_run(sys, 10);
+
+    test_check(
+      test_print("Check that the domains keep their phase over runs"),
+      sys->cycle == 40000000 && __test_platform_count(sys, 0) == 2000000 && __test_platform_count(sys, 1) == 656,
+      test_failure("Expecting 2000000/656 steps, got %u/%u", __test_platform_count(sys, 0), __test_platform_count(sys, 1))
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test(platform_halt, test_print("Platform halt"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+    system_t* sys = platform_new(&allocator, 1000);
+
+    platform_attach(sys, __test_platform_counter_new(&allocator, 1000, 10));
+    platform_attach(sys, __test_platform_counter_new(&allocator, 500, 20));
+
+    sys_run(sys, 1000);
+
+    test_check(
+      test_print("Check that a halted component is not stepped anymore"),
+      __test_platform_count(sys, 0) == 10 && __test_platform_count(sys, 1) == 20,
+      test_failure("Expecting 10/20 steps, got %u/%u", __test_platform_count(sys, 0), __test_platform_count(sys, 1))
+    );
+
+    test_check(
+      test_print("Check that the platform stops once every component halted"),
+      sys->cycle == 39 && sys->steps > 0,
+      test_failure("Expecting the platform to stop at cycle 39, got %llu", sys->cycle)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test_chapter(
+  platform, test_print("Platform"),
+  platform_clock_domains,
+  platform_idle,
+  platform_halt
+)
@@ -7,15 +7,14 @@
 #include "../src/system.h"
 #include "../src/riscv.h"
 
-system_t* riscv_bootstrap(byte* prog, size_t prog_length, size_t heap_memory)
+system_t* riscv_bootstrap_cfg(riscv_processor_cfg_t* cfg, byte* prog, size_t prog_length)
 {
   allocator_t allocator = GLOBAL_ALLOCATOR;
-  riscv_processor_cfg_t cfg;
 
-  cfg.boot_address = 0;
-  cfg.frequency    = 1000; // 1 kHz
+  cfg->boot_address = 0;
+  cfg->frequency    = 1000; // 1 kHz
 
-  system_t* sys = riscv_new(&allocator, &cfg);
+  system_t* sys = riscv_new(&allocator, cfg);
   riscv_processor_t* proc = __get_riscv_proc(sys);
    
   octa addr = 0x00;
@@ -33,6 +32,43 @@ system_t* riscv_bootstrap(byte* prog, size_t prog_length, size_t heap_memory)
   return sys;
 }
 
+// Core of the systems created by riscv_bootstrap and riscv_bootstrap_memory
+unsigned int riscv_test_core = RISCV_CORE_IN_ORDER;
+
+system_t* riscv_bootstrap(byte* prog, size_t prog_length, size_t heap_memory)
+{
+  riscv_processor_cfg_t cfg;
+  riscv_processor_cfg_init(&cfg);
+  cfg.core = riscv_test_core;
+
+  return riscv_bootstrap_cfg(&cfg, prog, prog_length);
+}
+
+// Load the program into mapped system memory, as the functional mode requires.
+system_t* riscv_bootstrap_memory_cfg(riscv_processor_cfg_t* cfg, byte* prog, size_t prog_length, size_t memory_size)
+{
+  allocator_t allocator = GLOBAL_ALLOCATOR;
+
+  cfg->boot_address = 0;
+  cfg->frequency    = 1000; // 1 kHz
+
+  system_t* sys = riscv_new(&allocator, cfg);
+  byte* mem = (byte*) mem_alloc_managed(&sys->mem, &allocator, (void*) 0, memory_size);
+
+  memcpy(mem, prog, prog_length);
+
+  return sys;
+}
+
+system_t* riscv_bootstrap_memory(byte* prog, size_t prog_length, size_t memory_size)
+{
+  riscv_processor_cfg_t cfg;
+  riscv_processor_cfg_init(&cfg);
+  cfg.core = riscv_test_core;
+
+  return riscv_bootstrap_memory_cfg(&cfg, prog, prog_length, memory_size);
+}
+
 tetra riscv_nop()
 {
   return 0;
@@ -201,6 +237,10 @@ tetra riscv_ebreak()
 {
   return 1048691;
 }
+tetra riscv_wfi()
+{
+  return encode_funct7(0b0001000) | encode_rs2(0b00101) | encode_opcode(0b1110011);
+}
 tetra riscv_csrrw(byte rd, byte rs1, tetra csr)
 {
   return encode_i_type(csr) | encode_rs1(rs1) | encode_rd(rd) | encode_funct3(0b001) | encode_opcode(0b1110011);
@@ -261,7 +301,7 @@ define_test(riscv_jal, test_print("RISCV_JAL"))
     proc->regs[28] = octa_zero;
     proc->regs[29] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the value of the register x28"),
@@ -303,7 +343,7 @@ define_test(riscv_jalr, test_print("RISCV_JALR"))
     proc->regs[29] = int_to_octa(12);
     proc->regs[30] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
   
     test_check(
       test_print("Check the value of x28"),
@@ -344,7 +384,7 @@ define_test(riscv_beq, test_print("RISCV_BEQ"))
     proc->regs[29] = int_to_octa(12);
     proc->regs[30] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
   
     test_check(
       test_print("Check the BEQ result"),
@@ -379,7 +419,7 @@ define_test(riscv_bne, test_print("RISCV_BNE"))
     proc->regs[29] = int_to_octa(6);
     proc->regs[30] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
   
     test_check(
       test_print("Check the BNE result"),
@@ -420,7 +460,7 @@ define_test(riscv_blt, test_print("RISCV_BLT"))
     proc->regs[29] = int_to_octa(12);
     proc->regs[30] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the BLT result"),
@@ -455,7 +495,7 @@ define_test(riscv_bge, test_print("RISCV_BGE"))
     proc->regs[29] = int_to_octa(6);
     proc->regs[30] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the BGE result"),
@@ -490,7 +530,7 @@ define_test(riscv_bltu, test_print("RISCV_BLTU"))
     proc->regs[29] = int_to_octa(12);
     proc->regs[30] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the BLTU result"),
@@ -525,7 +565,7 @@ define_test(riscv_bgeu, test_print("RISCV_BGEU"))
     proc->regs[29] = int_to_octa(6);
     proc->regs[30] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the BGEU result"),
@@ -557,7 +597,7 @@ define_test(riscv_lb, test_print("RISCV_LB"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the LB result"),
@@ -622,7 +662,7 @@ define_test(riscv_lw, test_print("RISCV_LW"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the LH result"),
@@ -654,7 +694,7 @@ define_test(riscv_lbu, test_print("RISCV_LBU"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the LBU result"),
@@ -686,7 +726,7 @@ define_test(riscv_lhu, test_print("RISCV_LHU"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = octa_zero;
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Check the LH result"),
@@ -719,7 +759,7 @@ define_test(riscv_sb, test_print("RISCV_SB"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = int_to_octa(0xD00D);
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Try to load memory value"),
@@ -758,7 +798,7 @@ define_test(riscv_sh, test_print("RISCV_SH"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = int_to_octa(0xD00D);
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Try to load memory value"),
@@ -797,7 +837,7 @@ define_test(riscv_sw, test_print("RISCV_SW"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = int_to_octa(0x1234D00D);
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Try to load memory value"),
@@ -837,7 +877,7 @@ define_test(riscv_sd, test_print("RISCV_SD"))
     proc->regs[28] = int_to_octa(12);
     proc->regs[29] = ll_int_to_octa(0x1122334455667788);
 
-    sys_run(sys, 1);
+    sys_run(sys, 100);
 
     test_check(
       test_print("Try to load memory value"),
@@ -1459,54 +1499,1219 @@ define_test(riscv_csrrw, test_print("RISCV_CSRRW"))
     test_end;
 }
 
-define_test_chapter(
-  riscv_branching, test_print("RISCV Branching"),
-  riscv_jal,
-  riscv_jalr,
-  riscv_beq, 
-  riscv_bne, 
-  riscv_blt, 
-  riscv_bge, 
-  riscv_bltu, 
-  riscv_bgeu
-)
+define_test(riscv_functional, test_print("RISCV functional mode"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
 
-define_test_chapter(
-  riscv_memory, test_print("RISCV Memory"),
-  riscv_lb, riscv_lh, riscv_lw, riscv_lbu, riscv_lhu,
-  riscv_sb, riscv_sh, riscv_sw, riscv_sd
-)
+    tetra prog[] = {
+      riscv_addi(0, 1, 5),
+      riscv_addi(0, 2, 7),
+      riscv_add(3, 1, 2),
+      riscv_addi(0, 7, 0x100),
+      riscv_sw(7, 3, 0),
+      riscv_lw(7, 4, 0),
+      riscv_bne(1, 0, 1),
+      riscv_addi(0, 5, 1), // Skipped
+      riscv_addi(0, 6, 9),
+      riscv_ebreak()
+    };
 
-define_test_chapter(
-  riscv_alu_1, test_print("RISCV ALU #1"),
-  riscv_addi, riscv_slti, riscv_sltiu,
-  riscv_xori, riscv_ori, riscv_andi,
-  riscv_slli, riscv_srli, riscv_srai,
-  riscv_add, riscv_sub
-)
+    system_t* sys = riscv_bootstrap_memory((byte*) &prog, sizeof(prog), PAGE_SIZE);
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+    tetra stored;
+    char exceptions = 0;
+    void* paddr;
 
-define_test_chapter(
-  riscv_alu_2, test_print("RISCV ALU #2"),
-  riscv_slt, riscv_sltu, riscv_xor,
-  riscv_srl, riscv_sll, riscv_or, 
-  riscv_and
-)
+    riscv_set_mode(sys, RISCV_MODE_FUNCTIONAL);
+    sys_run(sys, 100);
 
-define_test_chapter(
-  riscv_alu, test_print("RISCV ALU"),
-  riscv_alu_1, riscv_alu_2
-)
+    test_check(
+      test_print("Check that the processor is in functional mode"),
+      proc->mode == RISCV_MODE_FUNCTIONAL,
+      test_failure("Expecting mode %d, got %d", RISCV_MODE_FUNCTIONAL, proc->mode)
+    );
 
-define_test_chapter(
-  riscv_csr, test_print("RISCV CSR"),
-  riscv_csrrw
-)
+    test_check(
+      test_print("Check that x3 := x1 + x2"),
+      proc->regs[3] == 12,
+      test_failure("Expecting 12, got %lld", proc->regs[3])
+    );
 
-define_test_chapter(
-  riscv, test_print("RISCV"),
-  riscv_auipc,
-  riscv_branching,
-  riscv_memory,
-  riscv_alu,
-  riscv_csr
-)
+    mem_tl(&sys->mem, (void*) 0x100, &paddr, &exceptions);
+    memcpy(&stored, paddr, sizeof(tetra));
+
+    test_check(
+      test_print("Check that the store reached the system memory"),
+      stored == 12 && proc->regs[4] == 12,
+      test_failure("Expecting 12, got %d (loaded %lld)", stored, proc->regs[4])
+    );
+
+    test_check(
+      test_print("Check that the taken branch skipped an instruction"),
+      proc->regs[5] == 0 && proc->regs[6] == 9,
+      test_failure("Expecting x5 = 0 and x6 = 9, got %lld and %lld", proc->regs[5], proc->regs[6])
+    );
+
+    test_check(
+      test_print("Check that EBREAK halted at the end of the program"),
+      sys->state == SYS_HALTED && proc->pc == sizeof(prog),
+      test_failure("Expecting pc %lld, got %lld", (octa) sizeof(prog), proc->pc)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+define_test(riscv_smp, test_print("RISCV SMP"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // Each hart stores its id + 100 at 0x400 + 8 * id
+    tetra prog[] = {
+      riscv_csrrw(5, 0, MHARTID),
+      riscv_csrrw(0, 5, MHARTID), // Restore it
+      riscv_slli(5, 6, 3),
+      riscv_addi(6, 6, 0x400),
+      riscv_addi(5, 7, 100),
+      riscv_sd(6, 7, 0),
+      riscv_ebreak()
+    };
+
+    riscv_smp_cfg_t cfg;
+    riscv_smp_cfg_init(&cfg);
+    cfg.harts = 4;
+    cfg.quantum = 2;
+
+    system_t* sys = 0;
+    bool threaded = false;
+
+    for(unsigned int run = 0; run < 2; run++)
+    {
+      threaded = run == 1;
+      sys = riscv_smp_new(&allocator, &cfg);
+      memcpy(riscv_smp_memory(sys), prog, sizeof(prog));
+
+      if(threaded)
+        riscv_smp_run(sys, 100);
+      else
+        sys_run(sys, 100);
+
+      for(unsigned int i = 0; i < cfg.harts; i++)
+      {
+        system_t* hart = riscv_smp_hart(sys, i);
+        riscv_processor_t* proc = __get_riscv_proc(hart);
+        octa stored = *(octa*)((byte*) riscv_smp_memory(sys) + 0x400 + 8 * i);
+
+        test_check(
+          test_print("Check that hart %u (%s) stored its id", i, threaded ? "threaded" : "sequential"),
+          stored == i + 100,
+          test_failure("Expecting %u, got %lld", i + 100, stored)
+        );
+
+        test_check(
+          test_print("Check that hart %u (%s) halted with its id", i, threaded ? "threaded" : "sequential"),
+          hart->state == SYS_HALTED && proc->csrs[MHARTID] == i,
+          test_failure("Expecting state %d and id %u, got %d and %lld", SYS_HALTED, i, hart->state, proc->csrs[MHARTID])
+        );
+      }
+
+      sys_delete(sys, &allocator);
+      sys = 0;
+    }
+
+    test_success;
+    test_teardown;
+    if(sys) sys_delete(sys, &allocator);
+    test_end;
+}
+define_test(riscv_smp_coherence, test_print("RISCV SMP coherent L1s"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // Hart 1 spins on mem[0x100] from its L1, until hart 0 stores 7 there after a delay.
+    tetra prog[] = {
+      riscv_csrrw(5, 0, MHARTID),
+      riscv_csrrw(0, 5, MHARTID), // Restore it
+      riscv_addi(0, 10, 16),
+      riscv_beq(5, 0, 4),         // Hart 0 to the writer
+      riscv_lw(0, 6, 0x100),      // Reader loop
+      riscv_bne(6, 0, 1),
+      riscv_jalr(0, 10, 0),
+      riscv_ebreak(),
+      riscv_addi(0, 11, 40),      // Writer
+      riscv_addi(0, 8, 50),
+      riscv_addi(9, 9, 1),        // Delay loop
+      riscv_beq(9, 8, 1),
+      riscv_jalr(0, 11, 0),
+      riscv_addi(0, 7, 7),
+      riscv_addi(0, 12, 0x100),
+      riscv_sw(12, 7, 0),
+      riscv_ebreak()
+    };
+
+    riscv_smp_cfg_t cfg;
+    riscv_smp_cfg_init(&cfg);
+    cfg.harts = 2;
+    cfg.mode = RISCV_MODE_PIPELINE;
+
+    system_t* sys = riscv_smp_new(&allocator, &cfg);
+    memcpy(riscv_smp_memory(sys), prog, sizeof(prog));
+
+    riscv_smp_run(sys, 2000);
+
+    system_t* writer = riscv_smp_hart(sys, 0);
+    system_t* reader = riscv_smp_hart(sys, 1);
+    tetra stored = *(tetra*)((byte*) riscv_smp_memory(sys) + 0x100);
+
+    test_check(
+      test_print("Check that the harts run the pipeline over their own L1"),
+      __get_riscv_proc(reader)->mode == RISCV_MODE_PIPELINE && __get_riscv_proc(reader)->l1.cfg.write_through,
+      test_failure("Expecting pipeline harts with write-through L1s")
+    );
+
+    test_check(
+      test_print("Check that the store was written through to the shared memory"),
+      stored == 7 && writer->state == SYS_HALTED,
+      test_failure("Expecting 7, got %u", stored)
+    );
+
+    test_check(
+      test_print("Check that the reader saw the store of the writer"),
+      reader->state == SYS_HALTED && __get_riscv_proc(reader)->regs[6] == 7,
+      test_failure("Expecting x6 = 7, got %lld (state %d)", __get_riscv_proc(reader)->regs[6], reader->state)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+define_test(riscv_l1_geometry, test_print("RISCV L1 geometry"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+    riscv_processor_cfg_t cfg;
+    byte data = 0;
+
+    riscv_processor_cfg_init(&cfg);
+    cfg.l1.line_size = 32;
+    cfg.l1.sets = 16;
+    cfg.l1.ways = 2;
+
+    system_t* sys = riscv_new(&allocator, &cfg);
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+
+    test_check(
+      test_print("Check that the L1 follows the configured geometry"),
+      proc->l1.cfg.line_size == 32 && proc->l1.cfg.sets == 16 && proc->l1.cfg.ways == 2,
+      test_failure("Expecting 32/16/2, got %u/%u/%u", proc->l1.cfg.line_size, proc->l1.cfg.sets, proc->l1.cfg.ways)
+    );
+
+    data_cache_write(&proc->l1, 0x1000, 42, 0);
+
+    test_check(
+      test_print("Check that the L1 storage holds a written byte"),
+      data_cache_read(&proc->l1, 0x1000, &data, 0) && data == 42,
+      test_failure("Expecting 42, got %d", data)
+    );
+
+    cfg.l1.sets = 3;
+
+    test_check(
+      test_print("Check that an invalid geometry is rejected"),
+      riscv_new(&allocator, &cfg) == NULL,
+      test_failure("Expecting no system")
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+define_test(riscv_wfi, test_print("RISCV WFI"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    tetra prog[] = {
+      riscv_addi(0, 1, 5),
+      riscv_wfi(),
+      riscv_addi(0, 2, 7),
+      riscv_ebreak()
+    };
+
+    system_t* sys = riscv_bootstrap_memory((byte*) &prog, sizeof(prog), PAGE_SIZE);
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+
+    riscv_set_mode(sys, RISCV_MODE_FUNCTIONAL);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that WFI put the processor to sleep"),
+      proc->regs[1] == 5 && proc->regs[2] == 0 && proc->pc == 8 && sys->sleep == SYS_SLEEP_FOREVER,
+      test_failure("Expecting pc 8 asleep, got pc %lld (sleep %u)", proc->pc, sys->sleep)
+    );
+
+    sys_wake(sys);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that the processor resumed after WFI"),
+      proc->regs[2] == 7 && proc->pc == sizeof(prog),
+      test_failure("Expecting x2 = 7 and pc %lld, got %lld and %lld", (octa) sizeof(prog), proc->regs[2], proc->pc)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+// Cycles until the register holds the value, at most limit.
+octa riscv_cycles_until(system_t* sys, unsigned char reg, octa value, octa limit)
+{
+  riscv_processor_t* proc = __get_riscv_proc(sys);
+  octa cycles = 0;
+
+  while(proc->regs[reg] != value && cycles < limit)
+  {
+    sys_run_cycles(sys, 1);
+    cycles++;
+  }
+
+  return cycles;
+}
+
+define_test(riscv_forwarding, test_print("RISCV operand forwarding"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    tetra dependent[] = {
+      riscv_addi(0, 1, 1),
+      riscv_addi(1, 1, 1),
+      riscv_addi(1, 1, 1),
+      riscv_add(2, 1, 1),
+      riscv_add(3, 2, 1),
+      riscv_ebreak()
+    };
+
+    tetra independent[] = {
+      riscv_addi(0, 1, 1),
+      riscv_addi(0, 2, 1),
+      riscv_addi(0, 3, 1),
+      riscv_addi(0, 4, 1),
+      riscv_addi(0, 5, 9),
+      riscv_ebreak()
+    };
+
+    // x5 := 21 from 0x20, used by the next instruction, or the one after
+    tetra load_use[] = {
+      riscv_lw(0, 5, 0x20),
+      riscv_add(6, 5, 5),
+      riscv_addi(6, 7, 1),
+      riscv_ebreak(),
+      0, 0, 0, 0, 21, 0
+    };
+
+    tetra load_other[] = {
+      riscv_lw(0, 5, 0x20),
+      riscv_addi(0, 4, 1),
+      riscv_addi(4, 7, 42),
+      riscv_ebreak(),
+      0, 0, 0, 0, 21, 0
+    };
+
+    system_t* systems[4] = {
+      riscv_bootstrap((byte*) &dependent, sizeof(dependent), 0),
+      riscv_bootstrap((byte*) &independent, sizeof(independent), 0),
+      riscv_bootstrap((byte*) &load_use, sizeof(load_use), 0),
+      riscv_bootstrap((byte*) &load_other, sizeof(load_other), 0)
+    };
+
+    octa cycles[4] = {
+      riscv_cycles_until(systems[0], 3, 9, 100),
+      riscv_cycles_until(systems[1], 5, 9, 100),
+      riscv_cycles_until(systems[2], 7, 43, 100),
+      riscv_cycles_until(systems[3], 7, 43, 100)
+    };
+
+    riscv_processor_t* proc = __get_riscv_proc(systems[0]);
+
+    test_check(
+      test_print("Check that the dependent instructions get the results in flight"),
+      proc->regs[1] == 3 && proc->regs[2] == 6 && proc->regs[3] == 9,
+      test_failure("Expecting 3, 6 and 9, got %lld, %lld and %lld", proc->regs[1], proc->regs[2], proc->regs[3])
+    );
+
+    test_check(
+      test_print("Check that the dependent ALU instructions do not stall"),
+      cycles[0] < 100 && cycles[0] == cycles[1],
+      test_failure("Expecting %llu cycles, got %llu", cycles[1], cycles[0])
+    );
+
+    test_check(
+      test_print("Check that a load-use hazard stalls a single cycle"),
+      __get_riscv_proc(systems[2])->regs[6] == 42 && cycles[3] < 100 && cycles[2] == cycles[3] + 1,
+      test_failure("Expecting %llu cycles, got %llu (x6 = %lld)", cycles[3] + 1, cycles[2], __get_riscv_proc(systems[2])->regs[6])
+    );
+
+    test_success;
+    test_teardown;
+    for(unsigned int i = 0; i < 4; i++) sys_delete(systems[i], &allocator);
+    test_end;
+}
+
+define_test(riscv_branch_prediction, test_print("RISCV branch prediction"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // Taken branch over x5 and x6, x30 := 16
+    tetra skip[] = {
+      riscv_nop(),
+      riscv_beq(28, 29, 2),
+      riscv_addi(0, 5, 1),
+      riscv_addi(0, 6, 1),
+      riscv_auipc(30, 0),
+      riscv_ebreak()
+    };
+
+    // Ten iterations, back to 0 through x3
+    tetra loop[] = {
+      riscv_addi(1, 1, 1),
+      riscv_beq(1, 2, 1),
+      riscv_jalr(0, 3, 0),
+      riscv_addi(0, 7, 1),
+      riscv_ebreak()
+    };
+
+    // Call and return through x1, the fetch past ebreak spins at 0xc
+    tetra call[] = {
+      riscv_jal(1, 4),
+      riscv_addi(0, 7, 1),
+      riscv_ebreak(),
+      riscv_jal(0, 0),
+      riscv_addi(0, 8, 2),
+      riscv_jalr(0, 1, 0)
+    };
+
+    system_t* systems[4] = {
+      riscv_bootstrap((byte*) &skip, sizeof(skip), 0),
+      riscv_bootstrap((byte*) &loop, sizeof(loop), 0),
+      riscv_bootstrap((byte*) &loop, sizeof(loop), 0),
+      riscv_bootstrap((byte*) &call, sizeof(call), 0)
+    };
+
+    riscv_processor_t* procs[4];
+    for(unsigned int i = 0; i < 4; i++) procs[i] = __get_riscv_proc(systems[i]);
+
+    // Static, always falls through
+    riscv_bp_cfg_t static_cfg;
+    riscv_bp_cfg_init(&static_cfg);
+    static_cfg.kind = RISCV_BP_NOT_TAKEN;
+    static_cfg.btb = static_cfg.ras = false;
+    riscv_bp_create(&procs[2]->bp, &static_cfg);
+
+    procs[0]->regs[28] = procs[0]->regs[29] = 12;
+    procs[1]->regs[2] = procs[2]->regs[2] = 10;
+
+    riscv_cycles_until(systems[0], 30, 16, 100);
+
+    octa cycles[2] = {
+      riscv_cycles_until(systems[1], 7, 1, 500),
+      riscv_cycles_until(systems[2], 7, 1, 500)
+    };
+
+    riscv_cycles_until(systems[3], 7, 1, 100);
+
+    test_check(
+      test_print("Check that the instructions after a mispredicted branch are squashed"),
+      procs[0]->regs[30] == 16 && procs[0]->regs[5] == 0 && procs[0]->regs[6] == 0,
+      test_failure("Expecting 16, 0 and 0, got %lld, %lld and %lld", procs[0]->regs[30], procs[0]->regs[5], procs[0]->regs[6])
+    );
+
+    test_check(
+      test_print("Check that the loop runs ten times"),
+      procs[1]->regs[1] == 10 && procs[2]->regs[1] == 10,
+      test_failure("Expecting 10, got %lld and %lld", procs[1]->regs[1], procs[2]->regs[1])
+    );
+
+    test_check(
+      test_print("Check that the direction and the targets of the loop are learnt"),
+      procs[1]->bp.stats.direction.hits == 9 && procs[1]->bp.stats.direction.misses == 1
+        && procs[1]->bp.stats.btb.hits == 8 && procs[1]->bp.stats.btb.misses == 1,
+      test_failure("Expecting 9/1 and 8/1, got %llu/%llu and %llu/%llu",
+        procs[1]->bp.stats.direction.hits, procs[1]->bp.stats.direction.misses,
+        procs[1]->bp.stats.btb.hits, procs[1]->bp.stats.btb.misses)
+    );
+
+    test_check(
+      test_print("Check that the predicted loop is faster than the static one"),
+      cycles[0] < cycles[1] && cycles[1] < 500,
+      test_failure("Expecting less than %llu cycles, got %llu", cycles[1], cycles[0])
+    );
+
+    test_check(
+      test_print("Check that the return is predicted by the return-address stack"),
+      procs[3]->regs[8] == 2 && procs[3]->regs[1] == 4 && procs[3]->bp.stats.ras.hits == 1 && procs[3]->bp.stats.ras.misses == 0,
+      test_failure("Expecting a hit, got %llu/%llu", procs[3]->bp.stats.ras.hits, procs[3]->bp.stats.ras.misses)
+    );
+
+    test_success;
+    test_teardown;
+    for(unsigned int i = 0; i < 4; i++) sys_delete(systems[i], &allocator);
+    test_end;
+}
+
+define_test(riscv_superscalar, test_print("RISCV multi-issue pipeline"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    tetra independent[] = {
+      riscv_addi(0, 1, 1),
+      riscv_addi(0, 2, 2),
+      riscv_addi(0, 3, 3),
+      riscv_addi(0, 4, 4),
+      riscv_addi(0, 5, 5),
+      riscv_addi(0, 6, 6),
+      riscv_addi(0, 7, 7),
+      riscv_addi(0, 8, 8),
+      riscv_ebreak()
+    };
+
+    // Dependencies within a group, load-use, back to back loads, a taken branch over x8,
+    // x10 written twice, then x11 := 42; 10, 20 and 30 from 0x40.
+    tetra mixed[] = {
+      riscv_addi(0, 1, 5),
+      riscv_addi(0, 2, 7),
+      riscv_add(3, 1, 2),
+      riscv_lw(0, 4, 0x40),
+      riscv_add(5, 4, 3),
+      riscv_lw(0, 6, 0x44),
+      riscv_lw(0, 7, 0x48),
+      riscv_beq(1, 1, 1),
+      riscv_addi(0, 8, 99),
+      riscv_addi(0, 10, 3),
+      riscv_addi(0, 10, 0),
+      riscv_addi(0, 11, 42),
+      riscv_ebreak(),
+      0, 0, 0, 10, 20, 30
+    };
+
+    riscv_processor_cfg_t cfg;
+    system_t* systems[6];
+
+    for(unsigned int i = 0; i < 3; i++)
+    {
+      riscv_processor_cfg_init(&cfg);
+      cfg.issue_width = 1 << i;
+
+      systems[i] = riscv_bootstrap_cfg(&cfg, (byte*) &independent, sizeof(independent));
+      systems[3 + i] = riscv_bootstrap_cfg(&cfg, (byte*) &mixed, sizeof(mixed));
+    }
+
+    octa cycles[3] = {
+      riscv_cycles_until(systems[0], 8, 8, 100),
+      riscv_cycles_until(systems[1], 8, 8, 100),
+      riscv_cycles_until(systems[2], 8, 8, 100)
+    };
+
+    for(unsigned int i = 3; i < 6; i++)
+      riscv_cycles_until(systems[i], 11, 42, 200);
+
+    riscv_processor_t* proc = __get_riscv_proc(systems[1]);
+    riscv_processor_t* mixed_proc = __get_riscv_proc(systems[4]);
+
+    test_check(
+      test_print("Check that the independent instructions complete"),
+      proc->regs[1] == 1 && proc->regs[7] == 7 && proc->regs[8] == 8,
+      test_failure("Expecting 1, 7 and 8, got %lld, %lld and %lld", proc->regs[1], proc->regs[7], proc->regs[8])
+    );
+
+    test_check(
+      test_print("Check that wider pipelines retire independent instructions in fewer cycles"),
+      cycles[0] < 100 && cycles[1] < cycles[0] && cycles[2] < cycles[1],
+      test_failure("Expecting decreasing cycles, got %llu, %llu and %llu", cycles[0], cycles[1], cycles[2])
+    );
+
+    test_check(
+      test_print("Check that the dual-issue pipeline gets the results of the single-issue one"),
+      mixed_proc->regs[3] == 12 && mixed_proc->regs[5] == 22 && mixed_proc->regs[6] == 20 && mixed_proc->regs[7] == 30
+        && mixed_proc->regs[8] == 0 && mixed_proc->regs[10] == 0 && mixed_proc->regs[11] == 42,
+      test_failure("Expecting 12, 22, 20, 30, 0, 0 and 42, got %lld, %lld, %lld, %lld, %lld, %lld and %lld",
+        mixed_proc->regs[3], mixed_proc->regs[5], mixed_proc->regs[6], mixed_proc->regs[7],
+        mixed_proc->regs[8], mixed_proc->regs[10], mixed_proc->regs[11])
+    );
+
+    test_check(
+      test_print("Check that every issue width gets the same registers"),
+      memcmp(__get_riscv_proc(systems[3])->regs, mixed_proc->regs, sizeof(mixed_proc->regs)) == 0
+        && memcmp(__get_riscv_proc(systems[5])->regs, mixed_proc->regs, sizeof(mixed_proc->regs)) == 0,
+      test_failure("Expecting the same registers")
+    );
+
+    cfg.issue_width = RISCV_MAX_ISSUE_WIDTH + 1;
+
+    test_check(
+      test_print("Check that an issue width over RISCV_MAX_ISSUE_WIDTH is rejected"),
+      riscv_new(&allocator, &cfg) == NULL,
+      test_failure("Expecting no system")
+    );
+
+    test_success;
+    test_teardown;
+    for(unsigned int i = 0; i < 6; i++) sys_delete(systems[i], &allocator);
+    test_end;
+}
+
+// UART: bytes written at 0 are transmitted, the status is read at 4.
+typedef struct {
+  char tx[16];
+  unsigned int len;
+} riscv_test_uart_t;
+
+static bool riscv_test_uart_read(void* self, octa offset, void* dst, size_t size)
+{
+  tetra status = 0x60;
+
+  if(offset != 4 || size > sizeof(tetra))
+    return false;
+
+  memcpy(dst, &status, size);
+  return true;
+}
+
+static bool riscv_test_uart_write(void* self, octa offset, const void* src, size_t size)
+{
+  riscv_test_uart_t* uart = (riscv_test_uart_t*) self;
+
+  if(offset != 0 || uart->len >= sizeof(uart->tx))
+    return false;
+
+  uart->tx[uart->len++] = *(const char*) src;
+  return true;
+}
+
+define_test(riscv_mmio, test_print("RISCV memory-mapped device"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // x7 := 0x1000, the UART past the RAM
+    tetra prog[] = {
+      riscv_addi(0, 7, 0x7FF),
+      riscv_addi(7, 7, 0x7FF),
+      riscv_addi(7, 7, 2),
+      riscv_addi(0, 1, 'H'),
+      riscv_sw(7, 1, 0),
+      riscv_addi(0, 1, 'i'),
+      riscv_sw(7, 1, 0),
+      riscv_lw(7, 4, 4),
+      riscv_ebreak()
+    };
+
+    riscv_test_uart_t uart = {{0}, 0};
+    mem_device_t device = {riscv_test_uart_read, riscv_test_uart_write, &uart};
+
+    system_t* sys = riscv_bootstrap_memory((byte*) &prog, sizeof(prog), PAGE_SIZE);
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+
+    test_check(
+      test_print("Check that the UART is bound past the RAM"),
+      mem_attach_device(&sys->mem, (void*) 0x1000, 8, &device) && !mem_attach_device(&sys->mem, (void*) 0x1004, 8, &device),
+      test_failure("Expecting the overlapping region to be rejected")
+    );
+
+    riscv_set_mode(sys, RISCV_MODE_FUNCTIONAL);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that the stores reached the UART, and the load its status"),
+      uart.len == 2 && memcmp(uart.tx, "Hi", 2) == 0 && proc->regs[4] == 0x60,
+      test_failure("Expecting \"Hi\" and 0x60, got %u bytes and %llx", uart.len, proc->regs[4])
+    );
+
+    test_check(
+      test_print("Check that the program ran to its end"),
+      sys->state == SYS_HALTED && proc->pc == sizeof(prog),
+      test_failure("Expecting pc %lld, got %lld", (octa) sizeof(prog), proc->pc)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+define_test(riscv_mode_switch, test_print("RISCV mode switch"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    tetra prog[] = {
+      riscv_addi(0, 1, 5),
+      riscv_addi(0, 2, 7),
+      riscv_addi(0, 3, 1),
+      riscv_addi(0, 4, 2),
+      riscv_ebreak()
+    };
+
+    system_t* sys = riscv_bootstrap_memory((byte*) &prog, sizeof(prog), PAGE_SIZE);
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+    byte written = 0;
+    char exceptions = 0;
+    void* paddr;
+
+    // A dirty byte in the L1, which must be written back when leaving the pipeline.
+    data_cache_write(&proc->l1, 0x200, 42, 0);
+
+    // Drain the pipeline, then retire one instruction per step.
+    riscv_set_mode(sys, RISCV_MODE_FUNCTIONAL);
+    sys->steps = 0;
+
+    for(unsigned int i = 0; i < 32 && proc->mode != RISCV_MODE_FUNCTIONAL; i++)
+      sys_step(sys);
+
+    sys_step(sys);
+
+    mem_tl(&sys->mem, (void*) 0x200, &paddr, &exceptions);
+    written = *(byte*) paddr;
+
+    test_check(
+      test_print("Check that the dirty L1 bytes were written back"),
+      written == 42,
+      test_failure("Expecting 42, got %d", written)
+    );
+
+    test_check(
+      test_print("Check that two instructions retired in functional mode"),
+      proc->mode == RISCV_MODE_FUNCTIONAL && proc->pc == 8 && proc->regs[1] == 5 && proc->regs[2] == 7 && proc->regs[3] == 0,
+      test_failure("Expecting pc 8, got %lld", proc->pc)
+    );
+
+    // Back to the pipeline, which fetches the rest of the program through the L1.
+    riscv_set_mode(sys, RISCV_MODE_PIPELINE);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that the pipeline resumed at pc 8"),
+      proc->mode == RISCV_MODE_PIPELINE && proc->regs[1] == 5 && proc->regs[2] == 7 && proc->regs[3] == 1 && proc->regs[4] == 2,
+      test_failure("Expecting x3 = 1 and x4 = 2, got %lld and %lld", proc->regs[3], proc->regs[4])
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test(riscv_jit, test_print("RISCV JIT"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // for(;;) { x4++; x3 += 3; mem[0x100] = x4; if(x4 == 40) break; x9++; csr30 := x4 } x5 = mem[0x100]
+    tetra prog[] = {
+      riscv_addi(0, 1, 40),
+      riscv_addi(0, 10, 12),
+      riscv_addi(0, 7, 0x100),
+      riscv_addi(4, 4, 1),     // Loop head
+      riscv_addi(3, 3, 3),
+      riscv_sw(7, 4, 0),
+      riscv_beq(4, 1, 3),      // Chained to the next block while not taken
+      riscv_addi(9, 9, 1),
+      riscv_csrrw(0, 4, 30),   // Left to the interpreter
+      riscv_jalr(0, 10, 0),
+      riscv_lw(7, 5, 0),
+      riscv_ebreak()
+    };
+
+    system_t* systems[2];
+    riscv_processor_t* procs[2];
+
+    for(unsigned int i = 0; i < 2; i++)
+    {
+      systems[i] = riscv_bootstrap_memory((byte*) &prog, sizeof(prog), PAGE_SIZE);
+      procs[i] = __get_riscv_proc(systems[i]);
+      procs[i]->mode = procs[i]->next_mode = RISCV_MODE_FUNCTIONAL;
+    }
+
+    bool enabled = riscv_jit_enable(systems[1], RISCV_JIT_DEFAULT_CAPACITY);
+
+    for(unsigned int i = 0; i < 2; i++)
+      sys_run(systems[i], 1000);
+
+#ifdef RISCV_JIT_SUPPORTED
+    riscv_block_t* head = riscv_block_cache_entry(&procs[1]->blocks, 12);
+
+    test_check(
+      test_print("Check that the loop head was translated, and chained to its successor"),
+      enabled && head->pc == 12 && head->code != NULL && head->exits[1].target == 28 && head->exits[1].jump == NULL,
+      test_failure("Expecting a chained translation of the block at 12")
+    );
+#else
+    test_check(
+      test_print("Check that the JIT is not enabled on this host"),
+      !enabled,
+      test_failure("Expecting the interpreter only")
+    );
+#endif
+
+    test_check(
+      test_print("Check that the loop ran to completion"),
+      systems[1]->state == SYS_HALTED && procs[1]->regs[4] == 40 && procs[1]->regs[3] == 120 && procs[1]->regs[9] == 39 && procs[1]->regs[5] == 40 && procs[1]->csrs[30] == 39,
+      test_failure("Expecting x4 = 40, x3 = 120, x9 = 39, x5 = 40, csr30 = 39, got %lld, %lld, %lld, %lld, %lld", procs[1]->regs[4], procs[1]->regs[3], procs[1]->regs[9], procs[1]->regs[5], procs[1]->csrs[30])
+    );
+
+    test_check(
+      test_print("Check that the translated and interpreted runs agree"),
+      memcmp(procs[0]->regs, procs[1]->regs, sizeof(procs[0]->regs)) == 0 && procs[0]->pc == procs[1]->pc && systems[0]->steps == systems[1]->steps,
+      test_failure("Expecting the same registers, pc and steps left")
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(systems[0], &allocator);
+    sys_delete(systems[1], &allocator);
+    test_end;
+}
+
+define_test(riscv_jit_bge, test_print("RISCV JIT BGE/BGEU"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // for(;;) { x4++; if(x4 >=u x1) break; if(-1 >= x4) break; x9++ } 
+    tetra prog[] = {
+      riscv_addi(0, 1, 40),
+      riscv_addi(0, 2, 1),
+      riscv_sub(2, 0, 2),
+      riscv_addi(0, 10, 16),
+      riscv_addi(4, 4, 1),     // Loop head
+      riscv_bgeu(4, 1, 3),     // Not taken until x4 reaches 40
+      riscv_bge(2, 4, 2),      // Never taken, -1 is below x4 once signed
+      riscv_addi(9, 9, 1),
+      riscv_jalr(0, 10, 0),
+      riscv_ebreak()
+    };
+
+    system_t* systems[2];
+    riscv_processor_t* procs[2];
+
+    for(unsigned int i = 0; i < 2; i++)
+    {
+      systems[i] = riscv_bootstrap_memory((byte*) &prog, sizeof(prog), PAGE_SIZE);
+      procs[i] = __get_riscv_proc(systems[i]);
+      procs[i]->mode = procs[i]->next_mode = RISCV_MODE_FUNCTIONAL;
+    }
+
+    riscv_jit_enable(systems[1], RISCV_JIT_DEFAULT_CAPACITY);
+
+    for(unsigned int i = 0; i < 2; i++)
+      sys_run(systems[i], 1000);
+
+    test_check(
+      test_print("Check that the loop ran to completion"),
+      systems[1]->state == SYS_HALTED && procs[1]->regs[4] == 40 && procs[1]->regs[9] == 39,
+      test_failure("Expecting x4 = 40, x9 = 39, got %lld, %lld", procs[1]->regs[4], procs[1]->regs[9])
+    );
+
+    test_check(
+      test_print("Check that the translated and interpreted runs agree"),
+      memcmp(procs[0]->regs, procs[1]->regs, sizeof(procs[0]->regs)) == 0 && procs[0]->pc == procs[1]->pc && systems[0]->steps == systems[1]->steps,
+      test_failure("Expecting the same registers, pc and steps left")
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(systems[0], &allocator);
+    sys_delete(systems[1], &allocator);
+    test_end;
+}
+
+define_test_chapter(
+  riscv_branching, test_print("RISCV Branching"),
+  riscv_jal,
+  riscv_jalr,
+  riscv_beq, 
+  riscv_bne, 
+  riscv_blt, 
+  riscv_bge, 
+  riscv_bltu, 
+  riscv_bgeu
+)
+
+define_test_chapter(
+  riscv_memory, test_print("RISCV Memory"),
+  riscv_lb, riscv_lh, riscv_lw, riscv_lbu, riscv_lhu,
+  riscv_sb, riscv_sh, riscv_sw, riscv_sd
+)
+
+define_test_chapter(
+  riscv_alu_1, test_print("RISCV ALU #1"),
+  riscv_addi, riscv_slti, riscv_sltiu,
+  riscv_xori, riscv_ori, riscv_andi,
+  riscv_slli, riscv_srli, riscv_srai,
+  riscv_add, riscv_sub
+)
+
+define_test_chapter(
+  riscv_alu_2, test_print("RISCV ALU #2"),
+  riscv_slt, riscv_sltu, riscv_xor,
+  riscv_srl, riscv_sll, riscv_or, 
+  riscv_and
+)
+
+define_test_chapter(
+  riscv_alu, test_print("RISCV ALU"),
+  riscv_alu_1, riscv_alu_2
+)
+
+define_test_chapter(
+  riscv_csr, test_print("RISCV CSR"),
+  riscv_csrrw
+)
+define_test(riscv_out_of_order, test_print("RISCV out-of-order core"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // Dependencies, load-use, a taken branch over x8, x10 written twice, then x11 := 42;
+    // 10, 20 and 30 from 0x48.
+    tetra mixed[] = {
+      riscv_addi(0, 1, 5),
+      riscv_addi(0, 2, 7),
+      riscv_add(3, 1, 2),
+      riscv_lw(0, 4, 0x48),
+      riscv_add(5, 4, 3),
+      riscv_lw(0, 6, 0x4c),
+      riscv_lw(0, 7, 0x50),
+      riscv_beq(1, 1, 1),
+      riscv_addi(0, 8, 99),
+      riscv_addi(0, 10, 3),
+      riscv_addi(0, 10, 0),
+      riscv_addi(0, 11, 42),
+      riscv_ebreak(),
+      0, 0, 0, 0, 0, 10, 20, 30
+    };
+
+    // Store to load forwarding, a byte store under a word load, then x11 := 42
+    tetra memory[] = {
+      riscv_addi(0, 1, 0x55),
+      riscv_addi(0, 5, 0x30),
+      riscv_sw(5, 1, 0),
+      riscv_lw(5, 2, 0),
+      riscv_add(3, 2, 1),
+      riscv_sw(5, 0, 8),
+      riscv_sb(5, 1, 8),
+      riscv_lw(5, 4, 8),
+      riscv_addi(0, 11, 42),
+      riscv_ebreak()
+    };
+
+    // Ten iterations, back to 0 through x3
+    tetra loop[] = {
+      riscv_addi(1, 1, 1),
+      riscv_beq(1, 2, 1),
+      riscv_jalr(0, 3, 0),
+      riscv_addi(0, 7, 1),
+      riscv_ebreak()
+    };
+
+    riscv_processor_cfg_t cfg;
+    system_t* systems[12];
+
+    // In order, then out of order at widths 1, 2 and 4
+    for(unsigned int i = 0; i < 4; i++)
+    {
+      riscv_processor_cfg_init(&cfg);
+      cfg.core = i == 0 ? RISCV_CORE_IN_ORDER : RISCV_CORE_OUT_OF_ORDER;
+      cfg.issue_width = i == 0 ? 1 : 1 << (i - 1);
+
+      systems[i] = riscv_bootstrap_cfg(&cfg, (byte*) &mixed, sizeof(mixed));
+      systems[4 + i] = riscv_bootstrap_cfg(&cfg, (byte*) &memory, sizeof(memory));
+      systems[8 + i] = riscv_bootstrap_cfg(&cfg, (byte*) &loop, sizeof(loop));
+
+      __get_riscv_proc(systems[8 + i])->regs[2] = 10;
+    }
+
+    octa cycles[4];
+
+    for(unsigned int i = 0; i < 4; i++)
+    {
+      cycles[i] = riscv_cycles_until(systems[i], 11, 42, 200);
+      riscv_cycles_until(systems[4 + i], 11, 42, 200);
+      riscv_cycles_until(systems[8 + i], 7, 1, 500);
+    }
+
+    riscv_processor_t* mixed_proc = __get_riscv_proc(systems[1]);
+    riscv_processor_t* memory_proc = __get_riscv_proc(systems[5]);
+    riscv_processor_t* loop_proc = __get_riscv_proc(systems[9]);
+
+    test_check(
+      test_print("Check that the out-of-order core gets the results of the in-order pipeline"),
+      mixed_proc->regs[3] == 12 && mixed_proc->regs[5] == 22 && mixed_proc->regs[6] == 20 && mixed_proc->regs[7] == 30
+        && mixed_proc->regs[8] == 0 && mixed_proc->regs[10] == 0 && mixed_proc->regs[11] == 42,
+      test_failure("Expecting 12, 22, 20, 30, 0, 0 and 42, got %lld, %lld, %lld, %lld, %lld, %lld and %lld",
+        mixed_proc->regs[3], mixed_proc->regs[5], mixed_proc->regs[6], mixed_proc->regs[7],
+        mixed_proc->regs[8], mixed_proc->regs[10], mixed_proc->regs[11])
+    );
+
+    test_check(
+      test_print("Check that every core and width gets the same registers"),
+      memcmp(__get_riscv_proc(systems[0])->regs, mixed_proc->regs, sizeof(mixed_proc->regs)) == 0
+        && memcmp(__get_riscv_proc(systems[2])->regs, mixed_proc->regs, sizeof(mixed_proc->regs)) == 0
+        && memcmp(__get_riscv_proc(systems[3])->regs, mixed_proc->regs, sizeof(mixed_proc->regs)) == 0,
+      test_failure("Expecting the same registers")
+    );
+
+    test_check(
+      test_print("Check that the loads get the data of the older stores"),
+      memory_proc->regs[2] == 0x55 && memory_proc->regs[3] == 0xAA && memory_proc->regs[4] == 0x55
+        && memcmp(__get_riscv_proc(systems[4])->regs, memory_proc->regs, sizeof(memory_proc->regs)) == 0
+        && memcmp(__get_riscv_proc(systems[7])->regs, memory_proc->regs, sizeof(memory_proc->regs)) == 0,
+      test_failure("Expecting 0x55, 0xAA and 0x55, got %llx, %llx and %llx", memory_proc->regs[2], memory_proc->regs[3], memory_proc->regs[4])
+    );
+
+    test_check(
+      test_print("Check that the mispredicted loop branches are recovered"),
+      loop_proc->regs[1] == 10 && __get_riscv_proc(systems[11])->regs[1] == 10 && loop_proc->regs[7] == 1,
+      test_failure("Expecting 10 and 1, got %lld and %lld", loop_proc->regs[1], loop_proc->regs[7])
+    );
+
+    test_check(
+      test_print("Check that the wider out-of-order core is faster"),
+      cycles[3] < cycles[1] && cycles[1] < 200,
+      test_failure("Expecting less than %llu cycles, got %llu", cycles[1], cycles[3])
+    );
+
+    test_success;
+    test_teardown;
+    for(unsigned int i = 0; i < 12; i++) sys_delete(systems[i], &allocator);
+    test_end;
+}
+
+define_test(riscv_set_conflict, test_print("RISCV stores over the ways of a set"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // x1 := 1 stored at 0x8FC0 + k * 0x1000 for k < 12: twelve lines of the last set,
+    // which the write-back scan of the L1 reaches last.
+    tetra prog[6 + 2 * 12 + 1] = {
+      riscv_addi(0, 1, 1),
+      riscv_addi(0, 8, 1),
+      riscv_slli(8, 8, 12),
+      riscv_addi(0, 7, 0x8F),
+      riscv_slli(7, 7, 8),
+      riscv_addi(7, 7, 0xC0)
+    };
+
+    for(unsigned int k = 0; k < 12; k++)
+    {
+      prog[6 + 2 * k] = riscv_sd(7, 1, 0);
+      prog[7 + 2 * k] = riscv_add(7, 7, 8);
+    }
+
+    prog[6 + 2 * 12] = riscv_ebreak();
+
+    riscv_processor_cfg_t cfg;
+
+    for(unsigned int i = 0; i < 2; i++)
+    {
+      riscv_processor_cfg_init(&cfg);
+      cfg.core = i == 0 ? RISCV_CORE_IN_ORDER : RISCV_CORE_OUT_OF_ORDER;
+
+      system_t* sys = riscv_bootstrap_memory_cfg(&cfg, (byte*) &prog, sizeof(prog), 0x20000);
+      riscv_processor_t* proc = __get_riscv_proc(sys);
+      octa stored = 0;
+
+      // Far less than a scan of the L1
+      sys_run_cycles(sys, 200);
+
+      // The lines left in the L1 go to the memory too
+      data_cache_flush(&proc->l1, sys, (data_cache_writeback_t) __riscv_writeback_line);
+
+      for(unsigned int k = 0; k < 12; k++)
+      {
+        octa value = 0;
+        riscv_mem_copy(sys, 0x8FC0 + k * 0x1000, &value, sizeof(octa), false);
+        stored += value;
+      }
+
+      test_check(
+        test_print("Check that the %s core stores past the ways of the set", i == 0 ? "in-order" : "out-of-order"),
+        sys->state == SYS_HALTED && proc->regs[7] == 0x8FC0 + 12 * 0x1000 && stored == 12,
+        test_failure("Expecting a halt with x7 = %x and 12 stores, got state %d, x7 = %llx and %llu stores", 0x8FC0 + 12 * 0x1000, sys->state, proc->regs[7], stored)
+      );
+
+      sys_delete(sys, &allocator);
+    }
+
+    test_success;
+    test_teardown;
+    test_end;
+}
+
+define_test(riscv_hit_under_miss, test_print("RISCV loads under a miss"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // Two loads missing distinct lines, independent instructions under the misses,
+    // then x5 := 10 + 20 from 0x100 and 0x140.
+    tetra prog[96] = {
+      riscv_lw(0, 1, 0x100),
+      riscv_addi(0, 2, 2),
+      riscv_addi(0, 3, 3),
+      riscv_lw(0, 4, 0x140),
+      riscv_add(5, 1, 4),
+      riscv_ebreak()
+    };
+
+    prog[0x40] = 10;
+    prog[0x50] = 20;
+
+    riscv_processor_cfg_t cfg;
+    system_t* systems[2];
+
+    for(unsigned int i = 0; i < 2; i++)
+    {
+      riscv_processor_cfg_init(&cfg);
+      cfg.l1.fill_latency = 10;
+      cfg.core = i == 0 ? RISCV_CORE_IN_ORDER : RISCV_CORE_OUT_OF_ORDER;
+
+      systems[i] = riscv_bootstrap_memory_cfg(&cfg, (byte*) &prog, sizeof(prog), PAGE_SIZE);
+    }
+
+    riscv_processor_t* proc = __get_riscv_proc(systems[0]);
+    riscv_processor_t* ooo_proc = __get_riscv_proc(systems[1]);
+
+    // Past the fetch of the program, up to the instructions after the first load
+    octa cycles = riscv_cycles_until(systems[0], 3, 3, 100);
+    octa x1 = proc->regs[1];
+    unsigned int misses = 0;
+
+    while(proc->regs[5] != 30 && cycles < 100)
+    {
+      if(data_cache_misses(&proc->l1) > misses) misses = data_cache_misses(&proc->l1);
+
+      sys_run_cycles(systems[0], 1);
+      cycles++;
+    }
+
+    riscv_cycles_until(systems[1], 5, 30, 100);
+
+    test_check(
+      test_print("Check that the instructions after a load miss complete before it"),
+      proc->regs[3] == 3 && x1 == 0,
+      test_failure("Expecting x3 = 3 under the miss, got x1 = %lld", x1)
+    );
+
+    test_check(
+      test_print("Check that both misses are in flight at once"),
+      misses == 2,
+      test_failure("Expecting 2 misses, got %u", misses)
+    );
+
+    test_check(
+      test_print("Check that the loads are written back"),
+      proc->regs[5] == 30 && proc->regs[1] == 10 && proc->regs[4] == 20 && ooo_proc->regs[5] == 30,
+      test_failure("Expecting 30, 10 and 20, got %lld, %lld and %lld (out of order: %lld)", proc->regs[5], proc->regs[1], proc->regs[4], ooo_proc->regs[5])
+    );
+
+    test_check(
+      test_print("Check that the misses overlap"),
+      cycles < 2 * 10 + 20,
+      test_failure("Expecting less than %u cycles, got %llu", 2 * 10 + 20, cycles)
+    );
+
+    test_success;
+    test_teardown;
+    for(unsigned int i = 0; i < 2; i++) sys_delete(systems[i], &allocator);
+    test_end;
+}
+
+
+define_test_chapter(
+  riscv_modes, test_print("RISCV Modes"),
+  riscv_functional, riscv_mode_switch, riscv_jit, riscv_jit_bge, riscv_smp, riscv_smp_coherence, riscv_wfi, riscv_mmio
+)
+
+define_test(riscv_miss_sleep, test_print("RISCV sleep on a miss"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    // x2 := 2 * mem[0x100], the add waits on the load, then a store under the miss of 0x140
+    tetra prog[96] = {
+      riscv_lw(0, 1, 0x100),
+      riscv_add(2, 1, 1),
+      riscv_lw(0, 3, 0x140),
+      riscv_sd(0, 2, 0x180),
+      riscv_ebreak()
+    };
+
+    prog[0x40] = 21;
+    prog[0x50] = 5;
+
+    riscv_processor_cfg_t cfg;
+    riscv_processor_cfg_init(&cfg);
+    cfg.l1.fill_latency = 20;
+
+    system_t* sys = riscv_bootstrap_memory_cfg(&cfg, (byte*) &prog, sizeof(prog), PAGE_SIZE);
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+
+    octa cycles[2] = {0, 0};
+    unsigned int sleep = 0;
+
+    for(octa cycle = 1; cycle <= 100; cycle++)
+    {
+      sys_run_cycles(sys, 1);
+
+      if(sys->sleep > sleep) sleep = sys->sleep;
+      if(cycles[0] == 0 && proc->regs[2] == 42) cycles[0] = cycle;
+      if(cycles[1] == 0 && proc->regs[3] == 5) cycles[1] = cycle;
+    }
+
+    test_check(
+      test_print("Check that the processor slept on the misses"),
+      sleep > 0 && proc->regs[2] == 42 && proc->regs[3] == 5,
+      test_failure("Expecting a sleep, x2 = 42 and x3 = 5, got %u, %lld and %lld", sleep, proc->regs[2], proc->regs[3])
+    );
+
+    // The cycles of the same run stepped through every cycle
+    test_check(
+      test_print("Check that the sleep keeps the timing of the fills"),
+      cycles[0] == 51 && cycles[1] == 72 && proc->l1.clock == 100,
+      test_failure("Expecting the loads on cycles 51 and 72 and a L1 clock of 100, got %llu, %llu and %u", cycles[0], cycles[1], proc->l1.clock)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test_chapter(
+  riscv_pipeline, test_print("RISCV Pipeline"),
+  riscv_forwarding,
+  riscv_branch_prediction,
+  riscv_superscalar,
+  riscv_out_of_order,
+  riscv_hit_under_miss,
+  riscv_set_conflict,
+  riscv_miss_sleep
+)
+
+define_test_chapter(
+  riscv, test_print("RISCV"),
+  riscv_auipc,
+  riscv_branching,
+  riscv_memory,
+  riscv_l1_geometry,
+  riscv_alu,
+  riscv_csr,
+  riscv_modes,
+  riscv_pipeline
+)
+
+// Instruction chapters, run by the out-of-order core.
+void test_riscv_ooo(test_context_t* __test_context)
+{
+  riscv_test_core = RISCV_CORE_OUT_OF_ORDER;
+  exec_test(riscv_auipc);
+  exec_test(riscv_branching);
+  exec_test(riscv_memory);
+  exec_test(riscv_alu);
+  exec_test(riscv_csr);
+  riscv_test_core = RISCV_CORE_IN_ORDER;
+}
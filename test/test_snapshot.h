@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "../lib/common/include/testing/utils.h"
+#include "../lib/common/include/allocator.h"
+
+#include "../src/snapshot.h"
+#include "../src/riscv.h"
+#include "../src/mmix/core.h"
+
+define_test(snapshot_riscv_pipeline, test_print("Snapshot of a RISC-V pipeline"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    tetra prog[] = {
+      riscv_addi(0, 1, 1),
+      riscv_addi(0, 2, 2),
+      riscv_addi(0, 3, 3),
+      riscv_addi(0, 4, 4),
+      riscv_addi(0, 5, 5),
+      riscv_addi(0, 6, 6),
+      riscv_ebreak()
+    };
+
+    riscv_processor_cfg_t cfg;
+    riscv_processor_cfg_init(&cfg);
+
+    system_t* ref = riscv_bootstrap((byte*) &prog, sizeof(prog), 0);
+    system_t* sys = riscv_new(&allocator, &cfg);
+    riscv_processor_t* ref_proc = __get_riscv_proc(ref);
+    riscv_processor_t* proc = __get_riscv_proc(sys);
+
+    // Stop with instructions in flight
+    sys_run_cycles(ref, 4);
+
+    snapshot_t* snapshot = sys_snapshot(ref, &allocator);
+
+    test_check(
+      test_print("Check that the snapshot was taken"),
+      snapshot != NULL,
+      test_failure("Expecting a snapshot")
+    );
+
+    test_check(
+      test_print("Check that the snapshot is restored"),
+      sys_restore(sys, snapshot) && sys->cycle == ref->cycle,
+      test_failure("Expecting the restore to succeed at cycle %llu", ref->cycle)
+    );
+
+    sys_run(ref, 100);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that the restored system completes the program as the original one"),
+      memcmp(proc->regs, ref_proc->regs, sizeof(proc->regs)) == 0 && proc->pc == ref_proc->pc && proc->regs[6] == 6,
+      test_failure("Expecting x6 = 6 and pc %llx, got %lld and %llx", ref_proc->pc, proc->regs[6], proc->pc)
+    );
+
+    test_check(
+      test_print("Check that the restored system halted on the same cycle"),
+      sys->state == SYS_HALTED && sys->cycle == ref->cycle,
+      test_failure("Expecting cycle %llu, got %llu", ref->cycle, sys->cycle)
+    );
+
+    snapshot_delete(snapshot);
+
+    test_success;
+    test_teardown;
+    sys_delete(ref, &allocator);
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test(snapshot_riscv_file, test_print("Snapshot file of a RISC-V system"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+#ifndef MEM_MMAP_SUPPORTED
+    test_check(
+      test_print("Check that snapshot files are not opened without mmap"),
+      snapshot_open(&allocator, "palinka.snapshot") == NULL,
+      test_failure("Expecting no snapshot")
+    );
+
+    test_success;
+    test_teardown;
+    test_end;
+#else
+
+    // Store x3 := 5 + 7 at 0x100, then 9 at 0x108
+    tetra prog[] = {
+      riscv_addi(0, 1, 5),
+      riscv_addi(0, 2, 7),
+      riscv_add(3, 1, 2),
+      riscv_addi(0, 7, 0x100),
+      riscv_sd(7, 3, 0),
+      riscv_addi(0, 4, 9),
+      riscv_sd(7, 4, 8),
+      riscv_ebreak()
+    };
+
+    char path[] = "/tmp/palinka-snapshot-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    riscv_processor_cfg_t cfg;
+    riscv_processor_cfg_init(&cfg);
+
+    system_t* ref = riscv_bootstrap_memory((byte*) &prog, sizeof(prog), PAGE_SIZE);
+    system_t* forks[2] = {riscv_new(&allocator, &cfg), riscv_new(&allocator, &cfg)};
+
+    riscv_set_mode(ref, RISCV_MODE_FUNCTIONAL);
+    sys_run_cycles(ref, 3);
+
+    snapshot_t* snapshot = sys_snapshot(ref, &allocator);
+    bool saved = snapshot != NULL && snapshot_save(snapshot, path);
+
+    snapshot_delete(snapshot);
+    snapshot = saved ? snapshot_open(&allocator, path) : NULL;
+
+    test_check(
+      test_print("Check that the snapshot file is saved and opened"),
+      snapshot != NULL,
+      test_failure("Expecting a snapshot mapped from %s", path)
+    );
+
+    test_check(
+      test_print("Check that the snapshot is restored in two systems"),
+      sys_restore(forks[0], snapshot) && sys_restore(forks[1], snapshot),
+      test_failure("Expecting the restores to succeed")
+    );
+
+    sys_run(ref, 100);
+    sys_run(forks[0], 100);
+
+    octa* ref_mem; octa* mem[2]; octa* image_mem;
+    char exceptions = 0;
+    const snapshot_header_t* header = (const snapshot_header_t*) snapshot->image;
+
+    mem_tl(&ref->mem, (void*) 0x100, (void**) &ref_mem, &exceptions);
+    mem_tl(&forks[0]->mem, (void*) 0x100, (void**) &mem[0], &exceptions);
+    mem_tl(&forks[1]->mem, (void*) 0x100, (void**) &mem[1], &exceptions);
+    image_mem = (octa*)(snapshot->image + header->data_offset + 0x100);
+
+    test_check(
+      test_print("Check that the restored system completes the program as the original one"),
+      exceptions == 0 && mem[0][0] == 12 && mem[0][1] == 9 && ref_mem[1] == 9
+        && memcmp(__get_riscv_proc(forks[0])->regs, __get_riscv_proc(ref)->regs, sizeof(octa) * 32) == 0,
+      test_failure("Expecting 12 and 9, got %lld and %lld", mem[0][0], mem[0][1])
+    );
+
+    test_check(
+      test_print("Check that the writes of a restored system are private (copy-on-write)"),
+      mem[1][0] == 0 && mem[1][1] == 0 && image_mem[0] == 0 && mem[0] != mem[1],
+      test_failure("Expecting 0 in the other system and the snapshot, got %lld and %lld", mem[1][0], image_mem[0])
+    );
+
+    sys_run(forks[1], 100);
+
+    test_check(
+      test_print("Check that the other restored system runs on its own"),
+      mem[1][0] == 12 && mem[1][1] == 9 && forks[1]->state == SYS_HALTED,
+      test_failure("Expecting 12 and 9, got %lld and %lld", mem[1][0], mem[1][1])
+    );
+
+    test_success;
+    test_teardown;
+    if(snapshot) snapshot_delete(snapshot);
+    unlink(path);
+    sys_delete(ref, &allocator);
+    sys_delete(forks[0], &allocator);
+    sys_delete(forks[1], &allocator);
+    test_end;
+#endif
+}
+
+define_test(snapshot_mismatch, test_print("Snapshot of another configuration"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    riscv_processor_cfg_t cfg;
+    riscv_processor_cfg_init(&cfg);
+
+    system_t* ref = riscv_new(&allocator, &cfg);
+
+    cfg.l1.ways = 4;
+    system_t* sys = riscv_new(&allocator, &cfg);
+
+    snapshot_t* snapshot = sys_snapshot(ref, &allocator);
+
+    test_check(
+      test_print("Check that a snapshot is not restored over another L1 geometry"),
+      !sys_restore(sys, snapshot),
+      test_failure("Expecting the restore to fail")
+    );
+
+    test_success;
+    test_teardown;
+    snapshot_delete(snapshot);
+    sys_delete(ref, &allocator);
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test(snapshot_mmix, test_print("Snapshot of a MMIX system"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+
+    octa prog [] = {
+      __mmix_instr(ADDUI, 0xC0, 0xC0, 1),
+      __mmix_instr(ADDUI, 0xC0, 0xC0, 2),
+      __mmix_instr(ADDUI, 0xC0, 0xC0, 3)
+    };
+
+    mmix_cfg_t cfg;
+    mmix_cfg_init(&cfg);
+
+    system_t* ref = mmix_bootstrap(prog, 3);
+    system_t* sys = mmix_create(&allocator, &cfg);
+    mmix_processor_t* ref_proc = __get_mmix_proc(ref);
+    mmix_processor_t* proc = __get_mmix_proc(sys);
+
+    mmix_alloc_sim_time(ref, 1000);
+    sys_step(ref);
+
+    snapshot_t* snapshot = sys_snapshot(ref, &allocator);
+
+    test_check(
+      test_print("Check that the snapshot is restored"),
+      snapshot != NULL && sys_restore(sys, snapshot),
+      test_failure("Expecting the restore to succeed")
+    );
+
+    sys_step(ref); sys_step(ref);
+    sys_step(sys); sys_step(sys);
+
+    test_check(
+      test_print("Check that the restored system runs as the original one"),
+      mmix_get_regv(proc, 0xC0) == 6 && proc->instr_ptr == ref_proc->instr_ptr && proc->sclock == ref_proc->sclock
+        && memcmp(proc->g, ref_proc->g, sizeof(proc->g)) == 0,
+      test_failure("Expecting 6, got %llu", mmix_get_regv(proc, 0xC0))
+    );
+
+    test_success;
+    test_teardown;
+    if(snapshot) snapshot_delete(snapshot);
+    mmix_shutdown(ref);
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test_chapter(
+  snapshot, test_print("Snapshot"),
+  snapshot_riscv_pipeline,
+  snapshot_riscv_file,
+  snapshot_mismatch,
+  snapshot_mmix
+)
@@ -5,4 +5,98 @@ define_test(system, test_print("System"))
 {
     test_success;
     test_end;
-}
\ No newline at end of file
+}
+void __test_system_count_step(system_t* sys)
+{
+    (*(unsigned int*)(sys + 1))++;
+}
+
+define_test(system_sleep, test_print("System sleep"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+    system_t* sys = (system_t*) pmalloc(&allocator, sizeof(system_t) + sizeof(unsigned int));
+    unsigned int* count = (unsigned int*)(sys + 1);
+    unsigned int budget = 100; // Steps granted by sys_run(sys, 100)
+
+    __sys_init(sys, &allocator);
+    sys->frequency = 1000; // 1 kHz
+    sys->vtable.step = __test_system_count_step;
+    *count = 0;
+
+    sys_sleep(sys, 40);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that the idle steps were skipped"),
+      *count == budget - 40 && sys->sleep == 0,
+      test_failure("Expecting %u steps, got %u (%u still asleep)", budget - 40, *count, sys->sleep)
+    );
+
+    sys_sleep(sys, SYS_SLEEP_FOREVER);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that a system sleeping forever is not stepped"),
+      *count == budget - 40 && sys->steps == 0,
+      test_failure("Expecting %u steps, got %u", budget - 40, *count)
+    );
+
+    sys_wake(sys);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that a woken system is stepped again"),
+      *count == 2 * budget - 40,
+      test_failure("Expecting %u steps, got %u", 2 * budget - 40, *count)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}
+
+define_test(system_cycles, test_print("System cycle time"))
+{
+    allocator_t allocator = GLOBAL_ALLOCATOR;
+    system_t* sys = (system_t*) pmalloc(&allocator, sizeof(system_t) + sizeof(unsigned int));
+    unsigned int* count = (unsigned int*)(sys + 1);
+
+    __sys_init(sys, &allocator);
+    sys->frequency = 500000000; // 500 MHz
+    sys->vtable.step = __test_system_count_step;
+    *count = 0;
+
+    // 50M cycles, all but 10 idle.
+    sys_sleep(sys, 50000000 - 10);
+    sys_run(sys, 100);
+
+    test_check(
+      test_print("Check that 100 ms at 500 MHz are 50M cycles"),
+      sys->cycle == 50000000 && *count == 10,
+      test_failure("Expecting 50000000 cycles and 10 steps, got %llu and %u", sys->cycle, *count)
+    );
+
+    // Beyond the precision of a float
+    sys_sleep(sys, 16777210);
+    sys_run_until(sys, 50000000 + 16777217);
+
+    test_check(
+      test_print("Check that the system runs up to the exact target cycle"),
+      sys->cycle == 50000000 + 16777217 && *count == 17,
+      test_failure("Expecting %llu cycles and 17 steps, got %llu and %u", (octa) 50000000 + 16777217, sys->cycle, *count)
+    );
+
+    sys_run_cycles(sys, 3);
+
+    test_check(
+      test_print("Check that sys_run_cycles runs n cycles"),
+      sys->cycle == 50000000 + 16777220 && *count == 20,
+      test_failure("Expecting 20 steps, got %u", *count)
+    );
+
+    test_success;
+    test_teardown;
+    sys_delete(sys, &allocator);
+    test_end;
+}